@@ -1,3 +1,4 @@
 # coding: utf-8
 
-from _ordereddict import ordereddict, sorteddict
+from _ordereddict import ordereddict, sorteddict, autoshrink, snapshotdict, \
+    frozenordereddict, pool, incremental, stats, arena, sharedkeys
@@ -1,5 +1,5 @@
-/* Ordered Dictionary object implementation using a hash table and a vector of
-   pointers to the items.
+/* Ordered Dictionary object implementation using a table of indices into a
+   dense, ordered, array of the items.
 */
 /*
 
@@ -20,6 +20,7 @@ Ordering by key insertion order (KIO) instead of key/val insertion order
 */
 
 #include "Python.h"
+#include <stddef.h>	/* offsetof */
 #include "ordereddict.h"
 
 #if PY_VERSION_HEX < 0x02050000
@@ -34,6 +35,222 @@ Ordering by key insertion order (KIO) instead of key/val insertion order
 #define Py_Type Py_TYPE
 #endif
 
+#if PY_MAJOR_VERSION >= 3
+/* Python 3: str is unicode, which caches its hash in the object as the
+   Python 2 str did, and all ints are longs.  The small ones, that fit in
+   a machine word without conversion, take the place of the Python 2 int
+   in the fast paths. */
+#define OD_PY3
+#define PyString_CheckExact		PyUnicode_CheckExact
+#define PyString_FromString		PyUnicode_FromString
+#define PyString_FromFormat		PyUnicode_FromFormat
+#define PyString_InternFromString	PyUnicode_InternFromString
+#define PyString_Concat			PyUnicode_Append
+#define PyString_ConcatAndDel		PyUnicode_AppendAndDel
+#define _PyString_Join			PyUnicode_Join
+#define _PyString_Eq			od_unicode_eq
+#define OD_STR_HASH(o)			(((PyASCIIObject *) (o))->hash)
+#if PY_VERSION_HEX >= 0x030C0000
+#define OD_INT_CHECKEXACT(o)		(PyLong_CheckExact(o) && \
+	PyUnstable_Long_IsCompact((PyLongObject *) (o)))
+#define OD_INT_AS_LONG(o)		\
+	((long) PyUnstable_Long_CompactValue((PyLongObject *) (o)))
+#else
+#define OD_INT_CHECKEXACT(o)		(PyLong_CheckExact(o) && \
+	Py_SIZE(o) >= -1 && Py_SIZE(o) <= 1)
+#define OD_INT_AS_LONG(o)		\
+	((long) Py_SIZE(o) * (long) ((PyLongObject *) (o))->ob_digit[0])
+#endif
+#define PyInt_FromLong			PyLong_FromLong
+#define PyInt_FromSsize_t		PyLong_FromSsize_t
+#define PyInt_FromSize_t		PyLong_FromSize_t
+#define OD_TP_PRINT(f)			0
+#define OD_TP_COMPARE(f)		0
+#define OD_SQ_SLICE(f)			0
+#define OD_SLICE(o)			(o)
+
+/* string equality for lookdict_string(), both are exact str */
+static int
+od_unicode_eq(PyObject *a, PyObject *b)
+{
+    Py_ssize_t n = PyUnicode_GET_LENGTH(a);
+
+    if (PyUnicode_GET_LENGTH(b) != n || PyUnicode_KIND(a) != PyUnicode_KIND(b))
+        return 0;
+    return memcmp(PyUnicode_DATA(a), PyUnicode_DATA(b),
+                  n * PyUnicode_KIND(a)) == 0;
+}
+#else
+#define OD_STR_HASH(o)			(((PyStringObject *) (o))->ob_shash)
+#define OD_INT_CHECKEXACT(o)		PyInt_CheckExact(o)
+#define OD_INT_AS_LONG(o)		PyInt_AS_LONG(o)
+#define OD_TP_PRINT(f)			(printfunc) (f)
+#define OD_TP_COMPARE(f)		(cmpfunc) (f)
+#define OD_SQ_SLICE(f)			(f)
+#define OD_SLICE(o)			((PySliceObject *) (o))
+#endif
+
+/* An ordereddict is a dict subclass on Python 2, but dict.c must not change
+   one: PyDict_Clear() would free its ma_table (which is in the od_indices
+   block) and zero the od_* fields where a dict has its ma_smalltable.
+   Without Py_TPFLAGS_DICT_SUBCLASS PyDict_Check() fails for it, so that
+   PyDict_Clear(), PyDict_SetItem() etc. leave it alone, and dict(od) or
+   f(**od) take it as a mapping.  PyType_Ready() sets the flag again for a
+   subclass, so it is cleared when making one. */
+#ifdef OD_PY3
+#define OD_NOT_DICT_C(type)
+#else
+#define OD_NOT_DICT_C(type)	((type)->tp_flags &= ~Py_TPFLAGS_DICT_SUBCLASS)
+#endif
+
+/*
+The methods that take a few positional arguments get them without the
+format parsing of PyArg_ParseTuple(), from od_unpack_args(): as a C array
+with METH_FASTCALL (Python 3.7 and later), else from the argument tuple.
+Declare them with OD_FAST_ARGS and unpack with OD_UNPACK_ARGS().
+*/
+/* a plain dict keeps its insertion order from Python 3.7 on, so there is no
+   need to be relaxed about its order when taking its items */
+#if PY_VERSION_HEX >= 0x03070000
+#define OD_DICT_ORDERED			1
+#else
+#define OD_DICT_ORDERED			0
+#endif
+
+/* whether the collector tracks an object (the macro is internal in 3.13) */
+#if PY_VERSION_HEX >= 0x03090000
+#define OD_GC_IS_TRACKED(o)		PyObject_GC_IsTracked(o)
+#else
+#define OD_GC_IS_TRACKED(o)		_PyObject_GC_IS_TRACKED(o)
+#endif
+
+#if PY_VERSION_HEX >= 0x03070000
+#define OD_METH_FAST			METH_FASTCALL
+#define OD_FAST_ARGS			PyObject *const *args, Py_ssize_t nargs
+#define OD_FAST_PASS			args, nargs
+#define OD_UNPACK_ARGS(name, min, max, out) \
+	od_unpack_args(name, args, nargs, min, max, out)
+#else
+#define OD_METH_FAST			METH_VARARGS
+#define OD_FAST_ARGS			PyObject *args
+#define OD_FAST_PASS			args
+#define OD_UNPACK_ARGS(name, min, max, out) \
+	od_unpack_args(name, &PyTuple_GET_ITEM(args, 0), \
+	               PyTuple_GET_SIZE(args), min, max, out)
+#endif
+
+/* copy the nargs arguments to out[], which has the defaults for the ones
+   that are optional; -1 with TypeError if there are not min to max */
+static int
+od_unpack_args(const char *name, PyObject *const *args, Py_ssize_t nargs,
+               Py_ssize_t min, Py_ssize_t max, PyObject **out)
+{
+    Py_ssize_t i;
+
+    if (nargs < min || nargs > max) {
+        if (min == max)
+            PyErr_Format(PyExc_TypeError,
+                         "%s expected %zd argument%s, got %zd",
+                         name, min, min == 1 ? "" : "s", nargs);
+        else
+            PyErr_Format(PyExc_TypeError,
+                         "%s expected at %s %zd argument%s, got %zd",
+                         name, nargs < min ? "least" : "most",
+                         nargs < min ? min : max,
+                         (nargs < min ? min : max) == 1 ? "" : "s", nargs);
+        return -1;
+    }
+    for (i = 0; i < nargs; i++)
+        out[i] = args[i];
+    return 0;
+}
+
+/*
+Free-threaded builds (Py_GIL_DISABLED, Python 3.13 on): the methods and
+slots of the dict types run in a critical section of the object, or of both
+objects where another mapping is read.  OD_LOCKED_*(name, kind) defines a
+wrapper name_locked that does so, and OD_LOCKED(name) is what goes into a
+method table or slot; with the GIL these are nothing and name itself.
+
+A kind WRITE wrapper makes od_seq odd as long as name runs, so that the
+readers that don't lock (OD_LOCKFREE_READS, see od_lockfree_lookup()) know
+the table may be changing.  READ wrappers leave od_seq alone, they only
+change the table in compact_entries() and sd_order_apply(), which see to
+od_seq themselves.  The PyOrderedDict_* functions that change the dict do
+the same as a WRITE wrapper (OD_WRITE_DO()), for C code that calls them
+in the critical section; od_seq only changes in the outermost one.
+*/
+#ifdef Py_GIL_DISABLED
+#define OD_LOCKED(name)			name##_locked
+#define OD_LOCKED_WRAP(name, kind, rtype, params, args)		\
+static rtype								\
+name##_locked params							\
+{									\
+    rtype res;								\
+    Py_BEGIN_CRITICAL_SECTION(self);					\
+    OD_##kind##_BEGIN(self);						\
+    res = name args;							\
+    OD_##kind##_END(self);						\
+    Py_END_CRITICAL_SECTION();						\
+    return res;								\
+}
+#define OD_LOCKED_1(name, kind) OD_LOCKED_WRAP(name, kind, PyObject *,	\
+	(PyObject *self), ((void *) self))
+#define OD_LOCKED_2(name, kind) OD_LOCKED_WRAP(name, kind, PyObject *,	\
+	(PyObject *self, PyObject *a), ((void *) self, a))
+#define OD_LOCKED_3(name, kind) OD_LOCKED_WRAP(name, kind, PyObject *,	\
+	(PyObject *self, PyObject *a, PyObject *b), ((void *) self, a, b))
+#define OD_LOCKED_FAST(name, kind) OD_LOCKED_WRAP(name, kind, PyObject *, \
+	(PyObject *self, OD_FAST_ARGS), ((void *) self, OD_FAST_PASS))
+#define OD_LOCKED_INT2(name, kind) OD_LOCKED_WRAP(name, kind, int,	\
+	(PyObject *self, PyObject *a), ((void *) self, a))
+#define OD_LOCKED_INT3(name, kind) OD_LOCKED_WRAP(name, kind, int,	\
+	(PyObject *self, PyObject *a, PyObject *b), ((void *) self, a, b))
+#define OD_LOCK2_BEGIN(a, b)		Py_BEGIN_CRITICAL_SECTION2(a, b)
+#define OD_LOCK2_END()			Py_END_CRITICAL_SECTION2()
+#else
+#define OD_LOCKED(name)			name
+#define OD_LOCKED_1(name, kind)
+#define OD_LOCKED_2(name, kind)
+#define OD_LOCKED_3(name, kind)
+#define OD_LOCKED_FAST(name, kind)
+#define OD_LOCKED_INT2(name, kind)
+#define OD_LOCKED_INT3(name, kind)
+#define OD_LOCK2_BEGIN(a, b)		{
+#define OD_LOCK2_END()			}
+#endif
+
+#define OD_READ_BEGIN(op)
+#define OD_READ_END(op)
+/* stmt as a write; for the PyOrderedDict_* functions that change the
+   dict, whose C callers only hold the critical section */
+#define OD_WRITE_DO(op, stmt) do {					\
+	OD_WRITE_BEGIN(op);						\
+	stmt;								\
+	OD_WRITE_END(op);						\
+    } while(0)
+#ifdef OD_LOCKFREE_READS
+#define OD_WRITE_BEGIN(op) \
+	int od_began_ = od_write_begin((PyOrderedDictObject *) (op))
+#define OD_WRITE_END(op) \
+	od_write_end((PyOrderedDictObject *) (op), od_began_)
+#define OD_INIT_SEQ(mp)		((mp)->od_seq = 0, (mp)->od_retired = NULL)
+#else
+#define OD_WRITE_BEGIN(op)
+#define OD_WRITE_END(op)
+#define OD_INIT_SEQ(mp)
+#endif
+
+/* the global free lists and table pool are shared by the threads */
+#ifdef Py_GIL_DISABLED
+static PyMutex od_pool_mutex;
+#define OD_POOL_LOCK()			PyMutex_Lock(&od_pool_mutex)
+#define OD_POOL_UNLOCK()		PyMutex_Unlock(&od_pool_mutex)
+#else
+#define OD_POOL_LOCK()
+#define OD_POOL_UNLOCK()
+#endif
+
 #ifdef NDEBUG
 #undef NDEBUG
 #endif
@@ -54,6 +271,21 @@ set_key_error(PyObject *arg)
     Py_DECREF(tup);
 }
 
+/* a frozenordereddict, once initialised, can't be changed */
+static void
+od_frozen_error(PyObject *op)
+{
+    PyErr_Format(PyExc_TypeError, "'%.200s' object is immutable",
+                 Py_TYPE(op)->tp_name);
+}
+
+#define OD_NOT_FROZEN(mp, err) do {					\
+	if (FROZEN((mp))) {						\
+		od_frozen_error((PyObject *) (mp));			\
+		return err;						\
+	}								\
+    } while(0)
+
 /* Define this out if you don't want conversion statistics on exit. */
 #undef SHOW_CONVERSION_COUNTS
 
@@ -64,25 +296,130 @@ set_key_error(PyObject *arg)
 see object/dictobject.c for subtilities of the base dict implementation
 */
 
-/* Object used as dummy key to fill deleted entries */
-static PyObject *dummy = NULL; /* Initialized by first call to newPyDictObject() */
-
-#ifdef Py_REF_DEBUG
-PyObject *
-_PyOrderedDict_Dummy(void)
-{
-    return dummy;
-}
-#endif
+/*
+The layout follows the "compact dict" of later CPython versions: od_indices
+is the hash table, and its slots are just (1, 2, 4 or 8 byte) indices into
+ma_table, which holds the entries densely and in order. Compared to a hash
+table of entries plus a vector of pointers to them this needs about a third less
+memory, the order needs no separate bookkeeping and iterating in order is a
+walk over contiguous memory.
+
+Appending to the order is O(1), deletion leaves a deleted entry (me_key ==
+me_value == NULL) that is squeezed out later. Routines that address items
+by their position in the order first call OD_COMPACT(), which squeezes out
+the deleted entries and rebuilds od_indices in one pass; that happens as well
+in dictresize(), which is called when an item is to be added to a ma_table
+that is full.
+Moving entries around (insert() at a position, sorteddict inserts) needs
+the indices in od_indices to be adjusted, which is done with one linear pass
+over od_indices (move_entry()); only putting an item at the front doesn't,
+it goes into the deleted entry before the first one (od_first), room for
+which is made now and then by moving all entries up (od_front_room()).
+*/
 
 /* relaxed: allow init etc. of ordereddict from dicts if true */
 static int ordereddict_relaxed = 0;
 /* Key Value Insertion Order: rearrange at end on update if true */
 static int ordereddict_kvio = 0;
+/* give memory back when most of the items have been deleted, if true */
+static int ordereddict_autoshrink = 1;
+/* tables of at least this many slots grow by incremental rehashing, if > 0 */
+static Py_ssize_t ordereddict_incremental = 0;
+
+/* how a table grows incrementally, see od_grow() */
+typedef struct _od_rehash {
+    /* the indices of the table that was replaced, with rh_oldimask + 1
+       slots, of which those from rh_pos on are still to be moved over;
+       NULL once that is done */
+    void *rh_oldindices;
+    Py_ssize_t rh_oldimask;
+    Py_ssize_t rh_pos;
+    /* the block for the table it grows to next, with rh_nextimask + 1
+       slots, of which the first rh_nextdone bytes have been initialised;
+       NULL if there is none (yet) */
+    void *rh_next;
+    Py_ssize_t rh_nextimask;
+    Py_ssize_t rh_nextdone;
+} od_rehash;
+
+#define OD_REHASHING(mp) ((mp)->od_rehash != NULL &&			\
+			  (mp)->od_rehash->rh_oldindices != NULL)
 
 /* forward declarations */
+static void od_rehash_chain(PyOrderedDictObject *mp, long hash);
+/* before a lookup, while the table is rehashed incrementally */
+#define OD_REHASH_CHAIN(mp, hash) do {					\
+	if (OD_REHASHING(mp))						\
+		od_rehash_chain(mp, hash);				\
+    } while(0)
+
+/* what stats() counts, for each dict and in total, while it is on */
+typedef struct _od_stats {
+    Py_ssize_t st_lookups;	/* lookups of a key */
+    Py_ssize_t st_probes;	/* slots of od_indices those looked at */
+    Py_ssize_t st_maxprobes;	/* the most for one lookup */
+    Py_ssize_t st_resizes;	/* tables rebuilt by dictresize(), od_grow() */
+    Py_ssize_t st_resizebytes;	/* bytes of entries copied to a new table */
+    Py_ssize_t st_movebytes;	/* bytes of entries moved within ma_table */
+    Py_ssize_t st_keycalls;	/* calls of the key function of a sorteddict */
+} od_stats;
+
+/* count into od_stats_total and the od_stats of each dict, if true */
+static int ordereddict_stats = 0;
+static od_stats od_stats_total;
+
+static void od_stats_add(PyOrderedDictObject *mp, size_t offset,
+                         Py_ssize_t n);
+static Py_ssize_t od_lookup_counted(PyOrderedDictObject *mp, PyObject *key,
+                                    long hash, Py_ssize_t *hashpos);
+/* add n to the counter field for mp, costs a test of the flag when off */
+#define OD_STAT(mp, field, n) do {					\
+	if (ordereddict_stats)						\
+		od_stats_add((PyOrderedDictObject *) (mp),		\
+			     offsetof(od_stats, field), (n));		\
+    } while(0)
+/* mp->od_lookup(), counted while stats() is on */
+#define OD_LOOKUP(mp, key, hash, hashpos)				\
+	(ordereddict_stats ? od_lookup_counted(mp, key, hash, hashpos) :	\
+	 (mp)->od_lookup(mp, key, hash, hashpos))
+/*
+Shared keys.  A sharedkeys object (see sharedkeys_new()) holds the keys of a
+kind of record in a private ordereddict, whose table is as small as it can
+be.  The ordereddicts it makes point their od_indices at the indices of that
+dict, and only have a ma_table of their own, with room for exactly the keys
+(dict.c reads the values from the entries, so those are not shared).  Values
+are replaced in place; anything that adds, removes or reorders keys first
+gives the dict a table of its own, of the same size (od_unshare()), or a
+larger one in dictresize() when it grows.
+*/
+typedef struct _sharedkeysobject {
+    PyObject_HEAD
+    PyOrderedDictObject *sk_dict;	/* not GC tracked, never changed */
+} sharedkeysobject;
+
+/* mp uses the indices of its sharedkeys */
+#define OD_KEYS_SHARED(mp) ((mp)->od_keys != NULL &&			\
+		       (mp)->od_indices == (mp)->od_keys->sk_dict->od_indices)
+#ifdef OD_LOCKFREE_READS
+/* the readers that don't lock may still be looking at the shared indices,
+   the sharedkeys is only released with the dict */
+#define OD_KEYS_RELEASE(mp)
+#else
+#define OD_KEYS_RELEASE(mp) Py_CLEAR((mp)->od_keys)
+#endif
+
+static int od_unshare(PyOrderedDictObject *mp);
+/* before a change of the keys of mp, return err if out of memory */
+#define OD_UNSHARE(mp, err) do {					\
+	if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0)			\
+		return err;						\
+    } while(0)
+
+static Py_ssize_t
+lookdict_string(PyOrderedDictObject *mp, PyObject *key, long hash,
+                Py_ssize_t *hashpos);
 static PyOrderedDictEntry *
-lookdict_string(PyOrderedDictObject *mp, PyObject *key, long hash);
+lookdict_compat(PyOrderedDictObject *mp, PyObject *key, long hash);
 int PyOrderedDict_CopySome(PyObject *a, PyObject *b,
                            Py_ssize_t start, Py_ssize_t step,
                            Py_ssize_t count, int override);
@@ -111,65 +448,388 @@ show_counts(void)
 
 #define INIT_NONZERO_DICT_SLOTS(mp) do {				\
 	(mp)->ma_table = (mp)->ma_smalltable;				\
-	(mp)->od_otablep = (mp)->ma_smallotablep;           \
-	(mp)->ma_mask = PyOrderedDict_MINSIZE - 1;				\
+	(mp)->od_indices = (mp)->od_smallindices;			\
+	memset((mp)->od_smallindices, 0xff, sizeof((mp)->od_smallindices)); \
+	(mp)->ma_mask = OD_USABLE_FRACTION(PyOrderedDict_MINSIZE) - 1;	\
+	(mp)->od_imask = PyOrderedDict_MINSIZE - 1;			\
+	(mp)->ma_lookup = lookdict_compat;				\
+	(mp)->od_lookup = lookdict_string;				\
     } while(0)
 
 #define EMPTY_TO_MINSIZE(mp) do {					\
 	memset((mp)->ma_smalltable, 0, sizeof((mp)->ma_smalltable));	\
-	memset((mp)->ma_smallotablep, 0, sizeof((mp)->ma_smallotablep));	\
-	(mp)->ma_used = (mp)->od_fill = (mp)->od_state = 0;				\
+	(mp)->ma_used = (mp)->od_fill = (mp)->od_nentries = (mp)->od_state = 0;	\
+	(mp)->od_first = 0;						\
+	(mp)->od_rehash = NULL;						\
 	INIT_NONZERO_DICT_SLOTS(mp);					\
     } while(0)
 
 /* 	(mp)->od_cmp = (mp)->od_key = NULL;				\*/
 
+/* a change of mp, and one that adds, removes or reorders keys, after
+   which the iterators over mp stop */
+#define OD_CHANGED(mp)		((mp)->od_version++)
+#define OD_MOVED(mp)		((mp)->od_moved = ++(mp)->od_version)
+
 #define INIT_SORT_FUNCS(SD) do {						\
 	SD->sd_cmp = Py_None; Py_INCREF(Py_None);		\
 	SD->sd_key = Py_None; Py_INCREF(Py_None);		\
 	SD->sd_value = Py_None; Py_INCREF(Py_None);		\
+	SD->sd_order = NULL;					\
+	SD->sd_tkeys = NULL;					\
+	SD->sd_bulk = 0;					\
 	} while(0)
 
 
 #define OD_KVIO_BIT		(1<<0)
 #define OD_RELAXED_BIT	(1<<1)
 #define OD_REVERSE_BIT	(1<<2)
+#define OD_LRU_BIT		(1<<3)
+#define OD_FROZEN_BIT		(1<<4)
 
 #define KVIO(mp)	(mp->od_state & OD_KVIO_BIT)
 #define RELAXED(mp)	(mp->od_state & OD_RELAXED_BIT)
 #define REVERSE(mp)	(mp->od_state & OD_REVERSE_BIT)
+#define LRU(mp)		(mp->od_state & OD_LRU_BIT)
+#define FROZEN(mp)	((mp)->od_state & OD_FROZEN_BIT)
 
-/* Dictionary reuse scheme to save calls to malloc, free, and memset */
+/* Dictionary reuse scheme to save calls to malloc, free, and memset.
+   ordereddict and sorteddict each keep a free list of deallocated objects
+   of their exact type, at most od_freelist_limit (settable with pool())
+   long. */
 #define MAXFREEDICTS 80
-static PyOrderedDictObject *free_dicts[MAXFREEDICTS];
+#define OD_MAXFREELIST 1024
+static PyOrderedDictObject *free_dicts[OD_MAXFREELIST];
 static int num_free_dicts = 0;
+static PyOrderedDictObject *free_sorteddicts[OD_MAXFREELIST];
+static int num_free_sorteddicts = 0;
+static int od_freelist_limit = MAXFREEDICTS;
+
+/* Size in bytes of a slot of od_indices for a table of n slots: the
+   smallest signed integer that can hold any index into ma_table. */
+#define OD_IXSIZE(n) ((n) <= 0xff ? 1 : (n) <= 0xffff ? 2 : \
+		      (SIZEOF_SIZE_T > 4 && (n) <= 0xffffffffL) ? 4 : \
+		      (Py_ssize_t) sizeof(Py_ssize_t))
+
+/* Size in bytes of the block holding od_indices and ma_table for a table of
+   n slots. */
+#define OD_BLOCKSIZE(n) ((n) * OD_IXSIZE(n) + \
+			 (OD_USABLE_FRACTION(n) + 1) * sizeof(PyOrderedDictEntry))
+
+/* Table reuse scheme: the malloc'ed block holding od_indices and ma_table
+   of a table with up to od_pool_maxslots slots is not freed but kept for
+   the next dict that grows to the same size.  The block size only depends
+   on the number of slots, a power of 2, so its log2 is the size class;
+   od_pool_depth blocks are kept per class. */
+#define OD_POOL_CLASSES 17		/* up to 1 << 16 slots */
+#define OD_POOL_MAXDEPTH 32
+static void *od_pool[OD_POOL_CLASSES][OD_POOL_MAXDEPTH];
+static int od_pool_count[OD_POOL_CLASSES];
+static int od_pool_depth = 4;
+static Py_ssize_t od_pool_maxslots = 4096;
+
+/* log2 of slots, a power of 2 */
+static int
+od_size_class(Py_ssize_t slots)
+{
+    int c = 0;
+
+    while (((Py_ssize_t) 1 << c) < slots)
+        c++;
+    return c;
+}
+
+static int
+od_pool_class(Py_ssize_t slots)
+{
+    int c;
+
+    if (slots > od_pool_maxslots)
+        return -1;
+    c = od_size_class(slots);
+    assert(c < OD_POOL_CLASSES);
+    return c;
+}
+
+/*
+Slabs.  With arena() on, the blocks of tables of up to OD_SLAB_MAXSLOTS
+slots, those of small dicts, are cut from slabs of OD_SLAB_SIZE bytes instead
+of being malloc'ed one by one: that saves the malloc overhead per block and
+keeps many small dicts from fragmenting the heap.  Per size class there is a
+list of the slabs that have free chunks; a slab is freed as soon as none of
+its chunks is in use.  od_slab_index has all slabs sorted by address, to
+tell whether a block being freed is on one (only looked at while there are
+slabs), so a block goes back the way it came whatever the setting is by
+then.  Slabs are PyMem blocks too, so tracemalloc sees them.  All of this is
+done with the pool locked.
+*/
+#define OD_SLAB_SIZE (256 * 1024)
+#define OD_SLAB_MAXSLOTS 128
+
+typedef struct _od_slab {
+    /* in the list of slabs with free chunks of its class */
+    struct _od_slab *sl_next;
+    struct _od_slab *sl_prev;
+    void *sl_free;	/* the free chunks, linked through their first word */
+    Py_ssize_t sl_used;	/* chunks in use */
+    int sl_class;
+    double sl_align;	/* the chunks after it are aligned like malloc's */
+} od_slab;
+
+/* bytes in a slab of a chunk for a block of n bytes */
+#define OD_CHUNKSIZE(n) (((n) + 15) & ~(size_t) 15)
+
+static int od_arena = 0;	/* cut small tables from slabs, if true */
+static od_slab *od_slabs[OD_POOL_CLASSES];
+static od_slab **od_slab_index = NULL;
+static Py_ssize_t od_slab_count = 0;	/* slabs in od_slab_index */
+static Py_ssize_t od_slab_room = 0;	/* that od_slab_index has room for */
+static Py_ssize_t od_slab_chunks = 0;	/* chunks in use, of all slabs */
+/* the blocks for tables there are (in use or pooled), and their bytes */
+static Py_ssize_t od_table_count = 0;
+static Py_ssize_t od_table_bytes = 0;
+
+/* the position in od_slab_index of the last slab at or before p, -1 if none */
+static Py_ssize_t
+od_slab_search(void *p)
+{
+    Py_ssize_t lo = 0, hi = od_slab_count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if ((char *) od_slab_index[mid] <= (char *) p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+static void
+od_slab_unlink(od_slab *sl)
+{
+    if (sl->sl_prev != NULL)
+        sl->sl_prev->sl_next = sl->sl_next;
+    else
+        od_slabs[sl->sl_class] = sl->sl_next;
+    if (sl->sl_next != NULL)
+        sl->sl_next->sl_prev = sl->sl_prev;
+}
+
+/* a new slab with chunks for blocks of class c and size bytes each, NULL
+   if out of memory */
+static od_slab *
+od_slab_new(int c, size_t size)
+{
+    od_slab *sl, **index;
+    Py_ssize_t i, room;
+    char *p;
+
+    if (od_slab_count == od_slab_room) {
+        room = od_slab_room ? 2 * od_slab_room : 16;
+        index = PyMem_RESIZE(od_slab_index, od_slab *, room);
+        if (index == NULL)
+            return NULL;
+        od_slab_index = index;
+        od_slab_room = room;
+    }
+    sl = (od_slab *) PyMem_MALLOC(OD_SLAB_SIZE);
+    if (sl == NULL)
+        return NULL;
+    sl->sl_free = NULL;
+    sl->sl_used = 0;
+    sl->sl_class = c;
+    /* link up the chunks, so that the first one goes out first */
+    for (p = (char *) (sl + 1) + (OD_SLAB_SIZE - sizeof(od_slab)) / size * size;
+         (p -= size) >= (char *) (sl + 1); ) {
+        *(void **) p = sl->sl_free;
+        sl->sl_free = p;
+    }
+    i = od_slab_search(sl) + 1;
+    memmove(&od_slab_index[i + 1], &od_slab_index[i],
+            (od_slab_count - i) * sizeof(od_slab *));
+    od_slab_index[i] = sl;
+    od_slab_count++;
+    return sl;
+}
+
+/* a chunk for the block of a table of slots slots off a slab, NULL if out
+   of memory */
+static void *
+od_slab_alloc(Py_ssize_t slots)
+{
+    int c = od_size_class(slots);
+    od_slab *sl = od_slabs[c];
+    void *chunk;
+
+    if (sl == NULL) {
+        sl = od_slab_new(c, OD_CHUNKSIZE(OD_BLOCKSIZE(slots)));
+        if (sl == NULL)
+            return NULL;
+        sl->sl_prev = sl->sl_next = NULL;
+        od_slabs[c] = sl;
+    }
+    chunk = sl->sl_free;
+    sl->sl_free = *(void **) chunk;
+    if (sl->sl_free == NULL)
+        od_slab_unlink(sl);
+    sl->sl_used++;
+    od_slab_chunks++;
+    return chunk;
+}
+
+/* give back block if it is on a slab, and return 1; else return 0 */
+static int
+od_slab_free(void *block)
+{
+    Py_ssize_t i = od_slab_search(block);
+    od_slab *sl;
+
+    if (i < 0 || (char *) block >= (char *) od_slab_index[i] + OD_SLAB_SIZE)
+        return 0;
+    sl = od_slab_index[i];
+    if (sl->sl_free == NULL) {
+        /* it was full, now it has a free chunk again */
+        sl->sl_prev = NULL;
+        sl->sl_next = od_slabs[sl->sl_class];
+        if (sl->sl_next != NULL)
+            sl->sl_next->sl_prev = sl;
+        od_slabs[sl->sl_class] = sl;
+    }
+    *(void **) block = sl->sl_free;
+    sl->sl_free = block;
+    od_slab_chunks--;
+    if (--sl->sl_used == 0) {
+        od_slab_unlink(sl);
+        od_slab_count--;
+        memmove(&od_slab_index[i], &od_slab_index[i + 1],
+                (od_slab_count - i) * sizeof(od_slab *));
+        PyMem_FREE(sl);
+    }
+    return 1;
+}
+
+/* give back the block for a table of slots slots, with the pool locked */
+static void
+od_block_release(void *block, Py_ssize_t slots)
+{
+    od_table_count--;
+    od_table_bytes -= OD_BLOCKSIZE(slots);
+    if (slots > OD_SLAB_MAXSLOTS || od_slab_count == 0 || !od_slab_free(block))
+        PyMem_FREE(block);
+}
+
+/* the block for a table of slots slots, of nbytes bytes */
+static void *
+od_table_alloc(Py_ssize_t slots, size_t nbytes)
+{
+    void *block = NULL;
+    int c;
+
+    OD_POOL_LOCK();
+    c = od_pool_class(slots);
+    if (c >= 0 && od_pool_count[c] > 0)
+        block = od_pool[c][--od_pool_count[c]];
+    else if (od_arena && slots <= OD_SLAB_MAXSLOTS &&
+             (block = od_slab_alloc(slots)) != NULL) {
+        od_table_count++;
+        od_table_bytes += nbytes;
+    }
+    OD_POOL_UNLOCK();
+    if (block != NULL)
+        return block;
+    block = PyMem_MALLOC(nbytes);
+    if (block != NULL) {
+        OD_POOL_LOCK();
+        od_table_count++;
+        od_table_bytes += nbytes;
+        OD_POOL_UNLOCK();
+    }
+    return block;
+}
+
+/* slots 0 is for the ma_table of a dict with shared keys, which is just
+   PyMem memory */
+static void
+od_table_free(void *block, Py_ssize_t slots)
+{
+    int c;
+
+    if (slots == 0) {
+        PyMem_FREE(block);
+        return;
+    }
+    OD_POOL_LOCK();
+    c = od_pool_class(slots);
+    if (c >= 0 && od_pool_count[c] < od_pool_depth)
+        od_pool[c][od_pool_count[c]++] = block;
+    else
+        od_block_release(block, slots);
+    OD_POOL_UNLOCK();
+}
+
+/* drop what is over the (lowered) limits, with the pool locked */
+static void
+od_pool_trim(void)
+{
+    int c;
+
+    while (num_free_dicts > od_freelist_limit)
+        PyObject_GC_Del(free_dicts[--num_free_dicts]);
+    while (num_free_sorteddicts > od_freelist_limit)
+        PyObject_GC_Del(free_sorteddicts[--num_free_sorteddicts]);
+    for (c = 0; c < OD_POOL_CLASSES; c++)
+        while (od_pool_count[c] > od_pool_depth ||
+               (od_pool_count[c] > 0 && ((Py_ssize_t) 1 << c) > od_pool_maxslots))
+            od_block_release(od_pool[c][--od_pool_count[c]], (Py_ssize_t) 1 << c);
+}
+
+/* an empty dict of exactly type type off its free list, NULL if there is
+   none; it is not GC tracked yet */
+static PyOrderedDictObject *
+od_freelist_pop(PyTypeObject *type)
+{
+    register PyOrderedDictObject *mp = NULL;
 
+    OD_POOL_LOCK();
+    if (type == &PyOrderedDict_Type && num_free_dicts)
+        mp = free_dicts[--num_free_dicts];
+    else if (type == &PySortedDict_Type && num_free_sorteddicts)
+        mp = free_sorteddicts[--num_free_sorteddicts];
+    OD_POOL_UNLOCK();
+    if (mp == NULL)
+        return NULL;
+    assert (mp != NULL);
+    assert (Py_Type(mp) == type);
+    _Py_NewReference((PyObject *)mp);
+    if (mp->od_fill || mp->ma_table != mp->ma_smalltable) {
+        EMPTY_TO_MINSIZE(mp);
+    }
+    assert (mp->ma_used == 0);
+    assert (mp->ma_table == mp->ma_smalltable);
+    assert (mp->od_indices == mp->od_smallindices);
+    assert (mp->od_imask == PyOrderedDict_MINSIZE - 1);
+    mp->od_state = 0;
+    mp->od_lookup = lookdict_string;
+    return mp;
+}
 
 PyObject *
 PyOrderedDict_New(void)
 {
     register PyOrderedDictObject *mp;
-    assert(dummy != NULL);
-    if (num_free_dicts) {
-        mp = free_dicts[--num_free_dicts];
-        assert (mp != NULL);
-        /* assert (mp->ob_type == &PyOrderedDict_Type); */
-        assert (Py_Type(mp) == &PyOrderedDict_Type);
-        _Py_NewReference((PyObject *)mp);
-        if (mp->od_fill) {
-            EMPTY_TO_MINSIZE(mp);
-        }
-        assert (mp->ma_used == 0);
-        assert (mp->ma_table == mp->ma_smalltable);
-        assert (mp->od_otablep == mp->ma_smallotablep);
-        assert (mp->ma_mask == PyOrderedDict_MINSIZE - 1);
-    } else {
+    mp = od_freelist_pop(&PyOrderedDict_Type);
+    if (mp == NULL) {
         mp = PyObject_GC_New(PyOrderedDictObject, &PyOrderedDict_Type);
         if (mp == NULL)
             return NULL;
         EMPTY_TO_MINSIZE(mp);
+        OD_INIT_SEQ(mp);
     }
-    mp->ma_lookup = lookdict_string;
+    mp->od_maxsize = 0;
+    mp->od_version = mp->od_moved = 0;
+    mp->od_stats = NULL;
+    mp->od_keys = NULL;
 #ifdef SHOW_CONVERSION_COUNTS
     ++created;
 #endif
@@ -183,12 +843,19 @@ PySortedDict_New(void)
 {
     register PyOrderedDictObject *mp;
     register PySortedDictObject *sd;
-    assert(dummy != NULL);
-    mp = (PyOrderedDictObject *) PyObject_GC_New(PySortedDictObject, &PySortedDict_Type);
-    if (mp == NULL)
-        return NULL;
-    EMPTY_TO_MINSIZE(mp);
-    mp->ma_lookup = lookdict_string;
+    mp = od_freelist_pop(&PySortedDict_Type);
+    if (mp == NULL) {
+        mp = (PyOrderedDictObject *) PyObject_GC_New(PySortedDictObject,
+                                                     &PySortedDict_Type);
+        if (mp == NULL)
+            return NULL;
+        EMPTY_TO_MINSIZE(mp);
+        OD_INIT_SEQ(mp);
+    }
+    mp->od_maxsize = 0;
+    mp->od_version = mp->od_moved = 0;
+    mp->od_stats = NULL;
+    mp->od_keys = NULL;
     sd = (PySortedDictObject*)mp;
     INIT_SORT_FUNCS(sd);
 #ifdef SHOW_CONVERSION_COUNTS
@@ -198,6 +865,276 @@ PySortedDict_New(void)
     return (PyObject *)mp;
 }
 
+/* read slot i of indices, of a table of s slots */
+static Py_ssize_t
+od_ix_get(void *indices, Py_ssize_t s, size_t i)
+{
+    if (s <= 0xff)
+        return ((signed char *) indices)[i];
+    if (s <= 0xffff)
+        return ((short *) indices)[i];
+#if SIZEOF_SIZE_T > 4
+    if (s <= 0xffffffffL)
+        return ((int *) indices)[i];
+#endif
+    return ((Py_ssize_t *) indices)[i];
+}
+
+/* write ix in slot i of indices, of a table of s slots */
+static void
+od_ix_set(void *indices, Py_ssize_t s, size_t i, Py_ssize_t ix)
+{
+    if (s <= 0xff)
+        ((signed char *) indices)[i] = (signed char) ix;
+    else if (s <= 0xffff)
+        ((short *) indices)[i] = (short) ix;
+#if SIZEOF_SIZE_T > 4
+    else if (s <= 0xffffffffL)
+        ((int *) indices)[i] = (int) ix;
+#endif
+    else
+        ((Py_ssize_t *) indices)[i] = ix;
+}
+
+/* read slot i of od_indices */
+static Py_ssize_t
+od_get_index(PyOrderedDictObject *mp, size_t i)
+{
+    return od_ix_get(mp->od_indices, mp->od_imask + 1, i);
+}
+
+/* write ix in slot i of od_indices */
+static void
+od_set_index(PyOrderedDictObject *mp, size_t i, Py_ssize_t ix)
+{
+    assert(!OD_KEYS_SHARED(mp));
+    od_ix_set(mp->od_indices, mp->od_imask + 1, i, ix);
+}
+
+#ifdef OD_LOCKFREE_READS
+/*
+The readers that don't lock look at the table while od_seq stays the same
+even number (a seqlock).  A writer sets it odd as it starts changing the
+table and even again when done, and PyUnstable_EnableTryIncRef() has been
+called for the keys and values put in the table (OD_SHARE), so that a
+reader can tell whether it still got a reference to one.
+
+The block of a table that is replaced may still be read, it waits on
+od_retired until no reader can be looking at it (epoch based reclamation).
+Readers count themselves in by od_epoch, in a slot of od_readers picked by
+their thread; od_epoch only goes on to the next when the readers of the
+one before it are gone, so a block retired in epoch e is free from e + 2.
+*/
+#define OD_SHARE(o)		PyUnstable_EnableTryIncRef(o)
+#define OD_TABLE_RELEASE(mp, block, slots) od_table_retire(mp, block, slots)
+
+#define OD_READER_STRIPES 64
+static struct {
+    Py_ssize_t n[2];
+    char pad[64 - 2 * sizeof(Py_ssize_t)];	/* a cache line each */
+} od_readers[OD_READER_STRIPES];
+static uintptr_t od_epoch;
+
+struct _od_retired {
+    struct _od_retired *next;
+    void *block;
+    Py_ssize_t slots;
+    uintptr_t epoch;
+};
+
+/* 1 if od_seq was made odd, 0 if that was done by an outer writer */
+static int
+od_write_begin(PyOrderedDictObject *mp)
+{
+    uintptr_t seq = _Py_atomic_load_uintptr_relaxed(&mp->od_seq);
+
+    if (seq & 1)
+        return 0;
+    _Py_atomic_store_uintptr_relaxed(&mp->od_seq, seq + 1);
+    _Py_atomic_fence_release();
+    return 1;
+}
+
+/* free what od_epoch has left behind, all of it when mp goes away */
+static void
+od_retired_free(PyOrderedDictObject *mp, int all)
+{
+    struct _od_retired *r, **rp = &mp->od_retired;
+    uintptr_t epoch = _Py_atomic_load_uintptr(&od_epoch);
+
+    while ((r = *rp) != NULL) {
+        if (all || epoch - r->epoch >= 2) {
+            *rp = r->next;
+            od_table_free(r->block, r->slots);
+            PyMem_FREE(r);
+        }
+        else
+            rp = &r->next;
+    }
+}
+
+/* go on to the next epoch if nobody reads in the one before */
+static void
+od_epoch_advance(void)
+{
+    uintptr_t epoch = _Py_atomic_load_uintptr(&od_epoch);
+    Py_ssize_t n = 0;
+    int i;
+
+    for (i = 0; i < OD_READER_STRIPES; i++)
+        n += _Py_atomic_load_ssize(&od_readers[i].n[(epoch - 1) & 1]);
+    if (n == 0)
+        _Py_atomic_compare_exchange_uintptr(&od_epoch, &epoch, epoch + 1);
+}
+
+static void
+od_write_end(PyOrderedDictObject *mp, int began)
+{
+    if (!began)
+        return;
+    _Py_atomic_store_uintptr_release(&mp->od_seq, mp->od_seq + 1);
+    if (mp->od_retired != NULL) {
+        od_epoch_advance();
+        od_retired_free(mp, 0);
+    }
+}
+
+/* the block of the table just replaced in mp */
+static void
+od_table_retire(PyOrderedDictObject *mp, void *block, Py_ssize_t slots)
+{
+    struct _od_retired *r = PyMem_MALLOC(sizeof(struct _od_retired));
+
+    _Py_atomic_fence_seq_cst();
+    if (r == NULL) {
+        /* the readers never wait for anything, wait for them */
+        uintptr_t epoch = _Py_atomic_load_uintptr(&od_epoch);
+        while (_Py_atomic_load_uintptr(&od_epoch) - epoch < 2)
+            od_epoch_advance();
+        od_table_free(block, slots);
+        return;
+    }
+    r->block = block;
+    r->slots = slots;
+    r->epoch = _Py_atomic_load_uintptr(&od_epoch);
+    r->next = mp->od_retired;
+    mp->od_retired = r;
+}
+
+/* slot i of indices, of a table of size slots, as od_get_index() */
+static Py_ssize_t
+od_load_index(void *indices, Py_ssize_t size, size_t i)
+{
+    if (size <= 0xff)
+        return _Py_atomic_load_int8_relaxed(&((int8_t *) indices)[i]);
+    if (size <= 0xffff)
+        return _Py_atomic_load_int16_relaxed(&((int16_t *) indices)[i]);
+#if SIZEOF_SIZE_T > 4
+    if (size <= 0xffffffffL)
+        return _Py_atomic_load_int32_relaxed(&((int32_t *) indices)[i]);
+#endif
+    return _Py_atomic_load_ssize_relaxed(&((Py_ssize_t *) indices)[i]);
+}
+
+/*
+Look up the exact str key in mp without its lock.  1 with *pvalue a new
+reference to the value, 0 if key is not there, -1 if that could not be
+told (a writer came by, or a key needs comparing by __eq__): the caller
+looks again in a critical section.
+*/
+static int
+od_lockfree_lookup(PyOrderedDictObject *mp, PyObject *key, Py_hash_t hash,
+                   PyObject **pvalue)
+{
+    uintptr_t seq, epoch;
+    Py_ssize_t size, usable, ix, probes, *count;
+    size_t i, mask, perturb, stripe;
+    void *indices;
+    PyOrderedDictEntry *table, *ep;
+    PyObject *k, *v = NULL;
+    int result = -1, eq;
+
+    /* stats() counts the lookups in the critical section */
+    if (ordereddict_stats)
+        return -1;
+    seq = _Py_atomic_load_uintptr_acquire(&mp->od_seq);
+    if (seq & 1)
+        return -1;
+    stripe = (size_t) (_Py_ThreadId() >> 4) * 2654435761u % OD_READER_STRIPES;
+    epoch = _Py_atomic_load_uintptr(&od_epoch);
+    count = &od_readers[stripe].n[epoch & 1];
+    _Py_atomic_add_ssize(count, 1);
+    _Py_atomic_fence_seq_cst();
+    if (_Py_atomic_load_uintptr(&od_epoch) != epoch)
+        goto Done;
+    size = _Py_atomic_load_ssize_relaxed(&mp->od_imask) + 1;
+    indices = _Py_atomic_load_ptr_relaxed(&mp->od_indices);
+    table = _Py_atomic_load_ptr_relaxed(&mp->ma_table);
+    /* while it grows the key can still be in the old indices */
+    if (_Py_atomic_load_ptr_relaxed(&mp->od_rehash) != NULL)
+        goto Done;
+    _Py_atomic_fence_acquire();
+    if (_Py_atomic_load_uintptr_relaxed(&mp->od_seq) != seq)
+        goto Done;
+    /* size, indices and table belong together, and stay allocated */
+    mask = (size_t) size - 1;
+    usable = OD_USABLE_FRACTION(size);
+    i = (size_t) hash & mask;
+    perturb = (size_t) hash;
+    for (probes = 0; probes < size; probes++) {
+        ix = od_load_index(indices, size, i & mask);
+        if (ix == OD_IX_EMPTY) {
+            result = 0;
+            break;
+        }
+        if (ix >= usable)
+            break;
+        if (ix >= 0) {
+            ep = &table[ix];
+            k = _Py_atomic_load_ptr_relaxed(&ep->me_key);
+            if (k == key)
+                eq = 1;
+            else if (k == NULL ||
+                     _Py_atomic_load_ssize_relaxed(&ep->me_hash) != hash)
+                eq = 0;
+            else {
+                if (!PyUnstable_TryIncRef(k))
+                    break;
+                if (!PyUnicode_CheckExact(k)) {
+                    Py_DECREF(k);
+                    break;
+                }
+                eq = _PyString_Eq(k, key);
+                Py_DECREF(k);
+            }
+            if (eq) {
+                v = _Py_atomic_load_ptr_relaxed(&ep->me_value);
+                if (v == NULL || !PyUnstable_TryIncRef(v))
+                    v = NULL;
+                else
+                    result = 1;
+                break;
+            }
+        }
+        i = (i << 2) + i + perturb + 1;
+        perturb >>= PERTURB_SHIFT;
+    }
+    _Py_atomic_fence_acquire();
+    if (_Py_atomic_load_uintptr_relaxed(&mp->od_seq) != seq) {
+        Py_XDECREF(v);
+        result = -1;
+    }
+    else if (result == 1)
+        *pvalue = v;
+Done:
+    _Py_atomic_add_ssize(count, -1);
+    return result;
+}
+#else
+#define OD_SHARE(o)
+#define OD_TABLE_RELEASE(mp, block, slots) od_table_free(block, slots)
+#endif
+
 /*
 The basic lookup function used by all operations.
 This is based on Algorithm D from Knuth Vol. 3, Sec. 6.4.
@@ -213,87 +1150,264 @@ All arithmetic on hash should ignore overflow.
 contributions by Reimer Behrends, Jyrki Alakuijala, Vladimir Marangozov and
 Christian Tismer).
 
-lookdict() is general-purpose, and may return NULL if (and only if) a
+lookdict() is general-purpose, and may return OD_IX_ERROR if (and only if) a
 comparison raises an exception (this was new in Python 2.5).
 lookdict_string() below is specialized to string keys, comparison of which can
-never raise an exception; that function can never return NULL.  For both, when
-the key isn't found a PyOrderedDictEntry* is returned for which the me_value field is
-NULL; this is the slot in the dict at which the key would have been found, and
-the caller can (if it wishes) add the <key, value> pair to the returned
-PyOrderedDictEntry *.
+never raise an exception; that function can never return OD_IX_ERROR.  For
+both, when the key is found its index in ma_table is returned, else
+OD_IX_EMPTY.  In both cases *hashpos is set to the slot of od_indices at which
+the key was, or would have been, found; the caller can (if it wishes) put
+the index of a new entry there.
 */
-static PyOrderedDictEntry *
-lookdict(PyOrderedDictObject *mp, PyObject *key, register long hash)
+static Py_ssize_t
+lookdict(PyOrderedDictObject *mp, PyObject *key, register long hash,
+         Py_ssize_t *hashpos)
 {
     register size_t i;
     register size_t perturb;
-    register PyOrderedDictEntry *freeslot;
-    register size_t mask = (size_t)mp->ma_mask;
+    register Py_ssize_t freeslot;
+    register size_t mask = (size_t)mp->od_imask;
     PyOrderedDictEntry *ep0 = mp->ma_table;
     register PyOrderedDictEntry *ep;
+    register Py_ssize_t ix;
     register int cmp;
     PyObject *startkey;
 
+    OD_REHASH_CHAIN(mp, hash);
     i = (size_t)hash & mask;
-    ep = &ep0[i];
-    if (ep->me_key == NULL || ep->me_key == key)
-        return ep;
-
-    if (ep->me_key == dummy)
-        freeslot = ep;
+    ix = od_get_index(mp, i);
+    if (ix == OD_IX_EMPTY) {
+        *hashpos = i;
+        return OD_IX_EMPTY;
+    }
+    if (ix == OD_IX_DUMMY)
+        freeslot = i;
     else {
+        ep = &ep0[ix];
+        if (ep->me_key == key) {
+            *hashpos = i;
+            return ix;
+        }
         if (ep->me_hash == hash) {
             startkey = ep->me_key;
             cmp = PyObject_RichCompareBool(startkey, key, Py_EQ);
             if (cmp < 0)
-                return NULL;
-            if (ep0 == mp->ma_table && ep->me_key == startkey) {
-                if (cmp > 0)
-                    return ep;
+                return OD_IX_ERROR;
+            if (ep0 == mp->ma_table && od_get_index(mp, i) == ix &&
+                    ep->me_key == startkey) {
+                if (cmp > 0) {
+                    *hashpos = i;
+                    return ix;
+                }
             } else {
                 /* The compare did major nasty stuff to the
                  * dict:  start over.
                  * XXX A clever adversary could prevent this
                  * XXX from terminating.
                  */
-                return lookdict(mp, key, hash);
+                return lookdict(mp, key, hash, hashpos);
             }
         }
-        freeslot = NULL;
+        freeslot = -1;
     }
 
-    /* In the loop, me_key == dummy is by far (factor of 100s) the
+    /* In the loop, a Dummy slot is by far (factor of 100s) the
        least likely outcome, so test for that last. */
     for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
         i = (i << 2) + i + perturb + 1;
-        ep = &ep0[i & mask];
-        if (ep->me_key == NULL)
-            return freeslot == NULL ? ep : freeslot;
-        if (ep->me_key == key)
-            return ep;
-        if (ep->me_hash == hash && ep->me_key != dummy) {
-            startkey = ep->me_key;
-            cmp = PyObject_RichCompareBool(startkey, key, Py_EQ);
-            if (cmp < 0)
-                return NULL;
-            if (ep0 == mp->ma_table && ep->me_key == startkey) {
-                if (cmp > 0)
-                    return ep;
-            } else {
-                /* The compare did major nasty stuff to the
-                 * dict:  start over.
-                 * XXX A clever adversary could prevent this
-                 * XXX from terminating.
-                 */
-                return lookdict(mp, key, hash);
+        ix = od_get_index(mp, i & mask);
+        if (ix == OD_IX_EMPTY) {
+            /* a compare after the Dummy slot was seen can have put a key
+               added meanwhile there */
+            if (freeslot != -1 && od_get_index(mp, freeslot) != OD_IX_DUMMY)
+                return lookdict(mp, key, hash, hashpos);
+            *hashpos = freeslot == -1 ? (Py_ssize_t)(i & mask) : freeslot;
+            return OD_IX_EMPTY;
+        }
+        if (ix >= 0) {
+            ep = &ep0[ix];
+            if (ep->me_key == key) {
+                *hashpos = i & mask;
+                return ix;
+            }
+            if (ep->me_hash == hash) {
+                startkey = ep->me_key;
+                cmp = PyObject_RichCompareBool(startkey, key, Py_EQ);
+                if (cmp < 0)
+                    return OD_IX_ERROR;
+                if (ep0 == mp->ma_table && od_get_index(mp, i & mask) == ix &&
+                        ep->me_key == startkey) {
+                    if (cmp > 0) {
+                        *hashpos = i & mask;
+                        return ix;
+                    }
+                } else {
+                    /* The compare did major nasty stuff to the
+                     * dict:  start over.
+                     * XXX A clever adversary could prevent this
+                     * XXX from terminating.
+                     */
+                    return lookdict(mp, key, hash, hashpos);
+                }
             }
-        } else if (ep->me_key == dummy && freeslot == NULL)
-            freeslot = ep;
+        } else if (freeslot == -1)
+            freeslot = i & mask;
     }
     assert(0);	/* NOT REACHED */
     return 0;
 }
 
+/*
+ * lookdict_int() and lookdict_tuple() are like lookdict_string() for dicts
+ * that, so far, only have exact int keys, resp. exact tuples of exact ints
+ * and strings (e.g. (row, column) pairs).  Comparing those can't raise or
+ * run Python code either.  A dict only gets one of them when it is empty
+ * and the first key for which the current one doesn't do arrives; when a
+ * key of another type arrives otherwise, it goes to lookdict() for good.
+ */
+static Py_ssize_t lookdict_int(PyOrderedDictObject *mp, PyObject *key,
+                               long hash, Py_ssize_t *hashpos);
+static Py_ssize_t lookdict_tuple(PyOrderedDictObject *mp, PyObject *key,
+                                 long hash, Py_ssize_t *hashpos);
+
+/* a tuple that lookdict_tuple() can handle */
+static int
+simple_tuple(PyObject *key)
+{
+    Py_ssize_t i;
+    PyObject *item;
+
+    if (!PyTuple_CheckExact(key))
+        return 0;
+    for (i = PyTuple_GET_SIZE(key); --i >= 0; ) {
+        item = PyTuple_GET_ITEM(key, i);
+        if (!OD_INT_CHECKEXACT(item) && !PyString_CheckExact(item))
+            return 0;
+    }
+    return 1;
+}
+
+/* equality of two tuples for which simple_tuple() holds */
+static int
+simple_tuple_eq(PyObject *a, PyObject *b)
+{
+    Py_ssize_t i, n = PyTuple_GET_SIZE(a);
+    PyObject *x, *y;
+
+    if (PyTuple_GET_SIZE(b) != n)
+        return 0;
+    for (i = 0; i < n; i++) {
+        x = PyTuple_GET_ITEM(a, i);
+        y = PyTuple_GET_ITEM(b, i);
+        if (x == y)
+            continue;
+        if (Py_Type(x) != Py_Type(y))
+            return 0;
+        if (OD_INT_CHECKEXACT(x)) {
+            if (OD_INT_AS_LONG(x) != OD_INT_AS_LONG(y))
+                return 0;
+        } else if (!_PyString_Eq(x, y))
+            return 0;
+    }
+    return 1;
+}
+
+/* switch mp to the lookup function best suited for key, and use that */
+static Py_ssize_t
+lookdict_switch(PyOrderedDictObject *mp, PyObject *key, long hash,
+                Py_ssize_t *hashpos)
+{
+#ifdef SHOW_CONVERSION_COUNTS
+    ++converted;
+#endif
+    if (mp->ma_used == 0 && PyString_CheckExact(key))
+        mp->od_lookup = lookdict_string;
+    else if (mp->ma_used == 0 && OD_INT_CHECKEXACT(key))
+        mp->od_lookup = lookdict_int;
+    else if (mp->ma_used == 0 && simple_tuple(key))
+        mp->od_lookup = lookdict_tuple;
+    else
+        mp->od_lookup = lookdict;
+    return mp->od_lookup(mp, key, hash, hashpos);
+}
+
+/*
+Statistics.  While ordereddict_stats is on (see stats()), lookups, resizes
+and moves of entries are counted into the od_stats of the dict, allocated
+the first time, and into od_stats_total; if that allocation fails only the
+total counts.  The probes of a lookup are counted after the fact, by
+following the probe sequence of its hash again up to the slot it found (or
+the first empty one), so the lookup functions are the same either way.
+*/
+#ifdef Py_GIL_DISABLED
+#define OD_STAT_ADD(p, n) _Py_atomic_add_ssize(p, n)
+#define OD_STAT_MAX(p, n) do {						\
+	if ((n) > _Py_atomic_load_ssize_relaxed(p))			\
+		_Py_atomic_store_ssize_relaxed(p, n);			\
+    } while(0)
+#else
+#define OD_STAT_ADD(p, n) (*(p) += (n))
+#define OD_STAT_MAX(p, n) do {						\
+	if ((n) > *(p))							\
+		*(p) = (n);						\
+    } while(0)
+#endif
+
+static od_stats *
+od_stats_get(PyOrderedDictObject *mp)
+{
+    if (mp->od_stats == NULL) {
+        mp->od_stats = PyMem_NEW(od_stats, 1);
+        if (mp->od_stats != NULL)
+            memset(mp->od_stats, 0, sizeof(od_stats));
+    }
+    return mp->od_stats;
+}
+
+static void
+od_stats_add(PyOrderedDictObject *mp, size_t offset, Py_ssize_t n)
+{
+    od_stats *st = od_stats_get(mp);
+
+    OD_STAT_ADD((Py_ssize_t *) ((char *) &od_stats_total + offset), n);
+    if (st != NULL)
+        *(Py_ssize_t *) ((char *) st + offset) += n;
+}
+
+static Py_ssize_t
+od_lookup_counted(PyOrderedDictObject *mp, PyObject *key, long hash,
+                  Py_ssize_t *hashpos)
+{
+    Py_ssize_t ix, probes;
+    size_t i, perturb, mask;
+    od_stats *st;
+
+    ix = mp->od_lookup(mp, key, hash, hashpos);
+    if (ix == OD_IX_ERROR)
+        return ix;
+    mask = (size_t) mp->od_imask;
+    i = (size_t) hash & mask;
+    perturb = (size_t) hash;
+    for (probes = 1; (size_t) probes <= mask; probes++) {
+        if (ix >= 0 ? (Py_ssize_t) i == *hashpos :
+                od_get_index(mp, i) == OD_IX_EMPTY)
+            break;
+        i = ((i << 2) + i + perturb + 1) & mask;
+        perturb >>= PERTURB_SHIFT;
+    }
+    OD_STAT_ADD(&od_stats_total.st_lookups, 1);
+    OD_STAT_ADD(&od_stats_total.st_probes, probes);
+    OD_STAT_MAX(&od_stats_total.st_maxprobes, probes);
+    st = od_stats_get(mp);
+    if (st != NULL) {
+        st->st_lookups++;
+        st->st_probes += probes;
+        if (probes > st->st_maxprobes)
+            st->st_maxprobes = probes;
+    }
+    return ix;
+}
+
 /*
  * Hacked up version of lookdict which can assume keys are always strings;
  * this assumption allows testing for errors during PyObject_RichCompareBool()
@@ -303,58 +1417,383 @@ lookdict(PyOrderedDictObject *mp, PyObject *key, register long hash)
  *
  * This is valuable because dicts with only string keys are very common.
  */
-static PyOrderedDictEntry *
-lookdict_string(PyOrderedDictObject *mp, PyObject *key, register long hash)
+static Py_ssize_t
+lookdict_string(PyOrderedDictObject *mp, PyObject *key, register long hash,
+                Py_ssize_t *hashpos)
 {
     register size_t i;
     register size_t perturb;
-    register PyOrderedDictEntry *freeslot;
-    register size_t mask = (size_t)mp->ma_mask;
+    register Py_ssize_t freeslot;
+    register size_t mask = (size_t)mp->od_imask;
     PyOrderedDictEntry *ep0 = mp->ma_table;
     register PyOrderedDictEntry *ep;
+    register Py_ssize_t ix;
 
     /* Make sure this function doesn't have to handle non-string keys,
        including subclasses of str; e.g., one reason to subclass
        strings is to override __eq__, and for speed we don't cater to
        that here. */
-    if (!PyString_CheckExact(key)) {
-#ifdef SHOW_CONVERSION_COUNTS
-        ++converted;
-#endif
-        mp->ma_lookup = lookdict;
-        return lookdict(mp, key, hash);
-    }
+    if (!PyString_CheckExact(key))
+        return lookdict_switch(mp, key, hash, hashpos);
+    OD_REHASH_CHAIN(mp, hash);
     i = hash & mask;
-    ep = &ep0[i];
-    if (ep->me_key == NULL || ep->me_key == key)
-        return ep;
-    if (ep->me_key == dummy)
-        freeslot = ep;
+    ix = od_get_index(mp, i);
+    if (ix == OD_IX_EMPTY) {
+        *hashpos = i;
+        return OD_IX_EMPTY;
+    }
+    if (ix == OD_IX_DUMMY)
+        freeslot = i;
     else {
-        if (ep->me_hash == hash && _PyString_Eq(ep->me_key, key))
-            return ep;
-        freeslot = NULL;
+        ep = &ep0[ix];
+        if (ep->me_key == key
+                || (ep->me_hash == hash && _PyString_Eq(ep->me_key, key))) {
+            *hashpos = i;
+            return ix;
+        }
+        freeslot = -1;
     }
 
-    /* In the loop, me_key == dummy is by far (factor of 100s) the
+    /* In the loop, a Dummy slot is by far (factor of 100s) the
        least likely outcome, so test for that last. */
     for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
         i = (i << 2) + i + perturb + 1;
-        ep = &ep0[i & mask];
-        if (ep->me_key == NULL)
-            return freeslot == NULL ? ep : freeslot;
+        ix = od_get_index(mp, i & mask);
+        if (ix == OD_IX_EMPTY) {
+            *hashpos = freeslot == -1 ? (Py_ssize_t)(i & mask) : freeslot;
+            return OD_IX_EMPTY;
+        }
+        if (ix >= 0) {
+            ep = &ep0[ix];
+            if (ep->me_key == key
+                    || (ep->me_hash == hash && _PyString_Eq(ep->me_key, key))) {
+                *hashpos = i & mask;
+                return ix;
+            }
+        } else if (freeslot == -1)
+            freeslot = i & mask;
+    }
+    assert(0);	/* NOT REACHED */
+    return 0;
+}
+
+/*
+ * As lookdict_string(), for int keys; equal ints have equal hashes, so the
+ * values can be compared right away.
+ */
+static Py_ssize_t
+lookdict_int(PyOrderedDictObject *mp, PyObject *key, register long hash,
+             Py_ssize_t *hashpos)
+{
+    register size_t i;
+    register size_t perturb;
+    register Py_ssize_t freeslot;
+    register size_t mask = (size_t)mp->od_imask;
+    PyOrderedDictEntry *ep0 = mp->ma_table;
+    register PyOrderedDictEntry *ep;
+    register Py_ssize_t ix;
+    register long ival;
+
+    if (!OD_INT_CHECKEXACT(key))
+        return lookdict_switch(mp, key, hash, hashpos);
+    ival = OD_INT_AS_LONG(key);
+    OD_REHASH_CHAIN(mp, hash);
+    i = hash & mask;
+    ix = od_get_index(mp, i);
+    if (ix == OD_IX_EMPTY) {
+        *hashpos = i;
+        return OD_IX_EMPTY;
+    }
+    if (ix == OD_IX_DUMMY)
+        freeslot = i;
+    else {
+        ep = &ep0[ix];
+        if (ep->me_key == key || OD_INT_AS_LONG(ep->me_key) == ival) {
+            *hashpos = i;
+            return ix;
+        }
+        freeslot = -1;
+    }
+
+    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
+        i = (i << 2) + i + perturb + 1;
+        ix = od_get_index(mp, i & mask);
+        if (ix == OD_IX_EMPTY) {
+            *hashpos = freeslot == -1 ? (Py_ssize_t)(i & mask) : freeslot;
+            return OD_IX_EMPTY;
+        }
+        if (ix >= 0) {
+            ep = &ep0[ix];
+            if (ep->me_key == key || OD_INT_AS_LONG(ep->me_key) == ival) {
+                *hashpos = i & mask;
+                return ix;
+            }
+        } else if (freeslot == -1)
+            freeslot = i & mask;
+    }
+    assert(0);	/* NOT REACHED */
+    return 0;
+}
+
+/*
+ * As lookdict_string(), for tuples of ints and strings.
+ */
+static Py_ssize_t
+lookdict_tuple(PyOrderedDictObject *mp, PyObject *key, register long hash,
+               Py_ssize_t *hashpos)
+{
+    register size_t i;
+    register size_t perturb;
+    register Py_ssize_t freeslot;
+    register size_t mask = (size_t)mp->od_imask;
+    PyOrderedDictEntry *ep0 = mp->ma_table;
+    register PyOrderedDictEntry *ep;
+    register Py_ssize_t ix;
+
+    if (!simple_tuple(key))
+        return lookdict_switch(mp, key, hash, hashpos);
+    OD_REHASH_CHAIN(mp, hash);
+    i = hash & mask;
+    ix = od_get_index(mp, i);
+    if (ix == OD_IX_EMPTY) {
+        *hashpos = i;
+        return OD_IX_EMPTY;
+    }
+    if (ix == OD_IX_DUMMY)
+        freeslot = i;
+    else {
+        ep = &ep0[ix];
         if (ep->me_key == key
-                || (ep->me_hash == hash
-                    && ep->me_key != dummy
-                    && _PyString_Eq(ep->me_key, key)))
-            return ep;
-        if (ep->me_key == dummy && freeslot == NULL)
-            freeslot = ep;
+                || (ep->me_hash == hash && simple_tuple_eq(ep->me_key, key))) {
+            *hashpos = i;
+            return ix;
+        }
+        freeslot = -1;
+    }
+
+    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
+        i = (i << 2) + i + perturb + 1;
+        ix = od_get_index(mp, i & mask);
+        if (ix == OD_IX_EMPTY) {
+            *hashpos = freeslot == -1 ? (Py_ssize_t)(i & mask) : freeslot;
+            return OD_IX_EMPTY;
+        }
+        if (ix >= 0) {
+            ep = &ep0[ix];
+            if (ep->me_key == key
+                    || (ep->me_hash == hash && simple_tuple_eq(ep->me_key, key))) {
+                *hashpos = i & mask;
+                return ix;
+            }
+        } else if (freeslot == -1)
+            freeslot = i & mask;
+    }
+    assert(0);	/* NOT REACHED */
+    return 0;
+}
+
+/*
+ * Find the index of the Active entry that holds key itself (not just an
+ * equal key), without any comparisons; used to find the slot of an entry
+ * that is known to be in the table.
+ */
+static Py_ssize_t
+lookdict_ident(PyOrderedDictObject *mp, PyObject *key, long hash,
+               Py_ssize_t *hashpos)
+{
+    register size_t i;
+    register size_t perturb;
+    register size_t mask = (size_t)mp->od_imask;
+    register Py_ssize_t ix;
+
+    OD_REHASH_CHAIN(mp, hash);
+    i = (size_t)hash & mask;
+    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
+        ix = od_get_index(mp, i & mask);
+        assert(ix != OD_IX_EMPTY);
+        if (ix >= 0 && mp->ma_table[ix].me_key == key) {
+            *hashpos = i & mask;
+            return ix;
+        }
+        i = (i << 2) + i + perturb + 1;
     }
     assert(0);	/* NOT REACHED */
     return 0;
 }
 
+/* Return the first Unused slot in the probe sequence for hash. */
+static Py_ssize_t
+find_empty_slot(PyOrderedDictObject *mp, long hash)
+{
+    register size_t i;
+    register size_t perturb;
+    register size_t mask = (size_t)mp->od_imask;
+
+    i = (size_t)hash & mask;
+    for (perturb = hash; od_get_index(mp, i & mask) != OD_IX_EMPTY;
+            perturb >>= PERTURB_SHIFT)
+        i = (i << 2) + i + perturb + 1;
+    return i & mask;
+}
+
+/*
+Incremental growing.  A large ordereddict (see ordereddict_incremental)
+that grows doesn't get its new table filled all at once, which takes time in
+proportion to its size, but this is spread over the inserts around it:
+
+- the entries are copied to the new block as they are, tombstones included,
+  so that they keep their positions and the old indices still hold for them.
+  The new od_indices starts out empty, the old indices stay around until
+  every slot of them has been moved over, OD_REHASH_STEP slots with each
+  insertdict().  The old indices are only ever changed by turning a slot that
+  has been moved over into a Dummy one.
+- what is left is copying the entries, a memcpy(); the new block itself is
+  allocated and initialised (which, being fresh memory, takes even longer)
+  ahead of that, OD_PREPARE_STEP bytes with each insertdict() of the last
+  1/OD_PREPARE_AHEAD of the inserts before the table is full.
+
+A lookup first moves over, from the probe sequence for its hash in the old
+indices, the entries with that hash; as that doesn't compare any keys
+(which could run code that changes the dict) a lookup, and the slot it
+returns, only concern od_indices, like without rehashing.  Anything that
+moves entries around (insert() at a position) rebuilds od_indices first,
+and whatever rebuilds od_indices (build_indices()) drops the old ones.
+*/
+#define OD_REHASH_STEP 32
+#define OD_PREPARE_STEP 4096
+#define OD_PREPARE_AHEAD 16
+
+/* mp grows incrementally */
+#define OD_INCREMENTAL(mp) (ordereddict_incremental > 0 &&		\
+	!PySortedDict_Check(mp) && (mp)->ma_table != (mp)->ma_smalltable &&	\
+	(mp)->od_imask + 1 >= ordereddict_incremental && !OD_KEYS_SHARED(mp))
+
+/* the entries of a block for a table of n slots */
+#define OD_BLOCK_TABLE(block, n) \
+	((PyOrderedDictEntry *) ((char *) (block) + (n) * OD_IXSIZE(n)))
+
+/* the od_rehash of mp, made if there is none, NULL if out of memory */
+static od_rehash *
+od_rehash_get(PyOrderedDictObject *mp)
+{
+    od_rehash *rh = mp->od_rehash;
+
+    if (rh == NULL) {
+        rh = PyMem_NEW(od_rehash, 1);
+        if (rh == NULL)
+            return NULL;
+        rh->rh_oldindices = rh->rh_next = NULL;
+        mp->od_rehash = rh;
+    }
+    return rh;
+}
+
+/* release the old indices, now that all have been moved over (or
+   od_indices is rebuilt), and the od_rehash once it is not used */
+static void
+od_rehash_drop(PyOrderedDictObject *mp)
+{
+    od_rehash *rh = mp->od_rehash;
+
+    OD_TABLE_RELEASE(mp, rh->rh_oldindices, rh->rh_oldimask + 1);
+    rh->rh_oldindices = NULL;
+    if (rh->rh_next == NULL) {
+        PyMem_FREE(rh);
+        mp->od_rehash = NULL;
+    }
+}
+
+/* release all of the od_rehash of mp, if there is one */
+static void
+od_rehash_free(PyOrderedDictObject *mp)
+{
+    od_rehash *rh = mp->od_rehash;
+
+    if (rh == NULL)
+        return;
+    if (rh->rh_next != NULL)
+        od_table_free(rh->rh_next, rh->rh_nextimask + 1);
+    rh->rh_next = NULL;
+    if (rh->rh_oldindices != NULL)
+        od_rehash_drop(mp);
+    else {
+        PyMem_FREE(rh);
+        mp->od_rehash = NULL;
+    }
+}
+
+/* move the entry referred to by slot i of the old indices over */
+static void
+od_rehash_slot(PyOrderedDictObject *mp, size_t i)
+{
+    od_rehash *rh = mp->od_rehash;
+    Py_ssize_t size = rh->rh_oldimask + 1;
+    Py_ssize_t ix = od_ix_get(rh->rh_oldindices, size, i);
+
+    if (ix < 0)
+        return;
+    /* it can't have been deleted, that would have looked it up first */
+    assert(mp->ma_table[ix].me_value != NULL);
+    od_set_index(mp, find_empty_slot(mp, (long)mp->ma_table[ix].me_hash), ix);
+    mp->od_fill++;
+    od_ix_set(rh->rh_oldindices, size, i, OD_IX_DUMMY);
+}
+
+/* move n more slots of the old indices over (all for PY_SSIZE_T_MAX) */
+static void
+od_rehash_step(PyOrderedDictObject *mp, Py_ssize_t n)
+{
+    od_rehash *rh = mp->od_rehash;
+    Py_ssize_t size = rh->rh_oldimask + 1;
+
+    for (; n > 0 && rh->rh_pos < size; n--)
+        od_rehash_slot(mp, (size_t)rh->rh_pos++);
+    if (rh->rh_pos == size)
+        od_rehash_drop(mp);
+}
+
+/* move the entries with hash over, before looking up a key with it; as
+   lookups are done by readers too this counts as a write of its own */
+static void
+od_rehash_chain(PyOrderedDictObject *mp, long hash)
+{
+    register size_t i;
+    register size_t perturb;
+    size_t mask = (size_t)mp->od_rehash->rh_oldimask;
+    Py_ssize_t ix;
+    OD_WRITE_BEGIN(mp);
+
+    i = (size_t)hash & mask;
+    for (perturb = hash;
+            (ix = od_ix_get(mp->od_rehash->rh_oldindices, mask + 1, i & mask))
+                != OD_IX_EMPTY;
+            perturb >>= PERTURB_SHIFT) {
+        if (ix >= 0 && (long)mp->ma_table[ix].me_hash == hash)
+            od_rehash_slot(mp, i & mask);
+        i = (i << 2) + i + perturb + 1;
+    }
+    OD_WRITE_END(mp);
+}
+
+/*
+ * ma_lookup is what the Python 2 dict.c calls (e.g. from PyDict_GetItem()) when it is
+ * handed an ordereddict. It has to return a PyDictEntry compatible pointer,
+ * for a missing key that is the always NULL entry after the last of
+ * ma_table.
+ */
+static PyOrderedDictEntry *
+lookdict_compat(PyOrderedDictObject *mp, PyObject *key, long hash)
+{
+    Py_ssize_t hashpos, ix;
+
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0)
+        return &mp->ma_table[mp->ma_mask + 1];
+    return &mp->ma_table[ix];
+}
+
 static int
 dump_ordereddict_head(register PyOrderedDictObject *mp)
 {
@@ -368,8 +1807,9 @@ dump_ordereddict_head(register PyOrderedDictObject *mp)
         printf("ordereddict");
     printf(": fill " SPR ", ", mp->od_fill);
     printf("used " SPR ", ", mp->ma_used);
+    printf("nentries " SPR ", ", mp->od_nentries);
     printf("mask " SPR ", ", mp->ma_mask);
-    printf("mask " SPR ", ", mp->ma_mask);
+    printf("imask " SPR ", ", mp->od_imask);
     printf("\nbits: ");
     if (KVIO(mp))
         printf("kvio ");
@@ -377,6 +1817,8 @@ dump_ordereddict_head(register PyOrderedDictObject *mp)
         printf("relax ");
     if (REVERSE(mp))
         printf("reverse ");
+    if (LRU(mp))
+        printf("lru ");
     printf("\n");
     return 0;
 }
@@ -389,3125 +1831,7574 @@ dump_sorteddict_fun(register PySortedDictObject *mp)
 
 
 static void
-dump_otablep(register PyOrderedDictObject *mp)
+dump_table(register PyOrderedDictObject *mp)
 {
     Py_ssize_t index;
-    PyOrderedDictEntry **p;
+    PyOrderedDictEntry *ep;
     printf("mp %p\n", mp);
-    for (index = 0, p = mp->od_otablep; index < mp->ma_used; index++, p++) {
-        printf("index " SPR " %p %p\n", index, p, *p);
+    for (index = 0; index <= mp->od_imask; index++) {
+        printf("slot " SPR " " SPR "\n", index, od_get_index(mp, index));
+    }
+    for (index = 0, ep = mp->ma_table; index < mp->od_nentries; index++, ep++) {
+        printf("index " SPR " %p %p\n", index, ep->me_key, ep->me_value);
     }
 }
 
 /*
-Internal routine to insert a new item into the table.
-Used both by the internal resize routine and by the public insert routine.
-Eats a reference to key and one to value.
-Returns -1 if an error occurred, or 0 on success.
+Rebuild od_indices from the Active entries in ma_table, this also gets rid
+of all Dummy slots.
 */
-static int
-insertdict(register PyOrderedDictObject *mp, PyObject *key, long hash,
-           PyObject *value, Py_ssize_t index)
+static void
+build_indices(register PyOrderedDictObject *mp)
 {
-    PyObject *old_value;
-    Py_ssize_t oindex;
-    register PyOrderedDictEntry *ep, **epp = NULL;
-    typedef PyOrderedDictEntry *(*lookupfunc)(PyOrderedDictObject *, PyObject *, long);
+    register Py_ssize_t ix;
+    register PyOrderedDictEntry *ep;
+    Py_ssize_t size = mp->od_imask + 1;
 
-    assert(mp->ma_lookup != NULL);
-    ep = mp->ma_lookup(mp, key, hash);
-    if (ep == NULL) {
-        Py_DECREF(key);
-        Py_DECREF(value);
-        return -1;
-    }
-    if (ep->me_value != NULL) { /* updating a value */
-        old_value = ep->me_value;
-        ep->me_value = value;
-        if (index != -1) {
-            if (index == -2) /* kvio */
-                index = mp->ma_used-1;
-            for (oindex = 0, epp = mp->od_otablep; oindex < mp->ma_used;
-                    oindex++, epp++)
-                if (*epp == ep)
-                    break;
-            /* epp now points to item and oindex is its index (optimize?) */
-            /* if index == oindex we don't have to anything */
-            if (index < oindex) {
-                epp = mp->od_otablep;
-                epp += index;
-                memmove(epp + 1, epp, (oindex - index) * sizeof(PyOrderedDictEntry *));
-                *epp = ep;
-            } else if ((index == oindex + 1) && (index == mp->ma_used)) {
-				/* nothing to do for inserting beyond last with same key */
-            } else if (index > oindex) {
-                /*
-                printf("moving %d %d %p\n", index, oindex, epp);
-                dump_otablep(mp); */
-                memmove(epp, epp + 1, (index - oindex) * sizeof(PyOrderedDictEntry *));
-                mp->od_otablep[index] = ep;
-                /*
-                dump_otablep(mp);
-                */
-            }
-        }
-        Py_DECREF(old_value); /* which **CAN** re-enter */
-        Py_DECREF(key);
-    } else { /* new value */
-        if (ep->me_key == NULL)
-            mp->od_fill++;
-        else {
-            assert(ep->me_key == dummy);
-            Py_DECREF(dummy);
-        }
-        ep->me_key = key;
-        ep->me_hash = (Py_ssize_t)hash;
-        ep->me_value = value;
-        if (index < 0)
-            mp->od_otablep[mp->ma_used] = ep;
-        else {
-            epp = mp->od_otablep;
-            epp += index;
-            /* make space */
-            memmove(epp + 1, epp, (mp->ma_used - index) * sizeof(PyOrderedDictEntry *));
-            *epp = ep;
-        }
-        mp->ma_used++;
+    assert(!OD_KEYS_SHARED(mp));
+    if (OD_REHASHING(mp))
+        od_rehash_drop(mp);
+    memset(mp->od_indices, 0xff, size * OD_IXSIZE(size)); /* OD_IX_EMPTY */
+    mp->od_fill = 0;
+    mp->od_first = 0;
+    for (ix = 0, ep = mp->ma_table; ix < mp->od_nentries; ix++, ep++) {
+        if (ep->me_value == NULL)
+            continue;
+        od_set_index(mp, find_empty_slot(mp, (long)ep->me_hash), ix);
+        mp->od_fill++;
     }
-    return 0;
 }
 
-static int
-insertsorteddict(register PyOrderedDictObject *mp, PyObject *key, long hash,
-                 PyObject *value)
+/*
+The order of a large sorteddict is kept in an sd_order, instead of in
+ma_table, so that adding a key in the middle doesn't have to move half of
+the entries and renumber od_indices.
+It is a two level B+tree: a vector of blocks, each holding the indices into
+ma_table of up to SD_BLOCK_MAX consecutive items, with a binary indexed
+(Fenwick) tree over the block lengths to find an item from its position, and
+the position of a block, in O(log n).  Which block holds entry ix is kept in
+ot_where[ix], so deletion doesn't need any comparisons.
+
+While there is an sd_order, the entries in ma_table are in the order in which
+they were added.  OD_COMPACT() (and dictresize()) put them back in sorted
+order, in place, and drop the sd_order; that way everything that works on
+the whole order of an ordereddict (iteration, keys(), slicing, etc.) works
+unchanged.  Only the single item operations (adding and deleting a key,
+popitem(i), index()) use the sd_order directly.  Small sorteddicts and ones
+that only get keys added at the end never get one.
+*/
+
+#define SD_BLOCK_LOAD 256	/* # of items per block when building */
+#define SD_BLOCK_MAX (2 * SD_BLOCK_LOAD)	/* a full block is split in two */
+#define SD_ORDER_MIN 512	/* smaller sorteddicts just move their entries */
+
+typedef struct {
+    Py_ssize_t b_len;
+    Py_ssize_t b_index;	/* position of the block in ot_blocks */
+    Py_ssize_t b_ix[SD_BLOCK_MAX];
+} sd_block;
+
+typedef union {
+    sd_block *w_block;	/* the block that holds the entry */
+    Py_ssize_t w_pos;	/* used while putting ma_table in order */
+} sd_where;
+
+typedef struct _sd_order {
+    Py_ssize_t ot_nblocks;
+    Py_ssize_t ot_allocated;	/* room in ot_blocks and ot_fenwick */
+    sd_block **ot_blocks;
+    Py_ssize_t *ot_fenwick;
+    sd_where *ot_where;	/* one for every entry ma_table has room for */
+} sd_order;
+
+#define SD_ORDER(mp) (PySortedDict_Check(mp) ? \
+		      ((PySortedDictObject *)(mp))->sd_order : NULL)
+#define SD_TKEYS(mp) (PySortedDict_Check(mp) ? \
+		      ((PySortedDictObject *)(mp))->sd_tkeys : NULL)
+/* sorteddict a sorts its keys the same way as sorteddict b */
+#define SD_SAME_ORDER(a, b) (PySortedDict_Check(a) &&			\
+	((PySortedDictObject *)(a))->sd_key == ((PySortedDictObject *)(b))->sd_key && \
+	((PySortedDictObject *)(a))->sd_cmp == ((PySortedDictObject *)(b))->sd_cmp && \
+	REVERSE(a) == REVERSE(b))
+
+/* renumber the blocks and rebuild the Fenwick tree in O(#blocks) */
+static void
+sd_fenwick_build(sd_order *ot)
 {
-    PyObject *old_value;
-    Py_ssize_t index = 0, lower, upper;
-    int res;
-    register PySortedDictObject *sd = (PySortedDictObject *) mp;
-    register PyOrderedDictEntry *ep, **epp = NULL;
-    typedef PyOrderedDictEntry *(*lookupfunc)(PyOrderedDictObject *, PyObject *, long);
+    Py_ssize_t i, j, n = ot->ot_nblocks;
 
-    /* printf("insert sorted dict\n"); */
-    assert(mp->ma_lookup != NULL);
-    ep = mp->ma_lookup(mp, key, hash);
-    if (ep == NULL) {
-        Py_DECREF(key);
-        Py_DECREF(value);
-        return -1;
+    for (i = 0; i < n; i++) {
+        ot->ot_blocks[i]->b_index = i;
+        ot->ot_fenwick[i] = ot->ot_blocks[i]->b_len;
     }
-    if (ep->me_value != NULL) { /* updating a value */
-        old_value = ep->me_value;
-        ep->me_value = value;
-        Py_DECREF(old_value); /* which **CAN** re-enter */
-        Py_DECREF(key);
-        if (sd->sd_value != Py_None || sd->sd_cmp != Py_None) {
-            PyErr_SetString(PyExc_NotImplementedError,
-                            "updating a value for a cmp/value sorted dict not implemented"
-                           );
-            return -1;
-        }
-    } else { /* new value */
-        if (ep->me_key == NULL)
-            mp->od_fill++;
-        else {
-            assert(ep->me_key == dummy);
-            Py_DECREF(dummy);
-        }
-        ep->me_key = key;
-        ep->me_hash = (Py_ssize_t)hash;
-        ep->me_value = value;
-        /* determine epp */
-        epp = mp->od_otablep;
-        lower = 0;
-        upper = mp->ma_used;
-        if (sd->sd_key != Py_None && sd->sd_key != Py_True) {
-            PyObject *transkey;
-            PyObject *chkkey;
-            transkey = PyObject_CallFunctionObjArgs(sd->sd_key, key, NULL);
-            if (transkey == NULL)
-                transkey = key;
-            while (lower < upper) {
-                index = (lower+upper) / 2;
-                chkkey = PyObject_CallFunctionObjArgs(sd->sd_key,(epp[index])->me_key, NULL);
-                if (chkkey == NULL)
-                    chkkey = (epp[index])->me_key;
-                res = PyObject_RichCompareBool(chkkey, transkey, Py_GT);
-                if (res == 0)
-                    lower = index + 1;
-                else if (res == 1)
-                    upper = index;
-                else
-                    return -1; /* res was -1 -> error */
-            }
-        } else {
-            while (lower < upper) {
-                index = (lower+upper) / 2;
-                res = PyObject_RichCompareBool((epp[index])->me_key, key, Py_GT);
-                if (res == 0)
-                    lower = index + 1;
-                else if (res == 1)
-                    upper = index;
-                else
-                    return -1; /* res was -1 -> error */
-            }
+    for (i = 1; i <= n; i++) {
+        j = i + (i & -i);
+        if (j <= n)
+            ot->ot_fenwick[j - 1] += ot->ot_fenwick[i - 1];
+    }
+}
+
+static void
+sd_fenwick_add(sd_order *ot, Py_ssize_t i, Py_ssize_t delta)
+{
+    for (i++; i <= ot->ot_nblocks; i += i & -i)
+        ot->ot_fenwick[i - 1] += delta;
+}
+
+/* # of items in the blocks before block i */
+static Py_ssize_t
+sd_fenwick_prefix(sd_order *ot, Py_ssize_t i)
+{
+    Py_ssize_t sum = 0;
+
+    for (; i > 0; i -= i & -i)
+        sum += ot->ot_fenwick[i - 1];
+    return sum;
+}
+
+/* Return the block with the item at position pos (0 <= pos <= ma_used, using
+   the last block for pos == ma_used) and set *offset to its position in there. */
+static sd_block *
+sd_order_find(sd_order *ot, Py_ssize_t pos, Py_ssize_t *offset)
+{
+    Py_ssize_t i = 0, step;
+    sd_block *b;
+
+    for (step = 1; step * 2 <= ot->ot_nblocks; step <<= 1)
+        ;
+    for (; step > 0; step >>= 1) {
+        if (i + step <= ot->ot_nblocks && ot->ot_fenwick[i + step - 1] <= pos) {
+            i += step;
+            pos -= ot->ot_fenwick[i - 1];
         }
-        epp += lower;
-        /* make space */
-        memmove(epp + 1, epp, (mp->ma_used - lower) * sizeof(PyOrderedDictEntry *));
-        *epp = ep;
-        mp->ma_used++;
     }
-    return 0;
+    if (i == ot->ot_nblocks) {
+        /* at the end */
+        b = ot->ot_blocks[i - 1];
+        *offset = b->b_len;
+        return b;
+    }
+    *offset = pos;
+    return ot->ot_blocks[i];
 }
 
+/* the index in ma_table of the item at position pos */
+static Py_ssize_t
+sd_order_at(sd_order *ot, Py_ssize_t pos)
+{
+    Py_ssize_t offset;
+    sd_block *b = sd_order_find(ot, pos, &offset);
+
+    assert(offset < b->b_len);
+    return b->b_ix[offset];
+}
+
+/* the position of the item with index ix in ma_table */
+static Py_ssize_t
+sd_order_position(sd_order *ot, Py_ssize_t ix)
+{
+    sd_block *b = ot->ot_where[ix].w_block;
+    Py_ssize_t offset = 0;
+
+    while (b->b_ix[offset] != ix)
+        offset++;
+    return sd_fenwick_prefix(ot, b->b_index) + offset;
+}
 
-/*
-Internal routine used by dictresize() to insert an item which is
-known to be absent from the dict.  This routine also assumes that
-the dict contains no deleted entries.  Besides the performance benefit,
-using insertdict() in dictresize() is dangerous (SF bug #1456209).
-Note that no refcounts are changed by this routine; if needed, the caller
-is responsible for incref'ing `key` and `value`.
-*/
 static void
-insertdict_clean(register PyOrderedDictObject *mp, PyObject *key, long hash,
-                 PyObject *value)
+sd_order_free(sd_order *ot)
 {
-    register size_t i;
-    register size_t perturb;
-    register size_t mask = (size_t)mp->ma_mask;
-    PyOrderedDictEntry *ep0 = mp->ma_table;
-    register PyOrderedDictEntry *ep;
+    Py_ssize_t i;
 
-    i = hash & mask;
-    ep = &ep0[i];
-    for (perturb = hash; ep->me_key != NULL; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
-        ep = &ep0[i & mask];
-    }
-    assert(ep->me_value == NULL);
-    mp->od_fill++;
-    ep->me_key = key;
-    ep->me_hash = (Py_ssize_t)hash;
-    ep->me_value = value;
-    mp->od_otablep[mp->ma_used] = ep;
-    mp->ma_used++;
+    for (i = 0; i < ot->ot_nblocks; i++)
+        PyMem_FREE(ot->ot_blocks[i]);
+    PyMem_FREE(ot->ot_blocks);
+    PyMem_FREE(ot->ot_fenwick);
+    PyMem_FREE(ot->ot_where);
+    PyMem_FREE(ot);
 }
 
 /*
-Restructure the table by allocating a new table and reinserting all
-items again.  When entries have been deleted, the new table may
-actually be smaller than the old one.
+Build an sd_order for mp, whose entries have to be in order, without
+deleted ones.  Returns NULL (without setting an exception) if there is not
+enough memory.
 */
-static int
-dictresize(PyOrderedDictObject *mp, Py_ssize_t minused)
+static sd_order *
+sd_order_new(PyOrderedDictObject *mp)
 {
-    Py_ssize_t newsize;
-    PyOrderedDictEntry *oldtable, *newtable, *ep, **epp;
-    PyOrderedDictEntry **oldotablep, **newotablep;
-    register Py_ssize_t i, j;
-    int is_oldtable_malloced;
-    int reusing_smalltable;
-    PyOrderedDictEntry small_copy[PyOrderedDict_MINSIZE];
-    PyOrderedDictEntry *small_ocopyp[PyOrderedDict_MINSIZE];
-
-    assert(minused >= 0);
-
-    /* Find the smallest table size > minused. */
-    for (newsize = PyOrderedDict_MINSIZE;
-            newsize <= minused && newsize > 0;
-            newsize <<= 1)
-        ;
-    if (newsize <= 0) {
-        PyErr_NoMemory();
-        return -1;
+    sd_order *ot;
+    sd_block *b;
+    Py_ssize_t i, j, n = mp->ma_used, nblocks;
+
+    assert(mp->od_nentries == n);
+    nblocks = n / SD_BLOCK_LOAD + 1;
+    ot = PyMem_NEW(sd_order, 1);
+    if (ot == NULL)
+        return NULL;
+    ot->ot_nblocks = 0;
+    ot->ot_allocated = nblocks * 2;
+    ot->ot_blocks = PyMem_NEW(sd_block *, ot->ot_allocated);
+    ot->ot_fenwick = PyMem_NEW(Py_ssize_t, ot->ot_allocated);
+    ot->ot_where = PyMem_NEW(sd_where, mp->ma_mask + 1);
+    if (ot->ot_blocks == NULL || ot->ot_fenwick == NULL || ot->ot_where == NULL)
+        goto Fail;
+    for (i = 0; i < nblocks; i++) {
+        b = PyMem_NEW(sd_block, 1);
+        if (b == NULL)
+            goto Fail;
+        ot->ot_blocks[ot->ot_nblocks++] = b;
+        b->b_len = 0;
+        for (j = i * SD_BLOCK_LOAD; j < n && b->b_len < SD_BLOCK_LOAD; j++) {
+            b->b_ix[b->b_len++] = j;
+            ot->ot_where[j].w_block = b;
+        }
     }
+    sd_fenwick_build(ot);
+    return ot;
 
-    /* Get space for a new table. */
-    oldtable = mp->ma_table;
-    oldotablep = mp->od_otablep;
-    assert(oldtable != NULL);
-    assert(oldotablep != NULL);
-    is_oldtable_malloced = oldtable != mp->ma_smalltable;
-
-    reusing_smalltable = 0;
+Fail:
+    sd_order_free(ot);
+    return NULL;
+}
 
-    if (newsize == PyOrderedDict_MINSIZE) {
-        /* A large table is shrinking, or we can't get any smaller. */
-        newtable = mp->ma_smalltable;
-        newotablep = mp->ma_smallotablep;
-        if (newtable == oldtable) {
-            if (mp->od_fill == mp->ma_used) {
-                /* No dummies, so no point doing anything. */
-                return 0;
+/*
+Put ix, the index of a new entry, at offset in block b.  Returns -1 (with
+an exception set, and nothing changed) if a block has to be split and there
+is not enough memory to do so.
+*/
+static int
+sd_order_insert(sd_order *ot, sd_block *b, Py_ssize_t offset, Py_ssize_t ix)
+{
+    sd_block *nb, **blocks;
+    Py_ssize_t i, split = 0, *fenwick;
+
+    if (b->b_len == SD_BLOCK_MAX) {
+        /* split the block in two */
+        if (ot->ot_nblocks == ot->ot_allocated) {
+            i = ot->ot_allocated * 2;
+            fenwick = (Py_ssize_t *) PyMem_REALLOC(ot->ot_fenwick,
+                                                   i * sizeof(Py_ssize_t));
+            if (fenwick == NULL) {
+                PyErr_NoMemory();
+                return -1;
             }
-            /* We're not going to resize it, but rebuild the
-               table anyway to purge old dummy entries.
-               Subtle:  This is *necessary* if fill==size,
-               as lookdict needs at least one virgin slot to
-               terminate failing searches.  If fill < size, it's
-               merely desirable, as dummies slow searches. */
-            assert(mp->od_fill > mp->ma_used);
-            memcpy(small_copy, oldtable, sizeof(small_copy));
-            /* Small_ocopyp must point into small_copy */
-            for (i = 0; i < PyOrderedDict_MINSIZE; i++) {
-                small_ocopyp[i] = oldotablep[i] ? &small_copy[oldotablep[i]-&oldtable[0]]: NULL;
+            ot->ot_fenwick = fenwick;
+            blocks = (sd_block **) PyMem_REALLOC(ot->ot_blocks,
+                                                 i * sizeof(sd_block *));
+            if (blocks == NULL) {
+                PyErr_NoMemory();
+                return -1;
             }
-            oldtable = small_copy;
-            reusing_smalltable = 1;
-        }
-    } else {
-        newtable = PyMem_NEW(PyOrderedDictEntry, newsize);
-        if (newtable == NULL) {
-            PyErr_NoMemory();
-            return -1;
+            ot->ot_blocks = blocks;
+            ot->ot_allocated = i;
         }
-        newotablep = PyMem_NEW(PyOrderedDictEntry*, newsize);
-        if (newotablep == NULL) {
+        nb = PyMem_NEW(sd_block, 1);
+        if (nb == NULL) {
             PyErr_NoMemory();
             return -1;
         }
-    }
-
-    /* Make the dict empty, using the new table. */
-    assert(newtable != oldtable);
-    assert(newotablep != oldotablep);
-    mp->ma_table = newtable;
-    mp->od_otablep = newotablep;
-    mp->ma_mask = newsize - 1;
-    memset(newtable, 0, sizeof(PyOrderedDictEntry) * newsize);
-    memcpy(newotablep, oldotablep, sizeof(PyOrderedDictEntry *) * mp->ma_used);
-    epp = mp->od_otablep;
-    j = mp->ma_used;
-    mp->ma_used = 0;
-    i = mp->od_fill;
-    mp->od_fill = 0;
-
-    /* Copy the data over; this is refcount-neutral for active entries;
-       dummy entries aren't copied over, of course */
-
-    for (epp = reusing_smalltable ? small_ocopyp: mp->od_otablep; j > 0; epp++, j--) {
-        insertdict_clean(mp, (*epp)->me_key, (long)(*epp)->me_hash,
-                         (*epp)->me_value);
-    }
-    for (ep = oldtable; i > 0; ep++) {
-        if (ep->me_value != NULL) {	/* active entry */
-            --i;
-        } else if (ep->me_key != NULL) {	/* dummy entry */
-            --i;
-            assert(ep->me_key == dummy);
-            Py_DECREF(ep->me_key);
+        nb->b_len = SD_BLOCK_MAX - SD_BLOCK_LOAD;
+        memcpy(nb->b_ix, b->b_ix + SD_BLOCK_LOAD, nb->b_len * sizeof(Py_ssize_t));
+        b->b_len = SD_BLOCK_LOAD;
+        for (i = 0; i < nb->b_len; i++)
+            ot->ot_where[nb->b_ix[i]].w_block = nb;
+        memmove(&ot->ot_blocks[b->b_index + 2], &ot->ot_blocks[b->b_index + 1],
+                (ot->ot_nblocks - b->b_index - 1) * sizeof(sd_block *));
+        ot->ot_blocks[b->b_index + 1] = nb;
+        ot->ot_nblocks++;
+        if (offset > SD_BLOCK_LOAD) {
+            offset -= SD_BLOCK_LOAD;
+            b = nb;
         }
-        /* else key == value == NULL:  nothing to do */
-    }
-
-    if (is_oldtable_malloced) {
-        PyMem_DEL(oldtable);
-        PyMem_DEL(oldotablep);
+        split = 1;
     }
+    memmove(b->b_ix + offset + 1, b->b_ix + offset,
+            (b->b_len - offset) * sizeof(Py_ssize_t));
+    b->b_ix[offset] = ix;
+    b->b_len++;
+    ot->ot_where[ix].w_block = b;
+    if (split)
+        sd_fenwick_build(ot);
+    else
+        sd_fenwick_add(ot, b->b_index, 1);
     return 0;
 }
 
-/* Note that, for historical reasons, PyOrderedDict_GetItem() suppresses all errors
- * that may occur (originally dicts supported only string keys, and exceptions
- * weren't possible).  So, while the original intent was that a NULL return
- * meant the key wasn't present, in reality it can mean that, or that an error
- * (suppressed) occurred while computing the key's hash, or that some error
- * (suppressed) occurred when comparing keys in the dict's internal probe
- * sequence.  A nasty example of the latter is when a Python-coded comparison
- * function hits a stack-depth error, which can cause this to return NULL
- * even if the key is present.
- */
-PyObject *
-PyOrderedDict_GetItem(PyObject *op, PyObject *key)
+/* take the entry with index ix out of the order */
+static void
+sd_order_remove(sd_order *ot, Py_ssize_t ix)
 {
-    long hash;
-    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
-    PyOrderedDictEntry *ep;
-    PyThreadState *tstate;
+    sd_block *b = ot->ot_where[ix].w_block;
+    Py_ssize_t offset = 0;
+
+    while (b->b_ix[offset] != ix)
+        offset++;
+    b->b_len--;
+    memmove(b->b_ix + offset, b->b_ix + offset + 1,
+            (b->b_len - offset) * sizeof(Py_ssize_t));
+    if (b->b_len == 0 && ot->ot_nblocks > 1) {
+        /* drop the block, but always keep one */
+        memmove(&ot->ot_blocks[b->b_index], &ot->ot_blocks[b->b_index + 1],
+                (ot->ot_nblocks - b->b_index - 1) * sizeof(sd_block *));
+        ot->ot_nblocks--;
+        PyMem_FREE(b);
+        sd_fenwick_build(ot);
+    } else
+        sd_fenwick_add(ot, b->b_index, -1);
+}
 
-    if (!PyOrderedDict_Check(op))
-        return NULL;
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1) {
-            PyErr_Clear();
-            return NULL;
+/*
+Move the entries of a sorteddict in ma_table to their position in the
+sd_order, squeezing out the deleted ones, then drop the sd_order.  This is
+done in place, following the cycles of the permutation, so it needs no
+memory and cannot fail.
+*/
+static void
+sd_order_apply(PyOrderedDictObject *mp)
+{
+    PySortedDictObject *sd = (PySortedDictObject *) mp;
+    sd_order *ot = sd->sd_order;
+    sd_where *where = ot->ot_where;
+    PyOrderedDictEntry *ep0 = mp->ma_table, tmp, next;
+    PyObject **tkeys = sd->sd_tkeys, *tk = NULL, *nexttk = NULL;
+    Py_ssize_t i, j, pos = 0, dst, nextdst, moved = 0;
+    sd_block *b;
+
+    for (i = 0; i < ot->ot_nblocks; i++) {
+        b = ot->ot_blocks[i];
+        for (j = 0; j < b->b_len; j++)
+            where[b->b_ix[j]].w_pos = pos++;
+    }
+    assert(pos == mp->ma_used);
+    for (i = 0; i < mp->od_nentries; i++) {
+        if (ep0[i].me_value == NULL || where[i].w_pos == i)
+            continue;	/* deleted, or already at its position */
+        tmp = ep0[i];
+        ep0[i].me_key = NULL;
+        ep0[i].me_value = NULL;
+        if (tkeys != NULL) {
+            tk = tkeys[i];
+            tkeys[i] = NULL;
+        }
+        dst = where[i].w_pos;
+        for (;;) {
+            next = ep0[dst];
+            nextdst = where[dst].w_pos;	/* only meaningful if next is Active */
+            ep0[dst] = tmp;
+            where[dst].w_pos = dst;
+            moved++;
+            if (tkeys != NULL) {
+                nexttk = tkeys[dst];
+                tkeys[dst] = tk;
+            }
+            if (next.me_value == NULL)
+                break;
+            tmp = next;
+            tk = nexttk;
+            dst = nextdst;
         }
     }
+    memset(ep0 + mp->ma_used, 0,
+           (mp->od_nentries - mp->ma_used) * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_movebytes, moved * sizeof(PyOrderedDictEntry));
+    mp->od_nentries = mp->ma_used;
+    sd_order_free(ot);
+    sd->sd_order = NULL;
+    build_indices(mp);
+}
 
-    /* We can arrive here with a NULL tstate during initialization:
-       try running "python -Wi" for an example related to string
-       interning.  Let's just hope that no exception occurs then... */
-    tstate = _PyThreadState_Current;
-    if (tstate != NULL && tstate->curexc_type != NULL) {
-        /* preserve the existing exception */
-        PyObject *err_type, *err_value, *err_tb;
-        PyErr_Fetch(&err_type, &err_value, &err_tb);
-        ep = (mp->ma_lookup)(mp, key, hash);
-        /* ignore errors */
-        PyErr_Restore(err_type, err_value, err_tb);
-        if (ep == NULL)
-            return NULL;
-    } else {
-        ep = (mp->ma_lookup)(mp, key, hash);
-        if (ep == NULL) {
-            PyErr_Clear();
-            return NULL;
+#define OD_HAS_TOMBSTONES(mp) ((mp)->od_nentries != (mp)->ma_used)
+
+/* compact_entries() without an sd_order */
+static void
+compact_table(register PyOrderedDictObject *mp)
+{
+    register PyOrderedDictEntry *src, *dst, *end, *start;
+    PyObject **tkeys = SD_TKEYS(mp);
+
+    dst = mp->ma_table;
+    end = dst + mp->od_nentries;
+    /* skip the part that doesn't move */
+    while (dst < end && dst->me_value != NULL)
+        dst++;
+    start = dst;
+    for (src = dst; src < end; src++)
+        if (src->me_value != NULL) {
+            if (tkeys != NULL) {
+                /* deleted entries have no transformed key */
+                tkeys[dst - mp->ma_table] = tkeys[src - mp->ma_table];
+                tkeys[src - mp->ma_table] = NULL;
+            }
+            *dst++ = *src;
         }
-    }
-    return ep->me_value;
+    memset(dst, 0, (end - dst) * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_movebytes, (dst - start) * sizeof(PyOrderedDictEntry));
+    mp->od_nentries = dst - mp->ma_table;
+    assert(mp->od_nentries == mp->ma_used);
+    build_indices(mp);
 }
 
-/* CAUTION: PyOrderedDict_SetItem() must guarantee that it won't resize the
- * dictionary if it's merely replacing the value for an existing key.
- * This means that it's safe to loop over a dictionary with PyOrderedDict_Next()
- * and occasionally replace a value -- but you can't insert new keys or
- * remove them.
- * This does never hold for kvio
- */
-int
-PyOrderedDict_SetItem(register PyObject *op, PyObject *key, PyObject *value)
+/* squeeze the deleted entries out of ma_table and rebuild od_indices, for
+   a sorteddict with an sd_order this puts the entries in order as well;
+   this is done by readers too, so it counts as a write of its own */
+static void
+compact_entries(register PyOrderedDictObject *mp)
 {
-    register PyOrderedDictObject *mp;
-    register long hash;
-    register Py_ssize_t n_used;
+    OD_WRITE_BEGIN(mp);
 
-    if (!PyOrderedDict_Check(op)) {
-        PyErr_BadInternalCall();
-        return -1;
-    }
-    assert(key);
-    assert(value);
-    mp = (PyOrderedDictObject *)op;
-    if (PyString_CheckExact(key)) {
-        hash = ((PyStringObject *)key)->ob_shash;
-        if (hash == -1)
-            hash = PyObject_Hash(key);
-    } else {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return -1;
-    }
-    assert(mp->od_fill <= mp->ma_mask);  /* at least one empty slot */
-    n_used = mp->ma_used;
-    Py_INCREF(value);
-    Py_INCREF(key);
-    if (PySortedDict_Check(op)) {
-        if (insertsorteddict(mp, key, hash, value) != 0)
-            return -1;
-    } else if (insertdict(mp, key, hash, value, KVIO(mp) ? -2: -1) != 0)
-        return -1;
-    /* If we added a key, we can safely resize.  Otherwise just return!
-     * If fill >= 2/3 size, adjust size.  Normally, this doubles or
-     * quaduples the size, but it's also possible for the dict to shrink
-     * (if od_fill is much larger than ma_used, meaning a lot of dict
-     * keys have been * deleted).
-     *
-     * Quadrupling the size improves average dictionary sparseness
-     * (reducing collisions) at the cost of some memory and iteration
-     * speed (which loops over every possible entry).  It also halves
-     * the number of expensive resize operations in a growing dictionary.
-     *
-     * Very large dictionaries (over 50K items) use doubling instead.
-     * This may help applications with severe memory constraints.
-     */
-    if (!(mp->ma_used > n_used && mp->od_fill*3 >= (mp->ma_mask+1)*2))
-        return 0;
-    return dictresize(mp, (mp->ma_used > 50000 ? 2 : 4) * mp->ma_used);
+    if (SD_ORDER(mp) != NULL)
+        sd_order_apply(mp);
+    else
+        compact_table(mp);
+    OD_WRITE_END(mp);
 }
 
-int
-PyOrderedDict_InsertItem(register PyOrderedDictObject *mp, Py_ssize_t index,
-                         PyObject *key, PyObject *value)
+#define OD_COMPACT(mp) do {						\
+	if (OD_HAS_TOMBSTONES(mp) || SD_ORDER(mp) != NULL)		\
+		compact_entries(mp);					\
+    } while(0)
+
+/* no room in ma_table, or od_indices too full, to add an entry */
+#define OD_FULL(mp) ((mp)->od_nentries > (mp)->ma_mask ||		\
+		     (mp)->od_fill > (mp)->ma_mask)
+
+#define OD_SHIFT_INDICES(type) do {					\
+	type *ip = (type *) mp->od_indices, *iend = ip + mp->od_imask + 1;	\
+	for (; ip < iend; ip++) {					\
+		v = *ip;						\
+		if (v >= lo && v <= hi)					\
+			*ip = (type) (v == from ? to : v + delta);	\
+	}								\
+    } while(0)
+
+/*
+Move the entry at position from in ma_table to position to, shifting the
+entries in between one position, and adjust od_indices accordingly.  No
+deleted entries are allowed in between.  If from is not in od_indices yet
+(as for a new entry at the end) only the others are renumbered.
+*/
+static void
+move_entry(register PyOrderedDictObject *mp, Py_ssize_t from, Py_ssize_t to)
 {
-    register long hash;
-    register Py_ssize_t n_used;
+    PyOrderedDictEntry tmp, *ep0 = mp->ma_table;
+    PyObject **tkeys = SD_TKEYS(mp), *tk;
+    Py_ssize_t lo, hi, delta, v, size = mp->od_imask + 1;
 
-    if (PySortedDict_Check(mp)) {
-        PyErr_SetString(PyExc_TypeError,
-                        "sorteddict does not support insert()");
-        return -1;
-    }
-    if (!PyOrderedDict_Check(mp)) {
-        PyErr_BadInternalCall();
-        return -1;
-    }
-    assert(key);
-    assert(value);
-    if (index < 0)
-        index += mp->ma_used;
-    /* test to see if index is in range */
-    if (index > mp->ma_used)
-        index = mp->ma_used;
-    else if (index < 0)
-        index = 0;
-    if (PyString_CheckExact(key)) {
-        hash = ((PyStringObject *)key)->ob_shash;
-        if (hash == -1)
-            hash = PyObject_Hash(key);
+    assert(!OD_REHASHING(mp) && !OD_KEYS_SHARED(mp));
+    if (from == to)
+        return;
+    OD_STAT(mp, st_movebytes,
+            (from > to ? from - to : to - from) * sizeof(PyOrderedDictEntry));
+    tmp = ep0[from];
+    if (from > to) {
+        memmove(&ep0[to + 1], &ep0[to], (from - to) * sizeof(PyOrderedDictEntry));
+        lo = to;
+        hi = from;
+        delta = 1;
     } else {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return -1;
+        memmove(&ep0[from], &ep0[from + 1], (to - from) * sizeof(PyOrderedDictEntry));
+        lo = from;
+        hi = to;
+        delta = -1;
     }
-    assert(mp->od_fill <= mp->ma_mask);  /* at least one empty slot */
-    n_used = mp->ma_used;
-    Py_INCREF(value);
-    Py_INCREF(key);
-    if (insertdict(mp, key, hash, value, index) != 0)
-        return -1;
-    /* If we added a key, we can safely resize.  Otherwise just return!
-     * If fill >= 2/3 size, adjust size.  Normally, this doubles or
-     * quaduples the size, but it's also possible for the dict to shrink
-     * (if od_fill is much larger than ma_used, meaning a lot of dict
-     * keys have been * deleted).
-     *
-     * Quadrupling the size improves average dictionary sparseness
-     * (reducing collisions) at the cost of some memory and iteration
-     * speed (which loops over every possible entry).  It also halves
-     * the number of expensive resize operations in a growing dictionary.
-     *
-     * Very large dictionaries (over 50K items) use doubling instead.
-     * This may help applications with severe memory constraints.
-     */
-    if (!(mp->ma_used > n_used && mp->od_fill*3 >= (mp->ma_mask+1)*2))
-        return 0;
-    return dictresize(mp, (mp->ma_used > 50000 ? 2 : 4) * mp->ma_used);
+    ep0[to] = tmp;
+    if (tkeys != NULL) {
+        tk = tkeys[from];
+        if (from > to)
+            memmove(&tkeys[to + 1], &tkeys[to], (from - to) * sizeof(PyObject *));
+        else
+            memmove(&tkeys[from], &tkeys[from + 1], (to - from) * sizeof(PyObject *));
+        tkeys[to] = tk;
+    }
+    if (size <= 0xff)
+        OD_SHIFT_INDICES(signed char);
+    else if (size <= 0xffff)
+        OD_SHIFT_INDICES(short);
+#if SIZEOF_SIZE_T > 4
+    else if (size <= 0xffffffffL)
+        OD_SHIFT_INDICES(int);
+#endif
+    else
+        OD_SHIFT_INDICES(Py_ssize_t);
 }
 
-
-static int
-del_inorder(PyOrderedDictObject *op, PyOrderedDictEntry* ep)
+/*
+Turn the Active entry ix, referred to by slot hashpos, into a deleted
+entry; the caller has to take over the references to key and value (its
+transformed key is released here, as the last thing, as that can re-enter).
+Deleted entries at the end are dropped right away, so that popitem() can
+always find the last item at od_nentries - 1 (unless there is an sd_order).
+*/
+static void
+delete_entry(register PyOrderedDictObject *mp, Py_ssize_t ix,
+             Py_ssize_t hashpos)
 {
-    register Py_ssize_t count = op->ma_used;
-    PyOrderedDictEntry **tmp = op->od_otablep;
-    while (count--) {
-        if (*tmp == ep) {
-            memmove(tmp, tmp+1, count * sizeof(PyOrderedDictEntry *));
-            return 1;
-        }
-        tmp++;
+    register PyOrderedDictEntry *ep = &mp->ma_table[ix];
+    sd_order *ot = SD_ORDER(mp);
+    PyObject **tkeys = SD_TKEYS(mp), *tk = NULL;
+
+    assert(od_get_index(mp, hashpos) == ix);
+    if (ot != NULL)
+        sd_order_remove(ot, ix);
+    if (tkeys != NULL) {
+        tk = tkeys[ix];
+        tkeys[ix] = NULL;
     }
-    return 0; /* not found */
+    od_set_index(mp, hashpos, OD_IX_DUMMY);
+    ep->me_key = NULL;
+    ep->me_value = NULL;
+    mp->ma_used--;
+    OD_MOVED(mp);
+    ep = &mp->ma_table[mp->od_nentries];
+    while (mp->od_nentries > 0 && (--ep)->me_value == NULL)
+        mp->od_nentries--;
+    if (ix == mp->od_first)
+        mp->od_first++;
+    if (mp->od_first > mp->od_nentries)
+        mp->od_first = mp->od_nentries;
+    Py_XDECREF(tk);
 }
 
-int
-PyOrderedDict_DelItem(PyObject *op, PyObject *key)
-{
-    register PyOrderedDictObject *mp;
-    register long hash;
-    register PyOrderedDictEntry *ep;
-    PyObject *old_value, *old_key;
+/* advance od_first to the first Active entry, there has to be one */
+#define OD_SKIP_DELETED(mp) do {					\
+	while ((mp)->ma_table[(mp)->od_first].me_value == NULL)		\
+		(mp)->od_first++;					\
+    } while(0)
 
-    if (!PyOrderedDict_Check(op)) {
-        PyErr_BadInternalCall();
-        return -1;
-    }
-    assert(key);
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return -1;
-    }
-    mp = (PyOrderedDictObject *)op;
-    ep = (mp->ma_lookup)(mp, key, hash);
-    /* at this point we have to move all the entries beyond the one found
-    back on space (this could be optimised by deferring)  */
-    del_inorder(mp, ep);
-    if (ep == NULL)
-        return -1;
-    if (ep->me_value == NULL) {
-        set_key_error(key);
-        return -1;
-    }
-    old_key = ep->me_key;
-    assert(ep->me_key);
-    Py_INCREF(dummy);
-    ep->me_key = dummy;
-    old_value = ep->me_value;
-    ep->me_value = NULL;
-    mp->ma_used--;
-    Py_DECREF(old_value);
-    Py_DECREF(old_key);
-    return 0;
-}
+static int dictresize(PyOrderedDictObject *mp, Py_ssize_t minused);
+static int od_grow(PyOrderedDictObject *mp, Py_ssize_t minused);
+static void od_prepare(PyOrderedDictObject *mp, Py_ssize_t n);
 
-void
-PyOrderedDict_Clear(PyObject *op)
-{
-    PyOrderedDictObject *mp;
-    PyOrderedDictEntry *ep, *table, **otablep;
-    int table_is_malloced;
-    Py_ssize_t fill;
-    PyOrderedDictEntry small_copy[PyOrderedDict_MINSIZE];
-#ifdef Py_DEBUG
-    Py_ssize_t i, n;
-#endif
+/* what insertion_resize() makes room for */
+#define OD_GROW_MINUSED(used) (((used) > 50000 ? 2 : 4) * (used))
 
-    if (!PyOrderedDict_Check(op))
-        return;
-    mp = (PyOrderedDictObject *)op;
-#ifdef Py_DEBUG
-    n = mp->ma_mask + 1;
-    i = 0;
-#endif
+/*
+Make room for one more entry.  Normally, this doubles or quaduples the
+size, but it's also possible for the dict to have the same size, or shrink
+(if od_nentries/od_fill is much larger than ma_used, meaning a lot of dict
+keys have been * deleted).
 
-    table = mp->ma_table;
-    otablep = mp->od_otablep;
-    assert(table != NULL);
-    assert(otablep != NULL);
-    table_is_malloced = table != mp->ma_smalltable;
+Quadrupling the size improves average dictionary sparseness (reducing
+collisions) at the cost of some memory.  It also halves the number of
+expensive resize operations in a growing dictionary.
 
-    /* This is delicate.  During the process of clearing the dict,
-     * decrefs can cause the dict to mutate.  To avoid fatal confusion
-     * (voice of experience), we have to make the dict empty before
-     * clearing the slots, and never refer to anything via mp->xxx while
-     * clearing.
-     */
-    fill = mp->od_fill;
-    if (table_is_malloced)
-        EMPTY_TO_MINSIZE(mp);
+Very large dictionaries (over 50K items) use doubling instead.
+This may help applications with severe memory constraints.
 
-    else if (fill > 0) {
-        /* It's a small table with something that needs to be cleared.
-         * Afraid the only safe way is to copy the dict entries into
-         * another small table first.
-         */
-        memcpy(small_copy, table, sizeof(small_copy));
-        table = small_copy;
-        EMPTY_TO_MINSIZE(mp);
-    }
-    /* else it's a small table that's already empty */
+An ordereddict of at least ordereddict_incremental slots is rehashed
+incrementally instead, so that the insert that makes it grow doesn't take
+time in proportion to its size.
+*/
+static int
+insertion_resize(PyOrderedDictObject *mp)
+{
+    Py_ssize_t minused = OD_GROW_MINUSED(mp->ma_used);
 
-    /* Now we can finally clear things.  If C had refcounts, we could
-     * assert that the refcount on table is 1 now, i.e. that this function
-     * has unique access to it, so decref side-effects can't alter it.
-     */
-    for (ep = table; fill > 0; ++ep) {
-#ifdef Py_DEBUG
-        assert(i < n);
-        ++i;
-#endif
-        if (ep->me_key) {
-            --fill;
-            Py_DECREF(ep->me_key);
-            Py_XDECREF(ep->me_value);
-        }
-#ifdef Py_DEBUG
-        else
-            assert(ep->me_value == NULL);
-#endif
-    }
+    if (OD_INCREMENTAL(mp))
+        return od_grow(mp, minused);
+    return dictresize(mp, minused);
+}
 
-    if (table_is_malloced) {
-        PyMem_DEL(table);
-        PyMem_DEL(otablep);
+/*
+Move the Active entry ix, referred to by slot hashpos, to the end of the
+order (kvio, or using an item of an lru ordereddict).  It is appended to
+ma_table and leaves a deleted entry behind, so this is O(1), apart from the
+resize that squeezes those out every so often.  Not for a sorteddict.
+Returns the new index of the entry, or OD_IX_ERROR if out of memory.
+*/
+static Py_ssize_t
+move_to_end(PyOrderedDictObject *mp, Py_ssize_t ix, Py_ssize_t hashpos)
+{
+    PyOrderedDictEntry *ep;
+    PyObject *key;
+    long hash;
+
+    assert(SD_ORDER(mp) == NULL && SD_TKEYS(mp) == NULL);
+    if (ix == mp->od_nentries - 1)
+        return ix;
+    if (OD_FULL(mp)) {
+        /* resizing doesn't run any Python code, so key stays alive */
+        key = mp->ma_table[ix].me_key;
+        hash = (long)mp->ma_table[ix].me_hash;
+        if (insertion_resize(mp) != 0)
+            return OD_IX_ERROR;
+        ix = lookdict_ident(mp, key, hash, &hashpos);
+        if (ix == mp->od_nentries - 1)
+            return ix;
     }
+    ep = &mp->ma_table[mp->od_nentries];
+    *ep = mp->ma_table[ix];
+    mp->ma_table[ix].me_key = NULL;
+    mp->ma_table[ix].me_value = NULL;
+    if (ix == mp->od_first)
+        mp->od_first++;
+    ix = mp->od_nentries++;
+    od_set_index(mp, hashpos, ix);
+    OD_CHANGED(mp);
+    return ix;
 }
 
 /*
- * Iterate over a dict.  Use like so:
- *
- *     Py_ssize_t i;
- *     PyObject *key, *value;
- *     i = 0;   # important!  i should not otherwise be changed by you
- *     while (PyOrderedDict_Next(yourdict, &i, &key, &value)) {
- *              Refer to borrowed references in key and value.
- *     }
- *
- * CAUTION:  In general, it isn't safe to use PyOrderedDict_Next in a loop that
- * mutates the dict.  One exception:  it is safe if the loop merely changes
- * the values associated with the keys (but doesn't insert new keys or
- * delete keys), via PyOrderedDict_SetItem().
- */
-int
-PyOrderedDict_Next(PyObject *op, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue)
+Make sure there is a deleted entry before the first item of ordereddict mp
+(which has one), for an item that is put at position 0.  If there is none
+the entries are moved up by half of the room after them (which is made first
+if their number is small compared to the items), so that putting items at
+the front is O(1) on average, like appending them.  Not for a sorteddict.
+Returns 1 if entries were moved, so the caller has to look up its slot
+again, 0 if there was room already or -1 if out of memory.
+*/
+static int
+od_front_room(PyOrderedDictObject *mp)
 {
-    register Py_ssize_t i;
-    register PyOrderedDictEntry **epp;
+    PyOrderedDictEntry *ep0;
+    Py_ssize_t lo, hi, delta, v, size, from = -1, to = -1;
 
-    if (!PyOrderedDict_Check(op) && !PySortedDict_Check(op))
-        return 0;
-    i = *ppos;
-    if (i < 0)
-        return 0;
-    if (i >= ((PyOrderedDictObject *)op)->ma_used)
+    assert(SD_ORDER(mp) == NULL && SD_TKEYS(mp) == NULL);
+    assert(!OD_KEYS_SHARED(mp) && mp->ma_used > 0);
+    OD_SKIP_DELETED(mp);
+    if (mp->od_first > 0)
         return 0;
-    *ppos = i+1;
-    epp = ((PyOrderedDictObject *)op)->od_otablep;
-    if (pkey)
-        *pkey = epp[i]->me_key;
-    if (pvalue)
-        *pvalue = epp[i]->me_value;
+    /* the positions in the old indices would no longer hold */
+    if (OD_REHASHING(mp))
+        od_rehash_step(mp, PY_SSIZE_T_MAX);
+    if (mp->ma_mask + 1 - mp->od_nentries <= mp->ma_used / 4 &&
+            dictresize(mp, OD_GROW_MINUSED(mp->ma_used)) != 0)
+        return -1;
+    delta = (mp->ma_mask + 2 - mp->od_nentries) / 2;
+    ep0 = mp->ma_table;
+    memmove(&ep0[delta], &ep0[0], mp->od_nentries * sizeof(PyOrderedDictEntry));
+    memset(&ep0[0], 0, delta * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_movebytes, mp->od_nentries * sizeof(PyOrderedDictEntry));
+    /* all of them, as from is no index */
+    lo = 0;
+    hi = mp->od_nentries - 1;
+    size = mp->od_imask + 1;
+    if (size <= 0xff)
+        OD_SHIFT_INDICES(signed char);
+    else if (size <= 0xffff)
+        OD_SHIFT_INDICES(short);
+#if SIZEOF_SIZE_T > 4
+    else if (size <= 0xffffffffL)
+        OD_SHIFT_INDICES(int);
+#endif
+    else
+        OD_SHIFT_INDICES(Py_ssize_t);
+    mp->od_nentries += delta;
+    mp->od_first = delta;
     return 1;
 }
 
-/* Internal version of PyOrderedDict_Next that returns a hash value in addition to the key and value.*/
-int
-_PyOrderedDict_Next(PyObject *op, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue, long *phash)
+/*
+Move the Active entry ix, referred to by slot hashpos, to the front of the
+order (insert() of an existing key at position 0), into the deleted entry
+before the first item, so this is O(1) like move_to_end().  Not for a
+sorteddict.  Returns the new index of the entry, or OD_IX_ERROR if out of
+memory.
+*/
+static Py_ssize_t
+move_to_front(PyOrderedDictObject *mp, Py_ssize_t ix, Py_ssize_t hashpos)
 {
-    register Py_ssize_t i;
-    register Py_ssize_t mask;
-    register PyOrderedDictEntry *ep;
+    PyOrderedDictEntry *ep;
+    PyObject *key;
+    long hash;
+    int res;
 
-    if (!PyOrderedDict_Check(op))
-        return 0;
-    i = *ppos;
-    if (i < 0)
-        return 0;
-    ep = ((PyOrderedDictObject *)op)->ma_table;
-    mask = ((PyOrderedDictObject *)op)->ma_mask;
-    while (i <= mask && ep[i].me_value == NULL)
-        i++;
-    *ppos = i+1;
-    if (i > mask)
-        return 0;
-    *phash = (long)(ep[i].me_hash);
-    if (pkey)
-        *pkey = ep[i].me_key;
-    if (pvalue)
-        *pvalue = ep[i].me_value;
-    return 1;
+    OD_SKIP_DELETED(mp);
+    if (ix == mp->od_first)
+        return ix;
+    /* moving entries doesn't run any Python code, so key stays alive */
+    key = mp->ma_table[ix].me_key;
+    hash = (long)mp->ma_table[ix].me_hash;
+    res = od_front_room(mp);
+    if (res < 0)
+        return OD_IX_ERROR;
+    /* even if nothing moved, rather than trusting the hashpos from before
+       the comparisons of the lookup */
+    ix = lookdict_ident(mp, key, hash, &hashpos);
+    ep = &mp->ma_table[--mp->od_first];
+    *ep = mp->ma_table[ix];
+    mp->ma_table[ix].me_key = NULL;
+    mp->ma_table[ix].me_value = NULL;
+    /* as delete_entry() does */
+    ep = &mp->ma_table[mp->od_nentries];
+    while ((--ep)->me_value == NULL)
+        mp->od_nentries--;
+    ix = mp->od_first;
+    od_set_index(mp, hashpos, ix);
+    OD_MOVED(mp);
+    return ix;
 }
 
-/* Methods */
+/*
+Delete the front item of ordereddict mp (which has one), passing the
+references to its key and value to the caller.  As od_first keeps track of
+where the deleted entries at the front of ma_table end this is O(1).
+*/
+static void
+od_take_front(PyOrderedDictObject *mp, PyObject **key, PyObject **value)
+{
+    PyOrderedDictEntry *ep;
+    Py_ssize_t hashpos;
+
+    OD_SKIP_DELETED(mp);
+    ep = &mp->ma_table[mp->od_first];
+    *key = ep->me_key;
+    *value = ep->me_value;
+    lookdict_ident(mp, *key, (long)ep->me_hash, &hashpos);
+    delete_entry(mp, mp->od_first, hashpos);
+}
 
+/*
+Drop the oldest items of an ordereddict with an od_maxsize until there are
+no more than that.
+*/
 static void
-dict_dealloc(register PyOrderedDictObject *mp)
+od_evict(PyOrderedDictObject *mp)
 {
-    register PyOrderedDictEntry *ep;
-    Py_ssize_t fill = mp->od_fill;
-    PyObject_GC_UnTrack(mp);
-    Py_TRASHCAN_SAFE_BEGIN(mp)
-    for (ep = mp->ma_table; fill > 0; ep++) {
-        if (ep->me_key) {
-            --fill;
-            Py_DECREF(ep->me_key);
-            Py_XDECREF(ep->me_value);
-        }
-    }
-    if (mp->ma_table != mp->ma_smalltable) {
-        PyMem_DEL(mp->ma_table);
-        PyMem_DEL(mp->od_otablep);
+    PyObject *key, *value;
+
+    while (mp->od_maxsize > 0 && mp->ma_used > mp->od_maxsize) {
+        od_take_front(mp, &key, &value);
+        Py_DECREF(key);
+        Py_DECREF(value); /* which **CAN** re-enter */
     }
-    if (num_free_dicts < MAXFREEDICTS && Py_Type(mp) == &PyOrderedDict_Type)
-        free_dicts[num_free_dicts++] = mp;
-    else
-        Py_Type(mp)->tp_free((PyObject *)mp);
-    Py_TRASHCAN_SAFE_END(mp)
 }
 
+/*
+Make room for n entries in all, so that adding keys up to that number
+doesn't resize the table again.  It is never made smaller.
+*/
 static int
-ordereddict_print(register PyOrderedDictObject *mp, register FILE *fp, register int flags)
+od_reserve(PyOrderedDictObject *mp, Py_ssize_t n)
 {
-    register Py_ssize_t i;
-    register Py_ssize_t any;
-    char *typestr = "ordered";
-    int status;
-    PyOrderedDictEntry **epp;
-
-    if (PySortedDict_CheckExact(mp))
-        typestr = "sorted";
-    status = Py_ReprEnter((PyObject*)mp);
-    if (status != 0) {
-        if (status < 0)
-            return status;
-        fprintf(fp, "%sdict([...])", typestr);
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return -1;
+    }
+    if (n <= mp->ma_mask + 1)
         return 0;
+    if (n > PY_SSIZE_T_MAX / 3) {
+        PyErr_NoMemory();
+        return -1;
     }
+    /* a table of more than 3n/2 slots can hold n entries */
+    return dictresize(mp, n + n / 2);
+}
 
-    fprintf(fp, "%sdict([", typestr);
-    any = 0;
-    epp = mp->od_otablep;
-    for (i = 0; i < mp->ma_used; i++) {
-        PyObject *pvalue = (*epp)->me_value;
-        /* Prevent PyObject_Repr from deleting value during
-           key format */
-        Py_INCREF(pvalue);
-        if (any++ > 0)
-            fprintf(fp, ", ");
-        fprintf(fp, "(");
-        if (PyObject_Print((PyObject *)((*epp)->me_key), fp, 0)!=0) {
-            Py_DECREF(pvalue);
-            Py_ReprLeave((PyObject*)mp);
-            return -1;
+/* shrink a table once less than 1/OD_SHRINK_FRACTION of it is in use */
+#define OD_SHRINK_FRACTION 8
+
+/*
+Called after deleting an item.  A table that has become mostly empty is
+rebuilt at (twice) the size needed, which also gets rid of the Dummy slots
+that lookups would otherwise have to walk.  The number of items has to
+drop by a large factor again before the next time, so this is amortized
+O(1).  Failing to get the memory for it is not an error.
+*/
+static void
+od_autoshrink(PyOrderedDictObject *mp)
+{
+    if (!ordereddict_autoshrink || mp->ma_table == mp->ma_smalltable ||
+            mp->ma_used * OD_SHRINK_FRACTION >= mp->ma_mask + 1)
+        return;
+    if (dictresize(mp, mp->ma_used * 2) != 0)
+        PyErr_Clear();
+}
+
+/*
+Internal routine to insert a new item into the table, or to update the
+value of an existing one. index -1 adds a new key at the end, -2 (kvio) in
+addition moves an existing key to the end, and index >= 0 puts the key at
+that position (which is clipped to the last one for an existing key).
+Eats a reference to key and one to value.
+Returns -1 if an error occurred, or 0 on success.
+*/
+static int
+insertdict(register PyOrderedDictObject *mp, PyObject *key, long hash,
+           PyObject *value, Py_ssize_t index)
+{
+    PyObject *old_value, *stored_key;
+    Py_ssize_t ix, hashpos;
+    register PyOrderedDictEntry *ep;
+    PyObject *evicted_key = NULL, *evicted_value = NULL;
+    int front = 0;
+
+    assert(mp->od_lookup != NULL);
+    if (FROZEN(mp)) {
+        od_frozen_error((PyObject *) mp);
+        goto Fail;
+    }
+    if (OD_REHASHING(mp))
+        od_rehash_step(mp, OD_REHASH_STEP);
+    if (mp->od_nentries > mp->ma_mask - (mp->ma_mask + 1) / OD_PREPARE_AHEAD &&
+            OD_INCREMENTAL(mp))
+        od_prepare(mp, OD_PREPARE_STEP);
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        goto Fail;
+    if (ix >= 0) { /* updating a value */
+        stored_key = mp->ma_table[ix].me_key;
+        if (index == -2) { /* kvio, move to the back */
+            ix = move_to_end(mp, ix, hashpos);
+            if (ix == OD_IX_ERROR)
+                goto Fail;
+        } else if (index == 0) {
+            if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0)
+                goto Fail;
+            ix = move_to_front(mp, ix, hashpos);
+            if (ix == OD_IX_ERROR)
+                goto Fail;
+        } else if (index > 0) {
+            if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0)
+                goto Fail;
+            /* which also rebuilds od_indices when that is being rehashed */
+            if (OD_HAS_TOMBSTONES(mp) || OD_REHASHING(mp)) {
+                compact_entries(mp);
+                ix = lookdict_ident(mp, stored_key, hash, &hashpos);
+            }
+            /* inserting beyond the end: move to back */
+            if (index >= mp->ma_used)
+                index = mp->ma_used - 1;
+            move_entry(mp, ix, index);
+            ix = index;
+            OD_MOVED(mp);
         }
-        fprintf(fp, ", ");
-        if (PyObject_Print(pvalue, fp, 0) != 0) {
-            Py_DECREF(pvalue);
-            Py_ReprLeave((PyObject*)mp);
-            return -1;
+        ep = &mp->ma_table[ix];
+        old_value = ep->me_value;
+        OD_SHARE(value);
+        ep->me_value = value;
+        OD_CHANGED(mp);
+        Py_DECREF(old_value); /* which **CAN** re-enter */
+        Py_DECREF(key);
+        return 0;
+    }
+    /* new value */
+    if (OD_FULL(mp)) {
+        if (insertion_resize(mp) != 0)
+            goto Fail;
+        hashpos = find_empty_slot(mp, hash);
+    }
+    if (index == 0 && mp->ma_used > 0) {
+        /* into the deleted entry before the first item */
+        front = od_front_room(mp);
+        if (front < 0)
+            goto Fail;
+        if (mp->od_maxsize > 0 && mp->ma_used >= mp->od_maxsize) {
+            /* the oldest item goes now, dropping the front one afterwards
+               would drop the new one; it is released once that is in */
+            od_take_front(mp, &evicted_key, &evicted_value);
+            front = 1;
         }
-        Py_DECREF(pvalue);
-        fprintf(fp, ")");
-        epp++;
+        /* also when nothing moved: the hashpos of the lookup may have
+           been taken by a key that a comparison added in the meantime */
+        hashpos = find_empty_slot(mp, hash);
+        front = mp->ma_used > 0;
+    } else if (index >= 0 && index < mp->ma_used &&
+            (OD_HAS_TOMBSTONES(mp) || OD_REHASHING(mp))) {
+        compact_entries(mp);
+        hashpos = find_empty_slot(mp, hash);
     }
-    fprintf(fp, "])");
-    Py_ReprLeave((PyObject*)mp);
+    if (od_get_index(mp, hashpos) == OD_IX_EMPTY)
+        mp->od_fill++;
+    ix = front ? --mp->od_first : mp->od_nentries++;
+    ep = &mp->ma_table[ix];
+    OD_SHARE(key);
+    OD_SHARE(value);
+    ep->me_key = key;
+    ep->me_hash = (Py_ssize_t)hash;
+    ep->me_value = value;
+    if (!front && index >= 0 && index < mp->ma_used) {
+        /* make space */
+        move_entry(mp, ix, index);
+        ix = index;
+    }
+    od_set_index(mp, hashpos, ix);
+    mp->ma_used++;
+    OD_MOVED(mp);
+    if (mp->od_maxsize > 0 && mp->ma_used > mp->od_maxsize)
+        od_evict(mp);
+    Py_XDECREF(evicted_key);
+    Py_XDECREF(evicted_value); /* which **CAN** re-enter */
     return 0;
+
+Fail:
+    Py_DECREF(key);
+    Py_DECREF(value);
+    return -1;
 }
 
-static PyObject *
-ordereddict_repr(PyOrderedDictObject *mp)
+/*
+Compare the (transformed) key of entry ix of a sorteddict with transkey,
+that of one that is being added or looked for: 1 if the item compares op
+(Py_GT: sorts after it) to it, 0 if not, -1 on error.
+*/
+static int
+sd_item_cmp(PySortedDictObject *sd, Py_ssize_t ix, PyObject *transkey,
+            int op)
 {
-    Py_ssize_t i;
-    PyObject *s, *temp, *comma = NULL, *rightpar = NULL;
-    PyObject *pieces = NULL, *result = NULL;
-    PyObject *key, *value;
-    char *typestr = "ordered";
-
-    /* if (PySortedDict_CheckExact(mp))*/
-    if (PySortedDict_Check(mp))
-        typestr = "sorted";
-    i = Py_ReprEnter((PyObject *)mp);
-    if (i != 0) {
-        return i > 0 ? PyString_FromFormat("%sdict([...])", typestr) : NULL;
-    }
-
-    if (mp->ma_used == 0) {
-        result = PyString_FromFormat("%sdict([])", typestr);
-        goto Done;
-    }
-
-    pieces = PyList_New(0);
-    if (pieces == NULL)
-        goto Done;
-
-    comma = PyString_FromString(", ");
-    if (comma == NULL)
-        goto Done;
-    rightpar = PyString_FromString(")");
-    if (rightpar == NULL)
-        goto Done;
-
-    /* Do repr() on each key+value pair, and insert ": " between them.
-       Note that repr may mutate the dict. */
-    i = 0;
-    while (PyOrderedDict_Next((PyObject *)mp, &i, &key, &value)) {
-        int status;
-        /* Prevent repr from deleting value during key format. */
-        Py_INCREF(value);
-        s = PyString_FromString("(");
-        PyString_ConcatAndDel(&s, PyObject_Repr(key));
-        PyString_Concat(&s, comma);
-        PyString_ConcatAndDel(&s, PyObject_Repr(value));
-        Py_DECREF(value);
-        PyString_Concat(&s, rightpar);
-        if (s == NULL)
-            goto Done;
-        status = PyList_Append(pieces, s);
-        Py_DECREF(s);  /* append created a new ref */
-        if (status < 0)
-            goto Done;
-    }
-
-    /* Add "[]" decorations to the first and last items. */
-    assert(PyList_GET_SIZE(pieces) > 0);
-    s = PyString_FromFormat("%sdict([", typestr);
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, 0);
-    PyString_ConcatAndDel(&s, temp);
-    PyList_SET_ITEM(pieces, 0, s);
-    if (s == NULL)
-        goto Done;
-
-    s = PyString_FromString("])");
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
-    PyString_ConcatAndDel(&temp, s);
-    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
-    if (temp == NULL)
-        goto Done;
-
-    /* Paste them all together with ", " between. */
-    result = _PyString_Join(comma, pieces);
+    PyObject *chkkey = NULL;
+    int res;
 
-Done:
-    Py_XDECREF(pieces);
-    Py_XDECREF(comma);
-    Py_XDECREF(rightpar);
-    Py_ReprLeave((PyObject *)mp);
-    return result;
+    if (sd->sd_tkeys != NULL)
+        chkkey = sd->sd_tkeys[ix];
+    if (chkkey == NULL)
+        chkkey = sd->od.ma_table[ix].me_key;
+    Py_INCREF(chkkey);	/* the comparison could delete the entry */
+    res = PyObject_RichCompareBool(chkkey, transkey, op);
+    Py_DECREF(chkkey);
+    return res;
 }
 
-static Py_ssize_t
-dict_length(PyOrderedDictObject *mp)
-{
-    return mp->ma_used;
-}
+#define sd_item_gt(sd, ix, transkey) sd_item_cmp(sd, ix, transkey, Py_GT)
 
+/* the key that key sorts by in sd, a new reference: what the key function
+   returns, key itself if there is none or it fails on key */
 static PyObject *
-dict_subscript(PyOrderedDictObject *mp, register PyObject *key)
+sd_transform(PySortedDictObject *sd, PyObject *key)
 {
-    PyObject *v;
-    long hash;
-    PyOrderedDictEntry *ep;
-    if (PySlice_Check(key)) {
-        Py_ssize_t start, stop, step, slicelength;
-        PyObject* result;
+    PyObject *transkey = NULL;
 
-        if (PySlice_GetIndicesEx((PySliceObject*)key, mp->ma_used,
-                                 &start, &stop, &step, &slicelength) < 0) {
-            return NULL;
-        }
-        result = PyOrderedDict_New();
-        if (!result) return NULL;
-        if (slicelength <= 0) return result;
-        if (PyOrderedDict_CopySome(result, (PyObject *) mp, start, step, slicelength, 1) == 0)
-            return result;
-        Py_DECREF(result);
-        return NULL;
+    if (sd->sd_key != Py_None && sd->sd_key != Py_True) {
+        OD_STAT(sd, st_keycalls, 1);
+        transkey = PyObject_CallFunctionObjArgs(sd->sd_key, key, NULL);
+        if (transkey == NULL)
+            PyErr_Clear();
     }
-    assert(mp->ma_table != NULL);
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
+    if (transkey == NULL) {
+        transkey = key;
+        Py_INCREF(transkey);
     }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
-        return NULL;
-    v = ep->me_value;
-    if (v == NULL) {
-        if (!PyOrderedDict_CheckExact(mp) && !PySortedDict_CheckExact(mp)) {
-            /* Look up __missing__ method if we're a subclass. */
-            PyObject *missing;
-            static PyObject *missing_str = NULL;
-            if (missing_str == NULL)
-                missing_str =
-                    PyString_InternFromString("__missing__");
-            missing = _PyType_Lookup(Py_Type(mp), missing_str);
-            if (missing != NULL)
-                return PyObject_CallFunctionObjArgs(missing,
-                                                    (PyObject *)mp, key, NULL);
-        }
-        set_key_error(key);
-        return NULL;
-    } else
-        Py_INCREF(v);
-    return v;
+    return transkey;
 }
 
-/* a[ilow:ihigh] = v if v != NULL.
- * del a[ilow:ihigh] if v == NULL.
- *
- * Special speed gimmick:  when v is NULL and ihigh - ilow <= 8, it's
- * guaranteed the call cannot fail.
- */
+/* did the comparisons of insertsorteddict() change the dict */
+#define SD_CHANGED(mp, sd) (version != (mp)->od_version ||		\
+			    ep0 != (mp)->ma_table ||			\
+			    nentries != (mp)->od_nentries ||		\
+			    used != (mp)->ma_used || ot != (sd)->sd_order || \
+			    tkeys != (sd)->sd_tkeys)
+
+/*
+The position of the first item of sorteddict mp whose key compares op
+(Py_GT or Py_GE) to transkey, so that the ones before it don't, by binary
+search; ma_used if there is none.  With an sd_order *pb and *poffset are set
+to the block and offset in there for that position.  Returns -1 on error,
+-2 if the comparisons changed mp, which the caller should look at again.
+*/
 static Py_ssize_t
-dict_ass_slice(PyOrderedDictObject *self, Py_ssize_t ilow, Py_ssize_t ihigh, PyObject *value)
+sd_search(PyOrderedDictObject *mp, PyObject *transkey, int op,
+          sd_block **pb, Py_ssize_t *poffset)
 {
-    PyObject *recycle_on_stack[8];
-    PyObject **recycle = recycle_on_stack; /* will allocate more if needed */
-    Py_ssize_t result = -1, i;
-    Py_ssize_t num_to_delete = 0, s;
-    PyOrderedDictEntry **epp;
-
-    if (PySortedDict_CheckExact(self)) {
-        PyErr_Format(PyExc_TypeError,
-                     "sorteddict does not support slice %s", value ? "assignment" : "deletion");
-        return -1;
+    PySortedDictObject *sd = (PySortedDictObject *) mp;
+    PyOrderedDictEntry *ep0;
+    PyObject **tkeys;
+    Py_ssize_t index, lower, upper, offset = 0, nentries, used;
+    PY_UINT64_T version;
+    sd_order *ot;
+    sd_block *b = NULL;
+    int res = 0;
+
+    ot = sd->sd_order;
+    if (ot == NULL)
+        OD_COMPACT(mp);
+    ep0 = mp->ma_table;
+    nentries = mp->od_nentries;
+    used = mp->ma_used;
+    version = mp->od_version;
+    tkeys = sd->sd_tkeys;
+    if (ot == NULL) {
+        /* the entries are in order */
+        lower = 0;
+        upper = used;
+        while (lower < upper) {
+            index = (lower+upper) / 2;
+            res = sd_item_cmp(sd, index, transkey, op);
+            if (res == 0)
+                lower = index + 1;
+            else if (res == 1)
+                upper = index;
+            else
+                break; /* res was -1 -> error */
+            if (SD_CHANGED(mp, sd))
+                break;
+        }
+    } else {
+        /* first the block, by its last item, then the position in there */
+        lower = 0;
+        upper = ot->ot_nblocks - 1;
+        while (lower < upper) {
+            index = (lower+upper) / 2;
+            b = ot->ot_blocks[index];
+            res = sd_item_cmp(sd, b->b_ix[b->b_len - 1], transkey, op);
+            if (res == 0)
+                lower = index + 1;
+            else if (res == 1)
+                upper = index;
+            else
+                break;
+            if (SD_CHANGED(mp, sd))
+                break;
+        }
+        if (res >= 0 && !SD_CHANGED(mp, sd)) {
+            b = ot->ot_blocks[lower];
+            offset = 0;
+            upper = b->b_len;
+            while (offset < upper) {
+                index = (offset+upper) / 2;
+                res = sd_item_cmp(sd, b->b_ix[index], transkey, op);
+                if (res == 0)
+                    offset = index + 1;
+                else if (res == 1)
+                    upper = index;
+                else
+                    break;
+                if (SD_CHANGED(mp, sd))
+                    break;
+            }
+            lower = sd_fenwick_prefix(ot, lower) + offset;
+        }
     }
-    if (ilow < 0)
-        ilow = 0;
-    else if (ilow > self->ma_used)
-        ilow = self->ma_used;
+    if (res < 0)
+        return -1;
+    if (SD_CHANGED(mp, sd))
+        return -2;
+    *pb = b;
+    *poffset = offset;
+    return lower;
+}
 
-    if (ihigh < ilow)
-        ihigh = ilow;
-    else if (ihigh > self->ma_used)
-        ihigh = self->ma_used;
+static int
+insertsorteddict(register PyOrderedDictObject *mp, PyObject *key, long hash,
+                 PyObject *value)
+{
+    PyObject *old_value, *transkey, **tkeys;
+    Py_ssize_t lower, ix, hashpos, offset = 0;
+    Py_ssize_t nentries, used;
+    PY_UINT64_T version;
+    register PySortedDictObject *sd = (PySortedDictObject *) mp;
+    register PyOrderedDictEntry *ep, *ep0;
+    sd_order *ot;
+    sd_block *b = NULL;
 
-    if (value != NULL) {
-        if  (PyObject_Length(value) != (ihigh - ilow)) {
-            PyErr_SetString(PyExc_ValueError,
-                            "slice assigment: wrong size"
+    /* printf("insert sorted dict\n"); */
+    assert(mp->od_lookup != NULL);
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        goto Fail;
+    if (ix >= 0) { /* updating a value */
+        ep = &mp->ma_table[ix];
+        old_value = ep->me_value;
+        OD_SHARE(value);
+        ep->me_value = value;
+        OD_CHANGED(mp);
+        Py_DECREF(old_value); /* which **CAN** re-enter */
+        Py_DECREF(key);
+        if (sd->sd_value != Py_None || sd->sd_cmp != Py_None) {
+            PyErr_SetString(PyExc_NotImplementedError,
+                            "updating a value for a cmp/value sorted dict not implemented"
                            );
             return -1;
         }
-        if (!PyOrderedDict_CheckExact(value)) {
-            PyErr_SetString(PyExc_TypeError,
-                            "slice assigment: argument must be ordereddict"
-                           );
-            return -1;
+        return 0;
+    }
+    /* new value, make room first (a resize drops the sd_order) */
+    if (OD_FULL(mp)) {
+        if (insertion_resize(mp) != 0)
+            goto Fail;
+        hashpos = find_empty_slot(mp, hash);
+    }
+    ot = sd->sd_order;
+    if (ot == NULL && OD_HAS_TOMBSTONES(mp)) {
+        compact_entries(mp);
+        hashpos = find_empty_slot(mp, hash);
+    }
+    if (sd->sd_key != Py_None && sd->sd_key != Py_True &&
+        sd->sd_tkeys == NULL) {
+        sd->sd_tkeys = PyMem_NEW(PyObject *, mp->ma_mask + 1);
+        if (sd->sd_tkeys == NULL) {
+            PyErr_NoMemory();
+            goto Fail;
         }
+        memset(sd->sd_tkeys, 0, (mp->ma_mask + 1) * sizeof(PyObject *));
+    }
+    /* determine its position */
+    ep0 = mp->ma_table;
+    nentries = mp->od_nentries;
+    used = mp->ma_used;
+    version = mp->od_version;
+    tkeys = sd->sd_tkeys;
+    /* the key function is only called here, its result is kept in
+       sd_tkeys for the comparisons with later keys */
+    transkey = sd_transform(sd, key);
+    lower = sd_search(mp, transkey, Py_GT, &b, &offset);
+    if (lower < 0 || SD_CHANGED(mp, sd)) {
+        Py_DECREF(transkey);
+        if (lower == -1)
+            goto Fail;
+        /* the comparisons changed the dict, start over */
+        return insertsorteddict(mp, key, hash, value);
+    }
+    if (ot == NULL && lower < used && used >= SD_ORDER_MIN) {
+        /* adding in the middle of a large one, from now on keep the
+           order in an sd_order; if that fails just move the entries */
+        ot = sd->sd_order = sd_order_new(mp);
+        if (ot != NULL)
+            b = sd_order_find(ot, lower, &offset);
+    }
+    if (ot != NULL && sd_order_insert(ot, b, offset, mp->od_nentries) < 0) {
+        Py_DECREF(transkey);
+        goto Fail;
+    }
+    if (od_get_index(mp, hashpos) == OD_IX_EMPTY)
+        mp->od_fill++;
+    ix = mp->od_nentries++;
+    ep = &mp->ma_table[ix];
+    OD_SHARE(key);
+    OD_SHARE(value);
+    ep->me_key = key;
+    ep->me_hash = (Py_ssize_t)hash;
+    ep->me_value = value;
+    if (tkeys != NULL && transkey != key)
+        tkeys[ix] = transkey;	/* before move_entry(), which moves it too */
+    else
+        Py_DECREF(transkey);
+    if (ot == NULL) {
+        /* make space */
+        move_entry(mp, ix, lower);
+        ix = lower;
     }
+    od_set_index(mp, hashpos, ix);
+    mp->ma_used++;
+    OD_MOVED(mp);
+    return 0;
 
-    /* for now lazy implementation: first delete then insert */
-#define DELETION_AND_OVERWRITING_SEPERATE 0
-#if DELETION_AND_OVERWRITING_SEPERATE == 1
-    if (value == NULL) {
-#endif
-        s = (ihigh - ilow) * 2 * sizeof(PyObject *);
-        if (s > sizeof(recycle_on_stack)) {
-            recycle = (PyObject **)PyMem_MALLOC(s);
-            if (recycle == NULL) {
-                PyErr_NoMemory();
-                goto Error;
-            }
+Fail:
+    Py_DECREF(key);
+    Py_DECREF(value);
+    return -1;
+}
 
+/*
+Bulk updates of a sorteddict (construction, update(), fromkeys()) don't
+look for the position of every key: between sd_bulk_begin() and
+sd_bulk_end() new keys are added at the end by sd_append(), and then all
+of them are put in their place by one stable merge sort.  If they arrive
+in sorted order (e.g. when copying another sorteddict) that is just a
+linear check.
+*/
+
+/*
+Add key at the end of a sorteddict in a bulk update, or update the value of
+an existing one, like insertdict() does for an ordereddict.  Eats a
+reference to key and one to value.
+*/
+static int
+sd_append(register PyOrderedDictObject *mp, PyObject *key, long hash,
+          PyObject *value)
+{
+    PySortedDictObject *sd = (PySortedDictObject *) mp;
+    PyObject *transkey;
+    Py_ssize_t ix, used = mp->ma_used;
+    int res = 0;
+
+    if (sd->sd_order != NULL)
+        sd_order_apply(mp);	/* it would not know about the new entry */
+    Py_INCREF(key);	/* to check it is still there after calling sd_key */
+    res = insertdict(mp, key, hash, value, -1);
+    if (res != 0)
+        goto Done;
+    if (mp->ma_used == used || sd->sd_key == Py_None || sd->sd_key == Py_True)
+        goto Done;
+    ix = mp->od_nentries - 1;
+    if (sd->sd_tkeys == NULL) {
+        sd->sd_tkeys = PyMem_NEW(PyObject *, mp->ma_mask + 1);
+        if (sd->sd_tkeys == NULL) {
+            PyErr_NoMemory();
+            res = -1;
+            goto Done;
         }
-        epp = self->od_otablep;
-        epp += ilow;
-        for (i = ilow; i < ihigh; i++, epp++) {
-            /* AvdN: ToDo DECREF key and value */
-            recycle[num_to_delete++] = (*epp)->me_key;
-            Py_INCREF(dummy);
-            (*epp)->me_key = dummy;
-            recycle[num_to_delete++] = (*epp)->me_value;
-            (*epp)->me_value = NULL;
-        }
-        epp = self->od_otablep;
-        memmove(epp+ilow, epp+ihigh, (self->ma_used - ihigh) * sizeof(PyOrderedDictEntry *));
-        self->ma_used -= (ihigh - ilow);
-        result = 0;
-#if DELETION_AND_OVERWRITING_SEPERATE == 1
-    } else {
-        /* assignment first delete slice */
-        /* then delete any items whose keys are in itereable that are already in */
-        PyErr_SetString(PyExc_NotImplementedError,
-                        "ordered dictionary does not support slice assigment"
-                       );
-        result = -1;
-    }
-#endif
-    for (i = num_to_delete - 1; i >= 0; --i)
-        Py_XDECREF(recycle[i]);
-#if DELETION_AND_OVERWRITING_SEPERATE != 1
-    if (value != NULL) { /* now insert */
-        epp = ((PyOrderedDictObject *) value)->od_otablep;
-        for (i = ilow; i < ihigh; i++) {
-            if(PyOrderedDict_InsertItem(self, i, (*epp)->me_key, (*epp)->me_value) != 0)
-                return -1;
-            epp++;
-        }
+        memset(sd->sd_tkeys, 0, (mp->ma_mask + 1) * sizeof(PyObject *));
     }
-#endif
-Error:
-    if (recycle != recycle_on_stack)
-        PyMem_FREE(recycle);
-    return result;
+    OD_STAT(mp, st_keycalls, 1);
+    transkey = PyObject_CallFunctionObjArgs(sd->sd_key, key, NULL);
+    if (transkey == NULL)
+        PyErr_Clear();
+    else if (transkey != key && ix < mp->od_nentries &&
+             mp->ma_table[ix].me_key == key && sd->sd_tkeys != NULL &&
+             sd->sd_tkeys[ix] == NULL)
+        sd->sd_tkeys[ix] = transkey;
+    else
+        Py_DECREF(transkey);
+Done:
+    Py_DECREF(key);
+    return res;
 }
 
-static Py_ssize_t
-dict_ass_subscript(PyOrderedDictObject *self, PyObject *item, PyObject *value)
+/* sd_item_gt() for entries a and b, 0 if one of them is not there anymore */
+static int
+sd_entry_gt(PySortedDictObject *sd, Py_ssize_t a, Py_ssize_t b)
 {
-    if (PySlice_Check(item)) {
-        Py_ssize_t start, stop, step, slicelength;
-        if (PySortedDict_CheckExact(self)) {
-            PyErr_Format(PyExc_TypeError,
-                         "sorteddict does not support slice %s", value ? "assignment" : "deletion");
-            return -1;
-        }
-        if (PySlice_GetIndicesEx((PySliceObject*)item, self->ma_used,
-                                 &start, &stop, &step, &slicelength) < 0) {
-            return -1;
-        }
+    PyOrderedDictObject *mp = &sd->od;
+    PyObject *chkkey = NULL;
+    int res;
 
-        /* treat L[slice(a,b)] = v _exactly_ like L[a:b] = v */
-        if (step == 1 && ((PySliceObject*)item)->step == Py_None)
-            return dict_ass_slice(self, start, stop, value);
+    if (a >= mp->od_nentries || b >= mp->od_nentries ||
+        mp->ma_table[a].me_key == NULL || mp->ma_table[b].me_key == NULL)
+        return 0;
+    if (sd->sd_tkeys != NULL)
+        chkkey = sd->sd_tkeys[b];
+    if (chkkey == NULL)
+        chkkey = mp->ma_table[b].me_key;
+    Py_INCREF(chkkey);
+    res = sd_item_gt(sd, a, chkkey);
+    Py_DECREF(chkkey);
+    return res;
+}
 
-        /* do soemthing about step == -1 ? */
+/* stable merge sort of the n entry indices in ixs, tmp has room for n / 2 */
+static int
+sd_mergesort(PySortedDictObject *sd, Py_ssize_t *ixs, Py_ssize_t *tmp,
+             Py_ssize_t n)
+{
+    Py_ssize_t half = n / 2, i = 0, j = half, k = 0;
+    int res;
 
-        if (slicelength <= 0)
-            return 0;
-        if (value == NULL) {
-            /* delete slice */
-            /* printf("Deleting %d %d %d %d %p\n", start, stop, step, slicelength, value);*/
-            while (slicelength--) {
-                /* ToDo optimize */
-                if (step > 0) { /* do it from the back to preserve right indices */
-                    dict_ass_slice(self, start + slicelength *  step,
-                                   start + (slicelength * step) + 1, NULL);
-                } else {
-                    dict_ass_slice(self, start,
-                                   start  + 1, NULL);
-                    start += step;
-                }
-            }
-            return 0;
-        } else {
-            /* assign slice */
-            Py_ssize_t count = slicelength, start2 = start;
-            PyOrderedDictEntry **epp;
-            /* printf("Assigning %d %d %d %d %d %p\n", start, stop, step, slicelength, PyObject_Length(value), value); */
-            if  (PyObject_Length(value) != slicelength) {
-                PyErr_SetString(PyExc_ValueError,
-                                "slice assignment: wrong size"
-                               );
-                return -1;
-            }
-            if (!PyOrderedDict_CheckExact(value)) {
-                PyErr_SetString(PyExc_TypeError,
-                                "slice assignment: argument must be ordereddict"
-                               );
-                return -1;
-            }
-            while (count--) {
-                /* ToDo optimize */
-                if (step > 0) { /* do it from the back to preserve right indices */
-                    dict_ass_slice(self, start2 + count *  step,
-                                   start2 + (count * step) + 1, NULL);
-                } else {
-                    dict_ass_slice(self, start2, start2  + 1, NULL);
-                    start2 += step;
-                }
-            }
-            count = slicelength;
-            start2 = start;
-            epp = ((PyOrderedDictObject *) value)->od_otablep;
-            if (step < 0) {
-                epp += slicelength;
-            }
-            while (count--) {
-                /* ToDo optimize */
-                if (step > 0) { /* do it from the front */
-                    if(PyOrderedDict_InsertItem(self, start2, (*epp)->me_key, (*epp)->me_value) != 0)
-                        return -1;
-                    start2 += step;
-                    epp++;
-                } else {
-                    epp--;
-                    if(PyOrderedDict_InsertItem(self, start2 + count * step, (*epp)->me_key, (*epp)->me_value) != 0)
-                        return -1;
-                }
-            }
-            return 0;
+    if (n < 2)
+        return 0;
+    if (sd_mergesort(sd, ixs, tmp, half) < 0 ||
+        sd_mergesort(sd, ixs + half, tmp, n - half) < 0)
+        return -1;
+    /* the halves may already be in order */
+    res = sd_entry_gt(sd, ixs[half - 1], ixs[half]);
+    if (res <= 0)
+        return res;
+    memcpy(tmp, ixs, half * sizeof(Py_ssize_t));
+    while (i < half && j < n) {
+        res = sd_entry_gt(sd, tmp[i], ixs[j]);
+        if (res < 0)
+            return -1;
+        ixs[k++] = res ? ixs[j++] : tmp[i++];
+    }
+    while (i < half)
+        ixs[k++] = tmp[i++];
+    return 0;
+}
 
-        }
+/*
+Put the entries of a sorteddict in order, the ones before start already
+are.  On error the entries from start on are deleted again.
+*/
+static int
+sd_sort_entries(PyOrderedDictObject *mp, Py_ssize_t start)
+{
+    PySortedDictObject *sd = (PySortedDictObject *) mp;
+    PyOrderedDictEntry *ep0, *sorted;
+    PyObject **tkeys, **sortedtkeys = NULL, *key, *value;
+    PyObject *err_type, *err_value, *err_tb;
+    Py_ssize_t i, nentries, used, hashpos, *ixs = NULL, *tmp = NULL;
+    PY_UINT64_T version;
+    sd_order *ot = NULL;
+    int res = 0;
+
+Restart:
+    OD_COMPACT(mp);
+    ep0 = mp->ma_table;
+    nentries = used = mp->ma_used;
+    version = mp->od_version;
+    tkeys = sd->sd_tkeys;
+    if (start > used)
+        start = used;
+    for (i = start > 0 ? start : 1; i < used; i++) {
+        res = sd_entry_gt(sd, i - 1, i);
+        if (res != 0)
+            break;
+        if (SD_CHANGED(mp, sd))
+            goto Restart;
     }
-    if (value == NULL)
-        return PyOrderedDict_DelItem((PyObject *)self, item);
-    else
-        return PyOrderedDict_SetItem((PyObject *)self, item, value);
+    if (res == 0)
+        return 0;
+    if (res < 0)
+        goto Fail;
+    ixs = PyMem_NEW(Py_ssize_t, used);
+    tmp = PyMem_NEW(Py_ssize_t, used / 2 + 1);
+    if (ixs == NULL || tmp == NULL) {
+        PyErr_NoMemory();
+        goto Fail;
+    }
+    for (i = 0; i < used; i++)
+        ixs[i] = i;
+    res = sd_mergesort(sd, ixs, tmp, used);
+    if (res == 0 && SD_CHANGED(mp, sd)) {
+        /* the comparisons changed the dict, start over */
+        PyMem_FREE(ixs);
+        PyMem_FREE(tmp);
+        ixs = tmp = NULL;
+        start = 0;
+        goto Restart;
+    }
+    if (res < 0)
+        goto Fail;
+    sorted = PyMem_NEW(PyOrderedDictEntry, used);
+    if (tkeys != NULL)
+        sortedtkeys = PyMem_NEW(PyObject *, used);
+    if (sorted == NULL || (tkeys != NULL && sortedtkeys == NULL)) {
+        PyMem_FREE(sorted);
+        PyErr_NoMemory();
+        goto Fail;
+    }
+    for (i = 0; i < used; i++) {
+        sorted[i] = ep0[ixs[i]];
+        if (tkeys != NULL)
+            sortedtkeys[i] = tkeys[ixs[i]];
+    }
+    memcpy(ep0, sorted, used * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_movebytes, used * sizeof(PyOrderedDictEntry));
+    if (tkeys != NULL)
+        memcpy(tkeys, sortedtkeys, used * sizeof(PyObject *));
+    build_indices(mp);
+    OD_MOVED(mp);
+    PyMem_FREE(sorted);
+    PyMem_FREE(sortedtkeys);
+    PyMem_FREE(ixs);
+    PyMem_FREE(tmp);
+    return 0;
+
+Fail:
+    PyMem_FREE(sortedtkeys);
+    PyMem_FREE(ixs);
+    PyMem_FREE(tmp);
+    /* take the last entries out again, the decrefs can re-enter */
+    PyErr_Fetch(&err_type, &err_value, &err_tb);
+    while (mp->od_nentries > start) {
+        i = mp->od_nentries - 1;
+        key = mp->ma_table[i].me_key;
+        value = mp->ma_table[i].me_value;
+        lookdict_ident(mp, key, (long)mp->ma_table[i].me_hash, &hashpos);
+        delete_entry(mp, i, hashpos);
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    PyErr_Restore(err_type, err_value, err_tb);
+    return -1;
 }
 
-static PyMappingMethods dict_as_mapping = {
-    (lenfunc)dict_length, /*mp_length*/
-    (binaryfunc)dict_subscript, /*mp_subscript*/
-    (objobjargproc)dict_ass_subscript, /*mp_ass_subscript*/
-};
+/* Start a bulk update of sorteddict mp, returns where the new keys start,
+   or -1 if it already is in one (then that one sorts when done). */
+static Py_ssize_t
+sd_bulk_begin(PyOrderedDictObject *mp)
+{
+    PySortedDictObject *sd = (PySortedDictObject *) mp;
 
-static PyObject *
-dict_keys(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+    if (sd->sd_bulk)
+        return -1;
+    OD_COMPACT(mp);
+    sd->sd_bulk = 1;
+    return mp->ma_used;
+}
+
+/*
+End a bulk update started with sd_bulk_begin() that returned start, result
+is that of the update itself.  The keys added are sorted in even if that
+failed (keeping the exception); returns -1 if either failed.
+*/
+static int
+sd_bulk_end(PyOrderedDictObject *mp, Py_ssize_t start, int result)
 {
-    register PyObject *v;
-    register Py_ssize_t i;
-    PyOrderedDictEntry **epp;
-    Py_ssize_t n;
+    PyObject *err_type, *err_value, *err_tb;
+
+    if (start < 0)
+        return result;
+    ((PySortedDictObject *) mp)->sd_bulk = 0;
+    if (result >= 0)
+        return sd_sort_entries(mp, start);
+    PyErr_Fetch(&err_type, &err_value, &err_tb);
+    if (sd_sort_entries(mp, start) < 0)
+        PyErr_Clear();
+    PyErr_Restore(err_type, err_value, err_tb);
+    return -1;
+}
 
-    int reverse = 0;
-    static char *kwlist[] = {"reverse", 0};
+/* The smallest table size > minused that can hold all items of mp, -1 (with
+   MemoryError) if there is none. */
+static Py_ssize_t
+od_newsize(PyOrderedDictObject *mp, Py_ssize_t minused)
+{
+    Py_ssize_t newsize;
 
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:keys",
-                                         kwlist, &reverse))
-            return NULL;
+    assert(minused >= 0);
+    for (newsize = PyOrderedDict_MINSIZE;
+            (newsize <= minused || OD_USABLE_FRACTION(newsize) < mp->ma_used)
+            && newsize > 0;
+            newsize <<= 1)
+        ;
+    if (newsize <= 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return newsize;
+}
 
+/* A block for the indices and (at *ptable) the entries of a table of
+   newsize slots, NULL (with MemoryError) if out of memory. */
+static void *
+od_block_new(Py_ssize_t newsize, PyOrderedDictEntry **ptable)
+{
+    Py_ssize_t usable = OD_USABLE_FRACTION(newsize);
+    Py_ssize_t ixsize = OD_IXSIZE(newsize);
+    void *block;
 
-again:
-    n = mp->ma_used;
-    v = PyList_New(n);
-    if (v == NULL)
+    if (newsize > (PY_SSIZE_T_MAX - (usable + 1) *
+                   (Py_ssize_t) sizeof(PyOrderedDictEntry)) / ixsize) {
+        PyErr_NoMemory();
         return NULL;
-    if (n != mp->ma_used) {
-        /* Durnit.  The allocations caused the dict to resize.
-         * Just 	 over, this shouldn't normally happen.
-         */
-        Py_DECREF(v);
-        goto again;
     }
-    if (reverse) {
-        epp = mp->od_otablep + (n-1);
-        reverse = -1;
+    block = od_table_alloc(newsize, OD_BLOCKSIZE(newsize));
+    if (block == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    *ptable = OD_BLOCK_TABLE(block, newsize);
+    return block;
+}
+
+/*
+Restructure the table by allocating a new table and copying all Active
+entries over, in order.  When entries have been deleted, the new table may
+actually be smaller than the old one; if it has the same size the table is
+compacted in place.
+*/
+static int
+dictresize(PyOrderedDictObject *mp, Py_ssize_t minused)
+{
+    Py_ssize_t newsize, usable, oldsize;
+    PyOrderedDictEntry *oldtable, *newtable, *ep, *dst, *end;
+    void *oldindices, *newindices;
+    PyObject **oldtkeys, **newtkeys = NULL;
+    int is_oldtable_malloced, shared;
+
+    if (SD_ORDER(mp) != NULL)
+        /* copying is done in the order of ma_table */
+        sd_order_apply(mp);
+
+    newsize = od_newsize(mp, minused);
+    if (newsize < 0)
+        return -1;
+    shared = OD_KEYS_SHARED(mp);
+    if (shared && newsize == mp->od_imask + 1)
+        return od_unshare(mp);
+    if (newsize == mp->od_imask + 1) {
+        /* We're not going to resize it, but rebuild the
+           table anyway to purge deleted entries and dummy slots.
+           Subtle:  This is *necessary* if fill==size,
+           as lookdict needs at least one virgin slot to
+           terminate failing searches.  If fill < size, it's
+           merely desirable, as dummies slow searches. */
+        OD_STAT(mp, st_resizes, 1);
+        compact_entries(mp);
+        return 0;
+    }
+    usable = OD_USABLE_FRACTION(newsize);
+
+    /* Get space for a new table. */
+    oldtable = mp->ma_table;
+    oldindices = mp->od_indices;
+    oldsize = mp->od_imask + 1;
+    assert(oldtable != NULL);
+    is_oldtable_malloced = oldtable != mp->ma_smalltable;
+
+    if (newsize == PyOrderedDict_MINSIZE) {
+        /* A large table is shrinking. */
+        assert(is_oldtable_malloced);
+        newtable = mp->ma_smalltable;
+        newindices = mp->od_smallindices;
     } else {
-        epp = mp->od_otablep;
-        reverse = 1;
+        newindices = od_block_new(newsize, &newtable);
+        if (newindices == NULL)
+            return -1;
     }
-    for (i = 0; i < n; i++) {
-        PyObject *key = (*epp)->me_key;
-        Py_INCREF(key);
-        PyList_SET_ITEM(v, i, key);
-        epp += reverse;
+    oldtkeys = SD_TKEYS(mp);
+    if (oldtkeys != NULL) {
+        newtkeys = PyMem_NEW(PyObject *, usable);
+        if (newtkeys == NULL) {
+            if (newtable != mp->ma_smalltable)
+                od_table_free(newindices, newsize);
+            PyErr_NoMemory();
+            return -1;
+        }
+        memset(newtkeys, 0, usable * sizeof(PyObject *));
     }
-    return v;
+
+    /* Copy the data over, in order; this is refcount-neutral for active
+       entries, deleted entries aren't copied over, of course */
+    end = oldtable + mp->od_nentries;
+    for (ep = oldtable, dst = newtable; ep < end; ep++)
+        if (ep->me_value != NULL) {
+            if (newtkeys != NULL)
+                newtkeys[dst - newtable] = oldtkeys[ep - oldtable];
+            *dst++ = *ep;
+        }
+    memset(dst, 0, (newtable + usable + 1 - dst) * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_resizes, 1);
+    OD_STAT(mp, st_resizebytes, (dst - newtable) * sizeof(PyOrderedDictEntry));
+    if (newtkeys != NULL) {
+        ((PySortedDictObject *) mp)->sd_tkeys = newtkeys;
+        PyMem_FREE(oldtkeys);
+    }
+
+    mp->ma_table = newtable;
+    mp->od_indices = newindices;
+    mp->ma_mask = usable - 1;
+    mp->od_imask = newsize - 1;
+    mp->od_nentries = dst - newtable;
+    assert(mp->od_nentries == mp->ma_used);
+    /* a table prepared to grow to is for the old size */
+    od_rehash_free(mp);
+    build_indices(mp);
+
+    if (shared) {
+        OD_TABLE_RELEASE(mp, oldtable, 0);
+        OD_KEYS_RELEASE(mp);
+    }
+    else if (is_oldtable_malloced)
+        OD_TABLE_RELEASE(mp, oldindices, oldsize);
+    return 0;
 }
 
-static PyObject *
-dict_values(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+/*
+Give mp, that uses the indices of its sharedkeys, a table of its own of the
+same size, with a copy of those: the entries and slots keep their
+positions, only ma_table moves.
+*/
+static int
+od_unshare(PyOrderedDictObject *mp)
 {
-    register PyObject *v;
-    register Py_ssize_t i;
-    PyOrderedDictEntry **epp;
-    Py_ssize_t n;
+    Py_ssize_t size = mp->od_imask + 1, n = mp->od_nentries;
+    PyOrderedDictEntry *oldtable = mp->ma_table, *newtable;
+    void *newindices;
 
-    int reverse = 0;
-    static char *kwlist[] = {"reverse", 0};
+    newindices = od_block_new(size, &newtable);
+    if (newindices == NULL)
+        return -1;
+    memcpy(newindices, mp->od_indices, size * OD_IXSIZE(size));
+    memcpy(newtable, oldtable, n * sizeof(PyOrderedDictEntry));
+    memset(newtable + n, 0,
+           (OD_USABLE_FRACTION(size) + 1 - n) * sizeof(PyOrderedDictEntry));
+    mp->ma_table = newtable;
+    mp->od_indices = newindices;
+    mp->ma_mask = OD_USABLE_FRACTION(size) - 1;
+    OD_STAT(mp, st_resizes, 1);
+    OD_STAT(mp, st_resizebytes, n * sizeof(PyOrderedDictEntry));
+    OD_TABLE_RELEASE(mp, oldtable, 0);
+    OD_KEYS_RELEASE(mp);
+    return 0;
+}
 
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:values",
-                                         kwlist, &reverse))
-            return NULL;
+/*
+A new ordereddict with the keys of sk, in order, and None for every value.
+Its entries are a copy of those of sk->sk_dict, hashes included, and its
+indices are those of sk->sk_dict, or a copy of them if they are in
+od_smallindices (as sk_dict has at most 5 keys, and so does the dict).
+*/
+static PyObject *
+od_shared_new(sharedkeysobject *sk)
+{
+    PyOrderedDictObject *src = sk->sk_dict, *mp;
+    PyOrderedDictEntry *table;
+    Py_ssize_t i, n = src->ma_used;
 
-again:
-    n = mp->ma_used;
-    v = PyList_New(n);
-    if (v == NULL)
+    mp = (PyOrderedDictObject *) PyOrderedDict_New();
+    if (mp == NULL)
         return NULL;
-    if (n != mp->ma_used) {
-        /* Durnit.  The allocations caused the dict to resize.
-         * Just start over, this shouldn't normally happen.
-         */
-        Py_DECREF(v);
-        goto again;
-    }
-    if (reverse) {
-        epp = mp->od_otablep + (n-1);
-        reverse = -1;
+    if (src->ma_table == src->ma_smalltable) {
+        table = mp->ma_smalltable;
+        memcpy(mp->od_smallindices, src->od_smallindices,
+               sizeof(mp->od_smallindices));
     } else {
-        epp = mp->od_otablep;
-        reverse = 1;
+        table = PyMem_NEW(PyOrderedDictEntry, n + 1);
+        if (table == NULL) {
+            Py_DECREF(mp);
+            return PyErr_NoMemory();
+        }
+        memset(&table[n], 0, sizeof(PyOrderedDictEntry));
+        Py_INCREF(sk);
+        mp->od_keys = sk;
+        mp->od_indices = src->od_indices;
+        mp->od_imask = src->od_imask;
+        mp->ma_mask = n - 1;
     }
+    memcpy(table, src->ma_table, n * sizeof(PyOrderedDictEntry));
     for (i = 0; i < n; i++) {
-        PyObject *value = (*epp)->me_value;
-        Py_INCREF(value);
-        PyList_SET_ITEM(v, i, value);
-        epp += reverse;
+        Py_INCREF(table[i].me_key);
+        Py_INCREF(table[i].me_value);
     }
-    return v;
+    mp->ma_table = table;
+    mp->ma_used = mp->od_fill = mp->od_nentries = n;
+    mp->od_lookup = src->od_lookup;
+    mp->ma_lookup = src->ma_lookup;
+    /* as for ordereddict() */
+    if (ordereddict_kvio)
+        mp->od_state |= OD_KVIO_BIT;
+    if (ordereddict_relaxed)
+        mp->od_state |= OD_RELAXED_BIT;
+    return (PyObject *) mp;
 }
 
-static PyObject *
-dict_items(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+/*
+Initialise n more bytes of the block for the table that ordereddict mp
+grows to once full (PY_SSIZE_T_MAX: all of it); making it if there is none
+yet.  This is optional, not getting the memory is no error.
+*/
+static void
+od_prepare(PyOrderedDictObject *mp, Py_ssize_t n)
 {
-    register PyObject *v;
-    register Py_ssize_t i, n;
-    PyObject *item, *key, *value;
-    PyOrderedDictEntry **epp;
-
-    int reverse = 0;
-    static char *kwlist[] = {"reverse", 0};
+    od_rehash *rh;
+    Py_ssize_t size, ixbytes, nbytes, done, end;
+    PyOrderedDictEntry *table;
+    char *block;
 
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:items",
-                                         kwlist, &reverse))
-            return NULL;
+    rh = od_rehash_get(mp);
+    if (rh == NULL)
+        return;
+    if (rh->rh_next == NULL) {
+        /* as insertion_resize() will, with the entries there is room for */
+        size = od_newsize(mp, OD_GROW_MINUSED(mp->ma_used + mp->ma_mask + 1 -
+                                              mp->od_nentries));
+        if (size > 0)
+            rh->rh_next = od_block_new(size, &table);
+        if (rh->rh_next == NULL) {
+            PyErr_Clear();
+            od_rehash_free(mp);
+            return;
+        }
+        rh->rh_nextimask = size - 1;
+        rh->rh_nextdone = 0;
+    }
+    size = rh->rh_nextimask + 1;
+    ixbytes = size * OD_IXSIZE(size);
+    nbytes = OD_BLOCKSIZE(size);
+    block = rh->rh_next;
+    done = rh->rh_nextdone;
+    end = n >= nbytes - done ? nbytes : done + n;
+    /* the slots OD_IX_EMPTY, the entries NULL */
+    if (done < ixbytes)
+        memset(block + done, 0xff, (end < ixbytes ? end : ixbytes) - done);
+    if (end > ixbytes) {
+        if (done < ixbytes)
+            done = ixbytes;
+        memset(block + done, 0, end - done);
+    }
+    rh->rh_nextdone = end;
+}
 
-    /* Preallocate the list of tuples, to avoid allocations during
-     * the loop over the items, which could trigger GC, which
-     * could resize the dict. :-(
-     */
-again:
-    n = mp->ma_used;
-    v = PyList_New(n);
-    if (v == NULL)
-        return NULL;
-    for (i = 0; i < n; i++) {
-        item = PyTuple_New(2);
-        if (item == NULL) {
-            Py_DECREF(v);
-            return NULL;
-        }
-        PyList_SET_ITEM(v, i, item);
-    }
-    if (n != mp->ma_used) {
-        /* Durnit.  The allocations caused the dict to resize.
-         * Just start over, this shouldn't normally happen.
-         */
-        Py_DECREF(v);
-        goto again;
-    }
-    /* Nothing we do below makes any function calls. */
-    if (reverse) {
-        epp = mp->od_otablep + (n-1);
-        reverse = -1;
+/*
+Grow the table of ordereddict mp like dictresize(), but with the entries
+copied over as they are, to be rehashed incrementally (see od_rehash_step()),
+into the block od_prepare() has got ready if that has the size.  An
+earlier rehash is finished first.
+*/
+static int
+od_grow(PyOrderedDictObject *mp, Py_ssize_t minused)
+{
+    Py_ssize_t newsize, usable, n = mp->od_nentries;
+    PyOrderedDictEntry *newtable;
+    void *newindices;
+    od_rehash *rh;
+
+    assert(SD_ORDER(mp) == NULL && SD_TKEYS(mp) == NULL);
+    newsize = od_newsize(mp, minused);
+    if (newsize < 0)
+        return -1;
+    usable = OD_USABLE_FRACTION(newsize);
+    /* it has to make room for more entries, tombstones included */
+    if (newsize <= mp->od_imask + 1 || usable <= n)
+        return dictresize(mp, minused);
+    if (OD_REHASHING(mp))
+        od_rehash_step(mp, PY_SSIZE_T_MAX);
+    rh = od_rehash_get(mp);
+    if (rh == NULL)
+        return dictresize(mp, minused);
+    if (rh->rh_next != NULL && rh->rh_nextimask + 1 == newsize) {
+        od_prepare(mp, PY_SSIZE_T_MAX);
+        newindices = rh->rh_next;
+        newtable = OD_BLOCK_TABLE(newindices, newsize);
+        rh->rh_next = NULL;
     } else {
-        epp = mp->od_otablep;
-        reverse = 1;
-    }
-    for (i = 0; i < n; i++) {
-        key = (*epp)->me_key;
-        value = (*epp)->me_value;
-        item = PyList_GET_ITEM(v, i);
-        Py_INCREF(key);
-        PyTuple_SET_ITEM(item, 0, key);
-        Py_INCREF(value);
-        PyTuple_SET_ITEM(item, 1, value);
-        epp += reverse;
+        if (rh->rh_next != NULL) {
+            od_table_free(rh->rh_next, rh->rh_nextimask + 1);
+            rh->rh_next = NULL;
+        }
+        newindices = od_block_new(newsize, &newtable);
+        if (newindices == NULL) {
+            od_rehash_free(mp);
+            return -1;
+        }
+        memset(newtable + n, 0, (usable + 1 - n) * sizeof(PyOrderedDictEntry));
+        memset(newindices, 0xff, newsize * OD_IXSIZE(newsize)); /* OD_IX_EMPTY */
     }
-    return v;
+    memcpy(newtable, mp->ma_table, n * sizeof(PyOrderedDictEntry));
+    OD_STAT(mp, st_resizes, 1);
+    OD_STAT(mp, st_resizebytes, n * sizeof(PyOrderedDictEntry));
+    rh->rh_oldindices = mp->od_indices;
+    rh->rh_oldimask = mp->od_imask;
+    rh->rh_pos = 0;
+    mp->ma_table = newtable;
+    mp->od_indices = newindices;
+    mp->ma_mask = usable - 1;
+    mp->od_imask = newsize - 1;
+    mp->od_fill = 0;
+    return 0;
 }
 
-static PyObject *
-dict_fromkeys(PyObject *cls, PyObject *args)
+/* Note that, for historical reasons, PyOrderedDict_GetItem() suppresses all errors
+ * that may occur (originally dicts supported only string keys, and exceptions
+ * weren't possible).  So, while the original intent was that a NULL return
+ * meant the key wasn't present, in reality it can mean that, or that an error
+ * (suppressed) occurred while computing the key's hash, or that some error
+ * (suppressed) occurred when comparing keys in the dict's internal probe
+ * sequence.  A nasty example of the latter is when a Python-coded comparison
+ * function hits a stack-depth error, which can cause this to return NULL
+ * even if the key is present.
+ */
+PyObject *
+PyOrderedDict_GetItem(PyObject *op, PyObject *key)
 {
-    PyObject *seq;
-    PyObject *value = Py_None;
-    PyObject *it;	/* iter(seq) */
-    PyObject *key;
-    PyObject *d;
-    int status;
-
-    if (!PyArg_UnpackTuple(args, "fromkeys", 1, 2, &seq, &value))
-        return NULL;
+    long hash;
+    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
+    Py_ssize_t ix, hashpos;
+#ifndef OD_PY3
+    PyThreadState *tstate;
+#endif
 
-    d = PyObject_CallObject(cls, NULL);
-    if (d == NULL)
+    if (!PyOrderedDict_Check(op))
         return NULL;
-
-
-#if PY_VERSION_HEX >= 0x02050000
-    if ((PyOrderedDict_CheckExact(d) || PySortedDict_CheckExact(d)) && PyAnySet_CheckExact(seq)) {
-        PyOrderedDictObject *mp = (PyOrderedDictObject *)d;
-        Py_ssize_t pos = 0;
-        PyObject *key;
-        long hash;
-
-        if (dictresize(mp, PySet_GET_SIZE(seq)))
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1) {
+            PyErr_Clear();
             return NULL;
-
-        while (_PySet_NextEntry(seq, &pos, &key, &hash)) {
-            Py_INCREF(key);
-            Py_INCREF(value);
-            if (insertdict(mp, key, hash, value, -1))
-                return NULL;
         }
-        return d;
     }
+
+    /* We can arrive here with a NULL tstate during initialization:
+       try running "python -Wi" for an example related to string
+       interning.  Let's just hope that no exception occurs then... */
+#ifdef OD_PY3
+    if (PyErr_Occurred()) {
 #else
-    d = PyObject_CallObject(cls, NULL);
-    if (d == NULL)
-        return NULL;
+    tstate = _PyThreadState_Current;
+    if (tstate != NULL && tstate->curexc_type != NULL) {
 #endif
-
-    it = PyObject_GetIter(seq);
-    if (it == NULL) {
-        Py_DECREF(d);
-        return NULL;
-    }
-
-    for (;;) {
-        key = PyIter_Next(it);
-        if (key == NULL) {
-            if (PyErr_Occurred())
-                goto Fail;
-            break;
+        /* preserve the existing exception */
+        PyObject *err_type, *err_value, *err_tb;
+        PyErr_Fetch(&err_type, &err_value, &err_tb);
+        ix = OD_LOOKUP(mp, key, hash, &hashpos);
+        /* ignore errors */
+        PyErr_Restore(err_type, err_value, err_tb);
+        if (ix < 0)
+            return NULL;
+    } else {
+        ix = OD_LOOKUP(mp, key, hash, &hashpos);
+        if (ix < 0) {
+            PyErr_Clear();
+            return NULL;
         }
-        status = PyObject_SetItem(d, key, value);
-        Py_DECREF(key);
-        if (status < 0)
-            goto Fail;
     }
-
-    Py_DECREF(it);
-    return d;
-
-Fail:
-    Py_DECREF(it);
-    Py_DECREF(d);
-    return NULL;
+    return mp->ma_table[ix].me_value;
 }
 
-/* called by init, update and setitems */
+/* CAUTION: PyOrderedDict_SetItem() must guarantee that it won't resize the
+ * dictionary if it's merely replacing the value for an existing key.
+ * This means that it's safe to loop over a dictionary with PyOrderedDict_Next()
+ * and occasionally replace a value -- but you can't insert new keys or
+ * remove them.
+ * This does never hold for kvio
+ */
 static int
-dict_update_common(PyObject *self, PyObject *args, PyObject *kwds, char *args_name)
+od_set_item(register PyObject *op, PyObject *key, PyObject *value)
 {
-    PyObject *arg = NULL;
-    int result = 0, tmprelax = 0;
-
-    static char *kwlist[] = {"src", "relax", 0};
+    register PyOrderedDictObject *mp;
+    register long hash;
 
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, args_name,
-                                         kwlist, &arg, &tmprelax))
+    if (!PyOrderedDict_Check(op)) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    assert(key);
+    assert(value);
+    mp = (PyOrderedDictObject *)op;
+    if (PyString_CheckExact(key)) {
+        hash = OD_STR_HASH(key);
+        if (hash == -1)
+            hash = PyObject_Hash(key);
+    } else {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
             return -1;
-
-    if (arg != NULL) {
-        if (PyObject_HasAttrString(arg, "keys"))
-            result = PyOrderedDict_Merge(self, arg, 1, tmprelax);
-        else
-            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
     }
-    /* do not initialise from keywords at all */
-    /* if (result == 0 && kwds != NULL)
-    	result = PyOrderedDict_Merge(self, kwds, 1); */
-    return result;
+    assert(mp->od_fill <= mp->od_imask);  /* at least one empty slot */
+    Py_INCREF(value);
+    Py_INCREF(key);
+    /* insertdict() resizes the table itself, before adding a key to a
+     * table that is full
+     */
+    if (PySortedDict_Check(op)) {
+        if (((PySortedDictObject *) mp)->sd_bulk)
+            return sd_append(mp, key, hash, value);
+        return insertsorteddict(mp, key, hash, value);
+    }
+    return insertdict(mp, key, hash, value, KVIO(mp) ? -2: -1);
 }
 
-static PyObject *
-dict_update(PyObject *self, PyObject *args, PyObject *kwds)
+int
+PyOrderedDict_SetItem(PyObject *op, PyObject *key, PyObject *value)
 {
-    if (dict_update_common(self, args, kwds, "|Oi:update") != -1)
-        Py_RETURN_NONE;
-    return NULL;
-}
+    int res;
 
-/* Update unconditionally replaces existing items.
-   Merge has a 3rd argument 'override'; if set, it acts like Update,
-   otherwise it leaves existing items unchanged.
+    if (!PyOrderedDict_Check(op)) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    OD_WRITE_DO(op, res = od_set_item(op, key, value));
+    return res;
+}
 
-   PyOrderedDict_{Update,Merge} update/merge from a mapping object.
+static int
+od_insert_item(register PyOrderedDictObject *mp, Py_ssize_t index,
+               PyObject *key, PyObject *value)
+{
+    register long hash;
 
-   PyOrderedDict_MergeFromSeq2 updates/merges from any iterable object
-   producing iterable objects of length 2.
-*/
+    if (PySortedDict_Check(mp)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "sorteddict does not support insert()");
+        return -1;
+    }
+    if (!PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    OD_NOT_FROZEN(mp, -1);
+    assert(key);
+    assert(value);
+    if (index < 0)
+        index += mp->ma_used;
+    /* test to see if index is in range */
+    if (index > mp->ma_used)
+        index = mp->ma_used;
+    else if (index < 0)
+        index = 0;
+    if (PyString_CheckExact(key)) {
+        hash = OD_STR_HASH(key);
+        if (hash == -1)
+            hash = PyObject_Hash(key);
+    } else {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return -1;
+    }
+    assert(mp->od_fill <= mp->od_imask);  /* at least one empty slot */
+    Py_INCREF(value);
+    Py_INCREF(key);
+    return insertdict(mp, key, hash, value, index);
+}
 
 int
-PyOrderedDict_MergeFromSeq2(PyObject *d, PyObject *seq2, int override)
+PyOrderedDict_InsertItem(PyOrderedDictObject *mp, Py_ssize_t index,
+                         PyObject *key, PyObject *value)
 {
-    PyObject *it;	/* iter(seq2) */
-    Py_ssize_t i;	/* index into seq2 of current element */
-    PyObject *item;	/* seq2[i] */
-    PyObject *fast;	/* item as a 2-tuple or 2-list */
-
-    assert(d != NULL);
-    assert(PyOrderedDict_Check(d));
-    assert(seq2 != NULL);
+    int res;
 
-    it = PyObject_GetIter(seq2);
-    if (it == NULL)
+    if (!PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
         return -1;
+    }
+    OD_WRITE_DO(mp, res = od_insert_item(mp, index, key, value));
+    return res;
+}
 
-    for (i = 0; ; ++i) {
-        PyObject *key, *value;
-        Py_ssize_t n;
+static int
+od_del_item(PyObject *op, PyObject *key)
+{
+    register PyOrderedDictObject *mp;
+    register long hash;
+    Py_ssize_t ix, hashpos;
+    PyObject *old_value, *old_key;
 
-        fast = NULL;
-        item = PyIter_Next(it);
-        if (item == NULL) {
-            if (PyErr_Occurred())
-                goto Fail;
-            break;
-        }
-
-        /* Convert item to sequence, and verify length 2. */
-        fast = PySequence_Fast(item, "");
-        if (fast == NULL) {
-            if (PyErr_ExceptionMatches(PyExc_TypeError))
-                PyErr_Format(PyExc_TypeError,
-                             "cannot convert dictionary update "
-                             "sequence element #%zd to a sequence",
-                             i);
-            goto Fail;
-        }
-        n = PySequence_Fast_GET_SIZE(fast);
-        if (n != 2) {
-            PyErr_Format(PyExc_ValueError,
-                         "dictionary update sequence element #%zd "
-                         "has length %zd; 2 is required",
-                         i, n);
-            goto Fail;
-        }
-
-        /* Update/merge with this (key, value) pair. */
-        key = PySequence_Fast_GET_ITEM(fast, 0);
-        value = PySequence_Fast_GET_ITEM(fast, 1);
-        if (override || PyOrderedDict_GetItem(d, key) == NULL) {
-            int status = PyOrderedDict_SetItem(d, key, value);
-            if (status < 0)
-                goto Fail;
-        }
-        Py_DECREF(fast);
-        Py_DECREF(item);
+    if (!PyOrderedDict_Check(op)) {
+        PyErr_BadInternalCall();
+        return -1;
     }
-
-    i = 0;
-    goto Return;
-Fail:
-    Py_XDECREF(item);
-    Py_XDECREF(fast);
-    i = -1;
-Return:
-    Py_DECREF(it);
-    return Py_SAFE_DOWNCAST(i, Py_ssize_t, int);
-}
-
-int
-PyOrderedDict_Update(PyObject *a, PyObject *b)
-{
-    return PyOrderedDict_Merge(a, b, 1, 0);
+    OD_NOT_FROZEN((PyOrderedDictObject *) op, -1);
+    assert(key);
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return -1;
+    }
+    mp = (PyOrderedDictObject *)op;
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return -1;
+    if (ix < 0) {
+        set_key_error(key);
+        return -1;
+    }
+    OD_UNSHARE(mp, -1);
+    /* the entry is marked deleted, nothing is moved */
+    old_key = mp->ma_table[ix].me_key;
+    old_value = mp->ma_table[ix].me_value;
+    delete_entry(mp, ix, hashpos);
+    od_autoshrink(mp);
+    Py_DECREF(old_value);
+    Py_DECREF(old_key);
+    return 0;
 }
 
 int
-PyOrderedDict_Merge(PyObject *a, PyObject *b, int override, int relaxed)
+PyOrderedDict_DelItem(PyObject *op, PyObject *key)
 {
-    register PyOrderedDictObject *mp, *other;
-    register Py_ssize_t i;
-    PyOrderedDictEntry *entry, **epp;
+    int res;
 
-    /* We accept for the argument either a concrete ordered dictionary object,
-     * or an abstract "mapping" object.  For the former, we can do
-     * things quite efficiently.  For the latter, we only require that
-     * PyMapping_Keys() and PyObject_GetItem() be supported.
-     */
-    if (a == NULL || !PyOrderedDict_Check(a) || b == NULL) {
+    if (!PyOrderedDict_Check(op)) {
         PyErr_BadInternalCall();
         return -1;
     }
-    mp = (PyOrderedDictObject*)a;
-    /* sorted dicts are always done with individual elements */
-    if (!PySortedDict_CheckExact(a) && PyOrderedDict_CheckExact(b)) {
-        other = (PyOrderedDictObject *) b;
-        if (other == mp || other->ma_used == 0)
-            /* a.update(a) or a.update({}); nothing to do */
-            return 0;
-        if (mp->ma_used == 0)
-            /* Since the target dict is empty, PyOrderedDict_GetItem()
-             * always returns NULL.  Setting override to 1
-             * skips the unnecessary test.
-             */
-            override = 1;
-        /* Do one big resize at the start, rather than
-         * incrementally resizing as we insert new items.  Expect
-         * that there will be no (or few) overlapping keys.
-         */
-        if ((mp->od_fill + other->ma_used)*3 >= (mp->ma_mask+1)*2) {
-            if (dictresize(mp, (mp->ma_used + other->ma_used)*2) != 0)
-                return -1;
-        }
-        epp = other->od_otablep;
-        for (i = 0; i < other->ma_used; i++) {
-            entry = *epp++;
-            /* entry->me_value is never NULL when following the otablep */
-            /*
-            if (entry->me_value != NULL &&
-                (override ||
-                 PyOrderedDict_GetItem(a, entry->me_key) == NULL)) {
-            */
-            if (override || PyOrderedDict_GetItem(a, entry->me_key) == NULL) {
-                Py_INCREF(entry->me_key);
-                Py_INCREF(entry->me_value);
-                if (insertdict(mp, entry->me_key,
-                               (long)entry->me_hash,
-                               entry->me_value, -1) != 0)
-                    return -1;
-            }
-        }
-    } else if (relaxed || RELAXED(mp)) {
-        /* Do it the generic, slower way */
-        PyObject *keys = PyMapping_Keys(b);
-        PyObject *iter;
-        PyObject *key, *value;
-        int status;
+    OD_WRITE_DO(op, res = od_del_item(op, key));
+    return res;
+}
 
-        if (keys == NULL)
-            /* Docstring says this is equivalent to E.keys() so
-             * if E doesn't have a .keys() method we want
-             * AttributeError to percolate up.  Might as well
-             * do the same for any other error.
-             */
-            return -1;
+static void
+od_clear(PyObject *op)
+{
+    PyOrderedDictObject *mp;
+    PyOrderedDictEntry *ep, *table;
+    void *indices;
+    PyObject **tkeys;
+    int table_is_malloced;
+    Py_ssize_t n, i, slots;
+    long state;
+    PyOrderedDictEntry small_copy[OD_USABLE_FRACTION(PyOrderedDict_MINSIZE)];
 
-        iter = PyObject_GetIter(keys);
-        Py_DECREF(keys);
-        if (iter == NULL)
-            return -1;
+    if (!PyOrderedDict_Check(op))
+        return;
+    mp = (PyOrderedDictObject *)op;
 
-        for (key = PyIter_Next(iter); key; key = PyIter_Next(iter)) {
-            if (!override && PyDict_GetItem(a, key) != NULL) {
-                Py_DECREF(key);
-                continue;
-            }
-            value = PyObject_GetItem(b, key);
-            if (value == NULL) {
-                Py_DECREF(iter);
-                Py_DECREF(key);
-                return -1;
-            }
-            status = PyOrderedDict_SetItem(a, key, value);
-            Py_DECREF(key);
-            Py_DECREF(value);
-            if (status < 0) {
-                Py_DECREF(iter);
-                return -1;
-            }
-        }
-        Py_DECREF(iter);
-        if (PyErr_Occurred())
-            /* Iterator completed, via error */
-            return -1;
-    } else {
-        PyErr_SetString(PyExc_TypeError,
-                        "source has undefined order");
-        return -1;
+    table = mp->ma_table;
+    indices = mp->od_indices;
+    slots = mp->od_imask + 1;
+    assert(table != NULL);
+    table_is_malloced = table != mp->ma_smalltable;
+    if (OD_KEYS_SHARED(mp)) {
+        /* only ma_table is its own */
+        indices = table;
+        slots = 0;
     }
-    return 0;
-}
 
+    /* This is delicate.  During the process of clearing the dict,
+     * decrefs can cause the dict to mutate.  To avoid fatal confusion
+     * (voice of experience), we have to make the dict empty before
+     * clearing the slots, and never refer to anything via mp->xxx while
+     * clearing.
+     */
+    n = mp->od_nentries;
+    if (mp->ma_used > 0)
+        OD_MOVED(mp);
+    od_rehash_free(mp);
+    if (SD_ORDER(mp) != NULL) {
+        sd_order_free(SD_ORDER(mp));
+        ((PySortedDictObject *) mp)->sd_order = NULL;
+    }
+    /* a new one is made for the next key added */
+    tkeys = SD_TKEYS(mp);
+    if (tkeys != NULL)
+        ((PySortedDictObject *) mp)->sd_tkeys = NULL;
+    /* kvio, lru etc. stay in effect */
+    state = mp->od_state;
+    if (table_is_malloced) {
+        EMPTY_TO_MINSIZE(mp);
+        if (slots == 0)
+            OD_KEYS_RELEASE(mp);
+    }
 
-/*
-   assume that the start step and count are all within the
-   borders of what b provides
-*/
-int
-PyOrderedDict_CopySome(PyObject *a, PyObject *b,
-                       Py_ssize_t start, Py_ssize_t step,
-                       Py_ssize_t count, int override)
-{
-    register PyOrderedDictObject *mp, *other;
-    register Py_ssize_t i;
-    PyOrderedDictEntry *entry, **epp;
+    else if (mp->od_fill > 0) {
+        /* It's a small table with something that needs to be cleared.
+         * Afraid the only safe way is to copy the dict entries into
+         * another small table first.
+         */
+        memcpy(small_copy, table, sizeof(small_copy));
+        table = small_copy;
+        EMPTY_TO_MINSIZE(mp);
+    }
+    /* else it's a small table that's already empty */
+    mp->od_state = state;
 
-    /* We accept for the argument either a concrete ordered dictionary object
+    /* Now we can finally clear things.  If C had refcounts, we could
+     * assert that the refcount on table is 1 now, i.e. that this function
+     * has unique access to it, so decref side-effects can't alter it.
      */
-    if (a == NULL || !PyOrderedDict_Check(a) || b == NULL) {
-        PyErr_BadInternalCall();
-        return -1;
+    if (tkeys != NULL) {
+        for (i = 0; i < n; i++)
+            Py_XDECREF(tkeys[i]);
+        PyMem_FREE(tkeys);
     }
-    mp = (PyOrderedDictObject*)a;
-    if (PyOrderedDict_CheckExact(b) || PySortedDict_CheckExact(b)) {
-        other = (PyOrderedDictObject*)b;
-        if (other == mp || other->ma_used == 0)
-            /* a.update(a) or a.update({}); nothing to do */
-            return 0;
-        if (mp->ma_used == 0)
-            /* Since the target dict is empty, PyOrderedDict_GetItem()
-             * always returns NULL.  Setting override to 1
-             * skips the unnecessary test.
-             */
-            override = 1;
-        /* Do one big resize at the start, rather than
-         * incrementally resizing as we insert new items.  Expect
-         * that there will be no (or few) overlapping keys.
-         */
-        if ((mp->od_fill + count)*3 >= (mp->ma_mask+1)*2) {
-            if (dictresize(mp, (mp->ma_used + count)*2) != 0)
-                return -1;
-        }
-        epp = other->od_otablep;
-        epp += start;
-        for (i = 0; i < count; i++, epp += step) {
-            entry = *epp;
-            if (override || PyOrderedDict_GetItem(a, entry->me_key) == NULL) {
-                Py_INCREF(entry->me_key);
-                Py_INCREF(entry->me_value);
-                if (insertdict(mp, entry->me_key,
-                               (long)entry->me_hash,
-                               entry->me_value, -1) != 0)
-                    return -1;
-            }
+    for (ep = table; n > 0; ++ep, --n) {
+        if (ep->me_key) {
+            Py_DECREF(ep->me_key);
+            Py_XDECREF(ep->me_value);
         }
-    } else {
-        PyErr_SetString(PyExc_TypeError,
-                        "source has undefined order");
-        return -1;
+#ifdef Py_DEBUG
+        else
+            assert(ep->me_value == NULL);
+#endif
     }
-    return 0;
-}
 
-static PyObject *
-dict_copy(register PyOrderedDictObject *mp)
-{
-    return PyOrderedDict_Copy((PyObject*)mp);
+    if (table_is_malloced)
+        OD_TABLE_RELEASE(mp, indices, slots);
 }
 
-PyObject *
-PyOrderedDict_Copy(PyObject *o)
+void
+PyOrderedDict_Clear(PyObject *op)
 {
-    PyObject *copy;
+    if (!PyOrderedDict_Check(op))
+        return;
+    OD_WRITE_DO(op, od_clear(op));
+}
 
-    if (o == NULL || !PyOrderedDict_Check(o)) {
-        PyErr_BadInternalCall();
-        return NULL;
-    }
+/*
+ * Iterate over a dict.  Use like so:
+ *
+ *     Py_ssize_t i;
+ *     PyObject *key, *value;
+ *     i = 0;   # important!  i should not otherwise be changed by you
+ *     while (PyOrderedDict_Next(yourdict, &i, &key, &value)) {
+ *              Refer to borrowed references in key and value.
+ *     }
+ *
+ * CAUTION:  In general, it isn't safe to use PyOrderedDict_Next in a loop that
+ * mutates the dict.  One exception:  it is safe if the loop merely changes
+ * the values associated with the keys (but doesn't insert new keys or
+ * delete keys), via PyOrderedDict_SetItem().
+ * Starting (with i == 0) puts the entries of a sorteddict in order.
+ */
+int
+PyOrderedDict_Next(PyObject *op, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue)
+{
+    register Py_ssize_t i, n;
+    register PyOrderedDictEntry *ep;
+
+    if (!PyOrderedDict_Check(op) && !PySortedDict_Check(op))
+        return 0;
+    i = *ppos;
+    if (i < 0)
+        return 0;
+    if (i == 0 && SD_ORDER(op) != NULL)
+        compact_entries((PyOrderedDictObject *)op);
+    ep = ((PyOrderedDictObject *)op)->ma_table;
+    n = ((PyOrderedDictObject *)op)->od_nentries;
+    /* skip deleted entries, the last entry in use is never one */
+    while (i < n && ep[i].me_value == NULL)
+        i++;
+    if (i >= n)
+        return 0;
+    *ppos = i+1;
+    if (pkey)
+        *pkey = ep[i].me_key;
+    if (pvalue)
+        *pvalue = ep[i].me_value;
+    return 1;
+}
+
+/* Internal version of PyOrderedDict_Next that returns a hash value in addition to the key and value.*/
+int
+_PyOrderedDict_Next(PyObject *op, Py_ssize_t *ppos, PyObject **pkey, PyObject **pvalue, long *phash)
+{
+    register Py_ssize_t i, n;
+    register PyOrderedDictEntry *ep;
+
+    if (!PyOrderedDict_Check(op))
+        return 0;
+    i = *ppos;
+    if (i < 0)
+        return 0;
+    ep = ((PyOrderedDictObject *)op)->ma_table;
+    n = ((PyOrderedDictObject *)op)->od_nentries;
+    while (i < n && ep[i].me_value == NULL)
+        i++;
+    *ppos = i+1;
+    if (i >= n)
+        return 0;
+    *phash = (long)(ep[i].me_hash);
+    if (pkey)
+        *pkey = ep[i].me_key;
+    if (pvalue)
+        *pvalue = ep[i].me_value;
+    return 1;
+}
+
+/*
+ * Iterate over a dict in chunks, filling up to n (borrowed) keys and values
+ * per call, in order, into arrays provided by the caller (either can be
+ * NULL).  Use like so:
+ *
+ *     Py_ssize_t i = 0, j, n;
+ *     PyObject *keys[64], *values[64];
+ *     while ((n = PyOrderedDict_NextBatch(yourdict, &i, keys, values, 64)) > 0) {
+ *         for (j = 0; j < n; j++)
+ *              Refer to borrowed references in keys[j] and values[j].
+ *     }
+ *
+ * Returns the number of items filled in, 0 once there are no more.  The
+ * same CAUTION applies as for PyOrderedDict_Next, which calls can be mixed
+ * with these.
+ */
+Py_ssize_t
+PyOrderedDict_NextBatch(PyObject *op, Py_ssize_t *ppos, PyObject **keys,
+                        PyObject **values, Py_ssize_t n)
+{
+    register Py_ssize_t i, nentries, count = 0;
+    register PyOrderedDictEntry *ep;
+
+    if (!PyOrderedDict_Check(op) && !PySortedDict_Check(op))
+        return 0;
+    i = *ppos;
+    if (i < 0)
+        return 0;
+    if (i == 0 && SD_ORDER(op) != NULL)
+        compact_entries((PyOrderedDictObject *)op);
+    ep = ((PyOrderedDictObject *)op)->ma_table;
+    nentries = ((PyOrderedDictObject *)op)->od_nentries;
+    for (; count < n && i < nentries; i++) {
+        if (ep[i].me_value == NULL)
+            continue;
+        if (keys)
+            keys[count] = ep[i].me_key;
+        if (values)
+            values[count] = ep[i].me_value;
+        count++;
+    }
+    *ppos = i;
+    return count;
+}
+
+/* Methods */
+
+static void
+dict_dealloc(register PyOrderedDictObject *mp)
+{
+    register PyOrderedDictEntry *ep;
+    Py_ssize_t i, n = mp->od_nentries;
+    PyObject **tkeys = SD_TKEYS(mp);
+    int kept;
+    PyObject_GC_UnTrack(mp);
+#if PY_VERSION_HEX >= 0x03080000
+    Py_TRASHCAN_BEGIN(mp, dict_dealloc)
+#else
+    Py_TRASHCAN_SAFE_BEGIN(mp)
+#endif
+    if (SD_ORDER(mp) != NULL)
+        sd_order_free(SD_ORDER(mp));
+    if (tkeys != NULL) {
+        for (i = 0; i < n; i++)
+            Py_XDECREF(tkeys[i]);
+        PyMem_FREE(tkeys);
+    }
+    if (PySortedDict_Check(mp)) {
+        Py_XDECREF(((PySortedDictObject *) mp)->sd_cmp);
+        Py_XDECREF(((PySortedDictObject *) mp)->sd_key);
+        Py_XDECREF(((PySortedDictObject *) mp)->sd_value);
+    }
+    for (ep = mp->ma_table; n > 0; ep++, n--) {
+        if (ep->me_key) {
+            Py_DECREF(ep->me_key);
+            Py_XDECREF(ep->me_value);
+        }
+    }
+    od_rehash_free(mp);
+    if (mp->od_stats != NULL) {
+        PyMem_FREE(mp->od_stats);
+        mp->od_stats = NULL;
+    }
+#ifdef OD_LOCKFREE_READS
+    od_retired_free(mp, 1);
+#endif
+    if (OD_KEYS_SHARED(mp))
+        od_table_free(mp->ma_table, 0);
+    else if (mp->ma_table != mp->ma_smalltable)
+        od_table_free(mp->od_indices, mp->od_imask + 1);
+    Py_CLEAR(mp->od_keys);
+    if (mp->ma_table != mp->ma_smalltable) {
+        mp->ma_table = mp->ma_smalltable;
+        mp->od_indices = mp->od_smallindices;
+        mp->od_fill = 1;	/* make od_freelist_pop() clear it */
+    }
+    kept = 1;
+    OD_POOL_LOCK();
+    if (num_free_dicts < od_freelist_limit && Py_Type(mp) == &PyOrderedDict_Type)
+        free_dicts[num_free_dicts++] = mp;
+    else if (num_free_sorteddicts < od_freelist_limit &&
+             Py_Type(mp) == &PySortedDict_Type)
+        free_sorteddicts[num_free_sorteddicts++] = mp;
+    else
+        kept = 0;
+    OD_POOL_UNLOCK();
+    if (!kept)
+        Py_Type(mp)->tp_free((PyObject *)mp);
+#if PY_VERSION_HEX >= 0x03080000
+    Py_TRASHCAN_END
+#else
+    Py_TRASHCAN_SAFE_END(mp)
+#endif
+}
+
+#ifndef OD_PY3
+static int
+ordereddict_print(register PyOrderedDictObject *mp, register FILE *fp, register int flags)
+{
+    register Py_ssize_t i;
+    register Py_ssize_t any;
+    char *typestr = "ordered";
+    int status;
+    PyOrderedDictEntry *ep;
+
+    if (PySortedDict_CheckExact(mp))
+        typestr = "sorted";
+    else if (PyFrozenOrderedDict_Check(mp))
+        typestr = "frozenordered";
+    status = Py_ReprEnter((PyObject*)mp);
+    if (status != 0) {
+        if (status < 0)
+            return status;
+        fprintf(fp, "%sdict([...])", typestr);
+        return 0;
+    }
+
+    fprintf(fp, "%sdict([", typestr);
+    any = 0;
+    OD_COMPACT(mp);
+    ep = mp->ma_table;
+    for (i = 0; i < mp->ma_used; i++) {
+        PyObject *pvalue = ep->me_value;
+        /* Prevent PyObject_Repr from deleting value during
+           key format */
+        Py_INCREF(pvalue);
+        if (any++ > 0)
+            fprintf(fp, ", ");
+        fprintf(fp, "(");
+        if (PyObject_Print((PyObject *)(ep->me_key), fp, 0)!=0) {
+            Py_DECREF(pvalue);
+            Py_ReprLeave((PyObject*)mp);
+            return -1;
+        }
+        fprintf(fp, ", ");
+        if (PyObject_Print(pvalue, fp, 0) != 0) {
+            Py_DECREF(pvalue);
+            Py_ReprLeave((PyObject*)mp);
+            return -1;
+        }
+        Py_DECREF(pvalue);
+        fprintf(fp, ")");
+        ep++;
+    }
+    fprintf(fp, "])");
+    Py_ReprLeave((PyObject*)mp);
+    return 0;
+}
+#endif /* !OD_PY3 */
+
+static PyObject *
+ordereddict_repr(PyOrderedDictObject *mp)
+{
+    Py_ssize_t i;
+    PyObject *s, *temp, *comma = NULL, *rightpar = NULL;
+    PyObject *pieces = NULL, *result = NULL;
+    PyObject *key, *value;
+    char *typestr = "ordered";
+
+    /* if (PySortedDict_CheckExact(mp))*/
+    if (PySortedDict_Check(mp))
+        typestr = "sorted";
+    else if (PyFrozenOrderedDict_Check(mp))
+        typestr = "frozenordered";
+    i = Py_ReprEnter((PyObject *)mp);
+    if (i != 0) {
+        return i > 0 ? PyString_FromFormat("%sdict([...])", typestr) : NULL;
+    }
+
+    if (mp->ma_used == 0) {
+        result = PyString_FromFormat("%sdict([])", typestr);
+        goto Done;
+    }
+
+    pieces = PyList_New(0);
+    if (pieces == NULL)
+        goto Done;
+
+    comma = PyString_FromString(", ");
+    if (comma == NULL)
+        goto Done;
+    rightpar = PyString_FromString(")");
+    if (rightpar == NULL)
+        goto Done;
+
+    /* Do repr() on each key+value pair, and insert ": " between them.
+       Note that repr may mutate the dict. */
+    i = 0;
+    while (PyOrderedDict_Next((PyObject *)mp, &i, &key, &value)) {
+        int status;
+        /* Prevent repr from deleting value during key format. */
+        Py_INCREF(value);
+        s = PyString_FromString("(");
+        PyString_ConcatAndDel(&s, PyObject_Repr(key));
+        PyString_Concat(&s, comma);
+        PyString_ConcatAndDel(&s, PyObject_Repr(value));
+        Py_DECREF(value);
+        PyString_Concat(&s, rightpar);
+        if (s == NULL)
+            goto Done;
+        status = PyList_Append(pieces, s);
+        Py_DECREF(s);  /* append created a new ref */
+        if (status < 0)
+            goto Done;
+    }
+
+    /* Add "[]" decorations to the first and last items. */
+    assert(PyList_GET_SIZE(pieces) > 0);
+    s = PyString_FromFormat("%sdict([", typestr);
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, 0);
+    PyString_ConcatAndDel(&s, temp);
+    PyList_SET_ITEM(pieces, 0, s);
+    if (s == NULL)
+        goto Done;
+
+    s = PyString_FromString("])");
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
+    PyString_ConcatAndDel(&temp, s);
+    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
+    if (temp == NULL)
+        goto Done;
+
+    /* Paste them all together with ", " between. */
+    result = _PyString_Join(comma, pieces);
+
+Done:
+    Py_XDECREF(pieces);
+    Py_XDECREF(comma);
+    Py_XDECREF(rightpar);
+    Py_ReprLeave((PyObject *)mp);
+    return result;
+}
+OD_LOCKED_1(ordereddict_repr, READ)
+
+static Py_ssize_t
+dict_length(PyOrderedDictObject *mp)
+{
+    return mp->ma_used;
+}
+
+static PyObject *
+dict_subscript(PyOrderedDictObject *mp, register PyObject *key)
+{
+    PyObject *v;
+    long hash;
+    Py_ssize_t ix, hashpos;
+    if (PySlice_Check(key)) {
+        Py_ssize_t start, stop, step, slicelength;
+        PyObject* result;
+
+        if (PySlice_GetIndicesEx(OD_SLICE(key), mp->ma_used,
+                                 &start, &stop, &step, &slicelength) < 0) {
+            return NULL;
+        }
+        result = PyOrderedDict_New();
+        if (!result) return NULL;
+        if (slicelength <= 0) return result;
+        if (PyOrderedDict_CopySome(result, (PyObject *) mp, start, step, slicelength, 1) == 0)
+            return result;
+        Py_DECREF(result);
+        return NULL;
+    }
+    assert(mp->ma_table != NULL);
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0) {
+        if (!PyOrderedDict_CheckExact(mp) && !PySortedDict_CheckExact(mp)) {
+            /* Look up __missing__ method if we're a subclass. */
+            PyObject *missing;
+            static PyObject *missing_str = NULL;
+            if (missing_str == NULL)
+                missing_str =
+                    PyString_InternFromString("__missing__");
+            missing = _PyType_Lookup(Py_Type(mp), missing_str);
+            if (missing != NULL)
+                return PyObject_CallFunctionObjArgs(missing,
+                                                    (PyObject *)mp, key, NULL);
+        }
+        set_key_error(key);
+        return NULL;
+    }
+    if (LRU(mp) && (ix = move_to_end(mp, ix, hashpos)) == OD_IX_ERROR)
+        return NULL;
+    v = mp->ma_table[ix].me_value;
+    Py_INCREF(v);
+    return v;
+}
+
+/*
+Delete the count items from position start onwards, in steps of step
+(which can be negative), of an ordereddict without deleted entries.  The
+entries are cleared in place, and then squeezed out, and od_indices rebuilt,
+in a single pass.  The keys and values are only released after that, as
+that can re-enter.
+Special speed gimmick:  when count <= 8, it's guaranteed the call cannot
+fail.
+*/
+static int
+od_delete_range(PyOrderedDictObject *mp, Py_ssize_t start, Py_ssize_t step,
+                Py_ssize_t count)
+{
+    PyObject *recycle_on_stack[16];
+    PyObject **recycle = recycle_on_stack; /* will allocate more if needed */
+    PyOrderedDictEntry *ep;
+    Py_ssize_t i, n = 0;
+
+    assert(!OD_HAS_TOMBSTONES(mp) && SD_ORDER(mp) == NULL);
+    assert(SD_TKEYS(mp) == NULL);
+    if (count <= 0)
+        return 0;
+    OD_UNSHARE(mp, -1);
+    if (count > 8) {
+        recycle = PyMem_NEW(PyObject *, 2 * count);
+        if (recycle == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        ep = &mp->ma_table[start + i * step];
+        recycle[n++] = ep->me_key;
+        recycle[n++] = ep->me_value;
+        ep->me_key = NULL;
+        ep->me_value = NULL;
+    }
+    mp->ma_used -= count;
+    OD_MOVED(mp);
+    compact_entries(mp);
+    od_autoshrink(mp);
+    for (i = n - 1; i >= 0; --i)
+        Py_DECREF(recycle[i]);
+    if (recycle != recycle_on_stack)
+        PyMem_FREE(recycle);
+    return 0;
+}
+
+/* a[ilow:ihigh] = v if v != NULL.
+ * del a[ilow:ihigh] if v == NULL.
+ *
+ * Special speed gimmick:  when v is NULL and ihigh - ilow <= 8, it's
+ * guaranteed the call cannot fail.
+ */
+static Py_ssize_t
+dict_ass_slice(PyOrderedDictObject *self, Py_ssize_t ilow, Py_ssize_t ihigh, PyObject *value)
+{
+    Py_ssize_t i;
+    PyOrderedDictEntry *ep;
+
+    if (PySortedDict_CheckExact(self)) {
+        PyErr_Format(PyExc_TypeError,
+                     "sorteddict does not support slice %s", value ? "assignment" : "deletion");
+        return -1;
+    }
+    OD_NOT_FROZEN(self, -1);
+    OD_COMPACT(self);
+    if (ilow < 0)
+        ilow = 0;
+    else if (ilow > self->ma_used)
+        ilow = self->ma_used;
+
+    if (ihigh < ilow)
+        ihigh = ilow;
+    else if (ihigh > self->ma_used)
+        ihigh = self->ma_used;
+
+    if (value != NULL) {
+        if  (PyObject_Length(value) != (ihigh - ilow)) {
+            PyErr_SetString(PyExc_ValueError,
+                            "slice assigment: wrong size"
+                           );
+            return -1;
+        }
+        if (!PyOrderedDict_CheckExact(value)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "slice assigment: argument must be ordereddict"
+                           );
+            return -1;
+        }
+    }
+
+    /* for now lazy implementation: first delete then insert */
+    if (od_delete_range(self, ilow, 1, ihigh - ilow) != 0)
+        return -1;
+    if (value != NULL) { /* now insert */
+        OD_COMPACT((PyOrderedDictObject *) value);
+        ep = ((PyOrderedDictObject *) value)->ma_table;
+        for (i = ilow; i < ihigh; i++) {
+            if(PyOrderedDict_InsertItem(self, i, ep->me_key, ep->me_value) != 0)
+                return -1;
+            ep++;
+        }
+    }
+    return 0;
+}
+
+static Py_ssize_t
+dict_ass_subscript(PyOrderedDictObject *self, PyObject *item, PyObject *value)
+{
+    OD_NOT_FROZEN(self, -1);
+    if (PySlice_Check(item)) {
+        Py_ssize_t start, stop, step, slicelength;
+        if (PySortedDict_CheckExact(self)) {
+            PyErr_Format(PyExc_TypeError,
+                         "sorteddict does not support slice %s", value ? "assignment" : "deletion");
+            return -1;
+        }
+        if (PySlice_GetIndicesEx(OD_SLICE(item), self->ma_used,
+                                 &start, &stop, &step, &slicelength) < 0) {
+            return -1;
+        }
+
+        /* treat L[slice(a,b)] = v _exactly_ like L[a:b] = v */
+        if (step == 1 && ((PySliceObject*)item)->step == Py_None)
+            return dict_ass_slice(self, start, stop, value);
+
+        /* do soemthing about step == -1 ? */
+
+        if (slicelength <= 0)
+            return 0;
+        if (value == NULL) {
+            /* delete slice */
+            OD_COMPACT(self);
+            return od_delete_range(self, start, step, slicelength);
+        } else {
+            /* assign slice */
+            Py_ssize_t count = slicelength, start2 = start;
+            PyOrderedDictEntry *ep;
+            /* printf("Assigning %d %d %d %d %d %p\n", start, stop, step, slicelength, PyObject_Length(value), value); */
+            if  (PyObject_Length(value) != slicelength) {
+                PyErr_SetString(PyExc_ValueError,
+                                "slice assignment: wrong size"
+                               );
+                return -1;
+            }
+            if (!PyOrderedDict_CheckExact(value)) {
+                PyErr_SetString(PyExc_TypeError,
+                                "slice assignment: argument must be ordereddict"
+                               );
+                return -1;
+            }
+            while (count--) {
+                /* ToDo optimize */
+                if (step > 0) { /* do it from the back to preserve right indices */
+                    dict_ass_slice(self, start2 + count *  step,
+                                   start2 + (count * step) + 1, NULL);
+                } else {
+                    dict_ass_slice(self, start2, start2  + 1, NULL);
+                    start2 += step;
+                }
+            }
+            count = slicelength;
+            start2 = start;
+            OD_COMPACT((PyOrderedDictObject *) value);
+            ep = ((PyOrderedDictObject *) value)->ma_table;
+            if (step < 0) {
+                ep += slicelength;
+            }
+            while (count--) {
+                /* ToDo optimize */
+                if (step > 0) { /* do it from the front */
+                    if(PyOrderedDict_InsertItem(self, start2, ep->me_key, ep->me_value) != 0)
+                        return -1;
+                    start2 += step;
+                    ep++;
+                } else {
+                    ep--;
+                    if(PyOrderedDict_InsertItem(self, start2 + count * step, ep->me_key, ep->me_value) != 0)
+                        return -1;
+                }
+            }
+            return 0;
+
+        }
+    }
+    if (value == NULL)
+        return PyOrderedDict_DelItem((PyObject *)self, item);
+    else
+        return PyOrderedDict_SetItem((PyObject *)self, item, value);
+}
+
+#ifdef OD_LOCKFREE_READS
+/* look up key in self without the lock where that can be done: the result
+   of od_lockfree_lookup(), -1 if it is not tried */
+static int
+od_lockfree_get(PyObject *self, PyObject *key, PyObject **pvalue)
+{
+    PyOrderedDictObject *mp = (PyOrderedDictObject *) self;
+    Py_hash_t hash;
+
+    if (!PyUnicode_CheckExact(key) || LRU(mp) ||
+            (hash = OD_STR_HASH(key)) == -1)
+        return -1;
+    return od_lockfree_lookup(mp, key, hash, pvalue);
+}
+#endif
+
+#ifdef Py_GIL_DISABLED
+static PyObject *
+dict_subscript_locked(PyObject *self, PyObject *key)
+{
+    PyObject *res;
+
+#ifdef OD_LOCKFREE_READS
+    switch (od_lockfree_get(self, key, &res)) {
+    case 1:
+        return res;
+    case 0:
+        /* a subclass may have __missing__ */
+        if (!PyOrderedDict_CheckExact(self) && !PySortedDict_CheckExact(self))
+            break;
+        set_key_error(key);
+        return NULL;
+    }
+#endif
+    /* moves the item in an LRU ordered dict */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    OD_WRITE_BEGIN(self);
+    res = dict_subscript((PyOrderedDictObject *) self, key);
+    OD_WRITE_END(self);
+    Py_END_CRITICAL_SECTION();
+    return res;
+}
+#endif
+OD_LOCKED_INT3(dict_ass_subscript, WRITE)
+
+static PyMappingMethods dict_as_mapping = {
+    (lenfunc)dict_length, /*mp_length*/
+    (binaryfunc)OD_LOCKED(dict_subscript), /*mp_subscript*/
+    (objobjargproc)OD_LOCKED(dict_ass_subscript), /*mp_ass_subscript*/
+};
+
+static PyObject *
+dict_keys(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+{
+    register PyObject *v;
+    register Py_ssize_t i;
+    PyOrderedDictEntry *ep;
+    Py_ssize_t n;
+
+    int reverse = 0;
+    static char *kwlist[] = {"reverse", 0};
+
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:keys",
+                                         kwlist, &reverse))
+            return NULL;
+
+
+again:
+    n = mp->ma_used;
+    v = PyList_New(n);
+    if (v == NULL)
+        return NULL;
+    if (n != mp->ma_used) {
+        /* Durnit.  The allocations caused the dict to resize.
+         * Just 	 over, this shouldn't normally happen.
+         */
+        Py_DECREF(v);
+        goto again;
+    }
+    OD_COMPACT(mp);
+    if (reverse) {
+        ep = mp->ma_table + (n-1);
+        reverse = -1;
+    } else {
+        ep = mp->ma_table;
+        reverse = 1;
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *key = ep->me_key;
+        Py_INCREF(key);
+        PyList_SET_ITEM(v, i, key);
+        ep += reverse;
+    }
+    return v;
+}
+
+static PyObject *
+dict_values(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+{
+    register PyObject *v;
+    register Py_ssize_t i;
+    PyOrderedDictEntry *ep;
+    Py_ssize_t n;
+
+    int reverse = 0;
+    static char *kwlist[] = {"reverse", 0};
+
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:values",
+                                         kwlist, &reverse))
+            return NULL;
+
+again:
+    n = mp->ma_used;
+    v = PyList_New(n);
+    if (v == NULL)
+        return NULL;
+    if (n != mp->ma_used) {
+        /* Durnit.  The allocations caused the dict to resize.
+         * Just start over, this shouldn't normally happen.
+         */
+        Py_DECREF(v);
+        goto again;
+    }
+    OD_COMPACT(mp);
+    if (reverse) {
+        ep = mp->ma_table + (n-1);
+        reverse = -1;
+    } else {
+        ep = mp->ma_table;
+        reverse = 1;
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *value = ep->me_value;
+        Py_INCREF(value);
+        PyList_SET_ITEM(v, i, value);
+        ep += reverse;
+    }
+    return v;
+}
+
+static PyObject *
+dict_items(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+{
+    register PyObject *v;
+    register Py_ssize_t i, n;
+    PyObject *item, *key, *value;
+    PyOrderedDictEntry *ep;
+
+    int reverse = 0;
+    static char *kwlist[] = {"reverse", 0};
+
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:items",
+                                         kwlist, &reverse))
+            return NULL;
+
+    /* Preallocate the list of tuples, to avoid allocations during
+     * the loop over the items, which could trigger GC, which
+     * could resize the dict. :-(
+     */
+again:
+    n = mp->ma_used;
+    v = PyList_New(n);
+    if (v == NULL)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        item = PyTuple_New(2);
+        if (item == NULL) {
+            Py_DECREF(v);
+            return NULL;
+        }
+        PyList_SET_ITEM(v, i, item);
+    }
+    if (n != mp->ma_used) {
+        /* Durnit.  The allocations caused the dict to resize.
+         * Just start over, this shouldn't normally happen.
+         */
+        Py_DECREF(v);
+        goto again;
+    }
+    /* Nothing we do below makes any function calls. */
+    OD_COMPACT(mp);
+    if (reverse) {
+        ep = mp->ma_table + (n-1);
+        reverse = -1;
+    } else {
+        ep = mp->ma_table;
+        reverse = 1;
+    }
+    for (i = 0; i < n; i++) {
+        key = ep->me_key;
+        value = ep->me_value;
+        item = PyList_GET_ITEM(v, i);
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(item, 0, key);
+        Py_INCREF(value);
+        PyTuple_SET_ITEM(item, 1, value);
+        ep += reverse;
+    }
+    return v;
+}
+
+static PyObject *
+dict_fromkeys(PyObject *cls, PyObject *args)
+{
+    PyObject *seq;
+    PyObject *value = Py_None;
+    PyObject *it;	/* iter(seq) */
+    PyObject *key;
+    PyObject *d;
+    Py_ssize_t start = -1;
+    int status;
+
+    if (!PyArg_UnpackTuple(args, "fromkeys", 1, 2, &seq, &value))
+        return NULL;
+
+    d = PyObject_CallObject(cls, NULL);
+    if (d == NULL)
+        return NULL;
+
+
+/* 3.13 no longer exports _PySet_NextEntry(), a set is iterated over there */
+#if PY_VERSION_HEX >= 0x02050000 && PY_VERSION_HEX < 0x030D0000
+    if ((PyOrderedDict_CheckExact(d) || PySortedDict_CheckExact(d)) && PyAnySet_CheckExact(seq)) {
+        PyOrderedDictObject *mp = (PyOrderedDictObject *)d;
+        Py_ssize_t pos = 0, start = -1;
+        PyObject *key;
+        long hash;
+
+        if (dictresize(mp, PySet_GET_SIZE(seq))) {
+            Py_DECREF(d);
+            return NULL;
+        }
+        if (PySortedDict_CheckExact(d))
+            start = sd_bulk_begin(mp);
+        status = 0;
+        while (_PySet_NextEntry(seq, &pos, &key, &hash)) {
+            Py_INCREF(key);
+            Py_INCREF(value);
+            if (start >= 0)
+                status = sd_append(mp, key, hash, value);
+            else
+                status = insertdict(mp, key, hash, value, -1);
+            if (status != 0)
+                break;
+        }
+        if (sd_bulk_end(mp, start, status) != 0) {
+            Py_DECREF(d);
+            return NULL;
+        }
+        return d;
+    }
+#elif PY_VERSION_HEX < 0x02050000
+    d = PyObject_CallObject(cls, NULL);
+    if (d == NULL)
+        return NULL;
+#endif
+
+    it = PyObject_GetIter(seq);
+    if (it == NULL) {
+        Py_DECREF(d);
+        return NULL;
+    }
+
+    if (PySortedDict_CheckExact(d))
+        start = sd_bulk_begin((PyOrderedDictObject *)d);
+    for (;;) {
+        key = PyIter_Next(it);
+        if (key == NULL) {
+            if (PyErr_Occurred())
+                goto Fail;
+            break;
+        }
+        status = PyObject_SetItem(d, key, value);
+        Py_DECREF(key);
+        if (status < 0)
+            goto Fail;
+    }
+
+    Py_DECREF(it);
+    if (sd_bulk_end((PyOrderedDictObject *)d, start, 0) != 0) {
+        Py_DECREF(d);
+        return NULL;
+    }
+    return d;
+
+Fail:
+    sd_bulk_end((PyOrderedDictObject *)d, start, -1);
+    Py_DECREF(it);
+    Py_DECREF(d);
+    return NULL;
+}
+
+/* called by init, update and setitems */
+static int
+dict_update_common(PyObject *self, PyObject *args, PyObject *kwds, char *args_name)
+{
+    PyObject *arg = NULL;
+    int result = 0, tmprelax = 0;
+
+    static char *kwlist[] = {"src", "relax", 0};
+
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, args_name,
+                                         kwlist, &arg, &tmprelax))
+            return -1;
+
+    if (arg != NULL) {
+        if (PyObject_HasAttrString(arg, "keys"))
+            result = PyOrderedDict_Merge(self, arg, 1, tmprelax);
+        else
+            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
+    }
+    /* do not initialise from keywords at all */
+    /* if (result == 0 && kwds != NULL)
+    	result = PyOrderedDict_Merge(self, kwds, 1); */
+    return result;
+}
+
+static PyObject *
+dict_update(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    if (dict_update_common(self, args, kwds, "|Oi:update") != -1)
+        Py_RETURN_NONE;
+    return NULL;
+}
+
+/* Update unconditionally replaces existing items.
+   Merge has a 3rd argument 'override'; if set, it acts like Update,
+   otherwise it leaves existing items unchanged.
+
+   PyOrderedDict_{Update,Merge} update/merge from a mapping object.
+
+   PyOrderedDict_MergeFromSeq2 updates/merges from any iterable object
+   producing iterable objects of length 2.
+*/
+
+static int
+od_merge_seq2(PyObject *d, PyObject *seq2, int override)
+{
+    PyObject *it;	/* iter(seq2) */
+    Py_ssize_t i;	/* index into seq2 of current element */
+    PyObject *item;	/* seq2[i] */
+    PyObject *fast;	/* item as a 2-tuple or 2-list */
+    Py_ssize_t start = -1;
+
+    assert(d != NULL);
+    assert(PyOrderedDict_Check(d));
+    assert(seq2 != NULL);
+
+    OD_NOT_FROZEN((PyOrderedDictObject *) d, -1);
+    /* a list or tuple is indexed directly, and the table is made big
+       enough for all of it up front */
+    if (PyList_CheckExact(seq2) || PyTuple_CheckExact(seq2)) {
+        PyOrderedDictObject *mp = (PyOrderedDictObject *) d;
+        Py_ssize_t n = mp->ma_used + PySequence_Fast_GET_SIZE(seq2);
+
+        if (mp->od_maxsize > 0 && n > mp->od_maxsize)
+            n = mp->od_maxsize;
+        if (od_reserve(mp, n) < 0)
+            return -1;
+        it = NULL;
+    }
+    else {
+        it = PyObject_GetIter(seq2);
+        if (it == NULL)
+            return -1;
+    }
+    if (PySortedDict_Check(d))
+        start = sd_bulk_begin((PyOrderedDictObject *) d);
+
+    for (i = 0; ; ++i) {
+        PyObject *key, *value;
+        Py_ssize_t n;
+
+        fast = NULL;
+        if (it == NULL) {
+            /* the size is checked every time, a key's __eq__ may change
+               the list */
+            if (i >= PySequence_Fast_GET_SIZE(seq2))
+                break;
+            item = PySequence_Fast_GET_ITEM(seq2, i);
+            Py_INCREF(item);
+        }
+        else {
+            item = PyIter_Next(it);
+            if (item == NULL) {
+                if (PyErr_Occurred())
+                    goto Fail;
+                break;
+            }
+        }
+
+        /* Convert item to sequence, and verify length 2. */
+        fast = PySequence_Fast(item, "");
+        if (fast == NULL) {
+            if (PyErr_ExceptionMatches(PyExc_TypeError))
+                PyErr_Format(PyExc_TypeError,
+                             "cannot convert dictionary update "
+                             "sequence element #%zd to a sequence",
+                             i);
+            goto Fail;
+        }
+        n = PySequence_Fast_GET_SIZE(fast);
+        if (n != 2) {
+            PyErr_Format(PyExc_ValueError,
+                         "dictionary update sequence element #%zd "
+                         "has length %zd; 2 is required",
+                         i, n);
+            goto Fail;
+        }
+
+        /* Update/merge with this (key, value) pair. */
+        key = PySequence_Fast_GET_ITEM(fast, 0);
+        value = PySequence_Fast_GET_ITEM(fast, 1);
+        if (override || PyOrderedDict_GetItem(d, key) == NULL) {
+            int status = PyOrderedDict_SetItem(d, key, value);
+            if (status < 0)
+                goto Fail;
+        }
+        Py_DECREF(fast);
+        Py_DECREF(item);
+    }
+
+    i = 0;
+    goto Return;
+Fail:
+    Py_XDECREF(item);
+    Py_XDECREF(fast);
+    i = -1;
+Return:
+    Py_XDECREF(it);
+    return sd_bulk_end((PyOrderedDictObject *) d, start,
+                       Py_SAFE_DOWNCAST(i, Py_ssize_t, int));
+}
+
+int
+PyOrderedDict_MergeFromSeq2(PyObject *d, PyObject *seq2, int override)
+{
+    int res;
+
+    assert(d != NULL);
+    assert(PyOrderedDict_Check(d));
+    OD_WRITE_DO(d, res = od_merge_seq2(d, seq2, override));
+    return res;
+}
+
+int
+PyOrderedDict_Update(PyObject *a, PyObject *b)
+{
+    return PyOrderedDict_Merge(a, b, 1, 0);
+}
+
+/*
+_PyDict_Next() for a plain dict or an ordereddict b: 1 with the next item,
+0 at the end, -1 on error.  On Python 3 an ordereddict has not got the
+layout of a dict (which it shares up to ma_lookup on Python 2), and 3.13
+doesn't export _PyDict_Next(), there the hash is asked for again.
+*/
+static int
+od_dict_next(PyObject *b, Py_ssize_t *pos, PyObject **key, PyObject **value,
+             long *hash)
+{
+    if (PyOrderedDict_Check(b))
+        return _PyOrderedDict_Next(b, pos, key, value, hash);
+#if PY_VERSION_HEX >= 0x030D0000
+    if (!PyDict_Next(b, pos, key, value))
+        return 0;
+    if (!PyString_CheckExact(*key) || (*hash = OD_STR_HASH(*key)) == -1)
+        *hash = PyObject_Hash(*key);
+    return *hash == -1 ? -1 : 1;
+#else
+    return _PyDict_Next(b, pos, key, value, hash);
+#endif
+}
+
+static int
+od_merge(PyObject *a, PyObject *b, int override, int relaxed)
+{
+    register PyOrderedDictObject *mp, *other;
+    register Py_ssize_t i;
+    PyOrderedDictEntry *entry;
+
+    /* We accept for the argument either a concrete ordered dictionary object,
+     * or an abstract "mapping" object.  For the former, we can do
+     * things quite efficiently.  For the latter, we only require that
+     * PyMapping_Keys() and PyObject_GetItem() be supported.
+     */
+    if (a == NULL || !PyOrderedDict_Check(a) || b == NULL) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    mp = (PyOrderedDictObject*)a;
+    OD_NOT_FROZEN(mp, -1);
+    if (PySortedDict_Check(a) && (PyDict_CheckExact(b) ||
+                                  PyOrderedDict_CheckExact(b) ||
+                                  PySortedDict_CheckExact(b) ||
+                                  PyFrozenOrderedDict_Check(b))) {
+        /* the order of b doesn't matter, all is sorted in at the end */
+        PyObject *key, *value;
+        long hash;
+        Py_ssize_t start, pos = 0, n = PyObject_Size(b);
+        int result = 0, more;
+
+        if (b == a || n == 0)
+            return 0;
+        if (mp->ma_used == 0)
+            override = 1;
+        if (mp->od_nentries + n > mp->ma_mask + 1) {
+            if (dictresize(mp, (mp->ma_used + n)*2) != 0)
+                return -1;
+        }
+        if (!PyDict_CheckExact(b))
+            /* a sorteddict in order is just checked */
+            OD_COMPACT((PyOrderedDictObject *) b);
+        start = sd_bulk_begin(mp);
+        while ((more = od_dict_next(b, &pos, &key, &value, &hash)) != 0) {
+            if (more < 0) {
+                result = -1;
+                break;
+            }
+            if (!override && PyOrderedDict_GetItem(a, key) != NULL)
+                continue;
+            Py_INCREF(key);
+            Py_INCREF(value);
+            if (sd_append(mp, key, hash, value) != 0) {
+                result = -1;
+                break;
+            }
+        }
+        return sd_bulk_end(mp, start, result);
+    }
+    if (!PySortedDict_Check(a) && (PyOrderedDict_CheckExact(b) ||
+                                   PySortedDict_CheckExact(b) ||
+                                   PyFrozenOrderedDict_Check(b))) {
+        /* in the order of b, for a sorteddict that is its sort order */
+        other = (PyOrderedDictObject *) b;
+        if (other == mp || other->ma_used == 0)
+            /* a.update(a) or a.update({}); nothing to do */
+            return 0;
+        if (mp->ma_used == 0)
+            /* Since the target dict is empty, PyOrderedDict_GetItem()
+             * always returns NULL.  Setting override to 1
+             * skips the unnecessary test.
+             */
+            override = 1;
+        /* Do one big resize at the start, rather than
+         * incrementally resizing as we insert new items.  Expect
+         * that there will be no (or few) overlapping keys.
+         */
+        if (mp->od_nentries + other->ma_used > mp->ma_mask + 1) {
+            if (dictresize(mp, (mp->ma_used + other->ma_used)*2) != 0)
+                return -1;
+        }
+        OD_COMPACT(other);
+        entry = other->ma_table;
+        for (i = 0; i < other->ma_used; i++, entry++) {
+            /* entry->me_value is never NULL in a compacted table */
+            /*
+            if (entry->me_value != NULL &&
+                (override ||
+                 PyOrderedDict_GetItem(a, entry->me_key) == NULL)) {
+            */
+            if (override || PyOrderedDict_GetItem(a, entry->me_key) == NULL) {
+                Py_INCREF(entry->me_key);
+                Py_INCREF(entry->me_value);
+                if (insertdict(mp, entry->me_key,
+                               (long)entry->me_hash,
+                               entry->me_value, KVIO(mp) ? -2 : -1) != 0)
+                    return -1;
+            }
+        }
+    } else if ((relaxed || RELAXED(mp) || OD_DICT_ORDERED) &&
+               PyDict_CheckExact(b)) {
+        /* walk the table of the plain dict, using the hashes stored in it,
+           keys come in the order PyDict_Next() gives them (arbitrary before
+           Python 3.7) */
+        PyObject *key, *value;
+        long hash;
+        Py_ssize_t pos = 0, n = PyDict_Size(b);
+        int more;
+
+        if (n == 0)
+            return 0;
+        if (mp->ma_used == 0)
+            override = 1;
+        if (mp->od_nentries + n > mp->ma_mask + 1) {
+            if (dictresize(mp, (mp->ma_used + n)*2) != 0)
+                return -1;
+        }
+        while ((more = od_dict_next(b, &pos, &key, &value, &hash)) != 0) {
+            if (more < 0)
+                return -1;
+            if (!override && PyOrderedDict_GetItem(a, key) != NULL)
+                continue;
+            Py_INCREF(key);
+            Py_INCREF(value);
+            if (insertdict(mp, key, hash, value, KVIO(mp) ? -2 : -1) != 0)
+                return -1;
+        }
+    } else if (relaxed || RELAXED(mp)) {
+        /* Do it the generic, slower way */
+        PyObject *keys = PyMapping_Keys(b);
+        PyObject *iter;
+        PyObject *key, *value;
+        Py_ssize_t start = -1;
+        int status = 0;
+
+        if (keys == NULL)
+            /* Docstring says this is equivalent to E.keys() so
+             * if E doesn't have a .keys() method we want
+             * AttributeError to percolate up.  Might as well
+             * do the same for any other error.
+             */
+            return -1;
+
+        iter = PyObject_GetIter(keys);
+        Py_DECREF(keys);
+        if (iter == NULL)
+            return -1;
+
+        if (PySortedDict_Check(a))
+            start = sd_bulk_begin(mp);
+        for (key = PyIter_Next(iter); key; key = PyIter_Next(iter)) {
+            if (!override && PyOrderedDict_GetItem(a, key) != NULL) {
+                Py_DECREF(key);
+                continue;
+            }
+            value = PyObject_GetItem(b, key);
+            if (value == NULL) {
+                Py_DECREF(key);
+                status = -1;
+                break;
+            }
+            status = PyOrderedDict_SetItem(a, key, value);
+            Py_DECREF(key);
+            Py_DECREF(value);
+            if (status < 0)
+                break;
+        }
+        Py_DECREF(iter);
+        if (status == 0 && PyErr_Occurred())
+            /* Iterator completed, via error */
+            status = -1;
+        return sd_bulk_end(mp, start, status);
+    } else {
+        PyErr_SetString(PyExc_TypeError,
+                        "source has undefined order");
+        return -1;
+    }
+    return 0;
+}
+
+int
+PyOrderedDict_Merge(PyObject *a, PyObject *b, int override, int relaxed)
+{
+    int res;
+
+    if (a == NULL || !PyOrderedDict_Check(a)) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    OD_WRITE_DO(a, res = od_merge(a, b, override, relaxed));
+    return res;
+}
+
+
+/*
+Copy the count items of other from position start onwards, in steps of step,
+into the empty mp.  As the keys are known to be different, and their hashes
+are stored with them, the entries are just copied into a table made large
+enough up front, and od_indices is built in one pass afterwards, without any
+hashing or comparing of keys.  other must have its entries in order.
+The transformed keys of a sorteddict are copied along, for a sorteddict mp
+(which has to be sorted the same way).
+*/
+static int
+od_copy_range(PyOrderedDictObject *mp, PyOrderedDictObject *other,
+              Py_ssize_t start, Py_ssize_t step, Py_ssize_t count)
+{
+    PyOrderedDictEntry *src, *dst;
+    PyObject **tkeys = NULL, **otkeys = SD_TKEYS(other);
+    Py_ssize_t i;
+
+    assert(mp->ma_used == 0 && mp->od_nentries == 0);
+    assert(!OD_HAS_TOMBSTONES(other) && SD_ORDER(other) == NULL);
+    if (od_reserve(mp, count) < 0)
+        return -1;
+    if (PySortedDict_Check(mp) && otkeys != NULL) {
+        tkeys = SD_TKEYS(mp);
+        if (tkeys == NULL) {
+            tkeys = PyMem_NEW(PyObject *, mp->ma_mask + 1);
+            if (tkeys == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            memset(tkeys, 0, (mp->ma_mask + 1) * sizeof(PyObject *));
+            ((PySortedDictObject *) mp)->sd_tkeys = tkeys;
+        }
+    }
+    src = other->ma_table + start;
+    dst = mp->ma_table;
+    for (i = 0; i < count; i++, src += step, dst++) {
+        Py_INCREF(src->me_key);
+        Py_INCREF(src->me_value);
+        *dst = *src;
+        if (tkeys != NULL) {
+            tkeys[i] = otkeys[src - other->ma_table];
+            Py_XINCREF(tkeys[i]);
+        }
+    }
+    mp->ma_used = mp->od_nentries = count;
+    build_indices(mp);
+    OD_MOVED(mp);
+    return 0;
+}
+
+/*
+   assume that the start step and count are all within the
+   borders of what b provides
+*/
+int
+PyOrderedDict_CopySome(PyObject *a, PyObject *b,
+                       Py_ssize_t start, Py_ssize_t step,
+                       Py_ssize_t count, int override)
+{
+    register PyOrderedDictObject *mp, *other;
+    register Py_ssize_t i;
+    PyOrderedDictEntry *entry;
+
+    /* We accept for the argument either a concrete ordered dictionary object
+     */
+    if (a == NULL || !PyOrderedDict_Check(a) || b == NULL) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    mp = (PyOrderedDictObject*)a;
+    if (PyOrderedDict_CheckExact(b) || PySortedDict_CheckExact(b)) {
+        other = (PyOrderedDictObject*)b;
+        if (other == mp || other->ma_used == 0)
+            /* a.update(a) or a.update({}); nothing to do */
+            return 0;
+        if (mp->ma_used == 0)
+            /* Since the target dict is empty, PyOrderedDict_GetItem()
+             * always returns NULL.  Setting override to 1
+             * skips the unnecessary test.
+             */
+            override = 1;
+        OD_COMPACT(other);
+        if (mp->ma_used == 0 && (mp->od_maxsize == 0 || count <= mp->od_maxsize)
+                && (!PySortedDict_Check(mp) ||
+                    (PySortedDict_CheckExact(other) && SD_SAME_ORDER(mp, other))))
+            return od_copy_range(mp, other, start, step, count);
+        /* Do one big resize at the start, rather than
+         * incrementally resizing as we insert new items.  Expect
+         * that there will be no (or few) overlapping keys.
+         */
+        if (mp->od_nentries + count > mp->ma_mask + 1) {
+            if (dictresize(mp, (mp->ma_used + count)*2) != 0)
+                return -1;
+        }
+        entry = other->ma_table + start;
+        for (i = 0; i < count; i++, entry += step) {
+            if (override || PyOrderedDict_GetItem(a, entry->me_key) == NULL) {
+                Py_INCREF(entry->me_key);
+                Py_INCREF(entry->me_value);
+                if (insertdict(mp, entry->me_key,
+                               (long)entry->me_hash,
+                               entry->me_value, -1) != 0)
+                    return -1;
+            }
+        }
+    } else {
+        PyErr_SetString(PyExc_TypeError,
+                        "source has undefined order");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+dict_copy(register PyOrderedDictObject *mp)
+{
+    return PyOrderedDict_Copy((PyObject*)mp);
+}
+
+PyObject *
+PyOrderedDict_Copy(PyObject *o)
+{
+    PyObject *copy;
+
+    if (o == NULL || !PyOrderedDict_Check(o)) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
     if (PySortedDict_CheckExact(o)) {
+        PySortedDictObject *sd, *osd = (PySortedDictObject *) o;
         copy = PySortedDict_New();
         if (copy == NULL)
             return NULL;
-        ((PySortedDictObject *) copy)->sd_cmp = ((PySortedDictObject *) o)->sd_cmp;
-        ((PySortedDictObject *) copy)->sd_key = ((PySortedDictObject *) o)->sd_key;
-        ((PySortedDictObject *) copy)->sd_value = ((PySortedDictObject *) o)->sd_value;
+        sd = (PySortedDictObject *) copy;
+        /* replacing the Py_None references INIT_SORT_FUNCS took */
+        Py_INCREF(osd->sd_cmp);
+        Py_DECREF(sd->sd_cmp);
+        sd->sd_cmp = osd->sd_cmp;
+        Py_INCREF(osd->sd_key);
+        Py_DECREF(sd->sd_key);
+        sd->sd_key = osd->sd_key;
+        Py_INCREF(osd->sd_value);
+        Py_DECREF(sd->sd_value);
+        sd->sd_value = osd->sd_value;
+    } else if (PyOrderedDict_CheckExact(o) && OD_KEYS_SHARED((PyOrderedDictObject *) o)) {
+        /* shares the keys as well */
+        PyOrderedDictEntry *ep, *src = ((PyOrderedDictObject *) o)->ma_table;
+        Py_ssize_t i, n = ((PyOrderedDictObject *) o)->ma_used;
+
+        copy = od_shared_new(((PyOrderedDictObject *) o)->od_keys);
+        if (copy == NULL)
+            return NULL;
+        ep = ((PyOrderedDictObject *) copy)->ma_table;
+        for (i = 0; i < n; i++) {
+            Py_INCREF(src[i].me_value);
+            Py_DECREF(ep[i].me_value);	/* None */
+            ep[i].me_value = src[i].me_value;
+        }
+        ((PyOrderedDictObject *) copy)->od_state = ((PyOrderedDictObject *) o)->od_state;
+        ((PyOrderedDictObject *) copy)->od_maxsize = ((PyOrderedDictObject *) o)->od_maxsize;
+        return copy;
+    } else {
+        copy = PyOrderedDict_New();
+        if (copy == NULL)
+            return NULL;
+    }
+    ((PyOrderedDictObject *) copy)->od_state = ((PyOrderedDictObject *) o)->od_state;
+    ((PyOrderedDictObject *) copy)->od_maxsize = ((PyOrderedDictObject *) o)->od_maxsize;
+    if (PyOrderedDict_CheckExact(o) || PySortedDict_CheckExact(o)) {
+        if (PyOrderedDict_CopySome(copy, o, 0, 1,
+                                   ((PyOrderedDictObject *) o)->ma_used, 1) == 0)
+            return copy;
+    } else if (PyOrderedDict_Merge(copy, o, 1, 0) == 0)
+        return copy;
+    Py_DECREF(copy);
+    return NULL;
+}
+
+Py_ssize_t
+PyOrderedDict_Size(PyObject *mp)
+{
+    if (mp == NULL || !PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return -1;
+    }
+    return ((PyOrderedDictObject *)mp)->ma_used;
+}
+
+PY_UINT64_T
+PyOrderedDict_Version(PyObject *mp)
+{
+    if (mp == NULL || !PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return (PY_UINT64_T) -1;
+    }
+    return ((PyOrderedDictObject *)mp)->od_version;
+}
+
+PyObject *
+PyOrderedDict_Keys(PyObject *mp)
+{
+    if (mp == NULL || !PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
+    return dict_keys((PyOrderedDictObject *)mp, NULL, NULL);
+}
+
+PyObject *
+PyOrderedDict_Values(PyObject *mp)
+{
+    if (mp == NULL || !PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
+    return dict_values((PyOrderedDictObject *)mp, NULL, NULL);
+}
+
+PyObject *
+PyOrderedDict_Items(PyObject *mp)
+{
+    if (mp == NULL || !PyOrderedDict_Check(mp)) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
+    return dict_items((PyOrderedDictObject *)mp, NULL, NULL);
+}
+
+#ifndef OD_PY3
+/* Python 3 has no tp_compare (nor cmp()), only the rich comparisons */
+
+/* Subroutine which returns the smallest key in a for which b's value
+   is different or absent.  The value is returned too, through the
+   pval argument.  Both are NULL if no key in a is found for which b's status
+   differs.  The refcounts on (and only on) non-NULL *pval and function return
+   values must be decremented by the caller (characterize() increments them
+   to ensure that mutating comparison and PyOrderedDict_GetItem calls can't delete
+   them before the caller is done looking at them). */
+
+static PyObject *
+characterize(PyOrderedDictObject *a, PyOrderedDictObject *b, PyObject **pval)
+{
+    PyObject *akey = NULL; /* smallest key in a s.t. a[akey] != b[akey] */
+    PyObject *aval = NULL; /* a[akey] */
+    Py_ssize_t i;
+    int cmp;
+
+    for (i = 0; i < a->od_nentries; i++) {
+        PyObject *thiskey, *thisaval, *thisbval;
+        if (a->ma_table[i].me_value == NULL)
+            continue;
+        thiskey = a->ma_table[i].me_key;
+        Py_INCREF(thiskey);  /* keep alive across compares */
+        if (akey != NULL) {
+            cmp = PyObject_RichCompareBool(akey, thiskey, Py_LT);
+            if (cmp < 0) {
+                Py_DECREF(thiskey);
+                goto Fail;
+            }
+            if (cmp > 0 ||
+                    i >= a->od_nentries ||
+                    a->ma_table[i].me_value == NULL) {
+                /* Not the *smallest* a key; or maybe it is
+                 * but the compare shrunk the dict so we can't
+                 * find its associated value anymore; or
+                 * maybe it is but the compare deleted the
+                 * a[thiskey] entry.
+                 */
+                Py_DECREF(thiskey);
+                continue;
+            }
+        }
+
+        /* Compare a[thiskey] to b[thiskey]; cmp <- true iff equal. */
+        thisaval = a->ma_table[i].me_value;
+        assert(thisaval);
+        Py_INCREF(thisaval);   /* keep alive */
+        thisbval = PyOrderedDict_GetItem((PyObject *)b, thiskey);
+        if (thisbval == NULL)
+            cmp = 0;
+        else {
+            /* both dicts have thiskey:  same values? */
+            cmp = PyObject_RichCompareBool(
+                      thisaval, thisbval, Py_EQ);
+            if (cmp < 0) {
+                Py_DECREF(thiskey);
+                Py_DECREF(thisaval);
+                goto Fail;
+            }
+        }
+        if (cmp == 0) {
+            /* New winner. */
+            Py_XDECREF(akey);
+            Py_XDECREF(aval);
+            akey = thiskey;
+            aval = thisaval;
+        } else {
+            Py_DECREF(thiskey);
+            Py_DECREF(thisaval);
+        }
+    }
+    *pval = aval;
+    return akey;
+
+Fail:
+    Py_XDECREF(akey);
+    Py_XDECREF(aval);
+    *pval = NULL;
+    return NULL;
+}
+
+static int
+dict_compare(PyOrderedDictObject *a, PyOrderedDictObject *b)
+{
+    PyObject *adiff, *bdiff, *aval, *bval;
+    int res;
+
+    /* Compare lengths first */
+    if (a->ma_used < b->ma_used)
+        return -1;	/* a is shorter */
+    else if (a->ma_used > b->ma_used)
+        return 1;	/* b is shorter */
+
+    /* Same length -- check all keys */
+    bdiff = bval = NULL;
+    adiff = characterize(a, b, &aval);
+    if (adiff == NULL) {
+        assert(!aval);
+        /* Either an error, or a is a subset with the same length so
+         * must be equal.
+         */
+        res = PyErr_Occurred() ? -1 : 0;
+        goto Finished;
+    }
+    bdiff = characterize(b, a, &bval);
+    if (bdiff == NULL && PyErr_Occurred()) {
+        assert(!bval);
+        res = -1;
+        goto Finished;
+    }
+    res = 0;
+    if (bdiff) {
+        /* bdiff == NULL "should be" impossible now, but perhaps
+         * the last comparison done by the characterize() on a had
+         * the side effect of making the dicts equal!
+         */
+        res = PyObject_Compare(adiff, bdiff);
+    }
+    if (res == 0 && bval != NULL)
+        res = PyObject_Compare(aval, bval);
+
+Finished:
+    Py_XDECREF(adiff);
+    Py_XDECREF(bdiff);
+    Py_XDECREF(aval);
+    Py_XDECREF(bval);
+    return res;
+}
+#endif /* !OD_PY3 */
+
+/* Return 1 if dicts equal, 0 if not, -1 if error.
+ * The items are compared in order, walking both tables in lockstep without
+ * any lookups, and it gets out as soon as any difference is detected.
+ * Identical keys and values, and string keys, are compared without a call,
+ * keys whose stored hashes differ can't be equal.
+ * Uses only Py_EQ comparison.
+ */
+static int
+dict_equal(PyOrderedDictObject *a, PyOrderedDictObject *b)
+{
+    Py_ssize_t i;
+    PyOrderedDictEntry *ap, *bp;
+
+    if (a->ma_used != b->ma_used)
+        /* can't be equal if # of entries differ */
+        return 0;
+
+    OD_COMPACT(a);
+    OD_COMPACT(b);
+    /* Same # of entries -- check all of 'em.  Exit early on any diff. */
+    for (i = 0; i < a->ma_used; i++) {
+        int cmp;
+        PyObject *aval, *bval, *akey, *bkey;
+        ap = &a->ma_table[i];
+        bp = &b->ma_table[i];
+        aval = ap->me_value;
+        bval = bp->me_value;
+        akey = ap->me_key;
+        bkey = bp->me_key;
+        if (akey != bkey) {
+            if (ap->me_hash != bp->me_hash)
+                return 0;
+            /* comparing two strings can't run any code */
+            if (PyString_CheckExact(akey) && PyString_CheckExact(bkey)) {
+                if (!_PyString_Eq(akey, bkey))
+                    return 0;
+                akey = bkey;
+            }
+        }
+        if (akey == bkey && aval == bval)
+            continue;
+        /* temporarily bump aval's refcount to ensure it stays
+           alive until we're done with it */
+        Py_INCREF(aval);
+        Py_INCREF(bval);
+        /* ditto for key */
+        Py_INCREF(akey);
+        Py_INCREF(bkey);
+        cmp = akey == bkey ? 1 : PyObject_RichCompareBool(akey, bkey, Py_EQ);
+        if (cmp > 0) /* keys compare ok, now do values */
+            cmp = PyObject_RichCompareBool(aval, bval, Py_EQ);
+        Py_DECREF(bkey);
+        Py_DECREF(akey);
+        Py_DECREF(bval);
+        Py_DECREF(aval);
+        if (cmp <= 0)  /* error or not equal */
+            return cmp;
+        /* the comparisons above can mutate both dicts */
+        OD_COMPACT(a);
+        OD_COMPACT(b);
+        if (a->ma_used != b->ma_used)
+            return 0;
+    }
+    return 1;
+}
+
+/* Return 1 if a has the same items as the plain dict (or subclass) b, in
+ * any order, 0 if not, -1 if error.  This is not left to the reflected
+ * dict_richcompare() of b, which on Python 3 can't read a.
+ */
+static int
+dict_equal_plain(PyOrderedDictObject *a, PyObject *b)
+{
+    Py_ssize_t i;
+    PyObject *key, *aval, *bval;
+    int cmp;
+
+    if (a->ma_used != PyDict_Size(b))
+        return 0;
+    /* the comparisons can change a, don't hold on to its table */
+    for (i = 0; i < a->od_nentries; i++) {
+        aval = a->ma_table[i].me_value;
+        if (aval == NULL)
+            continue;
+        key = a->ma_table[i].me_key;
+        Py_INCREF(key);
+        Py_INCREF(aval);
+#ifdef OD_PY3
+        bval = PyDict_GetItemWithError(b, key);
+#else
+        bval = PyDict_GetItem(b, key);
+#endif
+        if (bval == NULL) {
+            Py_DECREF(key);
+            Py_DECREF(aval);
+            return PyErr_Occurred() ? -1 : 0;
+        }
+        Py_INCREF(bval);
+        cmp = PyObject_RichCompareBool(aval, bval, Py_EQ);
+        Py_DECREF(key);
+        Py_DECREF(aval);
+        Py_DECREF(bval);
+        if (cmp <= 0)
+            return cmp;
+    }
+    return 1;
+}
+
+static PyObject *
+dict_richcompare(PyObject *v, PyObject *w, int op)
+{
+    int cmp;
+    PyObject *res;
+
+    if (op != Py_EQ && op != Py_NE)
+        res = Py_NotImplemented;
+    else if (PyOrderedDict_Check(v) && PyOrderedDict_Check(w)) {
+        cmp = dict_equal((PyOrderedDictObject *)v, (PyOrderedDictObject *)w);
+        if (cmp < 0)
+            return NULL;
+        res = (cmp == (op == Py_EQ)) ? Py_True : Py_False;
+    } else if (PyOrderedDict_Check(v) && PyDict_Check(w)) {
+        cmp = dict_equal_plain((PyOrderedDictObject *)v, w);
+        if (cmp < 0)
+            return NULL;
+        res = (cmp == (op == Py_EQ)) ? Py_True : Py_False;
+    } else if (PyOrderedDict_Check(w) && PyDict_Check(v)) {
+        cmp = dict_equal_plain((PyOrderedDictObject *)w, v);
+        if (cmp < 0)
+            return NULL;
+        res = (cmp == (op == Py_EQ)) ? Py_True : Py_False;
+    } else
+        res = Py_NotImplemented;
+    Py_INCREF(res);
+    return res;
+}
+
+#ifdef Py_GIL_DISABLED
+static PyObject *
+dict_richcompare_locked(PyObject *v, PyObject *w, int op)
+{
+    PyObject *res;
+
+    Py_BEGIN_CRITICAL_SECTION2(v, w);
+    res = dict_richcompare(v, w, op);
+    Py_END_CRITICAL_SECTION2();
+    return res;
+}
+#endif
+
+static PyObject *
+dict_contains(register PyOrderedDictObject *mp, PyObject *key)
+{
+    long hash;
+    PyOrderedDictEntry *ep;
+
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ep = (mp->ma_lookup)(mp, key, hash);
+    if (ep == NULL)
+        return NULL;
+    return PyBool_FromLong(ep->me_value != NULL);
+}
+
+#ifndef OD_PY3
+static PyObject *
+dict_has_key(register PyOrderedDictObject *mp, PyObject *key)
+{
+#if PY_VERSION_HEX < 0x02060000
+    long hash;
+    PyOrderedDictEntry *ep;
+#endif
+
+#if PY_VERSION_HEX >= 0x02060000
+    if (Py_Py3kWarningFlag &&
+            PyErr_Warn(PyExc_DeprecationWarning,
+                       "dict.has_key() not supported in 3.x") < 0)
+        return NULL;
+    return dict_contains(mp, key);
+#else
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ep = (mp->ma_lookup)(mp, key, hash);
+    if (ep == NULL)
+        return NULL;
+    return PyBool_FromLong(ep->me_value != NULL);
+#endif
+}
+#endif /* !OD_PY3 */
+
+static PyObject *
+dict_get(register PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    PyObject *argv[2] = {NULL, Py_None};
+    PyObject *key, *failobj;
+    PyObject *val = NULL;
+    long hash;
+    Py_ssize_t ix, hashpos;
+
+    if (OD_UNPACK_ARGS("get", 1, 2, argv) < 0)
+        return NULL;
+    key = argv[0];
+    failobj = argv[1];
+
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0)
+        val = failobj;
+    else {
+        if (LRU(mp) && (ix = move_to_end(mp, ix, hashpos)) == OD_IX_ERROR)
+            return NULL;
+        val = mp->ma_table[ix].me_value;
+    }
+    Py_INCREF(val);
+    return val;
+}
+
+
+static PyObject *
+dict_setdefault(register PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    PyObject *argv[2] = {NULL, Py_None};
+    PyObject *key, *failobj;
+    PyObject *val = NULL;
+    long hash;
+    Py_ssize_t ix, hashpos;
+
+    if (OD_UNPACK_ARGS("setdefault", 1, 2, argv) < 0)
+        return NULL;
+    key = argv[0];
+    failobj = argv[1];
+
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0) {
+        val = failobj;
+        if (PyOrderedDict_SetItem((PyObject*)mp, key, failobj))
+            val = NULL;
+    } else {
+        if (LRU(mp) && (ix = move_to_end(mp, ix, hashpos)) == OD_IX_ERROR)
+            return NULL;
+        val = mp->ma_table[ix].me_value;
+    }
+    Py_XINCREF(val);
+    return val;
+}
+
+
+static PyObject *
+dict_clear(register PyOrderedDictObject *mp)
+{
+    OD_NOT_FROZEN(mp, NULL);
+    PyOrderedDict_Clear((PyObject *)mp);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+dict_pop(PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    long hash;
+    Py_ssize_t ix, hashpos;
+    PyObject *old_value, *old_key;
+    PyObject *argv[2] = {NULL, NULL};
+    PyObject *key, *deflt;
+
+    OD_NOT_FROZEN(mp, NULL);
+    if (OD_UNPACK_ARGS("pop", 1, 2, argv) < 0)
+        return NULL;
+    key = argv[0];
+    deflt = argv[1];
+    if (mp->ma_used == 0) {
+        if (deflt) {
+            Py_INCREF(deflt);
+            return deflt;
+        }
+        PyErr_SetString(PyExc_KeyError,
+                        "pop(): dictionary is empty");
+        return NULL;
+    }
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0) {
+        if (deflt) {
+            Py_INCREF(deflt);
+            return deflt;
+        }
+        set_key_error(key);
+        return NULL;
+    }
+    OD_UNSHARE(mp, NULL);
+    old_key = mp->ma_table[ix].me_key;
+    old_value = mp->ma_table[ix].me_value;
+    delete_entry(mp, ix, hashpos);
+    od_autoshrink(mp);
+    Py_DECREF(old_key);
+    return old_value;
+}
+
+static PyObject *
+dict_popitem(PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    Py_ssize_t i = -1, j, hashpos;
+    PyOrderedDictEntry *ep;
+    PyObject *res;
+    PyObject *argv[1] = {NULL};
+    sd_order *ot;
+
+    OD_NOT_FROZEN(mp, NULL);
+    /* Allocate the result tuple before checking the size.  Believe it
+     * or not, this allocation could trigger a garbage collection which
+     * could empty the dict, so if we checked the size first and that
+     * happened, the result would be an infinite loop (searching for an
+     * entry that no longer exists).  Note that the usual popitem()
+     * idiom is "while d: k, v = d.popitem()". so needing to throw the
+     * tuple away if the dict *is* empty isn't a significant
+     * inefficiency -- possible, but unlikely in practice.
+     */
+    if (OD_UNPACK_ARGS("popitem", 0, 1, argv) < 0)
+        return NULL;
+    if (argv[0] != NULL) {
+        i = PyNumber_AsSsize_t(argv[0], PyExc_OverflowError);
+        if (i == -1 && PyErr_Occurred())
+            return NULL;
+    }
+
+    res = PyTuple_New(2);
+    if (res == NULL)
+        return NULL;
+    if (mp->ma_used == 0) {
+        Py_DECREF(res);
+        PyErr_SetString(PyExc_KeyError,
+                        "popitem(): dictionary is empty");
+        return NULL;
+    }
+    if (i < 0)
+        j = mp->ma_used + i;
+    else
+        j = i;
+    if (j < 0 || j >= mp->ma_used) {
+        Py_DECREF(res);
+        PyErr_SetString(PyExc_KeyError,
+                        "popitem(): index out of range");
+        return NULL;
+    }
+    if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0) {
+        Py_DECREF(res);
+        return NULL;
+    }
+    ot = SD_ORDER(mp);
+    if (ot != NULL)
+        j = sd_order_at(ot, j);
+    else if (j == mp->ma_used - 1) /* the last one is never deleted */
+        j = mp->od_nentries - 1;
+    else if (j == 0) {
+        OD_SKIP_DELETED(mp);
+        j = mp->od_first;
+    } else
+        OD_COMPACT(mp);
+    ep = &mp->ma_table[j];
+    PyTuple_SET_ITEM(res, 0, ep->me_key);
+    PyTuple_SET_ITEM(res, 1, ep->me_value);
+    lookdict_ident(mp, ep->me_key, (long)ep->me_hash, &hashpos);
+    delete_entry(mp, j, hashpos);
+    od_autoshrink(mp);
+    return res;
+}
+
+static int
+dict_traverse(PyObject *op, visitproc visit, void *arg)
+{
+    Py_ssize_t i, n = ((PyOrderedDictObject *)op)->od_nentries;
+    PyOrderedDictEntry *ep = ((PyOrderedDictObject *)op)->ma_table;
+    PyObject **tkeys = SD_TKEYS(op);
+
+    /* not PyOrderedDict_Next(), the order doesn't matter here */
+    for (i = 0; i < n; i++, ep++) {
+        if (ep->me_value != NULL) {
+            Py_VISIT(ep->me_key);
+            Py_VISIT(ep->me_value);
+            if (tkeys != NULL)
+                Py_VISIT(tkeys[i]);
+        }
+    }
+    return 0;
+}
+
+static int
+dict_tp_clear(PyObject *op)
+{
+    PyOrderedDict_Clear(op);
+    return 0;
+}
+
+
+extern PyTypeObject PyOrderedDictIterKey_Type; /* Forward */
+extern PyTypeObject PyOrderedDictIterValue_Type; /* Forward */
+extern PyTypeObject PyOrderedDictIterItem_Type; /* Forward */
+static PyObject *dictiter_new(PyOrderedDictObject *, PyTypeObject *,
+                              PyObject *args, PyObject *kwds);
+static PyObject *dictiter_new_reversed(PyOrderedDictObject *,
+                                       PyTypeObject *);
+static PyObject *dictiter_range(PyOrderedDictObject *, PyTypeObject *,
+                                Py_ssize_t, Py_ssize_t, Py_ssize_t);
+
+static PyObject *
+dict_iterkeys(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictiter_new(dict, &PyOrderedDictIterKey_Type, args, kwds);
+}
+
+static PyObject *
+dict_itervalues(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictiter_new(dict, &PyOrderedDictIterValue_Type, args, kwds);
+}
+
+static PyObject *
+dict_iteritems(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictiter_new(dict, &PyOrderedDictIterItem_Type, args, kwds);
+}
+
+static PyObject *
+dict_reversed(PyOrderedDictObject *dict)
+{
+    return dictiter_new_reversed(dict, &PyOrderedDictIterKey_Type);
+}
+
+/* the one dict inherits assumes the layout of a dict; this counts the
+   tables (those being grown from and to as well), the counters and, for a
+   sorteddict, the transformed keys and the sort order */
+static PyObject *
+dict_sizeof(PyOrderedDictObject *mp)
+{
+    Py_ssize_t res, size = mp->od_imask + 1;
+    od_rehash *rh = mp->od_rehash;
+    sd_order *ot = SD_ORDER(mp);
+
+    res = Py_TYPE(mp)->tp_basicsize;
+    if (OD_KEYS_SHARED(mp))
+        /* the indices are those of the sharedkeys */
+        res += (mp->ma_mask + 2) * sizeof(PyOrderedDictEntry);
+    else if (mp->ma_table != mp->ma_smalltable)
+        res += OD_BLOCKSIZE(size);
+    if (rh != NULL) {
+        res += sizeof(od_rehash);
+        if (rh->rh_oldindices != NULL)
+            res += OD_BLOCKSIZE(rh->rh_oldimask + 1);
+        if (rh->rh_next != NULL)
+            res += OD_BLOCKSIZE(rh->rh_nextimask + 1);
+    }
+    if (mp->od_stats != NULL)
+        res += sizeof(od_stats);
+    if (SD_TKEYS(mp) != NULL)
+        res += (mp->ma_mask + 1) * sizeof(PyObject *);
+    if (ot != NULL)
+        res += sizeof(sd_order) + ot->ot_nblocks * sizeof(sd_block) +
+            ot->ot_allocated * (sizeof(sd_block *) + sizeof(Py_ssize_t)) +
+            (mp->ma_mask + 1) * sizeof(sd_where);
+    return PyInt_FromSsize_t(res);
+}
+
+extern PyTypeObject PyOrderedDictKeys_Type; /* Forward */
+extern PyTypeObject PyOrderedDictValues_Type; /* Forward */
+extern PyTypeObject PyOrderedDictItems_Type; /* Forward */
+static PyObject *dictview_new(PyOrderedDictObject *, PyTypeObject *,
+                              PyObject *args, PyObject *kwds);
+
+static PyObject *
+dict_viewkeys(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictview_new(dict, &PyOrderedDictKeys_Type, args, kwds);
+}
+
+static PyObject *
+dict_viewvalues(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictview_new(dict, &PyOrderedDictValues_Type, args, kwds);
+}
+
+static PyObject *
+dict_viewitems(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+{
+    return dictview_new(dict, &PyOrderedDictItems_Type, args, kwds);
+}
+
+/* index in ma_table of the item at position pos (which has to exist) */
+static Py_ssize_t
+od_entry_at(PyOrderedDictObject *mp, Py_ssize_t pos)
+{
+    if (SD_ORDER(mp) != NULL)
+        return sd_order_at(SD_ORDER(mp), pos);
+    OD_COMPACT(mp);
+    return pos;
+}
+
+/* position of the item in the Active entry ix, which has the given hash */
+static Py_ssize_t
+od_position(PyOrderedDictObject *mp, Py_ssize_t ix, long hash)
+{
+    PyObject *key;
+    Py_ssize_t hashpos;
+
+    if (SD_ORDER(mp) != NULL)
+        return sd_order_position(SD_ORDER(mp), ix);
+    /* the entry index is only the position once there are no deleted
+       entries before it */
+    if (OD_HAS_TOMBSTONES(mp)) {
+        key = mp->ma_table[ix].me_key;
+        compact_entries(mp);
+        ix = lookdict_ident(mp, key, hash, &hashpos);
+    }
+    return ix;
+}
+
+static PyObject *
+dict_index(register PyOrderedDictObject *mp, PyObject *key)
+{
+    long hash;
+    Py_ssize_t ix, hashpos;
+
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return NULL;
+    }
+    ix = OD_LOOKUP(mp, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return NULL;
+    if (ix < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "ordereddict.index(x): x not a key in ordereddict"
+                       );
+        return NULL;
+    }
+    return PyInt_FromSize_t(od_position(mp, ix, hash));
+}
+
+/* -1 with TypeError if mp is not a sorteddict, for the methods of those */
+static int
+sd_only(PyOrderedDictObject *mp, const char *name)
+{
+    if (PySortedDict_Check(mp))
+        return 0;
+    PyErr_Format(PyExc_TypeError, "ordereddict does not support %s()", name);
+    return -1;
+}
+
+/* the position in sorteddict mp before which no key compares op (Py_GT,
+   Py_GE) to key, as sd_search() does for its transformed key; -1 on error */
+static Py_ssize_t
+sd_bisect(PyOrderedDictObject *mp, PyObject *key, int op)
+{
+    PyObject *transkey;
+    sd_block *b;
+    Py_ssize_t pos, offset;
+
+    transkey = sd_transform((PySortedDictObject *) mp, key);
+    do
+        pos = sd_search(mp, transkey, op, &b, &offset);
+    while (pos == -2);
+    Py_DECREF(transkey);
+    return pos;
+}
+
+static PyObject *
+dict_bisect_left(register PyOrderedDictObject *mp, PyObject *key)
+{
+    Py_ssize_t pos;
+
+    if (sd_only(mp, "bisect_left") < 0)
+        return NULL;
+    pos = sd_bisect(mp, key, Py_GE);
+    if (pos < 0)
+        return NULL;
+    return PyInt_FromSsize_t(pos);
+}
+
+static PyObject *
+dict_bisect_right(register PyOrderedDictObject *mp, PyObject *key)
+{
+    Py_ssize_t pos;
+
+    if (sd_only(mp, "bisect_right") < 0)
+        return NULL;
+    pos = sd_bisect(mp, key, Py_GT);
+    if (pos < 0)
+        return NULL;
+    return PyInt_FromSsize_t(pos);
+}
+
+/* floor() and ceiling(): the key at the position before or at the bisection
+   of key, the default if there is none */
+static PyObject *
+sd_nearest(PyOrderedDictObject *mp, const char *name, int floor,
+           OD_FAST_ARGS)
+{
+    PyObject *argv[2] = {NULL, NULL};
+    PyObject *res;
+    Py_ssize_t pos;
+
+    if (sd_only(mp, name) < 0 || OD_UNPACK_ARGS(name, 1, 2, argv) < 0)
+        return NULL;
+    pos = sd_bisect(mp, argv[0], floor ? Py_GT : Py_GE);
+    if (pos == -1)
+        return NULL;
+    if (floor)
+        pos--;
+    if (pos < 0 || pos >= mp->ma_used) {
+        if (argv[1] == NULL) {
+            set_key_error(argv[0]);
+            return NULL;
+        }
+        res = argv[1];
+    } else
+        res = mp->ma_table[od_entry_at(mp, pos)].me_key;
+    Py_INCREF(res);
+    return res;
+}
+
+static PyObject *
+dict_floor(register PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    return sd_nearest(mp, "floor", 1, OD_FAST_PASS);
+}
+
+static PyObject *
+dict_ceiling(register PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    return sd_nearest(mp, "ceiling", 0, OD_FAST_PASS);
+}
+
+static PyObject *
+dict_irange(register PyOrderedDictObject *mp, PyObject *args, PyObject *kwds)
+{
+    PyObject *minimum = Py_None, *maximum = Py_None;
+    int lowincl = 1, highincl = 1, reverse = 0;
+    Py_ssize_t start = 0, end;
+    static char *kwlist[] = {"minimum", "maximum", "inclusive", "reverse", 0};
+
+    if (sd_only(mp, "irange") < 0)
+        return NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO(ii)i:irange", kwlist,
+                                     &minimum, &maximum, &lowincl, &highincl,
+                                     &reverse))
+        return NULL;
+    end = mp->ma_used;
+    if (minimum != Py_None &&
+            (start = sd_bisect(mp, minimum, lowincl ? Py_GE : Py_GT)) < 0)
+        return NULL;
+    if (maximum != Py_None &&
+            (end = sd_bisect(mp, maximum, highincl ? Py_GT : Py_GE)) < 0)
+        return NULL;
+    if (end < start)
+        end = start;
+    if (reverse)
+        return dictiter_range(mp, &PyOrderedDictIterKey_Type, end - 1, -1,
+                              end - start);
+    return dictiter_range(mp, &PyOrderedDictIterKey_Type, start, 1,
+                          end - start);
+}
+
+static PyObject *
+dict_insert(PyOrderedDictObject *mp, OD_FAST_ARGS)
+{
+    Py_ssize_t i;
+    PyObject *argv[3];
+
+    if (OD_UNPACK_ARGS("insert", 3, 3, argv) < 0)
+        return NULL;
+    i = PyNumber_AsSsize_t(argv[0], PyExc_OverflowError);
+    if (i == -1 && PyErr_Occurred())
+        return NULL;
+    if(PyOrderedDict_InsertItem(mp, i, argv[1], argv[2]) != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+dict_reverse(register PyOrderedDictObject *mp)
+{
+    PyOrderedDictEntry *eps, *epe, tmp;
+    PyObject **tkeys, *tk;
+    Py_ssize_t i, j;
+
+    OD_NOT_FROZEN(mp, NULL);
+    OD_UNSHARE(mp, NULL);
+    OD_COMPACT(mp);
+    eps = mp->ma_table;
+    epe = eps + ((mp->ma_used)-1);
+    while (eps < epe) {
+        tmp = *eps;
+        *eps++ = *epe;
+        *epe-- = tmp;
+    }
+    tkeys = SD_TKEYS(mp);
+    if (tkeys != NULL)
+        for (i = 0, j = mp->ma_used - 1; i < j; i++, j--) {
+            tk = tkeys[i];
+            tkeys[i] = tkeys[j];
+            tkeys[j] = tk;
+        }
+    build_indices(mp);
+    OD_MOVED(mp);
+    Py_RETURN_NONE;
+}
+
+/*
+Put the entries of mp in the order given by perm: afterwards position i
+holds the entry that was at position perm[i].  perm has to be a
+permutation of range(ma_used), and the table must not have holes.  The
+cycles of the permutation are followed in place, done (ma_used bytes) is
+scratch space to mark the positions already filled.  The hash values are
+kept in the entries, so the indices are rebuilt without hashing a key.
+*/
+static void
+od_permute(PyOrderedDictObject *mp, Py_ssize_t *perm, char *done)
+{
+    PyOrderedDictEntry *ep = mp->ma_table, tmp;
+    PyObject **tkeys = SD_TKEYS(mp), *tk = NULL;
+    Py_ssize_t n = mp->ma_used, s, j, k;
+
+    assert(!OD_HAS_TOMBSTONES(mp));
+    memset(done, 0, n);
+    for (s = 0; s < n; s++) {
+        if (done[s] || perm[s] == s)
+            continue;
+        tmp = ep[s];
+        if (tkeys != NULL)
+            tk = tkeys[s];
+        for (j = s; (k = perm[j]) != s; j = k) {
+            ep[j] = ep[k];
+            if (tkeys != NULL)
+                tkeys[j] = tkeys[k];
+            done[j] = 1;
+        }
+        ep[j] = tmp;
+        if (tkeys != NULL)
+            tkeys[j] = tk;
+        done[j] = 1;
+    }
+    build_indices(mp);
+    OD_MOVED(mp);
+}
+
+/* room for a permutation of n positions and n bytes of marks behind it */
+static Py_ssize_t *
+od_perm_new(Py_ssize_t n, char **marks)
+{
+    Py_ssize_t *perm;
+
+    if (n > (PY_SSIZE_T_MAX - 1) / (Py_ssize_t)(sizeof(Py_ssize_t) + 1)) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    perm = (Py_ssize_t *)PyMem_MALLOC(n * (sizeof(Py_ssize_t) + 1) + 1);
+    if (perm == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    *marks = (char *)(perm + n);
+    memset(*marks, 0, n);
+    return perm;
+}
+
+static PyObject *
+dict_setkeys(register PyOrderedDictObject *mp, PyObject *keys)
+{
+    PyObject *seq, *key;
+    Py_ssize_t n, i, ix, hashpos, *perm = NULL;
+    char *seen;
+    long hash;
+
+    OD_NOT_FROZEN(mp, NULL);
+    if (PySortedDict_CheckExact(mp)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "sorteddict does not support setkeys() assignment");
+        return NULL;
+    }
+    /* lists and tuples are used as is, anything else is read into a list
+       first, so that nothing is changed until all keys have been checked */
+    seq = PySequence_Fast(keys, "ordereddict setkeys requires an iterable");
+    if (seq == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n != mp->ma_used) {
+        PyErr_Format(PyExc_ValueError,
+                     "ordereddict setkeys requires sequence of length #%zd; "
+                     "provided was length %zd",
+                     mp->ma_used, n);
+        goto Fail;
+    }
+    OD_COMPACT(mp);
+    perm = od_perm_new(n, &seen);
+    if (perm == NULL)
+        goto Fail;
+    for (i = 0; i < n; i++) {
+        if (i >= PySequence_Fast_GET_SIZE(seq)) {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "sequence changed size during setkeys()");
+            goto Fail;
+        }
+        key = PySequence_Fast_GET_ITEM(seq, i);
+        Py_INCREF(key);
+        if (!PyString_CheckExact(key) ||
+                (hash = OD_STR_HASH(key)) == -1) {
+            hash = PyObject_Hash(key);
+            if (hash == -1) {
+                Py_DECREF(key);
+                goto Fail;
+            }
+        }
+        ix = OD_LOOKUP(mp, key, hash, &hashpos);
+        Py_DECREF(key);
+        if (ix == OD_IX_ERROR)
+            goto Fail;
+        /* a key's __eq__ may have changed the dict */
+        if (mp->ma_used != n || OD_HAS_TOMBSTONES(mp)) {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "dictionary changed size during setkeys()");
+            goto Fail;
+        }
+        if (ix < 0) {
+            PyErr_Format(PyExc_KeyError,
+                         "ordereddict setkeys unknown key at pos " SPR,
+                         i);
+            goto Fail;
+        }
+        if (seen[ix]) {
+            PyErr_Format(PyExc_KeyError,
+                         "ordereddict setkeys same key twice, the second at pos " SPR,
+                         i);
+            goto Fail;
+        }
+        seen[ix] = 1;
+        perm[i] = ix;
+    }
+    if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0)
+        goto Fail;
+    od_permute(mp, perm, seen);
+    PyMem_FREE(perm);
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+Fail:
+    if (perm != NULL)
+        PyMem_FREE(perm);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/* reorder by positions only: no key is hashed or compared */
+static PyObject *
+dict_reorder(register PyOrderedDictObject *mp, PyObject *indices)
+{
+    PyObject *seq, *item;
+    Py_ssize_t n, i, ix, *perm = NULL;
+    char *seen;
+
+    OD_NOT_FROZEN(mp, NULL);
+    if (PySortedDict_CheckExact(mp)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "sorteddict does not support reorder()");
+        return NULL;
+    }
+    seq = PySequence_Fast(indices, "ordereddict reorder requires an iterable");
+    if (seq == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n != mp->ma_used) {
+        PyErr_Format(PyExc_ValueError,
+                     "ordereddict reorder requires sequence of length #%zd; "
+                     "provided was length %zd",
+                     mp->ma_used, n);
+        goto Fail;
+    }
+    perm = od_perm_new(n, &seen);
+    if (perm == NULL)
+        goto Fail;
+    for (i = 0; i < n; i++) {
+        if (i >= PySequence_Fast_GET_SIZE(seq)) {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "sequence changed size during reorder()");
+            goto Fail;
+        }
+        item = PySequence_Fast_GET_ITEM(seq, i);
+        if (OD_INT_CHECKEXACT(item))
+            ix = OD_INT_AS_LONG(item);
+        else {
+            Py_INCREF(item);
+            ix = PyNumber_AsSsize_t(item, PyExc_IndexError);
+            Py_DECREF(item);
+            if (ix == -1 && PyErr_Occurred())
+                goto Fail;
+        }
+        if (ix < 0 || ix >= n || seen[ix]) {
+            PyErr_Format(PyExc_ValueError,
+                         "ordereddict reorder requires a permutation of "
+                         "range(%zd); got %zd at pos %zd",
+                         n, ix, i);
+            goto Fail;
+        }
+        seen[ix] = 1;
+        perm[i] = ix;
+    }
+    /* an __index__ method may have changed the dict */
+    if (mp->ma_used != n) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "dictionary changed size during reorder()");
+        goto Fail;
+    }
+    OD_COMPACT(mp);
+    if (OD_KEYS_SHARED(mp) && od_unshare(mp) < 0)
+        goto Fail;
+    od_permute(mp, perm, seen);
+    PyMem_FREE(perm);
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+Fail:
+    if (perm != NULL)
+        PyMem_FREE(perm);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+static PyObject *
+dict_setvalues(register PyOrderedDictObject *mp, PyObject *values)
+{
+    PyObject *seq, **items, **old;
+    Py_ssize_t n, i;
+    PyOrderedDictEntry *ep;
+
+    assert(mp != NULL);
+    assert(PyOrderedDict_Check(mp));
+    assert(values != NULL);
+    OD_NOT_FROZEN(mp, NULL);
+    seq = PySequence_Fast(values, "ordereddict setvalues requires an iterable");
+    if (seq == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n != mp->ma_used) {
+        PyErr_Format(PyExc_ValueError,
+                     "ordereddict setvalues requires sequence of length #%zd; "
+                     "provided was length %zd",
+                     mp->ma_used, n);
+        Py_DECREF(seq);
+        return NULL;
+    }
+    old = PyMem_NEW(PyObject *, n + 1);
+    if (old == NULL) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    OD_COMPACT(mp);
+    /* swap all values in before releasing the old ones, their __del__
+       may change the dict */
+    ep = mp->ma_table;
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < n; i++) {
+        old[i] = ep[i].me_value;
+        Py_INCREF(items[i]);
+        OD_SHARE(items[i]);
+        ep[i].me_value = items[i];
+    }
+    OD_CHANGED(mp);
+    Py_DECREF(seq);
+    for (i = 0; i < n; i++)
+        Py_DECREF(old[i]);
+    PyMem_DEL(old);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+dict_setitems(register PyObject *mp,  PyObject *args, PyObject *kwds)
+{
+    OD_NOT_FROZEN((PyOrderedDictObject *) mp, NULL);
+    PyOrderedDict_Clear((PyObject *)mp);
+    if (dict_update_common(mp, args, kwds, "|Oi:setitems") != -1)
+        Py_RETURN_NONE;
+    return NULL;
+}
+
+static PyObject *
+dict_rename(register PyOrderedDictObject *mp, PyObject *args)
+{
+    PyObject *oldkey, *newkey;
+    PyObject *val = NULL;
+    long hash;
+    Py_ssize_t hashpos;
+    register Py_ssize_t index;
+
+    OD_NOT_FROZEN(mp, NULL);
+    if (PySortedDict_CheckExact(mp)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "sorteddict does not support rename()");
+        return NULL;
+    }
+    if (!PyArg_UnpackTuple(args, "get", 1, 2, &oldkey, &newkey))
+        return NULL;
+
+    if (!PyString_CheckExact(oldkey) ||
+            (hash = OD_STR_HASH(oldkey)) == -1) {
+        hash = PyObject_Hash(oldkey);
+        if (hash == -1)
+            return NULL;
+    }
+    index = OD_LOOKUP(mp, oldkey, hash, &hashpos);
+    if (index == OD_IX_ERROR)
+        return NULL;
+    if (index < 0) {
+        set_key_error(oldkey);
+        return NULL;
+    }
+    OD_UNSHARE(mp, NULL);
+    oldkey = mp->ma_table[index].me_key; /* now point to key from item */
+    if (OD_HAS_TOMBSTONES(mp)) {
+        compact_entries(mp);
+        index = lookdict_ident(mp, oldkey, hash, &hashpos);
+    }
+    val = mp->ma_table[index].me_value;
+    delete_entry(mp, index, hashpos);
+    Py_DECREF(oldkey);
+    if(PyOrderedDict_InsertItem(mp, index, newkey, val) != 0)
+        return NULL;
+    Py_DECREF(val);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+dict_compact(register PyOrderedDictObject *mp)
+{
+    if (OD_KEYS_SHARED(mp))
+        /* its table is as small as it gets */
+        Py_RETURN_NONE;
+    if (dictresize(mp, mp->ma_used) != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+dict_reserve(register PyOrderedDictObject *mp, PyObject *arg)
+{
+    Py_ssize_t n = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+
+    if (n == -1 && PyErr_Occurred())
+        return NULL;
+    if (od_reserve(mp, n) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/* support for pickling */
+static PyObject *
+dict_reduce(PyOrderedDictObject *self)
+{
+    PyObject *result, *it, *dict=NULL;
+    it = dictiter_new(self, &PyOrderedDictIterItem_Type, NULL, NULL);
+    if (it == NULL)
+        return NULL;
+    dict = Py_None;
+    Py_INCREF(dict);
+    Py_INCREF(dict);
+    if (PySortedDict_CheckExact(self)) {
+        if (((PySortedDictObject *) self)->sd_cmp == NULL)
+            printf("NULL!!!!\n");
+        result = Py_BuildValue("O(()OOOi)NNN", Py_TYPE(self),
+                               ((PySortedDictObject *) self)->sd_cmp,
+                               ((PySortedDictObject *) self)->sd_key,
+                               ((PySortedDictObject *) self)->sd_value,
+                               REVERSE(self), dict, dict, it);
     } else {
-        copy = PyOrderedDict_New();
-        if (copy == NULL)
+        result = Py_BuildValue("O(()iinin)NNN", Py_TYPE(self), RELAXED(self),
+                               KVIO(self), (Py_ssize_t) 0, LRU(self) != 0,
+                               self->od_maxsize, dict, dict, it);
+    }
+    return result;
+}
+
+
+/* the bits of od_state that __setstate__ takes over for an ordereddict */
+#define OD_PICKLE_BITS (OD_KVIO_BIT | OD_RELAXED_BIT | OD_LRU_BIT)
+
+/*
+From protocol 2 on the items are not pickled as an iterator of pairs, but
+as the state (od_state, (key0, value0, key1, value1, ...)), which
+__setstate__ adds in one go.  Subclasses use their __reduce__.
+*/
+static PyObject *
+dict_reduce_ex(PyOrderedDictObject *self, PyObject *args)
+{
+    PyObject *result, *flat;
+    PyOrderedDictEntry *ep;
+    Py_ssize_t i, n;
+    int proto = 0;
+
+    if (!PyArg_ParseTuple(args, "|i:__reduce_ex__", &proto))
+        return NULL;
+    if (!PyOrderedDict_CheckExact(self) && !PySortedDict_CheckExact(self))
+        return PyObject_CallMethod((PyObject *) self, "__reduce__", NULL);
+    if (proto < 2)
+        return dict_reduce(self);
+    OD_COMPACT(self);
+    flat = PyTuple_New(2 * self->ma_used);
+    if (flat == NULL)
+        return NULL;
+    ep = self->ma_table;
+    for (i = 0, n = 0; i < self->ma_used; i++, ep++) {
+        Py_INCREF(ep->me_key);
+        PyTuple_SET_ITEM(flat, n++, ep->me_key);
+        Py_INCREF(ep->me_value);
+        PyTuple_SET_ITEM(flat, n++, ep->me_value);
+    }
+    if (PySortedDict_CheckExact(self))
+        result = Py_BuildValue("O(()OOOi)(lN)", Py_TYPE(self),
+                               ((PySortedDictObject *) self)->sd_cmp,
+                               ((PySortedDictObject *) self)->sd_key,
+                               ((PySortedDictObject *) self)->sd_value,
+                               REVERSE(self), self->od_state, flat);
+    else
+        result = Py_BuildValue("O(()iinin)(lN)", Py_TYPE(self), RELAXED(self),
+                               KVIO(self), (Py_ssize_t) 0, LRU(self) != 0,
+                               self->od_maxsize, self->od_state, flat);
+    return result;
+}
+
+/*
+Add the items of a state made by __reduce_ex__.  The table is made big
+enough for all of them first.  A sorteddict adds them as a bulk update,
+so the items of a pickled one, already in order, take one comparison
+each; the state is not trusted to be sorted.
+*/
+static PyObject *
+dict_setstate(PyOrderedDictObject *mp, PyObject *state)
+{
+    PyObject *seq, *key, *value;
+    Py_ssize_t i, n, start = -1;
+    long flags, hash;
+    int res = 0;
+
+    OD_NOT_FROZEN(mp, NULL);
+    if (!PyTuple_Check(state) ||
+            !PyArg_ParseTuple(state, "lO:__setstate__", &flags, &seq)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_TypeError,
+                            "ordereddict state must be a tuple");
+        return NULL;
+    }
+    seq = PySequence_Fast(seq, "ordereddict state items must be a sequence");
+    if (seq == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n & 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "ordereddict state needs a value for every key");
+        Py_DECREF(seq);
+        return NULL;
+    }
+    if (PySortedDict_Check(mp))
+        start = sd_bulk_begin(mp);
+    else
+        mp->od_state = (mp->od_state & ~OD_PICKLE_BITS) |
+                       (flags & OD_PICKLE_BITS);
+    if (n > 0 && (mp->od_maxsize == 0 || n / 2 <= mp->od_maxsize) &&
+            od_reserve(mp, mp->ma_used + n / 2) < 0)
+        res = -1;
+    for (i = 0; res == 0 && i + 1 < PySequence_Fast_GET_SIZE(seq); i += 2) {
+        key = PySequence_Fast_GET_ITEM(seq, i);
+        value = PySequence_Fast_GET_ITEM(seq, i + 1);
+        Py_INCREF(key);
+        Py_INCREF(value);
+        if (!PyString_CheckExact(key) ||
+                (hash = OD_STR_HASH(key)) == -1) {
+            hash = PyObject_Hash(key);
+            if (hash == -1) {
+                Py_DECREF(key);
+                Py_DECREF(value);
+                res = -1;
+                break;
+            }
+        }
+        /* both eat the references */
+        if (start >= 0)
+            res = sd_append(mp, key, hash, value);
+        else
+            res = insertdict(mp, key, hash, value, KVIO(mp) ? -2 : -1);
+    }
+    Py_DECREF(seq);
+    res = sd_bulk_end(mp, start, res);
+    if (res < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+
+/*
+A snapshot is a read-only binary image of an ordereddict whose keys and
+values are str, unicode, int, long, bool, float or None, that
+snapshotdict() can use in place (e.g. over an mmap) without unpickling.
+All fields are 64 bit in native byte order, the image consists of:
+
+- the header (od_snaphead)
+- sn_used entries (od_snapentry) in the order of the dict, with the hash
+  of the key and the offsets of its key and value records
+- sn_mask + 1 index slots, holding the entry index or -1, filled using the
+  same probe sequence as lookdict()
+- the records: a tag of 8 bytes, then 8 bytes holding the number or the
+  length of the string data that follows (padded to a multiple of 8); an
+  int that doesn't fit in 64 bits has its bytes there instead (tag 'L',
+  two's complement, little endian)
+
+String hashes depend on the hash seed (-R), sn_probe is the hash of a fixed
+string, so that an image is not used with a different one.
+*/
+#define OD_SNAPMAGIC "odsnap1"
+
+typedef struct {
+    char sn_magic[8];
+    PY_LONG_LONG sn_size;		/* size of the image in bytes */
+    PY_LONG_LONG sn_used;
+    PY_LONG_LONG sn_mask;
+    PY_LONG_LONG sn_probe;
+} od_snaphead;
+
+typedef struct {
+    PY_LONG_LONG se_hash;
+    PY_LONG_LONG se_key;		/* offsets of the records */
+    PY_LONG_LONG se_value;
+} od_snapentry;
+
+#define OD_SNAP_ALIGN(n) (((n) + 7) & ~(Py_ssize_t)7)
+#define OD_SNAP_INDEX(used) ((PY_LONG_LONG) sizeof(od_snaphead) + \
+	(used) * (PY_LONG_LONG) sizeof(od_snapentry))
+
+static long
+od_snap_probe(void)
+{
+    PyObject *s = PyString_FromString("ordereddict snapshot");
+    long hash;
+
+    if (s == NULL)
+        return -1;
+    hash = PyObject_Hash(s);
+    Py_DECREF(s);
+    return hash;
+}
+
+/* the bytes of an int for an 'L' record: how many it takes (-1 on error),
+   writing them, and making the int from them */
+#if PY_VERSION_HEX >= 0x030D0000
+#define OD_LONG_NBYTES(o)	\
+	PyLong_AsNativeBytes(o, NULL, 0, Py_ASNATIVEBYTES_LITTLE_ENDIAN)
+#define OD_LONG_AS_BYTES(o, b, n)	\
+	PyLong_AsNativeBytes(o, b, n, Py_ASNATIVEBYTES_LITTLE_ENDIAN)
+#define OD_LONG_FROM_BYTES(b, n)	\
+	PyLong_FromNativeBytes(b, n, Py_ASNATIVEBYTES_LITTLE_ENDIAN)
+#else
+#define OD_LONG_NBYTES(o)	od_long_nbytes(o)
+#define OD_LONG_AS_BYTES(o, b, n)	_PyLong_AsByteArray(	\
+	(PyLongObject *) (o), (unsigned char *) (b), n, 1, 1)
+#define OD_LONG_FROM_BYTES(b, n)	\
+	_PyLong_FromByteArray((const unsigned char *) (b), n, 1, 1)
+
+static Py_ssize_t
+od_long_nbytes(PyObject *o)
+{
+    size_t nbits = _PyLong_NumBits(o);
+
+    if (nbits == (size_t) -1 && PyErr_Occurred())
+        return -1;
+    return (Py_ssize_t) (nbits / 8 + 1);	/* and the sign bit */
+}
+#endif
+
+/*
+Size of the record for o, writing it at buf if that is not NULL; -1 with
+TypeError for objects that can't be stored.
+*/
+static Py_ssize_t
+od_snap_record(PyObject *o, char *buf)
+{
+    char tag[8] = {0};
+    PY_LONG_LONG n = 0;
+    double d;
+    PyObject *utf8 = NULL;
+    const char *data = NULL;
+    Py_ssize_t len = 0;
+    int big = 0;
+
+    if (PyBytes_CheckExact(o)) {
+        tag[0] = 's';
+        data = PyBytes_AS_STRING(o);
+        n = len = PyBytes_GET_SIZE(o);
+    }
+    else if (PyUnicode_CheckExact(o)) {
+        utf8 = PyUnicode_AsUTF8String(o);
+        if (utf8 == NULL)
+            return -1;
+        tag[0] = 'u';
+        data = PyBytes_AS_STRING(utf8);
+        n = len = PyBytes_GET_SIZE(utf8);
+    }
+    else if (PyBool_Check(o)) {
+        tag[0] = 'b';
+        n = o == Py_True;
+    }
+    else if (OD_INT_CHECKEXACT(o)) {
+        tag[0] = 'i';
+        n = OD_INT_AS_LONG(o);
+    }
+    else if (PyLong_CheckExact(o)) {
+        tag[0] = 'l';
+        n = PyLong_AsLongLong(o);
+        if (n == -1 && PyErr_Occurred()) {
+            if (!PyErr_ExceptionMatches(PyExc_OverflowError))
+                return -1;
+            PyErr_Clear();
+            tag[0] = 'L';
+            n = len = OD_LONG_NBYTES(o);
+            if (len < 0)
+                return -1;
+            big = 1;
+        }
+    }
+    else if (PyFloat_CheckExact(o)) {
+        tag[0] = 'f';
+        d = PyFloat_AS_DOUBLE(o);
+        memcpy(&n, &d, sizeof(d));
+    }
+    else if (o == Py_None)
+        tag[0] = 'n';
+    else {
+        PyErr_Format(PyExc_TypeError, "snapshot() can't store a '%.200s'",
+                     Py_TYPE(o)->tp_name);
+        return -1;
+    }
+    if (buf != NULL) {
+        memcpy(buf, tag, 8);
+        memcpy(buf + 8, &n, 8);
+        if (big) {
+            if (OD_LONG_AS_BYTES(o, buf + 16, len) < 0)
+                return -1;
+        }
+        else if (len > 0)
+            memcpy(buf + 16, data, len);
+        memset(buf + 16 + len, 0, OD_SNAP_ALIGN(len) - len);
+    }
+    Py_XDECREF(utf8);
+    return 16 + OD_SNAP_ALIGN(len);
+}
+
+static PyObject *
+dict_snapshot(register PyOrderedDictObject *mp)
+{
+    PyObject *result;
+    PyOrderedDictEntry *ep;
+    od_snaphead head;
+    od_snapentry se;
+    PY_LONG_LONG size, slot, empty = -1;
+    Py_ssize_t i, n, slots;
+    size_t j, perturb, mask;
+    char *buf;
+
+    OD_COMPACT(mp);
+    memset(&head, 0, sizeof(head));
+    memcpy(head.sn_magic, OD_SNAPMAGIC, sizeof(OD_SNAPMAGIC));
+    head.sn_used = mp->ma_used;
+    /* like od_indices keep at least a third of the slots empty */
+    for (slots = PyOrderedDict_MINSIZE; slots <= mp->ma_used + mp->ma_used / 2;
+            slots <<= 1)
+        ;
+    head.sn_mask = slots - 1;
+    head.sn_probe = od_snap_probe();
+    if (head.sn_probe == -1)
+        return NULL;
+    size = OD_SNAP_INDEX(head.sn_used) + slots * (PY_LONG_LONG) 8;
+    ep = mp->ma_table;
+    for (i = 0; i < mp->ma_used; i++) {
+        if ((n = od_snap_record(ep[i].me_key, NULL)) < 0)
+            return NULL;
+        size += n;
+        if ((n = od_snap_record(ep[i].me_value, NULL)) < 0)
             return NULL;
+        size += n;
+    }
+    if (size > PY_SSIZE_T_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "snapshot too large");
+        return NULL;
+    }
+    head.sn_size = size;
+    /* nothing above ran Python code, the table is still the same */
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) size);
+    if (result == NULL)
+        return NULL;
+    buf = PyBytes_AS_STRING(result);
+    memcpy(buf, &head, sizeof(head));
+    for (j = 0; j < (size_t) slots; j++)
+        memcpy(buf + OD_SNAP_INDEX(head.sn_used) + j * 8, &empty, 8);
+    mask = (size_t) head.sn_mask;
+    size = OD_SNAP_INDEX(head.sn_used) + slots * (PY_LONG_LONG) 8;
+    for (i = 0; i < mp->ma_used; i++) {
+        se.se_hash = (long) ep[i].me_hash;
+        se.se_key = size;
+        if ((n = od_snap_record(ep[i].me_key, buf + size)) < 0)
+            goto Fail;
+        size += n;
+        se.se_value = size;
+        if ((n = od_snap_record(ep[i].me_value, buf + size)) < 0)
+            goto Fail;
+        size += n;
+        memcpy(buf + sizeof(head) + i * sizeof(se), &se, sizeof(se));
+        /* the probe sequence of lookdict(), there are no dummies */
+        j = (size_t) se.se_hash & mask;
+        perturb = (size_t) se.se_hash;
+        for (;;) {
+            memcpy(&slot, buf + OD_SNAP_INDEX(head.sn_used) + (j & mask) * 8, 8);
+            if (slot == -1)
+                break;
+            j = (j << 2) + j + perturb + 1;
+            perturb >>= PERTURB_SHIFT;
+        }
+        slot = i;
+        memcpy(buf + OD_SNAP_INDEX(head.sn_used) + (j & mask) * 8, &slot, 8);
+    }
+    assert(size == head.sn_size);
+    return result;
+Fail:
+    Py_DECREF(result);
+    return NULL;
+}
+
+
+static PyObject *
+ordereddict_getstate(register PyOrderedDictObject *mp)
+{
+    return PyInt_FromLong(mp->od_state);
+}
+
+/* the counters of st as a dict (all 0 for NULL) */
+static PyObject *
+od_stats_dict(od_stats *st)
+{
+    od_stats none;
+
+    if (st == NULL) {
+        memset(&none, 0, sizeof(od_stats));
+        st = &none;
+    }
+    return Py_BuildValue("{snsnsnsdsnsnsnsn}",
+                         "lookups", st->st_lookups,
+                         "probes", st->st_probes,
+                         "max_probes", st->st_maxprobes,
+                         "avg_probes", st->st_lookups == 0 ? 0.0 :
+                             (double) st->st_probes / st->st_lookups,
+                         "resizes", st->st_resizes,
+                         "resize_bytes", st->st_resizebytes,
+                         "move_bytes", st->st_movebytes,
+                         "key_calls", st->st_keycalls);
+}
+
+static PyObject *
+dict_stats(register PyOrderedDictObject *mp)
+{
+    PyObject *res, *v;
+    Py_ssize_t i, size = mp->od_imask + 1, dummies = 0;
+    int err;
+
+    res = od_stats_dict(mp->od_stats);
+    if (res == NULL)
+        return NULL;
+    for (i = 0; i < size; i++)
+        if (od_get_index(mp, i) == OD_IX_DUMMY)
+            dummies++;
+    v = Py_BuildValue("{snsnsnsnsnsisi}",
+                      "slots", size,
+                      "entries", mp->od_nentries,
+                      "used", mp->ma_used,
+                      "deleted", mp->od_nentries - mp->ma_used,
+                      "dummies", dummies,
+                      "rehashing", OD_REHASHING(mp),
+                      "shared", OD_KEYS_SHARED(mp));
+    if (v == NULL) {
+        Py_DECREF(res);
+        return NULL;
+    }
+    err = PyDict_Update(res, v);
+    Py_DECREF(v);
+    if (err < 0) {
+        Py_DECREF(res);
+        return NULL;
+    }
+    return res;
+}
+
+static PyObject *
+ordereddict_dump(register PyOrderedDictObject *mp)
+{
+    if (dump_ordereddict_head(mp) != -1)
+        dump_table(mp);
+    if (PySortedDict_CheckExact(mp))
+        dump_sorteddict_fun((PySortedDictObject *) mp);
+    Py_RETURN_NONE;
+}
+
+
+#ifndef OD_PY3
+PyDoc_STRVAR(has_key__doc__,
+             "D.has_key(k) -> True if D has a key k, else False");
+#endif
+
+PyDoc_STRVAR(contains__doc__,
+             "D.__contains__(k) -> True if D has a key k, else False");
+
+PyDoc_STRVAR(reduce__doc__, "Return state information for pickling.");
+
+PyDoc_STRVAR(reduce_ex__doc__,
+             "Return state information for pickling, from protocol 2 on as\n"
+             "a flat tuple of keys and values.");
+
+PyDoc_STRVAR(setstate__doc__,
+             "D.__setstate__(state) -> add the items pickled by __reduce_ex__ in one go");
+
+PyDoc_STRVAR(getitem__doc__, "x.__getitem__(y) <==> x[y]");
+
+PyDoc_STRVAR(get__doc__,
+             "D.get(k[,d]) -> D[k] if k in D, else d.  d defaults to None.");
+
+PyDoc_STRVAR(setdefault_doc__,
+             "D.setdefault(k[,d]) -> D.get(k,d), also set D[k]=d if k not in D");
+
+PyDoc_STRVAR(pop__doc__,
+             "D.pop(k[,d]) -> v, remove specified key and return the corresponding value\n\
+If key is not found, d is returned if given, otherwise KeyError is raised");
+
+PyDoc_STRVAR(popitem__doc__,
+             "D.popitem([index]) -> (k, v), remove and return indexed (key, value) pair as a\n\
+2-tuple (default is last); but raise KeyError if D is empty");
+
+PyDoc_STRVAR(keys__doc__,
+             "D.keys([reverse=False]) -> list of D's keys, optionally reversed");
+
+PyDoc_STRVAR(items__doc__,
+             "D.items() -> list of D's (key, value) pairs, as 2-tuples");
+
+PyDoc_STRVAR(values__doc__,
+             "D.values() -> list of D's values");
+
+PyDoc_STRVAR(update__doc__,
+             "D.update(E, **F) -> None.  Update D from E and F: for k in E: D[k] = E[k]\n\
+(if E has keys else: for (k, v) in E: D[k] = v) then: for k in F: D[k] = F[k]");
+
+PyDoc_STRVAR(fromkeys__doc__,
+             "dict.fromkeys(S[,v]) -> New dict with keys from S and values equal to v.\n\
+v defaults to None.");
+
+PyDoc_STRVAR(clear__doc__,
+             "D.clear() -> None.  Remove all items from D.");
+
+PyDoc_STRVAR(copy__doc__,
+             "D.copy() -> a shallow copy of D");
+
+PyDoc_STRVAR(iterkeys__doc__,
+             "D.iterkeys([reverse=False]) -> an iterator over the keys of D");
+
+PyDoc_STRVAR(itervalues__doc__,
+             "D.itervalues() -> an iterator over the values of D");
+
+PyDoc_STRVAR(iteritems__doc__,
+             "D.iteritems() -> an iterator over the (key, value) items of D");
+
+PyDoc_STRVAR(viewkeys__doc__,
+             "D.viewkeys([reverse=False]) -> a view of the keys of D, that can be indexed and sliced");
+
+PyDoc_STRVAR(viewvalues__doc__,
+             "D.viewvalues([reverse=False]) -> a view of the values of D");
+
+PyDoc_STRVAR(viewitems__doc__,
+             "D.viewitems([reverse=False]) -> a view of the (key, value) items of D");
+
+PyDoc_STRVAR(index_doc,
+             "D.index(key) -> return position of key in ordered dict");
+
+PyDoc_STRVAR(bisect_left_doc,
+             "S.bisect_left(key) -> position of the first key in sorteddict S that\n"
+             "does not sort before key (len(S) if none)");
+
+PyDoc_STRVAR(bisect_right_doc,
+             "S.bisect_right(key) -> position of the first key in sorteddict S that\n"
+             "sorts after key (len(S) if none)");
+
+PyDoc_STRVAR(floor_doc,
+             "S.floor(key[, default]) -> the largest key of sorteddict S that does not\n"
+             "sort after key, default or KeyError if there is none");
+
+PyDoc_STRVAR(ceiling_doc,
+             "S.ceiling(key[, default]) -> the smallest key of sorteddict S that does\n"
+             "not sort before key, default or KeyError if there is none");
+
+PyDoc_STRVAR(irange_doc,
+             "S.irange(minimum=None, maximum=None, inclusive=(True, True), reverse=False)\n"
+             "-> an iterator over the keys of sorteddict S from minimum to maximum\n"
+             "(None: no limit), inclusive tells whether those are included");
+
+PyDoc_STRVAR(insert_doc,
+             "D.insert(index, key, value) -> add/update (key, value) and insert key at index");
+
+PyDoc_STRVAR(reversed__doc__,
+             "D.__reversed__() -> an iterator over the keys of D, last to first");
+
+PyDoc_STRVAR(sizeof__doc__,
+             "D.__sizeof__() -> size of D in memory, in bytes");
+
+PyDoc_STRVAR(reverse_doc,
+             "D.reverse() -> reverse the order of the keys of D");
+
+PyDoc_STRVAR(setkeys_doc,
+             "D.setkeys(keys) -> set the keys of D (keys must be iterable and a permutation of .keys())");
+
+PyDoc_STRVAR(reorder_doc,
+             "D.reorder(indices) -> put the items of D in the order of the positions\n"
+             "in indices (a permutation of range(len(D))), afterwards the item at\n"
+             "position i is the one that was at position indices[i]");
+
+PyDoc_STRVAR(setvalues_doc,
+             "D.setvalues(values) -> set D values to values (must be iterable)");
+
+PyDoc_STRVAR(setitems_doc,
+             "D.setitems(items) -> clear D and then set items");
+
+PyDoc_STRVAR(snapshot_doc,
+             "D.snapshot() -> str with a read-only image of D for snapshotdict()");
+
+PyDoc_STRVAR(rename_doc,
+             "D.rename(oldkey, newkey) -> exchange keys without changing order");
+
+PyDoc_STRVAR(reserve_doc,
+             "D.reserve(n) -> make room for n items, adding up to that many doesn't resize");
+
+PyDoc_STRVAR(compact_doc,
+             "D.compact() -> squeeze out deleted items and shrink the table to fit");
+
+PyDoc_STRVAR(getstate_doc,
+             "D.getstate() -> return the state integer");
+
+PyDoc_STRVAR(stats_doc,
+             "D.stats() -> dict with the table sizes of D, and what has been counted\n"
+             "for it while _ordereddict.stats() was enabled");
+
+PyDoc_STRVAR(dump_doc,
+             "D.dump() -> print internals of an orereddict");
+
+#ifdef Py_GIL_DISABLED
+static PyObject *
+dict_contains_locked(PyObject *self, PyObject *key)
+{
+    PyObject *res;
+
+#ifdef OD_LOCKFREE_READS
+    switch (od_lockfree_get(self, key, &res)) {
+    case 1:
+        Py_DECREF(res);
+        Py_RETURN_TRUE;
+    case 0:
+        Py_RETURN_FALSE;
+    }
+#endif
+    Py_BEGIN_CRITICAL_SECTION(self);
+    res = dict_contains((PyOrderedDictObject *) self, key);
+    Py_END_CRITICAL_SECTION();
+    return res;
+}
+
+static PyObject *
+dict_get_locked(PyObject *self, OD_FAST_ARGS)
+{
+    PyObject *res;
+
+#ifdef OD_LOCKFREE_READS
+    if (nargs == 1 || nargs == 2) {
+        switch (od_lockfree_get(self, args[0], &res)) {
+        case 1:
+            return res;
+        case 0:
+            res = nargs == 2 ? args[1] : Py_None;
+            Py_INCREF(res);
+            return res;
+        }
+    }
+#endif
+    Py_BEGIN_CRITICAL_SECTION(self);
+    OD_WRITE_BEGIN(self);
+    res = dict_get((PyOrderedDictObject *) self, args, nargs);
+    OD_WRITE_END(self);
+    Py_END_CRITICAL_SECTION();
+    return res;
+}
+
+/* these read another mapping as well */
+static PyObject *
+dict_update_locked(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *res, *other = PyTuple_GET_SIZE(args) > 0 ?
+                            PyTuple_GET_ITEM(args, 0) : self;
+
+    Py_BEGIN_CRITICAL_SECTION2(self, other);
+    OD_WRITE_BEGIN(self);
+    res = dict_update(self, args, kwds);
+    OD_WRITE_END(self);
+    Py_END_CRITICAL_SECTION2();
+    return res;
+}
+
+static PyObject *
+dict_setitems_locked(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *res, *other = PyTuple_GET_SIZE(args) > 0 ?
+                            PyTuple_GET_ITEM(args, 0) : self;
+
+    Py_BEGIN_CRITICAL_SECTION2(self, other);
+    OD_WRITE_BEGIN(self);
+    res = dict_setitems(self, args, kwds);
+    OD_WRITE_END(self);
+    Py_END_CRITICAL_SECTION2();
+    return res;
+}
+#endif
+OD_LOCKED_1(dict_reduce, READ)
+OD_LOCKED_1(dict_reversed, READ)
+OD_LOCKED_1(dict_sizeof, READ)
+OD_LOCKED_2(dict_reduce_ex, READ)
+OD_LOCKED_2(dict_setstate, WRITE)
+OD_LOCKED_FAST(dict_setdefault, WRITE)
+OD_LOCKED_FAST(dict_pop, WRITE)
+OD_LOCKED_FAST(dict_popitem, WRITE)
+OD_LOCKED_3(dict_keys, READ)
+OD_LOCKED_3(dict_items, READ)
+OD_LOCKED_3(dict_values, READ)
+OD_LOCKED_1(dict_clear, WRITE)
+OD_LOCKED_1(dict_copy, READ)
+OD_LOCKED_3(dict_iterkeys, READ)
+OD_LOCKED_3(dict_itervalues, READ)
+OD_LOCKED_3(dict_iteritems, READ)
+OD_LOCKED_3(dict_viewkeys, READ)
+OD_LOCKED_3(dict_viewvalues, READ)
+OD_LOCKED_3(dict_viewitems, READ)
+OD_LOCKED_2(dict_index, READ)
+OD_LOCKED_FAST(dict_insert, WRITE)
+OD_LOCKED_2(dict_bisect_left, READ)
+OD_LOCKED_2(dict_bisect_right, READ)
+OD_LOCKED_FAST(dict_floor, READ)
+OD_LOCKED_FAST(dict_ceiling, READ)
+OD_LOCKED_3(dict_irange, READ)
+OD_LOCKED_1(dict_reverse, WRITE)
+OD_LOCKED_2(dict_setkeys, WRITE)
+OD_LOCKED_2(dict_setvalues, WRITE)
+OD_LOCKED_2(dict_reorder, WRITE)
+OD_LOCKED_1(dict_snapshot, READ)
+OD_LOCKED_2(dict_rename, WRITE)
+OD_LOCKED_2(dict_reserve, WRITE)
+OD_LOCKED_1(dict_compact, WRITE)
+OD_LOCKED_1(ordereddict_getstate, READ)
+OD_LOCKED_1(ordereddict_dump, READ)
+OD_LOCKED_1(dict_stats, READ)
+
+static PyMethodDef ordereddict_methods[] = {
+    {
+        "__contains__",(PyCFunction)OD_LOCKED(dict_contains),   METH_O | METH_COEXIST,
+        contains__doc__
+    },
+    {
+        "__getitem__", (PyCFunction)OD_LOCKED(dict_subscript), METH_O | METH_COEXIST,
+        getitem__doc__
+    },
+    {"__reduce__", (PyCFunction)OD_LOCKED(dict_reduce), METH_NOARGS, reduce__doc__},
+    {"__reversed__", (PyCFunction)OD_LOCKED(dict_reversed), METH_NOARGS, reversed__doc__},
+    {"__sizeof__", (PyCFunction)OD_LOCKED(dict_sizeof), METH_NOARGS, sizeof__doc__},
+    {"__reduce_ex__", (PyCFunction)OD_LOCKED(dict_reduce_ex), METH_VARARGS, reduce_ex__doc__},
+    {"__setstate__", (PyCFunction)OD_LOCKED(dict_setstate), METH_O, setstate__doc__},
+#if PY_VERSION_HEX >= 0x03090000
+    /* no longer inherited from dict */
+    {"__class_getitem__", Py_GenericAlias, METH_O | METH_CLASS, NULL},
+#endif
+#ifndef OD_PY3
+    {
+        "has_key",	(PyCFunction)dict_has_key,      METH_O,
+        has_key__doc__
+    },
+#endif
+    {
+        "get",         (PyCFunction)OD_LOCKED(dict_get),          OD_METH_FAST,
+        get__doc__
+    },
+    {
+        "setdefault",  (PyCFunction)OD_LOCKED(dict_setdefault),   OD_METH_FAST,
+        setdefault_doc__
+    },
+    {
+        "pop",         (PyCFunction)OD_LOCKED(dict_pop),          OD_METH_FAST,
+        pop__doc__
+    },
+    {
+        "popitem",	(PyCFunction)OD_LOCKED(dict_popitem),	OD_METH_FAST,
+        popitem__doc__
+    },
+    {
+        "keys",	(PyCFunction)OD_LOCKED(dict_keys),		METH_VARARGS | METH_KEYWORDS,
+        keys__doc__
+    },
+    {
+        "items",	(PyCFunction)OD_LOCKED(dict_items),	METH_VARARGS | METH_KEYWORDS,
+        items__doc__
+    },
+    {
+        "values",	(PyCFunction)OD_LOCKED(dict_values),	METH_VARARGS | METH_KEYWORDS,
+        values__doc__
+    },
+    {
+        "update",	(PyCFunction)OD_LOCKED(dict_update),	METH_VARARGS | METH_KEYWORDS,
+        update__doc__
+    },
+    {
+        "fromkeys",	(PyCFunction)dict_fromkeys,	METH_VARARGS | METH_CLASS,
+        fromkeys__doc__
+    },
+    {
+        "clear",	(PyCFunction)OD_LOCKED(dict_clear),	METH_NOARGS,
+        clear__doc__
+    },
+    {
+        "copy",	(PyCFunction)OD_LOCKED(dict_copy),		METH_NOARGS,
+        copy__doc__
+    },
+    {
+        "iterkeys",	(PyCFunction)OD_LOCKED(dict_iterkeys),	METH_VARARGS | METH_KEYWORDS,
+        iterkeys__doc__
+    },
+    {
+        "itervalues",	(PyCFunction)OD_LOCKED(dict_itervalues),	METH_VARARGS | METH_KEYWORDS,
+        itervalues__doc__
+    },
+    {
+        "iteritems",	(PyCFunction)OD_LOCKED(dict_iteritems),	METH_VARARGS | METH_KEYWORDS,
+        iteritems__doc__
+    },
+    {
+        "viewkeys",	(PyCFunction)OD_LOCKED(dict_viewkeys),	METH_VARARGS | METH_KEYWORDS,
+        viewkeys__doc__
+    },
+    {
+        "viewvalues",	(PyCFunction)OD_LOCKED(dict_viewvalues),	METH_VARARGS | METH_KEYWORDS,
+        viewvalues__doc__
+    },
+    {
+        "viewitems",	(PyCFunction)OD_LOCKED(dict_viewitems),	METH_VARARGS | METH_KEYWORDS,
+        viewitems__doc__
+    },
+    {"index",       (PyCFunction)OD_LOCKED(dict_index),     METH_O, index_doc},
+    {"insert",      (PyCFunction)OD_LOCKED(dict_insert),    OD_METH_FAST, insert_doc},
+    {"bisect_left", (PyCFunction)OD_LOCKED(dict_bisect_left), METH_O, bisect_left_doc},
+    {"bisect_right", (PyCFunction)OD_LOCKED(dict_bisect_right), METH_O, bisect_right_doc},
+    {"floor",       (PyCFunction)OD_LOCKED(dict_floor),     OD_METH_FAST, floor_doc},
+    {"ceiling",     (PyCFunction)OD_LOCKED(dict_ceiling),   OD_METH_FAST, ceiling_doc},
+    {"irange",      (PyCFunction)OD_LOCKED(dict_irange),    METH_VARARGS | METH_KEYWORDS, irange_doc},
+    {"reverse",     (PyCFunction)OD_LOCKED(dict_reverse),   METH_NOARGS, reverse_doc},
+    {"setkeys",     (PyCFunction)OD_LOCKED(dict_setkeys),   METH_O, setkeys_doc},
+    {"setvalues",   (PyCFunction)OD_LOCKED(dict_setvalues), METH_O, setvalues_doc},
+    {"reorder",     (PyCFunction)OD_LOCKED(dict_reorder),   METH_O, reorder_doc},
+    {"snapshot",    (PyCFunction)OD_LOCKED(dict_snapshot),  METH_NOARGS, snapshot_doc},
+    {"setitems",    (PyCFunction)OD_LOCKED(dict_setitems),  METH_VARARGS | METH_KEYWORDS, setitems_doc},
+    {"rename",     (PyCFunction)OD_LOCKED(dict_rename),   METH_VARARGS, rename_doc},
+    {"reserve",    (PyCFunction)OD_LOCKED(dict_reserve),  METH_O, reserve_doc},
+    {"compact",    (PyCFunction)OD_LOCKED(dict_compact),  METH_NOARGS, compact_doc},
+    {"getstate",     (PyCFunction)OD_LOCKED(ordereddict_getstate),   METH_NOARGS, getstate_doc},
+    {"stats",    (PyCFunction)OD_LOCKED(dict_stats),    METH_NOARGS, stats_doc},
+    {"dump",     (PyCFunction)OD_LOCKED(ordereddict_dump),   METH_NOARGS, dump_doc},
+    {NULL,		NULL}	/* sentinel */
+};
+
+static PyObject *
+ordereddict_get_version(PyOrderedDictObject *mp, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(mp->od_version);
+}
+
+PyDoc_STRVAR(version_doc,
+             "a number that goes up with every change of the keys, values or order");
+
+static PyGetSetDef ordereddict_getset[] = {
+    {"version", (getter)ordereddict_get_version, NULL, version_doc, NULL},
+    {NULL}	/* sentinel */
+};
+
+/* Return 1 if `key` is in dict `op`, 0 if not, and -1 on error. */
+int
+PyOrderedDict_Contains(PyObject *op, PyObject *key)
+{
+    long hash;
+    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
+    PyOrderedDictEntry *ep;
+
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return -1;
     }
-    ((PyOrderedDictObject *) copy)->od_state = ((PyOrderedDictObject *) o)->od_state;
-    if (PyOrderedDict_Merge(copy, o, 1, 0) == 0)
-        return copy;
-    Py_DECREF(copy);
-    return NULL;
+    ep = (mp->ma_lookup)(mp, key, hash);
+    return ep == NULL ? -1 : (ep->me_value != NULL);
 }
 
-Py_ssize_t
-PyOrderedDict_Size(PyObject *mp)
+/* Internal version of PyOrderedDict_Contains used when the hash value is already known */
+int
+_PyOrderedDict_Contains(PyObject *op, PyObject *key, long hash)
 {
-    if (mp == NULL || !PyOrderedDict_Check(mp)) {
-        PyErr_BadInternalCall();
-        return -1;
-    }
-    return ((PyOrderedDictObject *)mp)->ma_used;
+    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
+    PyOrderedDictEntry *ep;
+
+    ep = (mp->ma_lookup)(mp, key, hash);
+    return ep == NULL ? -1 : (ep->me_value != NULL);
 }
 
-PyObject *
-PyOrderedDict_Keys(PyObject *mp)
+#ifndef OD_PY3
+/* Python 3 slices through dict_subscript() only */
+static PyObject *
+PyOderedDict_Slice(PyObject *op, register Py_ssize_t ilow,
+                   register Py_ssize_t ihigh)
 {
+    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
+    PyOrderedDictObject *slice;
+
     if (mp == NULL || !PyOrderedDict_Check(mp)) {
         PyErr_BadInternalCall();
         return NULL;
     }
-    return dict_keys((PyOrderedDictObject *)mp, NULL, NULL);
-}
-
-PyObject *
-PyOrderedDict_Values(PyObject *mp)
-{
-    if (mp == NULL || !PyOrderedDict_Check(mp)) {
-        PyErr_BadInternalCall();
+    slice = (PyOrderedDictObject *) PyOrderedDict_New();
+    if (slice == NULL)
         return NULL;
+    /* [:] -> ilow = 0, ihigh MAXINT */
+    if (ilow < 0)
+        ilow += mp->ma_used;
+    if (ihigh < 0)
+        ihigh += mp->ma_used;
+    if (ilow < 0)
+        ilow = 0;
+    else if (ilow > mp->ma_used)
+        ilow = mp->ma_used;
+    if (ihigh < ilow)
+        ihigh = ilow;
+    else if (ihigh > mp->ma_used)
+        ihigh = mp->ma_used;
+
+    if (PyOrderedDict_CopySome((PyObject *) slice,
+                               op, ilow, 1, (ihigh-ilow), 1) == 0) {
+        return (PyObject *) slice;
     }
-    return dict_values((PyOrderedDictObject *)mp, NULL, NULL);
+    Py_DECREF(slice);
+    return NULL;
 }
+#endif /* !OD_PY3 */
 
-PyObject *
-PyOrderedDict_Items(PyObject *mp)
+#ifdef Py_GIL_DISABLED
+static int
+PyOrderedDict_Contains_locked(PyObject *op, PyObject *key)
 {
-    if (mp == NULL || !PyOrderedDict_Check(mp)) {
-        PyErr_BadInternalCall();
-        return NULL;
+    int res;
+#ifdef OD_LOCKFREE_READS
+    PyObject *value;
+
+    switch (od_lockfree_get(op, key, &value)) {
+    case 1:
+        Py_DECREF(value);
+        return 1;
+    case 0:
+        return 0;
     }
-    return dict_items((PyOrderedDictObject *)mp, NULL, NULL);
+#endif
+    Py_BEGIN_CRITICAL_SECTION(op);
+    res = PyOrderedDict_Contains(op, key);
+    Py_END_CRITICAL_SECTION();
+    return res;
 }
+#endif
 
-/* Subroutine which returns the smallest key in a for which b's value
-   is different or absent.  The value is returned too, through the
-   pval argument.  Both are NULL if no key in a is found for which b's status
-   differs.  The refcounts on (and only on) non-NULL *pval and function return
-   values must be decremented by the caller (characterize() increments them
-   to ensure that mutating comparison and PyOrderedDict_GetItem calls can't delete
-   them before the caller is done looking at them). */
+/* Hack to implement "key in dict" */
+static PySequenceMethods dict_as_sequence = {
+    0,			/* sq_length */
+    0,			/* sq_concat */
+    0,			/* sq_repeat */
+    0,			/* sq_item */
+    OD_SQ_SLICE((ssizessizeargfunc)PyOderedDict_Slice),			/* sq_slice */
+    0,			/* sq_ass_item */
+    OD_SQ_SLICE((ssizessizeobjargproc)dict_ass_slice),			/* sq_ass_slice */
+    OD_LOCKED(PyOrderedDict_Contains),	/* sq_contains */
+    0,			/* sq_inplace_concat */
+    0,			/* sq_inplace_repeat */
+};
 
 static PyObject *
-characterize(PyOrderedDictObject *a, PyOrderedDictObject *b, PyObject **pval)
+dict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
-    PyObject *akey = NULL; /* smallest key in a s.t. a[akey] != b[akey] */
-    PyObject *aval = NULL; /* a[akey] */
-    Py_ssize_t i;
-    int cmp;
-
-    for (i = 0; i <= a->ma_mask; i++) {
-        PyObject *thiskey, *thisaval, *thisbval;
-        if (a->ma_table[i].me_value == NULL)
-            continue;
-        thiskey = a->ma_table[i].me_key;
-        Py_INCREF(thiskey);  /* keep alive across compares */
-        if (akey != NULL) {
-            cmp = PyObject_RichCompareBool(akey, thiskey, Py_LT);
-            if (cmp < 0) {
-                Py_DECREF(thiskey);
-                goto Fail;
-            }
-            if (cmp > 0 ||
-                    i > a->ma_mask ||
-                    a->ma_table[i].me_value == NULL) {
-                /* Not the *smallest* a key; or maybe it is
-                 * but the compare shrunk the dict so we can't
-                 * find its associated value anymore; or
-                 * maybe it is but the compare deleted the
-                 * a[thiskey] entry.
-                 */
-                Py_DECREF(thiskey);
-                continue;
-            }
-        }
+    PyObject *self;
 
-        /* Compare a[thiskey] to b[thiskey]; cmp <- true iff equal. */
-        thisaval = a->ma_table[i].me_value;
-        assert(thisaval);
-        Py_INCREF(thisaval);   /* keep alive */
-        thisbval = PyOrderedDict_GetItem((PyObject *)b, thiskey);
-        if (thisbval == NULL)
-            cmp = 0;
-        else {
-            /* both dicts have thiskey:  same values? */
-            cmp = PyObject_RichCompareBool(
-                      thisaval, thisbval, Py_EQ);
-            if (cmp < 0) {
-                Py_DECREF(thiskey);
-                Py_DECREF(thisaval);
-                goto Fail;
-            }
-        }
-        if (cmp == 0) {
-            /* New winner. */
-            Py_XDECREF(akey);
-            Py_XDECREF(aval);
-            akey = thiskey;
-            aval = thisaval;
-        } else {
-            Py_DECREF(thiskey);
-            Py_DECREF(thisaval);
-        }
+    assert(type != NULL && type->tp_alloc != NULL);
+    if (type == &PyOrderedDict_Type)
+        return PyOrderedDict_New();	/* from the free list if possible */
+    OD_NOT_DICT_C(type);
+    self = type->tp_alloc(type, 0);
+    if (self != NULL) {
+        PyOrderedDictObject *d = (PyOrderedDictObject *)self;
+        /* It's guaranteed that tp->alloc zeroed out the struct. */
+        assert(d->ma_table == NULL && d->od_fill == 0 && d->ma_used == 0);
+        INIT_NONZERO_DICT_SLOTS(d);
+#ifdef SHOW_CONVERSION_COUNTS
+        ++created;
+#endif
     }
-    *pval = aval;
-    return akey;
+    return self;
+}
 
-Fail:
-    Py_XDECREF(akey);
-    Py_XDECREF(aval);
-    *pval = NULL;
-    return NULL;
+static PyObject *
+sorteddict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PyObject *self;
+
+    assert(type != NULL && type->tp_alloc != NULL);
+    if (type == &PySortedDict_Type)
+        return PySortedDict_New();	/* from the free list if possible */
+    OD_NOT_DICT_C(type);
+    self = type->tp_alloc(type, 0);
+    if (self != NULL) {
+        PyOrderedDictObject *d = (PyOrderedDictObject *)self;
+        /* It's guaranteed that tp->alloc zeroed out the struct. */
+        assert(d->ma_table == NULL && d->od_fill == 0 && d->ma_used == 0);
+        INIT_NONZERO_DICT_SLOTS(d);
+        INIT_SORT_FUNCS(((PySortedDictObject *) self));
+#ifdef SHOW_CONVERSION_COUNTS
+        ++created;
+#endif
+    }
+    return self;
 }
 
+/* the arguments of ordereddict(), -1 for relax and kvio is the default */
 static int
-dict_compare(PyOrderedDictObject *a, PyOrderedDictObject *b)
+od_init(PyObject *self, PyObject *arg, int tmprelax, int tmpkvio,
+        Py_ssize_t capacity, int lru, Py_ssize_t maxsize)
 {
-    PyObject *adiff, *bdiff, *aval, *bval;
-    int res;
-
-    /* Compare lengths first */
-    if (a->ma_used < b->ma_used)
-        return -1;	/* a is shorter */
-    else if (a->ma_used > b->ma_used)
-        return 1;	/* b is shorter */
+    int result = 0;
 
-    /* Same length -- check all keys */
-    bdiff = bval = NULL;
-    adiff = characterize(a, b, &aval);
-    if (adiff == NULL) {
-        assert(!aval);
-        /* Either an error, or a is a subset with the same length so
-         * must be equal.
-         */
-        res = PyErr_Occurred() ? -1 : 0;
-        goto Finished;
+    if (maxsize < 0) {
+        PyErr_SetString(PyExc_ValueError, "maxsize must not be negative");
+        return -1;
     }
-    bdiff = characterize(b, a, &bval);
-    if (bdiff == NULL && PyErr_Occurred()) {
-        assert(!bval);
-        res = -1;
-        goto Finished;
+    if (od_reserve((PyOrderedDictObject *)self, capacity) < 0)
+        return -1;
+    ((PyOrderedDictObject *)self)->od_maxsize = maxsize;
+    /* an lru ordereddict also moves a key to the back on update */
+    if (lru) {
+        ((PyOrderedDictObject *)self)->od_state |= OD_LRU_BIT;
+        tmpkvio = 1;
     }
-    res = 0;
-    if (bdiff) {
-        /* bdiff == NULL "should be" impossible now, but perhaps
-         * the last comparison done by the characterize() on a had
-         * the side effect of making the dicts equal!
-         */
-        res = PyObject_Compare(adiff, bdiff);
+    if (tmpkvio == -1)
+        tmpkvio = ordereddict_kvio;
+    if (tmpkvio)
+        ((PyOrderedDictObject *)self)->od_state |= OD_KVIO_BIT;
+    if (tmprelax == -1)
+        tmprelax = ordereddict_relaxed;
+    if (tmprelax)
+        ((PyOrderedDictObject *)self)->od_state |= OD_RELAXED_BIT;
+
+    if (arg != NULL) {
+        OD_LOCK2_BEGIN(self, arg);
+        OD_WRITE_BEGIN(self);
+        if (PyObject_HasAttrString(arg, "keys"))
+            result = PyOrderedDict_Merge(self, arg, 1, tmprelax);
+        else
+            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
+        OD_WRITE_END(self);
+        OD_LOCK2_END();
     }
-    if (res == 0 && bval != NULL)
-        res = PyObject_Compare(aval, bval);
+    /* do not initialise from keywords at all */
+    return result;
+}
 
-Finished:
-    Py_XDECREF(adiff);
-    Py_XDECREF(bdiff);
-    Py_XDECREF(aval);
-    Py_XDECREF(bval);
-    return res;
+static int
+ordereddict_init(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *arg = NULL;
+    int tmprelax = -1, tmpkvio = -1, lru = 0;
+    Py_ssize_t capacity = 0, maxsize = 0;
+
+    static char *kwlist[] = {"src", "relax", "kvio", "capacity", "lru",
+                             "maxsize", 0};
+    if (args != NULL) {
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oiinin:ordereddict",
+                                         kwlist, &arg,  &tmprelax, &tmpkvio,
+                                         &capacity, &lru, &maxsize)) {
+            return -1;
+        }
+    }
+    return od_init(self, arg, tmprelax, tmpkvio, capacity, lru, maxsize);
 }
 
-/* Return 1 if dicts equal, 0 if not, -1 if error.
- * Gets out as soon as any difference is detected.
- * Uses only Py_EQ comparison.
- */
+/* the arguments of sorteddict() that are used */
 static int
-dict_equal(PyOrderedDictObject *a, PyOrderedDictObject *b)
+sd_init(PyObject *self, PyObject *arg, PyObject *keyfun, int reverse,
+        Py_ssize_t capacity)
 {
-    Py_ssize_t i;
-    PyOrderedDictEntry **app, **bpp;
+    int result = 0;
 
-    if (a->ma_used != b->ma_used)
-        /* can't be equal if # of entries differ */
-        return 0;
+    if (od_reserve((PyOrderedDictObject *)self, capacity) < 0)
+        return -1;
+    if (reverse)
+        ((PyOrderedDictObject *)self)->od_state |= OD_REVERSE_BIT;
+    /* always relaxed about order of source */
+    ((PyOrderedDictObject *)self)->od_state |= OD_RELAXED_BIT;
 
-    /* Same # of entries -- check all of 'em.  Exit early on any diff. */
+    if (keyfun != NULL && keyfun != Py_False) {
+        PyObject *tmp = ((PySortedDictObject *)self)->sd_key;
+        Py_INCREF(keyfun);
+        ((PySortedDictObject *)self)->sd_key = keyfun;
+        Py_DECREF(tmp);
+    }
 
-    for (i = 0, app = a->od_otablep, bpp = b->od_otablep; i < a->ma_used;
-            i++, app++, bpp++) {
-        int cmp;
-        PyObject *aval = (*app)->me_value;
-        PyObject *bval = (*bpp)->me_value;
-        PyObject *akey = (*app)->me_key;
-        PyObject *bkey = (*bpp)->me_key;
-        /* temporarily bump aval's refcount to ensure it stays
-           alive until we're done with it */
-        Py_INCREF(aval);
-        Py_INCREF(bval);
-        /* ditto for key */
-        Py_INCREF(akey);
-        Py_INCREF(bkey);
-        cmp = PyObject_RichCompareBool(akey, bkey, Py_EQ);
-        if (cmp > 0) /* keys compare ok, now do values */
-            cmp = PyObject_RichCompareBool(aval, bval, Py_EQ);
-        Py_DECREF(bkey);
-        Py_DECREF(akey);
-        Py_DECREF(bval);
-        Py_DECREF(aval);
-        if (cmp <= 0)  /* error or not equal */
-            return cmp;
+    if (arg != NULL) {
+        OD_LOCK2_BEGIN(self, arg);
+        OD_WRITE_BEGIN(self);
+        if (PyObject_HasAttrString(arg, "keys"))
+            result = PyOrderedDict_Merge(self, arg, 1, 1);
+        else
+            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
+        OD_WRITE_END(self);
+        OD_LOCK2_END();
     }
-    return 1;
+    /* do not initialise from keywords at all */
+    return result;
 }
 
-static PyObject *
-dict_richcompare(PyObject *v, PyObject *w, int op)
+static int
+sorteddict_init(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    int cmp;
-    PyObject *res;
+    PyObject *arg = NULL, *cmpfun = NULL, *keyfun = NULL, *valuefun = NULL;
+    int reverse = 0;
+    Py_ssize_t capacity = 0;
 
-    if (!PyOrderedDict_Check(v) || !PyOrderedDict_Check(w)) {
-        res = Py_NotImplemented;
-    } else if (op == Py_EQ || op == Py_NE) {
-        cmp = dict_equal((PyOrderedDictObject *)v, (PyOrderedDictObject *)w);
-        if (cmp < 0)
-            return NULL;
-        res = (cmp == (op == Py_EQ)) ? Py_True : Py_False;
-    } else
-        res = Py_NotImplemented;
-    Py_INCREF(res);
-    return res;
+    static char *kwlist[] = {"src", "cmp", "key", "value", "reverse",
+                             "capacity", 0};
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOOin:sorteddict",
+                                         kwlist, &arg, &cmpfun, &keyfun, &valuefun, &reverse,
+                                         &capacity))
+            return -1;
+    return sd_init(self, arg, keyfun, reverse, capacity);
 }
 
+#if PY_VERSION_HEX >= 0x03090000
+/* ordereddict() and sorteddict() with at most the source as argument, the
+   common case, are set up without going through argument tuples and
+   keyword parsing; anything else, and subclasses, goes to type.__call__ */
 static PyObject *
-dict_contains(register PyOrderedDictObject *mp, PyObject *key)
+od_vectorcall(PyObject *type, PyObject *const *args, size_t nargsf,
+              PyObject *kwnames)
 {
-    long hash;
-    PyOrderedDictEntry *ep;
-
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
+    Py_ssize_t i, nargs = PyVectorcall_NARGS(nargsf);
+    PyObject *self, *tuple, *kwds = NULL;
+
+    if (kwnames == NULL && nargs <= 1) {
+        if (type == (PyObject *) &PyOrderedDict_Type) {
+            self = PyOrderedDict_New();
+            if (self != NULL &&
+                    od_init(self, nargs ? args[0] : NULL, -1, -1, 0, 0, 0) < 0)
+                Py_CLEAR(self);
+            return self;
+        }
+        if (type == (PyObject *) &PySortedDict_Type) {
+            self = PySortedDict_New();
+            if (self != NULL &&
+                    sd_init(self, nargs ? args[0] : NULL, NULL, 0, 0) < 0)
+                Py_CLEAR(self);
+            return self;
+        }
     }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
+    tuple = PyTuple_New(nargs);
+    if (tuple == NULL)
         return NULL;
-    return PyBool_FromLong(ep->me_value != NULL);
+    for (i = 0; i < nargs; i++) {
+        Py_INCREF(args[i]);
+        PyTuple_SET_ITEM(tuple, i, args[i]);
+    }
+    if (kwnames != NULL && PyTuple_GET_SIZE(kwnames) > 0) {
+        kwds = PyDict_New();
+        if (kwds == NULL)
+            goto Fail;
+        for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++)
+            if (PyDict_SetItem(kwds, PyTuple_GET_ITEM(kwnames, i),
+                               args[nargs + i]) < 0)
+                goto Fail;
+    }
+    self = PyType_Type.tp_call(type, tuple, kwds);
+    Py_DECREF(tuple);
+    Py_XDECREF(kwds);
+    return self;
+Fail:
+    Py_DECREF(tuple);
+    Py_XDECREF(kwds);
+    return NULL;
 }
+#endif
 
+static long
+dict_nohash(PyObject *self)
+{
+    PyErr_SetString(PyExc_TypeError, "ordereddict objects are unhashable");
+    return -1;
+}
 
 static PyObject *
-dict_has_key(register PyOrderedDictObject *mp, PyObject *key)
+dict_iter(PyOrderedDictObject *dict)
 {
-#if PY_VERSION_HEX < 0x02060000
-    long hash;
-    PyOrderedDictEntry *ep;
-#endif
+    return dictiter_new(dict, &PyOrderedDictIterKey_Type, NULL, NULL);
+}
+OD_LOCKED_1(dict_iter, READ)
 
-#if PY_VERSION_HEX >= 0x02060000
-    if (Py_Py3kWarningFlag &&
-            PyErr_Warn(PyExc_DeprecationWarning,
-                       "dict.has_key() not supported in 3.x") < 0)
-        return NULL;
-    return dict_contains(mp, key);
-#else
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
+PyDoc_STRVAR(ordereddict_doc,
+             "ordereddict() -> new empty dictionary.\n"
+             "dict(orderddict) -> new dictionary initialized from a mappings object's\n"
+             "    (key, value) pairs.\n"
+//"dict(seq) -> new dictionary initialized as if via:\n"
+//"    d = {}\n"
+//"    for k, v in seq:\n"
+//"        d[k] = v\n"
+//"dict(**kwargs) -> new dictionary initialized with the name=value pairs\n"
+//"    in the keyword argument list.  For example:  dict(one=1, two=2)"
+            );
+
+#if PY_VERSION_HEX >= 0x03090000
+/* D | other and D |= other for a mapping other that is a dict (or an
+   ordereddict), like they are for a dict; dict | D gives a dict */
+static PyObject *
+dict_or(PyObject *self, PyObject *other)
+{
+    PyObject *tmp, *result;
+
+    if (PyDict_Check(self) && PyOrderedDict_Check(other)) {
+        result = PyDict_Copy(self);
+        if (result != NULL && PyDict_Update(result, other) < 0)
+            Py_CLEAR(result);
+        return result;
     }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
+    if (!PyOrderedDict_Check(self) ||
+            !(PyDict_Check(other) || PyOrderedDict_Check(other)))
+        Py_RETURN_NOTIMPLEMENTED;
+    if (!FROZEN((PyOrderedDictObject *)self)) {
+        result = PyOrderedDict_Copy(self);
+        if (result != NULL && PyOrderedDict_Update(result, other) < 0)
+            Py_CLEAR(result);
+        return result;
+    }
+    /* build the items in an ordereddict, then freeze them */
+    tmp = PyOrderedDict_New();
+    if (tmp == NULL)
         return NULL;
-    return PyBool_FromLong(ep->me_value != NULL);
-#endif
+    if (PyOrderedDict_Update(tmp, self) < 0 ||
+            PyOrderedDict_Update(tmp, other) < 0) {
+        Py_DECREF(tmp);
+        return NULL;
+    }
+    result = PyObject_CallFunctionObjArgs((PyObject *)Py_TYPE(self), tmp,
+                                          NULL);
+    Py_DECREF(tmp);
+    return result;
 }
 
+/* which takes what update() takes, like a dict's does */
 static PyObject *
-dict_get(register PyOrderedDictObject *mp, PyObject *args)
+dict_ior(PyObject *self, PyObject *other)
 {
-    PyObject *key;
-    PyObject *failobj = Py_None;
-    PyObject *val = NULL;
-    long hash;
-    PyOrderedDictEntry *ep;
+    int res;
 
-    if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &failobj))
+    if (FROZEN((PyOrderedDictObject *)self))
+        Py_RETURN_NOTIMPLEMENTED;
+    if (PyObject_HasAttrString(other, "keys"))
+        res = PyOrderedDict_Update(self, other);
+    else
+        res = PyOrderedDict_MergeFromSeq2(self, other, 1);
+    if (res < 0)
         return NULL;
+    Py_INCREF(self);
+    return self;
+}
 
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
-    }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
-        return NULL;
-    val = ep->me_value;
-    if (val == NULL)
-        val = failobj;
-    Py_INCREF(val);
-    return val;
+#ifdef Py_GIL_DISABLED
+static PyObject *
+dict_or_locked(PyObject *self, PyObject *other)
+{
+    PyObject *res;
+
+    Py_BEGIN_CRITICAL_SECTION2(self, other);
+    res = dict_or(self, other);
+    Py_END_CRITICAL_SECTION2();
+    return res;
+}
+
+static PyObject *
+dict_ior_locked(PyObject *self, PyObject *other)
+{
+    PyObject *res;
+
+    Py_BEGIN_CRITICAL_SECTION2(self, other);
+    OD_WRITE_BEGIN(self);
+    res = dict_ior(self, other);
+    OD_WRITE_END(self);
+    Py_END_CRITICAL_SECTION2();
+    return res;
+}
+#endif
+
+static PyNumberMethods dict_as_number = {
+    0,			/* nb_add */
+    0,			/* nb_subtract */
+    0,			/* nb_multiply */
+    0,			/* nb_remainder */
+    0,			/* nb_divmod */
+    0,			/* nb_power */
+    0,			/* nb_negative */
+    0,			/* nb_positive */
+    0,			/* nb_absolute */
+    0,			/* nb_bool */
+    0,			/* nb_invert */
+    0,			/* nb_lshift */
+    0,			/* nb_rshift */
+    0,			/* nb_and */
+    0,			/* nb_xor */
+    OD_LOCKED(dict_or),		/* nb_or */
+    0,			/* nb_int */
+    0,			/* nb_reserved */
+    0,			/* nb_float */
+    0,			/* nb_inplace_add */
+    0,			/* nb_inplace_subtract */
+    0,			/* nb_inplace_multiply */
+    0,			/* nb_inplace_remainder */
+    0,			/* nb_inplace_power */
+    0,			/* nb_inplace_lshift */
+    0,			/* nb_inplace_rshift */
+    0,			/* nb_inplace_and */
+    0,			/* nb_inplace_xor */
+    OD_LOCKED(dict_ior),		/* nb_inplace_or */
+};
+#define OD_AS_NUMBER			(&dict_as_number)
+#else
+#define OD_AS_NUMBER			0
+#endif
+
+PyTypeObject PyOrderedDict_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.ordereddict",
+    sizeof(PyOrderedDictObject),
+    0,
+    (destructor)dict_dealloc,		/* tp_dealloc */
+    OD_TP_PRINT(ordereddict_print),			/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    OD_TP_COMPARE(dict_compare),			/* tp_compare */
+    (reprfunc)OD_LOCKED(ordereddict_repr),	/* tp_repr */
+    OD_AS_NUMBER,				/* tp_as_number */
+    &dict_as_sequence,			/* tp_as_sequence */
+    &dict_as_mapping,			/* tp_as_mapping */
+    dict_nohash,				/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+    Py_TPFLAGS_BASETYPE,		/* tp_flags */
+    ordereddict_doc,				/* tp_doc */
+    dict_traverse,				/* tp_traverse */
+    dict_tp_clear,				/* tp_clear */
+    OD_LOCKED(dict_richcompare),		/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dict_iter),		/* tp_iter */
+    0,					/* tp_iternext */
+    ordereddict_methods,				/* tp_methods */
+    0,					/* tp_members */
+    ordereddict_getset,			/* tp_getset */
+    DEFERRED_ADDRESS(&PyDict_Type),					/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    ordereddict_init,				/* tp_init */
+    PyType_GenericAlloc,			/* tp_alloc */
+    dict_new,				/* tp_new */
+    PyObject_GC_Del,        		/* tp_free */
+};
+
+
+PyDoc_STRVAR(sorteddict_doc,
+             "sorteddict() -> new empty dictionary.\n"
+            );
+
+
+PyTypeObject PySortedDict_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.sorteddict",
+    sizeof(PySortedDictObject),
+    0,
+    (destructor)dict_dealloc,		/* tp_dealloc */
+    OD_TP_PRINT(ordereddict_print),			/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    OD_TP_COMPARE(dict_compare),			/* tp_compare */
+    (reprfunc)OD_LOCKED(ordereddict_repr),	/* tp_repr */
+    OD_AS_NUMBER,				/* tp_as_number */
+    &dict_as_sequence,			/* tp_as_sequence */
+    &dict_as_mapping,			/* tp_as_mapping */
+    dict_nohash,				/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+    Py_TPFLAGS_BASETYPE,		/* tp_flags */
+    sorteddict_doc,				/* tp_doc */
+    dict_traverse,				/* tp_traverse */
+    dict_tp_clear,				/* tp_clear */
+    OD_LOCKED(dict_richcompare),		/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dict_iter),		/* tp_iter */
+    0,					/* tp_iternext */
+    ordereddict_methods,				/* tp_methods */
+    0,					/* tp_members */
+    ordereddict_getset,			/* tp_getset */
+    DEFERRED_ADDRESS(&PyDict_Type),					/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    sorteddict_init,				/* tp_init */
+    PyType_GenericAlloc,			/* tp_alloc */
+    sorteddict_new,				/* tp_new */
+    PyObject_GC_Del,        		/* tp_free */
+};
+
+/*
+frozenordereddict: an ordereddict that can't be changed once __init__ has
+filled it (OD_FROZEN_BIT), so that it can be hashed.  The hash depends on
+the order, like that of the tuple of its items, and is computed once.
+copy() just returns the same object.
+*/
+static int
+frozenordereddict_init(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyOrderedDictObject *mp = (PyOrderedDictObject *) self;
+    int result;
+
+    OD_NOT_FROZEN(mp, -1);
+    result = ordereddict_init(self, args, kwds);
+    /* an lru one would move keys on lookup */
+    mp->od_state &= ~(OD_LRU_BIT | OD_KVIO_BIT);
+    mp->od_maxsize = 0;
+    mp->od_state |= OD_FROZEN_BIT;
+    ((PyFrozenOrderedDictObject *) self)->fd_hash = -1;
+    return result;
+}
+
+static long
+frozenordereddict_hash(PyObject *self)
+{
+    PyOrderedDictObject *mp = (PyOrderedDictObject *) self;
+    PyFrozenOrderedDictObject *fd = (PyFrozenOrderedDictObject *) self;
+    PyObject *value;
+    Py_ssize_t i;
+    long x, y, mult = 1000003L, len = 2 * mp->ma_used;
+
+    if (fd->fd_hash != -1)
+        return fd->fd_hash;
+    OD_COMPACT(mp);
+    /* as tuplehash() over key0, value0, key1, ... using the stored key
+       hashes; nothing can delete an item, so the positions don't change */
+    x = 0x345678L;
+    for (i = 0; i < mp->ma_used; i++) {
+        y = (long) mp->ma_table[i].me_hash;
+        x = (x ^ y) * mult;
+        mult += (long)(82520L + len + len);
+        value = mp->ma_table[i].me_value;
+        Py_INCREF(value);
+        y = PyObject_Hash(value);
+        Py_DECREF(value);
+        if (y == -1)
+            return -1;
+        x = (x ^ y) * mult;
+        mult += (long)(82520L + len + len);
+    }
+    x += 97531L;
+    if (x == -1)
+        x = -2;
+    fd->fd_hash = x;
+    return x;
 }
 
-
 static PyObject *
-dict_setdefault(register PyOrderedDictObject *mp, PyObject *args)
+frozenordereddict_copy(PyOrderedDictObject *mp)
 {
-    PyObject *key;
-    PyObject *failobj = Py_None;
-    PyObject *val = NULL;
-    long hash;
-    PyOrderedDictEntry *ep;
-
-    if (!PyArg_UnpackTuple(args, "setdefault", 1, 2, &key, &failobj))
-        return NULL;
+    PyObject *items, *res;
 
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
+    if (PyFrozenOrderedDict_CheckExact(mp)) {
+        Py_INCREF(mp);
+        return (PyObject *) mp;
     }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
+    items = dict_items(mp, NULL, NULL);
+    if (items == NULL)
         return NULL;
-    val = ep->me_value;
-    if (val == NULL) {
-        val = failobj;
-        if (PyOrderedDict_SetItem((PyObject*)mp, key, failobj))
-            val = NULL;
-    }
-    Py_XINCREF(val);
-    return val;
-}
-
-
-static PyObject *
-dict_clear(register PyOrderedDictObject *mp)
-{
-    PyOrderedDict_Clear((PyObject *)mp);
-    Py_RETURN_NONE;
+    res = PyObject_CallFunctionObjArgs((PyObject *) Py_TYPE(mp), items, NULL);
+    Py_DECREF(items);
+    return res;
 }
 
+/* it can't be filled after creation, so the items go to __init__ */
 static PyObject *
-dict_pop(PyOrderedDictObject *mp, PyObject *args)
+frozenordereddict_reduce(PyOrderedDictObject *mp)
 {
-    long hash;
-    PyOrderedDictEntry *ep;
-    PyObject *old_value, *old_key;
-    PyObject *key, *deflt = NULL;
+    PyObject *items = dict_items(mp, NULL, NULL);
 
-    if(!PyArg_UnpackTuple(args, "pop", 1, 2, &key, &deflt))
-        return NULL;
-    if (mp->ma_used == 0) {
-        if (deflt) {
-            Py_INCREF(deflt);
-            return deflt;
-        }
-        PyErr_SetString(PyExc_KeyError,
-                        "pop(): dictionary is empty");
-        return NULL;
-    }
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return NULL;
-    }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL)
-        return NULL;
-    if (ep->me_value == NULL) {
-        if (deflt) {
-            Py_INCREF(deflt);
-            return deflt;
-        }
-        set_key_error(key);
+    if (items == NULL)
         return NULL;
-    }
-    old_key = ep->me_key;
-    Py_INCREF(dummy);
-    ep->me_key = dummy;
-    old_value = ep->me_value;
-    ep->me_value = NULL;
-    del_inorder(mp, ep);
-    mp->ma_used--;
-    Py_DECREF(old_key);
-    return old_value;
+    return Py_BuildValue("O(N)", Py_TYPE(mp), items);
 }
 
+/* fill an ordereddict, and freeze that */
 static PyObject *
-dict_popitem(PyOrderedDictObject *mp, PyObject *args)
+frozenordereddict_fromkeys(PyObject *cls, PyObject *args)
 {
-    Py_ssize_t i = -1, j;
-    PyOrderedDictEntry **epp;
-    PyObject *res;
-
-    /* Allocate the result tuple before checking the size.  Believe it
-     * or not, this allocation could trigger a garbage collection which
-     * could empty the dict, so if we checked the size first and that
-     * happened, the result would be an infinite loop (searching for an
-     * entry that no longer exists).  Note that the usual popitem()
-     * idiom is "while d: k, v = d.popitem()". so needing to throw the
-     * tuple away if the dict *is* empty isn't a significant
-     * inefficiency -- possible, but unlikely in practice.
-     */
-#if PY_VERSION_HEX >= 0x02050000
-    if (!PyArg_ParseTuple(args, "|n:popitem", &i))
-#else
-    if (!PyArg_ParseTuple(args, "|i:popitem", &i))
-#endif
-        return NULL;
+    PyObject *od, *res;
 
-    res = PyTuple_New(2);
-    if (res == NULL)
+    od = dict_fromkeys((PyObject *) &PyOrderedDict_Type, args);
+    if (od == NULL)
         return NULL;
-    if (mp->ma_used == 0) {
-        Py_DECREF(res);
-        PyErr_SetString(PyExc_KeyError,
-                        "popitem(): dictionary is empty");
-        return NULL;
-    }
-    if (i < 0)
-        j = mp->ma_used + i;
-    else
-        j = i;
-    if (j < 0 || j >= mp->ma_used) {
-        Py_DECREF(res);
-        PyErr_SetString(PyExc_KeyError,
-                        "popitem(): index out of range");
-        return NULL;
-    }
-    epp = mp->od_otablep;
-    epp += j;
-    PyTuple_SET_ITEM(res, 0, (*epp)->me_key);
-    PyTuple_SET_ITEM(res, 1, (*epp)->me_value);
-    Py_INCREF(dummy);
-    (*epp)->me_key = dummy;
-    (*epp)->me_value = NULL;
-    mp->ma_used--;
-    if (i != -1) { /* for default case -1, we don't have to do anything */
-        /* ma_used has already been decremented ! */
-        memmove(epp, epp+1, (mp->ma_used - j) * sizeof(PyOrderedDictEntry *));
-    }
+    res = PyObject_CallFunctionObjArgs(cls, od, NULL);
+    Py_DECREF(od);
     return res;
 }
 
-static int
-dict_traverse(PyObject *op, visitproc visit, void *arg)
-{
-    Py_ssize_t i = 0;
-    PyObject *pk;
-    PyObject *pv;
+PyDoc_STRVAR(frozen_copy__doc__,
+             "F.copy() -> F itself, it can't be changed");
 
-    while (PyOrderedDict_Next(op, &i, &pk, &pv)) {
-        Py_VISIT(pk);
-        Py_VISIT(pv);
-    }
-    return 0;
-}
+static PyMethodDef frozenordereddict_methods[] = {
+    {"copy",       (PyCFunction)frozenordereddict_copy,   METH_NOARGS, frozen_copy__doc__},
+    {"__copy__",   (PyCFunction)frozenordereddict_copy,   METH_NOARGS, frozen_copy__doc__},
+    {"__reduce__", (PyCFunction)frozenordereddict_reduce, METH_NOARGS, reduce__doc__},
+    {"fromkeys",   (PyCFunction)frozenordereddict_fromkeys, METH_VARARGS | METH_CLASS, fromkeys__doc__},
+    {NULL,	NULL},
+};
 
-static int
-dict_tp_clear(PyObject *op)
-{
-    PyOrderedDict_Clear(op);
-    return 0;
-}
+PyDoc_STRVAR(frozenordereddict_doc,
+             "frozenordereddict(src) -> new ordered dictionary that can't be changed,\n"
+             "and can be hashed.  The keyword arguments are those of ordereddict.\n"
+            );
+
+PyTypeObject PyFrozenOrderedDict_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.frozenordereddict",
+    sizeof(PyFrozenOrderedDictObject),
+    0,
+    (destructor)dict_dealloc,		/* tp_dealloc */
+    OD_TP_PRINT(ordereddict_print),			/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    OD_TP_COMPARE(dict_compare),			/* tp_compare */
+    (reprfunc)OD_LOCKED(ordereddict_repr),	/* tp_repr */
+    OD_AS_NUMBER,				/* tp_as_number */
+    &dict_as_sequence,			/* tp_as_sequence */
+    &dict_as_mapping,			/* tp_as_mapping */
+    frozenordereddict_hash,			/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+    Py_TPFLAGS_BASETYPE,		/* tp_flags */
+    frozenordereddict_doc,			/* tp_doc */
+    dict_traverse,				/* tp_traverse */
+    dict_tp_clear,				/* tp_clear */
+    OD_LOCKED(dict_richcompare),		/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dict_iter),		/* tp_iter */
+    0,					/* tp_iternext */
+    frozenordereddict_methods,		/* tp_methods */
+    0,					/* tp_members */
+    0,					/* tp_getset */
+    DEFERRED_ADDRESS(&PyOrderedDict_Type),	/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    frozenordereddict_init,			/* tp_init */
+    PyType_GenericAlloc,			/* tp_alloc */
+    dict_new,				/* tp_new */
+    PyObject_GC_Del,        		/* tp_free */
+};
 
 
-extern PyTypeObject PyOrderedDictIterKey_Type; /* Forward */
-extern PyTypeObject PyOrderedDictIterValue_Type; /* Forward */
-extern PyTypeObject PyOrderedDictIterItem_Type; /* Forward */
-static PyObject *dictiter_new(PyOrderedDictObject *, PyTypeObject *,
-                              PyObject *args, PyObject *kwds);
 
-static PyObject *
-dict_iterkeys(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
-{
-    return dictiter_new(dict, &PyOrderedDictIterKey_Type, args, kwds);
-}
 
-static PyObject *
-dict_itervalues(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
-{
-    return dictiter_new(dict, &PyOrderedDictIterValue_Type, args, kwds);
-}
+/* Dictionary iterator types */
+
+typedef struct {
+    PyObject_HEAD
+    PyOrderedDictObject *di_dict; /* Set to NULL when iterator is exhausted */
+    Py_ssize_t di_used;
+    PY_UINT64_T di_version; /* od_version of di_dict when it started */
+    Py_ssize_t di_pos;
+    PyObject* di_result; /* reusable result tuple for iteritems */
+    Py_ssize_t len;
+    Py_ssize_t step;
+} ordereddictiterobject;
 
+/* an iterator over len items, from position start onwards in steps of step */
 static PyObject *
-dict_iteritems(PyOrderedDictObject *dict, PyObject *args, PyObject *kwds)
+dictiter_range(PyOrderedDictObject *dict, PyTypeObject *itertype,
+               Py_ssize_t start, Py_ssize_t step, Py_ssize_t len)
 {
-    return dictiter_new(dict, &PyOrderedDictIterItem_Type, args, kwds);
+    ordereddictiterobject *di;
+
+    di = PyObject_New(ordereddictiterobject, itertype);
+    if (di == NULL)
+        return NULL;
+    Py_INCREF(dict);
+    /* start from a table without deleted entries, so that positions in it
+       don't change if something compacts it while iterating; a short run
+       over a sorteddict with an sd_order looks its items up in there
+       instead (which may be applied meanwhile) */
+    if (SD_ORDER(dict) == NULL || len > dict->ma_used / 8)
+        OD_COMPACT(dict);
+    di->di_dict = dict;
+    di->di_used = dict->ma_used;
+    di->di_version = dict->od_version;
+    di->len = len;
+    di->di_pos = start;
+    di->step = step;
+    if (itertype == &PyOrderedDictIterItem_Type) {
+        di->di_result = PyTuple_Pack(2, Py_None, Py_None);
+        if (di->di_result == NULL) {
+            Py_DECREF(di);
+            return NULL;
+        }
+    } else
+        di->di_result = NULL;
+    return (PyObject *)di;
 }
 
 static PyObject *
-dict_index(register PyOrderedDictObject *mp, PyObject *key)
+dictiter_new(PyOrderedDictObject *dict, PyTypeObject *itertype,
+             PyObject *args, PyObject *kwds)
 {
-    long hash;
-    PyOrderedDictEntry *ep, **tmp;
-    register Py_ssize_t index;
+    int reverse = 0;
+    static char *kwlist[] = {"reverse", 0};
 
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:keys",
+                                         kwlist, &reverse))
             return NULL;
-    }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    if (ep == NULL || ep->me_value == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "ordereddict.index(x): x not a key in ordereddict"
-                       );
-        return NULL;
-    }
-
-    for (index = 0, tmp = mp->od_otablep; index < mp->ma_used; index++, tmp++) {
-        if (*tmp == ep) {
-            return PyInt_FromSize_t(index);
-        }
-    }
-    return NULL; /* not found */
+    if (reverse)
+        return dictiter_new_reversed(dict, itertype);
+    return dictiter_range(dict, itertype, 0, 1, dict->ma_used);
 }
 
 static PyObject *
-dict_insert(PyOrderedDictObject *mp, PyObject *args)
+dictiter_new_reversed(PyOrderedDictObject *dict, PyTypeObject *itertype)
 {
-    Py_ssize_t i;
-    PyObject *key;
-    PyObject *val;
+    return dictiter_range(dict, itertype, dict->ma_used - 1, -1,
+                          dict->ma_used);
+}
 
-#if PY_VERSION_HEX >= 0x02050000
-    if (!PyArg_ParseTuple(args, "nOO:insert", &i, &key, &val))
-#else
-    if (!PyArg_ParseTuple(args, "iOO:insert", &i, &key, &val))
-#endif
-        return NULL;
-    if(PyOrderedDict_InsertItem(mp, i, key, val) != 0)
-        return NULL;
-    Py_RETURN_NONE;
+static void
+dictiter_dealloc(ordereddictiterobject *di)
+{
+    Py_XDECREF(di->di_dict);
+    Py_XDECREF(di->di_result);
+    PyObject_Del(di);
 }
 
 static PyObject *
-dict_reverse(register PyOrderedDictObject *mp)
+dictiter_len(ordereddictiterobject *di)
 {
-    PyOrderedDictEntry **epps, **eppe, *tmp;
+    Py_ssize_t len = 0;
+    if (di->di_dict != NULL && di->di_used == di->di_dict->ma_used &&
+            di->di_dict->od_moved <= di->di_version)
+        len = di->len;
+    return PyInt_FromSize_t(len);
+}
 
-    epps = mp->od_otablep;
-    eppe = epps + ((mp->ma_used)-1);
-    while (epps < eppe) {
-        tmp = *epps;
-        *epps++ = *eppe;
-        *eppe-- = tmp;
-    }
-    Py_RETURN_NONE;
+PyDoc_STRVAR(length_hint_doc, "Private method returning an estimate of len(list(it)).");
+
+static PyMethodDef dictiter_methods[] = {
+    {"__length_hint__", (PyCFunction)dictiter_len, METH_NOARGS, length_hint_doc},
+    {NULL,		NULL}		/* sentinel */
+};
+
+/* Set RuntimeError and return 1 if d had keys added, removed or reordered
+   since di started.  A new value for a key, also when kvio or lru moves it
+   to the back, doesn't stop it. */
+static int
+dictiter_changed(ordereddictiterobject *di, PyOrderedDictObject *d)
+{
+    if (di->di_used == d->ma_used && d->od_moved <= di->di_version)
+        return 0;
+    PyErr_SetString(PyExc_RuntimeError, di->di_used != d->ma_used ?
+                    "dictionary changed size during iteration" :
+                    "dictionary keys changed during iteration");
+    di->di_used = -1; /* Make this state sticky */
+    return 1;
 }
 
-static PyObject *
-dict_setkeys(register PyOrderedDictObject *mp, PyObject *keys)
+/* Return the position in ma_table of the next item to iterate over,
+   skipping deleted entries, or -1 if exhausted. Iteration stops after di->len
+   items, as kvio updates while iterating move items to the back. */
+static Py_ssize_t
+dictiter_nextpos(register ordereddictiterobject *di, PyOrderedDictObject *d)
 {
-    PyOrderedDictEntry **newtable, *item;
-    Py_ssize_t size = mp->ma_used * sizeof(PyOrderedDictEntry *), i, oldindex;
-    PyObject *key = NULL;
-    PyObject *it;
-    long hash;
+    register Py_ssize_t i = di->di_pos;
+    register PyOrderedDictEntry *ep0 = d->ma_table;
 
-    if (PySortedDict_CheckExact(mp)) {
-        PyErr_SetString(PyExc_TypeError,
-                        "sorteddict does not support setkeys() assignment");
-        return NULL;
+    if (di->len <= 0)
+        return -1;
+    if (SD_ORDER(d) != NULL) {
+        /* i is a position, there are no deleted items to skip */
+        if (i < 0 || i >= d->ma_used)
+            return -1;
+        di->di_pos = i+di->step;
+        di->len--;
+        return sd_order_at(SD_ORDER(d), i);
     }
+    while (i >= 0 && i < d->od_nentries && ep0[i].me_value == NULL)
+        i += di->step;
+    if (i < 0 || i >= d->od_nentries)
+        return -1;
+    di->di_pos = i+di->step;
+    di->len--; /* len can be calculated */
+    return i;
+}
+
+/* an iterator is locked, and then the dict it may let go of */
+#ifdef Py_GIL_DISABLED
+#define OD_ITER_LOCKED(name)						\
+static PyObject *							\
+name##_locked(ordereddictiterobject *di)				\
+{									\
+    PyObject *res = NULL, *d;						\
+    Py_BEGIN_CRITICAL_SECTION(di);					\
+    d = (PyObject *) di->di_dict;					\
+    if (d != NULL) {							\
+        Py_INCREF(d);							\
+        Py_BEGIN_CRITICAL_SECTION(d);					\
+        res = name(di);							\
+        Py_END_CRITICAL_SECTION();					\
+        Py_DECREF(d);							\
+    }									\
+    Py_END_CRITICAL_SECTION();						\
+    return res;								\
+}
+#else
+#define OD_ITER_LOCKED(name)
+#endif
 
-    /* determine length -> ok if ok
-    if ok, then we still don't know if all keys will be found
-    	so we allocate an array of ma_mask+1 size (which is what was used for
-    	last resize and start filling that.
-    	On finish, memcopy (so we don't have to worry about where the
-    	values actually are (allocated or in smallbuffer), and
-    	delete the tmp stuff,
-    	if some key cannot be found (or is double) we don't update
-    */
+static PyObject *dictiter_iternextkey(ordereddictiterobject *di)
+{
+    PyObject *key;
+    register Py_ssize_t i;
+    register PyOrderedDictEntry *ep0;
+    PyOrderedDictObject *d = di->di_dict;
 
-    newtable = PyMem_NEW(PyOrderedDictEntry *, size);
-    if (newtable == NULL) {
-        PyErr_NoMemory();
+    if (d == NULL)
         return NULL;
-    }
+    assert (PyOrderedDict_Check(d));
 
-    i = PyObject_Length(keys);
-    if ((i >=0) && (i != mp->ma_used)) {
-        PyErr_Format(PyExc_ValueError,
-                     "ordereddict setkeys requires sequence of length #%zd; "
-                     "provided was length %zd",
-                     mp->ma_used, i);
+    if (dictiter_changed(di, d))
         return NULL;
-    }
-    if (i == -1) PyErr_Clear();
-
 
-    it = PyObject_GetIter(keys);
-    if (it == NULL)
-        return NULL;
+    i = dictiter_nextpos(di, d);
+    if (i < 0)
+        goto fail;
+    ep0 = d->ma_table;
+    key = ep0[i].me_key;
+    Py_INCREF(key);
+    return key;
 
-    for (i = 0; ; ++i) {
-        key = PyIter_Next(it);
-        if (key == NULL) {
-            if (PyErr_Occurred()) break;
-            if (i != mp->ma_used) {
-                PyErr_Format(PyExc_ValueError,
-                             "ordereddict setkeys requires sequence of length #%zd; "
-                             "provided was length %zd",
-                             mp->ma_used, i);
-                break;
-            }
-            memcpy(mp->od_otablep, newtable, size);
-            PyMem_DEL(newtable);
-            Py_DECREF(it);
-            Py_RETURN_NONE;
-        }
-        if (i >= mp->ma_used) {
-            PyErr_Format(PyExc_ValueError,
-                         "ordereddict setkeys requires sequence of max length #%zd; "
-                         "a longer sequence was provided",
-                         mp->ma_used);
-            Py_DECREF(it);
-            return NULL;
-        }
-        /* find the item with this key */
-        if (!PyString_CheckExact(key) ||
-                (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-            hash = PyObject_Hash(key);
-            if (hash == -1)
-                break;
-        }
-        item = (mp->ma_lookup)(mp, key, hash);
-        if (item == NULL || item->me_value == NULL) {
-            PyErr_Format(PyExc_KeyError,
-                         "ordereddict setkeys unknown key at pos " SPR,
-                         i);
-            break;
-        }
-        /* PyObject_Print((PyObject *)item->me_key, stdout, 0);*/
-        /* check if a pointer to this item has been set */
-        for (oldindex = 0; oldindex < i; oldindex++) {
-            if (newtable[oldindex] == item) {
-                PyErr_Format(PyExc_KeyError,
-                             "ordereddict setkeys same key at pos " SPR "and " SPR,
-                             oldindex, i);
-                break;
-            }
-        }
-        /* insert the pointer to this item */
-        newtable[i] = item;
-    }
-    PyMem_DEL(newtable);
-    Py_XDECREF(key);
-    Py_DECREF(it);
+fail:
+    Py_DECREF(d);
+    di->di_dict = NULL;
     return NULL;
 }
+OD_ITER_LOCKED(dictiter_iternextkey)
 
-static PyObject *
-dict_setvalues(register PyOrderedDictObject *mp, PyObject *values)
-{
-    PyObject *it;	/* iter(seq2) */
-    Py_ssize_t i;	/* index into seq2 of current element */
-    PyObject *item = NULL;	/* values[i] */
-    PyOrderedDictEntry **epp = mp->od_otablep, *tmp;
+PyTypeObject PyOrderedDictIterKey_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.keyiterator",		/* tp_name */
+    sizeof(ordereddictiterobject),			/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictiter_dealloc, 		/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    0,					/* tp_repr */
+    0,					/* tp_as_number */
+    0,					/* tp_as_sequence */
+    0,					/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,			/* tp_flags */
+    0,					/* tp_doc */
+    0,					/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    PyObject_SelfIter,			/* tp_iter */
+    (iternextfunc)OD_LOCKED(dictiter_iternextkey),	/* tp_iternext */
+    dictiter_methods,			/* tp_methods */
+    0,
+};
 
-    assert(mp != NULL);
-    assert(PyOrderedDict_Check(mp));
-    assert(values != NULL);
+static PyObject *dictiter_iternextvalue(ordereddictiterobject *di)
+{
+    PyObject *value;
+    register Py_ssize_t i;
+    register PyOrderedDictEntry *ep0;
+    PyOrderedDictObject *d = di->di_dict;
 
-    i = PyObject_Length(values);
-    /* printf("\nlength %d %d\n", i, mp->ma_used); */
-    if ((i >=0) && (i != mp->ma_used)) {
-        PyErr_Format(PyExc_ValueError,
-                     "ordereddict setvalues requires sequence of length #%zd; "
-                     "provided was length %zd",
-                     mp->ma_used, i);
+    if (d == NULL)
         return NULL;
-    }
-    if (i == -1) PyErr_Clear();
-
+    assert (PyOrderedDict_Check(d));
 
-    it = PyObject_GetIter(values);
-    if (it == NULL)
+    if (dictiter_changed(di, d))
         return NULL;
 
-    for (i = 0; ; ++i) {
-        item = PyIter_Next(it);
-        if (item == NULL) {
-            if (PyErr_Occurred()) break;
-            if (i != mp->ma_used) {
-                PyErr_Format(PyExc_ValueError,
-                             "ordereddict setvalues requires sequence of length #%zd; "
-                             "provided was length %zd, ordereddict partially updated",
-                             mp->ma_used, i);
-                break;
-            }
-            Py_DECREF(it);
-            Py_RETURN_NONE;
-        }
-        if (i >= mp->ma_used) {
-            PyErr_Format(PyExc_ValueError,
-                         "ordereddict setvalues requires sequence of max length #%zd; "
-                         "a longer sequence was provided, ordereddict fully updated",
-                         mp->ma_used);
-            Py_DECREF(it);
-            return NULL;
-        }
-        tmp = *epp++;
-        Py_DECREF(tmp->me_value);
-        tmp->me_value = item;
-    }
-    Py_XDECREF(item);
-    Py_DECREF(it);
-    return NULL;
-}
+    i = dictiter_nextpos(di, d);
+    if (i < 0)
+        goto fail;
+    ep0 = d->ma_table;
+    value = ep0[i].me_value;
+    Py_INCREF(value);
+    return value;
 
-static PyObject *
-dict_setitems(register PyObject *mp,  PyObject *args, PyObject *kwds)
-{
-    PyOrderedDict_Clear((PyObject *)mp);
-    if (dict_update_common(mp, args, kwds, "|Oi:setitems") != -1)
-        Py_RETURN_NONE;
+fail:
+    Py_DECREF(d);
+    di->di_dict = NULL;
     return NULL;
 }
+OD_ITER_LOCKED(dictiter_iternextvalue)
 
-static PyObject *
-dict_rename(register PyOrderedDictObject *mp, PyObject *args)
+PyTypeObject PyOrderedDictIterValue_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.valueiterator",		/* tp_name */
+    sizeof(ordereddictiterobject),			/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictiter_dealloc, 		/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    0,					/* tp_repr */
+    0,					/* tp_as_number */
+    0,					/* tp_as_sequence */
+    0,					/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,			/* tp_flags */
+    0,					/* tp_doc */
+    0,					/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    PyObject_SelfIter,			/* tp_iter */
+    (iternextfunc)OD_LOCKED(dictiter_iternextvalue),	/* tp_iternext */
+    dictiter_methods,			/* tp_methods */
+    0,
+};
+
+static PyObject *dictiter_iternextitem(ordereddictiterobject *di)
 {
-    PyObject *oldkey, *newkey;
-    PyObject *val = NULL;
-    long hash;
-    PyOrderedDictEntry *ep, **epp;
-    register Py_ssize_t index;
+    PyObject *key, *value, *result = di->di_result;
+    register Py_ssize_t i;
+    register PyOrderedDictEntry *ep0;
+    PyOrderedDictObject *d = di->di_dict;
 
-    if (PySortedDict_CheckExact(mp)) {
-        PyErr_SetString(PyExc_TypeError,
-                        "sorteddict does not support rename()");
-        return NULL;
-    }
-    if (!PyArg_UnpackTuple(args, "get", 1, 2, &oldkey, &newkey))
+    if (d == NULL)
         return NULL;
+    assert (PyOrderedDict_Check(d));
 
-    if (!PyString_CheckExact(oldkey) ||
-            (hash = ((PyStringObject *) oldkey)->ob_shash) == -1) {
-        hash = PyObject_Hash(oldkey);
-        if (hash == -1)
-            return NULL;
-    }
-    ep = (mp->ma_lookup)(mp, oldkey, hash);
-    if (ep == NULL || ep->me_value == NULL)
+    if (dictiter_changed(di, d))
         return NULL;
-    epp = mp->od_otablep;
-    for (index = 0; index < mp->ma_used; index++, epp++)
-        if (*epp == ep)
-            break;
-    if (*epp != ep)
-        return NULL; /* this is bad! */
 
-    oldkey = ep->me_key; /* now point to key from item */
-    val = ep->me_value;
-    Py_INCREF(dummy);
-    ep->me_key = dummy;
-    ep->me_value = NULL;
-    memmove(epp, epp+1, (mp->ma_used - index) * sizeof(PyOrderedDictEntry *));
-    mp->ma_used--;
-    Py_DECREF(oldkey);
-    if(PyOrderedDict_InsertItem(mp, index, newkey, val) != 0)
+    i = dictiter_nextpos(di, d);
+    if (i < 0)
+        goto fail;
+    ep0 = d->ma_table;
+    key = ep0[i].me_key;
+    value = ep0[i].me_value;
+    Py_INCREF(key);
+    Py_INCREF(value);
+    if (Py_REFCNT(result) == 1) {
+        /* nobody else has the tuple of the previous step, so reuse it;
+           release what it held only once the new items are in, as that
+           can run code that changes the dict */
+        PyObject *oldkey = PyTuple_GET_ITEM(result, 0);
+        PyObject *oldvalue = PyTuple_GET_ITEM(result, 1);
+        Py_INCREF(result);
+        PyTuple_SET_ITEM(result, 0, key);
+        PyTuple_SET_ITEM(result, 1, value);
+        /* a collection untracks a tuple of atoms, the new items might not
+           be that (bpo-42536) */
+        if (!OD_GC_IS_TRACKED(result))
+            PyObject_GC_Track(result);
+        Py_DECREF(oldkey);
+        Py_DECREF(oldvalue);
+        return result;
+    }
+    result = PyTuple_New(2);
+    if (result == NULL) {
+        Py_DECREF(key);
+        Py_DECREF(value);
         return NULL;
-    Py_DECREF(val);
-    Py_RETURN_NONE;
-}
-
-/* support for pickling */
-static PyObject *
-dict_reduce(PyOrderedDictObject *self)
-{
-    PyObject *result, *it, *dict=NULL;
-    it = dictiter_new(self, &PyOrderedDictIterItem_Type, NULL, NULL);
-    dict = Py_None;
-    Py_INCREF(dict);
-    Py_INCREF(dict);
-    if (PySortedDict_CheckExact(self)) {
-        if (((PySortedDictObject *) self)->sd_cmp == NULL)
-            printf("NULL!!!!\n");
-        result = Py_BuildValue("O(()OOOi)NNO", self->ob_type,
-                               ((PySortedDictObject *) self)->sd_cmp,
-                               ((PySortedDictObject *) self)->sd_key,
-                               ((PySortedDictObject *) self)->sd_value,
-                               REVERSE(self), dict, dict, it);
-    } else {
-        result = Py_BuildValue("O(()ii)NNO", self->ob_type, RELAXED(self), KVIO(self), dict, dict, it);
     }
+    PyTuple_SET_ITEM(result, 0, key);
+    PyTuple_SET_ITEM(result, 1, value);
     return result;
+
+fail:
+    Py_DECREF(d);
+    di->di_dict = NULL;
+    return NULL;
 }
+OD_ITER_LOCKED(dictiter_iternextitem)
+
+PyTypeObject PyOrderedDictIterItem_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.itemiterator",		/* tp_name */
+    sizeof(ordereddictiterobject),			/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictiter_dealloc, 		/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    0,					/* tp_repr */
+    0,					/* tp_as_number */
+    0,					/* tp_as_sequence */
+    0,					/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,			/* tp_flags */
+    0,					/* tp_doc */
+    0,					/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    PyObject_SelfIter,			/* tp_iter */
+    (iternextfunc)OD_LOCKED(dictiter_iternextitem),	/* tp_iternext */
+    dictiter_methods,			/* tp_methods */
+    0,
+};
 
+/* Dictionary view types */
+
+/*
+A view reads the keys, values or items of an ordereddict or sorteddict
+from the dict itself each time it is used, without copying them.  A view
+of all of the dict (from viewkeys() etc.) follows the changes of the dict.
+A slice of a view covers a range of positions, so just like an iterator it
+is no longer valid once the number of items in the dict has changed.
+*/
+typedef struct {
+    PyObject_HEAD
+    PyOrderedDictObject *dv_dict;
+    Py_ssize_t dv_used; /* ma_used of dv_dict when sliced, -1 if all of it */
+    PY_UINT64_T dv_version; /* od_version of dv_dict when sliced */
+    Py_ssize_t dv_start;
+    Py_ssize_t dv_step; /* also for a view of all of it: -1 if reversed */
+    Py_ssize_t dv_len;
+} ordereddictviewobject;
 
 static PyObject *
-ordereddict_getstate(register PyOrderedDictObject *mp)
+dictview_make(PyOrderedDictObject *dict, PyTypeObject *type, Py_ssize_t used,
+              Py_ssize_t start, Py_ssize_t step, Py_ssize_t len)
 {
-    return PyInt_FromLong(mp->od_state);
+    ordereddictviewobject *dv;
+
+    dv = PyObject_GC_New(ordereddictviewobject, type);
+    if (dv == NULL)
+        return NULL;
+    Py_INCREF(dict);
+    dv->dv_dict = dict;
+    dv->dv_used = used;
+    dv->dv_version = dict->od_version;
+    dv->dv_start = start;
+    dv->dv_step = step;
+    dv->dv_len = len;
+    PyObject_GC_Track(dv);
+    return (PyObject *)dv;
 }
 
 static PyObject *
-ordereddict_dump(register PyOrderedDictObject *mp)
+dictview_new(PyOrderedDictObject *dict, PyTypeObject *type,
+             PyObject *args, PyObject *kwds)
 {
-    if (dump_ordereddict_head(mp) != -1)
-        dump_otablep(mp);
-    if (PySortedDict_CheckExact(mp))
-        dump_sorteddict_fun((PySortedDictObject *) mp);
-    Py_RETURN_NONE;
-}
-
-
-PyDoc_STRVAR(has_key__doc__,
-             "D.has_key(k) -> True if D has a key k, else False");
-
-PyDoc_STRVAR(contains__doc__,
-             "D.__contains__(k) -> True if D has a key k, else False");
-
-PyDoc_STRVAR(reduce__doc__, "Return state information for pickling.");
+    int reverse = 0;
+    static char *kwlist[] = {"reverse", 0};
 
-PyDoc_STRVAR(getitem__doc__, "x.__getitem__(y) <==> x[y]");
+    if (args != NULL)
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:view",
+                                         kwlist, &reverse))
+            return NULL;
+    return dictview_make(dict, type, -1, 0, reverse ? -1 : 1, 0);
+}
 
-PyDoc_STRVAR(get__doc__,
-             "D.get(k[,d]) -> D[k] if k in D, else d.  d defaults to None.");
+static void
+dictview_dealloc(ordereddictviewobject *dv)
+{
+    PyObject_GC_UnTrack(dv);
+    Py_XDECREF(dv->dv_dict);
+    PyObject_GC_Del(dv);
+}
 
-PyDoc_STRVAR(setdefault_doc__,
-             "D.setdefault(k[,d]) -> D.get(k,d), also set D[k]=d if k not in D");
+static int
+dictview_traverse(ordereddictviewobject *dv, visitproc visit, void *arg)
+{
+    Py_VISIT(dv->dv_dict);
+    return 0;
+}
 
-PyDoc_STRVAR(pop__doc__,
-             "D.pop(k[,d]) -> v, remove specified key and return the corresponding value\n\
-If key is not found, d is returned if given, otherwise KeyError is raised");
+/* Get the positions in the dict the view covers: len of them from start
+   in steps of step.  Returns -1, with an exception set, for a slice of a
+   view of a dict that changed size. */
+static int
+dictview_range(ordereddictviewobject *dv, Py_ssize_t *start,
+               Py_ssize_t *step, Py_ssize_t *len)
+{
+    Py_ssize_t used = dv->dv_dict->ma_used;
 
-PyDoc_STRVAR(popitem__doc__,
-             "D.popitem([index]) -> (k, v), remove and return indexed (key, value) pair as a\n\
-2-tuple (default is last); but raise KeyError if D is empty");
+    if (dv->dv_used < 0) {
+        *step = dv->dv_step;
+        *start = *step < 0 ? used - 1 : 0;
+        *len = used;
+        return 0;
+    }
+    if (dv->dv_used != used ||
+            dv->dv_dict->od_moved > dv->dv_version) {
+        PyErr_SetString(PyExc_RuntimeError, dv->dv_used != used ?
+                        "dictionary changed size after slicing the view" :
+                        "dictionary keys changed after slicing the view");
+        return -1;
+    }
+    *start = dv->dv_start;
+    *step = dv->dv_step;
+    *len = dv->dv_len;
+    return 0;
+}
 
-PyDoc_STRVAR(keys__doc__,
-             "D.keys([reverse=False]) -> list of D's keys, optionally reversed");
+static Py_ssize_t
+dictview_len(ordereddictviewobject *dv)
+{
+    Py_ssize_t start, step, len;
 
-PyDoc_STRVAR(items__doc__,
-             "D.items() -> list of D's (key, value) pairs, as 2-tuples");
+    if (dictview_range(dv, &start, &step, &len) < 0)
+        return -1;
+    return len;
+}
 
-PyDoc_STRVAR(values__doc__,
-             "D.values() -> list of D's values");
+/* the key, value or item at position pos of the dict of the view */
+static PyObject *
+dictview_item(ordereddictviewobject *dv, Py_ssize_t pos)
+{
+    PyOrderedDictEntry *ep;
+    PyObject *key, *value, *result;
 
-PyDoc_STRVAR(update__doc__,
-             "D.update(E, **F) -> None.  Update D from E and F: for k in E: D[k] = E[k]\n\
-(if E has keys else: for (k, v) in E: D[k] = v) then: for k in F: D[k] = F[k]");
+    ep = &dv->dv_dict->ma_table[od_entry_at(dv->dv_dict, pos)];
+    key = ep->me_key;
+    value = ep->me_value;
+    if (Py_Type(dv) == &PyOrderedDictKeys_Type) {
+        Py_INCREF(key);
+        return key;
+    }
+    Py_INCREF(value);
+    if (Py_Type(dv) == &PyOrderedDictValues_Type)
+        return value;
+    /* hold on to them, the allocation could trigger a garbage collection
+       that clears the dict */
+    Py_INCREF(key);
+    result = PyTuple_New(2);
+    if (result == NULL) {
+        Py_DECREF(key);
+        Py_DECREF(value);
+        return NULL;
+    }
+    PyTuple_SET_ITEM(result, 0, key);
+    PyTuple_SET_ITEM(result, 1, value);
+    return result;
+}
 
-PyDoc_STRVAR(fromkeys__doc__,
-             "dict.fromkeys(S[,v]) -> New dict with keys from S and values equal to v.\n\
-v defaults to None.");
+static PyObject *
+dictview_subscript(ordereddictviewobject *dv, PyObject *item)
+{
+    Py_ssize_t start, step, len, used, i, slicestart, slicestop, slicestep;
+    Py_ssize_t slicelength;
 
-PyDoc_STRVAR(clear__doc__,
-             "D.clear() -> None.  Remove all items from D.");
+    if (PySlice_Check(item)) {
+        used = dv->dv_dict->ma_used;
+        if (dictview_range(dv, &start, &step, &len) < 0 ||
+                PySlice_GetIndicesEx(OD_SLICE(item), len, &slicestart,
+                                     &slicestop, &slicestep, &slicelength) < 0)
+            return NULL;
+        /* if getting the indices changed the dict, the slice isn't valid */
+        return dictview_make(dv->dv_dict, Py_Type(dv), used,
+                             start + slicestart * step, step * slicestep,
+                             slicelength);
+    }
+    if (!PyIndex_Check(item)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "view indices must be integers");
+        return NULL;
+    }
+    i = PyNumber_AsSsize_t(item, PyExc_IndexError);
+    if (i == -1 && PyErr_Occurred())
+        return NULL;
+    if (dictview_range(dv, &start, &step, &len) < 0)
+        return NULL;
+    if (i < 0)
+        i += len;
+    if (i < 0 || i >= len) {
+        PyErr_SetString(PyExc_IndexError, "view index out of range");
+        return NULL;
+    }
+    return dictview_item(dv, start + i * step);
+}
 
-PyDoc_STRVAR(copy__doc__,
-             "D.copy() -> a shallow copy of D");
+static int
+dictview_contains(ordereddictviewobject *dv, PyObject *obj)
+{
+    PyOrderedDictObject *d = dv->dv_dict;
+    PyObject *key = obj, *value = NULL, *found;
+    Py_ssize_t start, step, len, ix, hashpos, i;
+    long hash;
+    int res;
 
-PyDoc_STRVAR(iterkeys__doc__,
-             "D.iterkeys([reverse=False]) -> an iterator over the keys of D");
+    if (Py_Type(dv) == &PyOrderedDictValues_Type) {
+        /* the comparisons can change the dict, so check every time */
+        for (i = 0; ; i++) {
+            if (dictview_range(dv, &start, &step, &len) < 0)
+                return -1;
+            if (i >= len)
+                return 0;
+            found = d->ma_table[od_entry_at(d, start + i * step)].me_value;
+            Py_INCREF(found);
+            res = PyObject_RichCompareBool(found, obj, Py_EQ);
+            Py_DECREF(found);
+            if (res != 0)
+                return res;
+        }
+    }
+    if (Py_Type(dv) == &PyOrderedDictItems_Type) {
+        if (!PyTuple_Check(obj) || PyTuple_GET_SIZE(obj) != 2)
+            return 0;
+        key = PyTuple_GET_ITEM(obj, 0);
+        value = PyTuple_GET_ITEM(obj, 1);
+    }
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return -1;
+    }
+    ix = OD_LOOKUP(d, key, hash, &hashpos);
+    if (ix == OD_IX_ERROR)
+        return -1;
+    if (ix < 0)
+        return 0;
+    /* nothing below runs Python code before the value is compared */
+    if (dictview_range(dv, &start, &step, &len) < 0)
+        return -1;
+    if (dv->dv_used >= 0) {
+        i = od_position(d, ix, hash) - start;
+        if (i % step != 0 || i / step < 0 || i / step >= len)
+            return 0;
+        ix = od_entry_at(d, start + (i / step) * step);
+    }
+    if (value == NULL)
+        return 1;
+    found = d->ma_table[ix].me_value;
+    Py_INCREF(found);
+    res = PyObject_RichCompareBool(found, value, Py_EQ);
+    Py_DECREF(found);
+    return res;
+}
 
-PyDoc_STRVAR(itervalues__doc__,
-             "D.itervalues() -> an iterator over the values of D");
+static PyObject *
+dictview_iter(ordereddictviewobject *dv)
+{
+    Py_ssize_t start, step, len;
+    PyTypeObject *itertype;
 
-PyDoc_STRVAR(iteritems__doc__,
-             "D.iteritems() -> an iterator over the (key, value) items of D");
+    if (dictview_range(dv, &start, &step, &len) < 0)
+        return NULL;
+    if (Py_Type(dv) == &PyOrderedDictKeys_Type)
+        itertype = &PyOrderedDictIterKey_Type;
+    else if (Py_Type(dv) == &PyOrderedDictValues_Type)
+        itertype = &PyOrderedDictIterValue_Type;
+    else
+        itertype = &PyOrderedDictIterItem_Type;
+    return dictiter_range(dv->dv_dict, itertype, start, step, len);
+}
 
-PyDoc_STRVAR(index_doc,
-             "D.index(key) -> return position of key in ordered dict");
+static PyObject *
+dictview_repr(ordereddictviewobject *dv)
+{
+    PyObject *seq, *seq_str, *result;
+    const char *name = strrchr(Py_Type(dv)->tp_name, '.') + 1;
 
-PyDoc_STRVAR(insert_doc,
-             "D.insert(index, key, value) -> add/update (key, value) and insert key at index");
+    seq = PySequence_List((PyObject *)dv);
+    if (seq == NULL)
+        return NULL;
+    seq_str = PyObject_Repr(seq);
+    Py_DECREF(seq);
+    if (seq_str == NULL)
+        return NULL;
+#ifdef OD_PY3
+    result = PyUnicode_FromFormat("%s(%U)", name, seq_str);
+#else
+    result = PyString_FromFormat("%s(%s)", name, PyString_AS_STRING(seq_str));
+#endif
+    Py_DECREF(seq_str);
+    return result;
+}
 
-PyDoc_STRVAR(reverse_doc,
-             "D.reverse() -> reverse the order of the keys of D");
+/* a view reads its dict, that it holds on to */
+#ifdef Py_GIL_DISABLED
+#define OD_VIEW_LOCKED(name, rtype)					\
+static rtype								\
+name##_locked(ordereddictviewobject *dv, PyObject *a)			\
+{									\
+    rtype res;								\
+    Py_BEGIN_CRITICAL_SECTION(dv->dv_dict);				\
+    res = name(dv, a);							\
+    Py_END_CRITICAL_SECTION();						\
+    return res;								\
+}
 
-PyDoc_STRVAR(setkeys_doc,
-             "D.setkeys(keys) -> set the keys of D (keys must be iterable and a permutation of .keys())");
+OD_VIEW_LOCKED(dictview_contains, int)
+OD_VIEW_LOCKED(dictview_subscript, PyObject *)
 
-PyDoc_STRVAR(setvalues_doc,
-             "D.setvalues(values) -> set D values to values (must be iterable)");
+static PyObject *
+dictview_iter_locked(ordereddictviewobject *dv)
+{
+    PyObject *res;
 
-PyDoc_STRVAR(setitems_doc,
-             "D.setitems(items) -> clear D and then set items");
+    Py_BEGIN_CRITICAL_SECTION(dv->dv_dict);
+    res = dictview_iter(dv);
+    Py_END_CRITICAL_SECTION();
+    return res;
+}
+#endif
 
-PyDoc_STRVAR(rename_doc,
-             "D.rename(oldkey, newkey) -> exchange keys without changing order");
+static PySequenceMethods dictview_as_sequence = {
+    (lenfunc)dictview_len,		/* sq_length */
+    0,					/* sq_concat */
+    0,					/* sq_repeat */
+    0,					/* sq_item */
+    0,					/* sq_slice */
+    0,					/* sq_ass_item */
+    0,					/* sq_ass_slice */
+    (objobjproc)OD_LOCKED(dictview_contains),	/* sq_contains */
+};
 
-PyDoc_STRVAR(getstate_doc,
-             "D.getstate() -> return the state integer");
+static PyMappingMethods dictview_as_mapping = {
+    (lenfunc)dictview_len,		/* mp_length */
+    (binaryfunc)OD_LOCKED(dictview_subscript),	/* mp_subscript */
+    0,					/* mp_ass_subscript */
+};
 
-PyDoc_STRVAR(dump_doc,
-             "D.dump() -> print internals of an orereddict");
+PyTypeObject PyOrderedDictKeys_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.ordereddict_keys",		/* tp_name */
+    sizeof(ordereddictviewobject),	/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictview_dealloc,	/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    (reprfunc)dictview_repr,		/* tp_repr */
+    0,					/* tp_as_number */
+    &dictview_as_sequence,		/* tp_as_sequence */
+    &dictview_as_mapping,		/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+    0,					/* tp_doc */
+    (traverseproc)dictview_traverse,	/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dictview_iter),	/* tp_iter */
+    0,					/* tp_iternext */
+};
 
-static PyMethodDef ordereddict_methods[] = {
-    {
-        "__contains__",(PyCFunction)dict_contains,   METH_O | METH_COEXIST,
-        contains__doc__
-    },
-    {
-        "__getitem__", (PyCFunction)dict_subscript, METH_O | METH_COEXIST,
-        getitem__doc__
-    },
-    {"__reduce__", (PyCFunction)dict_reduce, METH_NOARGS, reduce__doc__},
-    {
-        "has_key",	(PyCFunction)dict_has_key,      METH_O,
-        has_key__doc__
-    },
-    {
-        "get",         (PyCFunction)dict_get,          METH_VARARGS,
-        get__doc__
-    },
-    {
-        "setdefault",  (PyCFunction)dict_setdefault,   METH_VARARGS,
-        setdefault_doc__
-    },
-    {
-        "pop",         (PyCFunction)dict_pop,          METH_VARARGS,
-        pop__doc__
-    },
-    {
-        "popitem",	(PyCFunction)dict_popitem,	METH_VARARGS,
-        popitem__doc__
-    },
-    {
-        "keys",	(PyCFunction)dict_keys,		METH_VARARGS | METH_KEYWORDS,
-        keys__doc__
-    },
-    {
-        "items",	(PyCFunction)dict_items,	METH_VARARGS | METH_KEYWORDS,
-        items__doc__
-    },
-    {
-        "values",	(PyCFunction)dict_values,	METH_VARARGS | METH_KEYWORDS,
-        values__doc__
-    },
-    {
-        "update",	(PyCFunction)dict_update,	METH_VARARGS | METH_KEYWORDS,
-        update__doc__
-    },
-    {
-        "fromkeys",	(PyCFunction)dict_fromkeys,	METH_VARARGS | METH_CLASS,
-        fromkeys__doc__
-    },
-    {
-        "clear",	(PyCFunction)dict_clear,	METH_NOARGS,
-        clear__doc__
-    },
-    {
-        "copy",	(PyCFunction)dict_copy,		METH_NOARGS,
-        copy__doc__
-    },
-    {
-        "iterkeys",	(PyCFunction)dict_iterkeys,	METH_VARARGS | METH_KEYWORDS,
-        iterkeys__doc__
-    },
-    {
-        "itervalues",	(PyCFunction)dict_itervalues,	METH_VARARGS | METH_KEYWORDS,
-        itervalues__doc__
-    },
-    {
-        "iteritems",	(PyCFunction)dict_iteritems,	METH_VARARGS | METH_KEYWORDS,
-        iteritems__doc__
-    },
-    {"index",       (PyCFunction)dict_index,     METH_O, index_doc},
-    {"insert",      (PyCFunction)dict_insert,    METH_VARARGS, insert_doc},
-    {"reverse",     (PyCFunction)dict_reverse,   METH_NOARGS, reverse_doc},
-    {"setkeys",     (PyCFunction)dict_setkeys,   METH_O, setkeys_doc},
-    {"setvalues",   (PyCFunction)dict_setvalues, METH_O, setvalues_doc},
-    {"setitems",    (PyCFunction)dict_setitems,  METH_VARARGS | METH_KEYWORDS, setitems_doc},
-    {"rename",     (PyCFunction)dict_rename,   METH_VARARGS, rename_doc},
-    {"getstate",     (PyCFunction)ordereddict_getstate,   METH_NOARGS, getstate_doc},
-    {"dump",     (PyCFunction)ordereddict_dump,   METH_NOARGS, dump_doc},
-    {NULL,		NULL}	/* sentinel */
+PyTypeObject PyOrderedDictValues_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.ordereddict_values",		/* tp_name */
+    sizeof(ordereddictviewobject),	/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictview_dealloc,	/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    (reprfunc)dictview_repr,		/* tp_repr */
+    0,					/* tp_as_number */
+    &dictview_as_sequence,		/* tp_as_sequence */
+    &dictview_as_mapping,		/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+    0,					/* tp_doc */
+    (traverseproc)dictview_traverse,	/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dictview_iter),	/* tp_iter */
+    0,					/* tp_iternext */
 };
 
-/* Return 1 if `key` is in dict `op`, 0 if not, and -1 on error. */
-int
-PyOrderedDict_Contains(PyObject *op, PyObject *key)
-{
-    long hash;
-    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
-    PyOrderedDictEntry *ep;
+PyTypeObject PyOrderedDictItems_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.ordereddict_items",		/* tp_name */
+    sizeof(ordereddictviewobject),	/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)dictview_dealloc,	/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    (reprfunc)dictview_repr,		/* tp_repr */
+    0,					/* tp_as_number */
+    &dictview_as_sequence,		/* tp_as_sequence */
+    &dictview_as_mapping,		/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+    0,					/* tp_doc */
+    (traverseproc)dictview_traverse,	/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)OD_LOCKED(dictview_iter),	/* tp_iter */
+    0,					/* tp_iternext */
+};
 
-    if (!PyString_CheckExact(key) ||
-            (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-        hash = PyObject_Hash(key);
-        if (hash == -1)
-            return -1;
-    }
-    ep = (mp->ma_lookup)(mp, key, hash);
-    return ep == NULL ? -1 : (ep->me_value != NULL);
+/*
+snapshotdict: a read-only mapping over an image made by snapshot(), in any
+object with a (read) buffer, e.g. an mmap.  The buffer is requested again
+for every operation, so a closed mmap raises and a buffer that moved is
+followed; every offset read from the image is checked against its size.
+*/
+typedef struct {
+    PyObject_HEAD
+    PyObject *sn_source;
+    Py_ssize_t sn_size;
+    Py_ssize_t sn_used;
+    Py_ssize_t sn_mask;
+} snapshotobject;
+
+extern PyTypeObject PySnapshotIter_Type; /* Forward */
+
+static PyObject *snapshot_corrupt(void)
+{
+    PyErr_SetString(PyExc_ValueError, "snapshot image is corrupt");
+    return NULL;
 }
 
-/* Internal version of PyOrderedDict_Contains used when the hash value is already known */
-int
-_PyOrderedDict_Contains(PyObject *op, PyObject *key, long hash)
+/* the read buffer of o, not held on to, like PyObject_AsReadBuffer() that
+   Python 3 no longer has */
+static int
+od_read_buffer(PyObject *o, const void **buf, Py_ssize_t *len)
 {
-    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
-    PyOrderedDictEntry *ep;
+#ifdef OD_PY3
+    Py_buffer view;
 
-    ep = (mp->ma_lookup)(mp, key, hash);
-    return ep == NULL ? -1 : (ep->me_value != NULL);
+    if (PyObject_GetBuffer(o, &view, PyBUF_SIMPLE) < 0)
+        return -1;
+    *buf = view.buf;
+    *len = view.len;
+    PyBuffer_Release(&view);
+    return 0;
+#else
+    return PyObject_AsReadBuffer(o, buf, len);
+#endif
 }
 
-static PyObject *
-PyOderedDict_Slice(PyObject *op, register Py_ssize_t ilow,
-                   register Py_ssize_t ihigh)
+static const char *
+snapshot_image(snapshotobject *so)
 {
-    PyOrderedDictObject *mp = (PyOrderedDictObject *)op;
-    PyOrderedDictObject *slice;
+    const void *buf;
+    Py_ssize_t len;
 
-    if (mp == NULL || !PyOrderedDict_Check(mp)) {
-        PyErr_BadInternalCall();
+    if (od_read_buffer(so->sn_source, &buf, &len) < 0)
         return NULL;
-    }
-    slice = (PyOrderedDictObject *) PyOrderedDict_New();
-    if (slice == NULL)
+    if (len < so->sn_size) {
+        PyErr_SetString(PyExc_ValueError, "snapshot buffer has shrunk");
         return NULL;
-    /* [:] -> ilow = 0, ihigh MAXINT */
-    if (ilow < 0)
-        ilow += mp->ma_used;
-    if (ihigh < 0)
-        ihigh += mp->ma_used;
-    if (ilow < 0)
-        ilow = 0;
-    else if (ilow > mp->ma_used)
-        ilow = mp->ma_used;
-    if (ihigh < ilow)
-        ihigh = ilow;
-    else if (ihigh > mp->ma_used)
-        ihigh = mp->ma_used;
-
-    if (PyOrderedDict_CopySome((PyObject *) slice,
-                               op, ilow, 1, (ihigh-ilow), 1) == 0) {
-        return (PyObject *) slice;
     }
-    Py_DECREF(slice);
-    return NULL;
+    return (const char *) buf;
 }
 
-/* Hack to implement "key in dict" */
-static PySequenceMethods dict_as_sequence = {
-    0,			/* sq_length */
-    0,			/* sq_concat */
-    0,			/* sq_repeat */
-    0,			/* sq_item */
-    (ssizessizeargfunc)PyOderedDict_Slice,			/* sq_slice */
-    0,			/* sq_ass_item */
-    (ssizessizeobjargproc)dict_ass_slice,			/* sq_ass_slice */
-    PyOrderedDict_Contains,	/* sq_contains */
-    0,			/* sq_inplace_concat */
-    0,			/* sq_inplace_repeat */
-};
-
-static PyObject *
-dict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static PY_LONG_LONG
+snapshot_get(const char *buf, PY_LONG_LONG off)
 {
-    PyObject *self;
+    PY_LONG_LONG v;
 
-    assert(type != NULL && type->tp_alloc != NULL);
-    assert(dummy != NULL);
-    self = type->tp_alloc(type, 0);
-    if (self != NULL) {
-        PyOrderedDictObject *d = (PyOrderedDictObject *)self;
-        /* It's guaranteed that tp->alloc zeroed out the struct. */
-        assert(d->ma_table == NULL && d->od_fill == 0 && d->ma_used == 0);
-        INIT_NONZERO_DICT_SLOTS(d);
-        d->ma_lookup = lookdict_string;
-#ifdef SHOW_CONVERSION_COUNTS
-        ++created;
-#endif
-    }
-    return self;
+    memcpy(&v, buf + off, sizeof(v));
+    return v;
 }
 
+/* the object for the record at off */
 static PyObject *
-sorteddict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+snapshot_decode(snapshotobject *so, const char *buf, PY_LONG_LONG off)
 {
-    PyObject *self;
-
-    assert(type != NULL && type->tp_alloc != NULL);
-    assert(dummy != NULL);
-    self = type->tp_alloc(type, 0);
-    if (self != NULL) {
-        PyOrderedDictObject *d = (PyOrderedDictObject *)self;
-        /* It's guaranteed that tp->alloc zeroed out the struct. */
-        assert(d->ma_table == NULL && d->od_fill == 0 && d->ma_used == 0);
-        INIT_NONZERO_DICT_SLOTS(d);
-        d->ma_lookup = lookdict_string;
-        INIT_SORT_FUNCS(((PySortedDictObject *) self));
-#ifdef SHOW_CONVERSION_COUNTS
-        ++created;
-#endif
+    PY_LONG_LONG n;
+    double d;
+
+    if (off < OD_SNAP_INDEX(so->sn_used) || off > so->sn_size - 16)
+        return snapshot_corrupt();
+    n = snapshot_get(buf, off + 8);
+    switch (buf[off]) {
+    case 's':
+    case 'u':
+        if (n < 0 || n > so->sn_size - off - 16)
+            return snapshot_corrupt();
+        if (buf[off] == 's')
+            return PyBytes_FromStringAndSize(buf + off + 16, (Py_ssize_t) n);
+        return PyUnicode_DecodeUTF8(buf + off + 16, (Py_ssize_t) n, NULL);
+    case 'i':
+        return PyInt_FromLong((long) n);
+    case 'l':
+        return PyLong_FromLongLong(n);
+    case 'L':
+        if (n <= 0 || n > so->sn_size - off - 16)
+            return snapshot_corrupt();
+        return OD_LONG_FROM_BYTES(buf + off + 16, (size_t) n);
+    case 'b':
+        return PyBool_FromLong(n != 0);
+    case 'f':
+        memcpy(&d, &n, sizeof(d));
+        return PyFloat_FromDouble(d);
+    case 'n':
+        Py_RETURN_NONE;
     }
-    return self;
+    return snapshot_corrupt();
 }
 
 static int
-ordereddict_init(PyObject *self, PyObject *args, PyObject *kwds)
+snapshot_entry(snapshotobject *so, const char *buf, Py_ssize_t ix,
+               od_snapentry *se)
 {
-    PyObject *arg = NULL;
-    int result = 0, tmprelax = -1, tmpkvio = -1;
-
-    static char *kwlist[] = {"src", "relax", "kvio", 0};
-    if (args != NULL) {
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oii:ordereddict",
-                                         kwlist, &arg,  &tmprelax, &tmpkvio)) {
-            return -1;
-        }
-    }
-    if (tmpkvio == -1)
-        tmpkvio = ordereddict_kvio;
-    if (tmpkvio)
-        ((PyOrderedDictObject *)self)->od_state |= OD_KVIO_BIT;
-    if (tmprelax == -1)
-        tmprelax = ordereddict_relaxed;
-    if (tmprelax)
-        ((PyOrderedDictObject *)self)->od_state |= OD_RELAXED_BIT;
-
-    if (arg != NULL) {
-        if (PyObject_HasAttrString(arg, "keys"))
-            result = PyOrderedDict_Merge(self, arg, 1, tmprelax);
-        else
-            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
+    if (ix < 0 || ix >= so->sn_used) {
+        snapshot_corrupt();
+        return -1;
     }
-    /* do not initialise from keywords at all */
-    return result;
+    memcpy(se, buf + sizeof(od_snaphead) + ix * sizeof(od_snapentry),
+           sizeof(od_snapentry));
+    return 0;
 }
 
-static int
-sorteddict_init(PyObject *self, PyObject *args, PyObject *kwds)
+/*
+Position of key in the snapshot, or -1 if it is not there, -2 on error.
+Exact strings are compared with the bytes in the image, anything else with
+the object decoded from it.
+*/
+static Py_ssize_t
+snapshot_lookup(snapshotobject *so, PyObject *key, long hash)
 {
-    PyObject *arg = NULL, *cmpfun = NULL, *keyfun = NULL, *valuefun = NULL;
-    int result = 0, reverse = 0;
-
-    static char *kwlist[] = {"src", "cmp", "key", "value", "reverse", 0};
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOOi:sorteddict",
-                                         kwlist, &arg, &cmpfun, &keyfun, &valuefun, &reverse))
-            return -1;
-    if (reverse)
-        ((PyOrderedDictObject *)self)->od_state |= OD_REVERSE_BIT;
-    /* always relaxed about order of source */
-    ((PyOrderedDictObject *)self)->od_state |= OD_RELAXED_BIT;
-
-    if (keyfun != NULL && keyfun != Py_False)
-        ((PySortedDictObject *)self)->sd_key = keyfun;
+    const char *buf = snapshot_image(so);
+    size_t i, perturb = (size_t) hash, mask = (size_t) so->sn_mask, tries;
+    PY_LONG_LONG ix, off, n;
+    od_snapentry se;
+    PyObject *stored;
+    const char *kdata = NULL;
+    Py_ssize_t klen = 0;
+    char ktag = 0;
+    int cmp;
 
-    if (arg != NULL) {
-        if (PyObject_HasAttrString(arg, "keys"))
-            result = PyOrderedDict_Merge(self, arg, 1, 1);
+    if (buf == NULL)
+        return -2;
+    if (PyBytes_CheckExact(key)) {
+        ktag = 's';
+        kdata = PyBytes_AS_STRING(key);
+        klen = PyBytes_GET_SIZE(key);
+    }
+#ifdef OD_PY3
+    /* the UTF-8 of a str is cached, the record holds that */
+    else if (PyUnicode_CheckExact(key)) {
+        kdata = PyUnicode_AsUTF8AndSize(key, &klen);
+        if (kdata == NULL)
+            PyErr_Clear();	/* e.g. surrogates, compare decoded keys */
         else
-            result = PyOrderedDict_MergeFromSeq2(self, arg, 1);
+            ktag = 'u';
+    }
+#endif
+    i = (size_t) hash & mask;
+    /* once perturb is 0 the probe visits every slot */
+    for (tries = 0; tries <= mask + 8 * sizeof(size_t); tries++) {
+        ix = snapshot_get(buf, OD_SNAP_INDEX(so->sn_used) + (i & mask) * 8);
+        if (ix == -1)
+            return -1;
+        if (snapshot_entry(so, buf, (Py_ssize_t) ix, &se) < 0)
+            return -2;
+        if (se.se_hash == hash) {
+            off = se.se_key;
+            if (ktag != 0 &&
+                    off >= OD_SNAP_INDEX(so->sn_used) &&
+                    off <= so->sn_size - 16 && buf[off] == ktag) {
+                n = snapshot_get(buf, off + 8);
+                if (n == klen &&
+                        n <= so->sn_size - off - 16 &&
+                        memcmp(buf + off + 16, kdata, (size_t) n) == 0)
+                    return (Py_ssize_t) ix;
+            }
+            else {
+                stored = snapshot_decode(so, buf, off);
+                if (stored == NULL)
+                    return -2;
+                cmp = PyObject_RichCompareBool(stored, key, Py_EQ);
+                Py_DECREF(stored);
+                if (cmp < 0)
+                    return -2;
+                if (cmp > 0)
+                    return (Py_ssize_t) ix;
+                /* the comparison may have run Python code */
+                if ((buf = snapshot_image(so)) == NULL)
+                    return -2;
+            }
+        }
+        i = (i << 2) + i + perturb + 1;
+        perturb >>= PERTURB_SHIFT;
     }
-    /* do not initialise from keywords at all */
-    return result;
-}
-
-static long
-dict_nohash(PyObject *self)
-{
-    PyErr_SetString(PyExc_TypeError, "ordereddict objects are unhashable");
     return -1;
 }
 
-static PyObject *
-dict_iter(PyOrderedDictObject *dict)
+/* the index of key, -1 with KeyError set if it is not there */
+static Py_ssize_t
+snapshot_find(snapshotobject *so, PyObject *key, int raise)
 {
-    return dictiter_new(dict, &PyOrderedDictIterKey_Type, NULL, NULL);
-}
-
-PyDoc_STRVAR(ordereddict_doc,
-             "ordereddict() -> new empty dictionary.\n"
-             "dict(orderddict) -> new dictionary initialized from a mappings object's\n"
-             "    (key, value) pairs.\n"
-//"dict(seq) -> new dictionary initialized as if via:\n"
-//"    d = {}\n"
-//"    for k, v in seq:\n"
-//"        d[k] = v\n"
-//"dict(**kwargs) -> new dictionary initialized with the name=value pairs\n"
-//"    in the keyword argument list.  For example:  dict(one=1, two=2)"
-            );
-
-PyTypeObject PyOrderedDict_Type = {
-    PyObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type))
-    0,
-    "_ordereddict.ordereddict",
-    sizeof(PyOrderedDictObject),
-    0,
-    (destructor)dict_dealloc,		/* tp_dealloc */
-    (printfunc)ordereddict_print,			/* tp_print */
-    0,					/* tp_getattr */
-    0,					/* tp_setattr */
-    (cmpfunc)dict_compare,			/* tp_compare */
-    (reprfunc)ordereddict_repr,			/* tp_repr */
-    0,					/* tp_as_number */
-    &dict_as_sequence,			/* tp_as_sequence */
-    &dict_as_mapping,			/* tp_as_mapping */
-    dict_nohash,				/* tp_hash */
-    0,					/* tp_call */
-    0,					/* tp_str */
-    PyObject_GenericGetAttr,		/* tp_getattro */
-    0,					/* tp_setattro */
-    0,					/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
-    Py_TPFLAGS_BASETYPE,		/* tp_flags */
-    ordereddict_doc,				/* tp_doc */
-    dict_traverse,				/* tp_traverse */
-    dict_tp_clear,				/* tp_clear */
-    dict_richcompare,			/* tp_richcompare */
-    0,					/* tp_weaklistoffset */
-    (getiterfunc)dict_iter,			/* tp_iter */
-    0,					/* tp_iternext */
-    ordereddict_methods,				/* tp_methods */
-    0,					/* tp_members */
-    0,					/* tp_getset */
-    DEFERRED_ADDRESS(&PyDict_Type),					/* tp_base */
-    0,					/* tp_dict */
-    0,					/* tp_descr_get */
-    0,					/* tp_descr_set */
-    0,					/* tp_dictoffset */
-    ordereddict_init,				/* tp_init */
-    PyType_GenericAlloc,			/* tp_alloc */
-    dict_new,				/* tp_new */
-    PyObject_GC_Del,        		/* tp_free */
-};
+    long hash;
+    Py_ssize_t ix;
 
+    if (!PyString_CheckExact(key) ||
+            (hash = OD_STR_HASH(key)) == -1) {
+        hash = PyObject_Hash(key);
+        if (hash == -1)
+            return -2;
+    }
+    ix = snapshot_lookup(so, key, hash);
+    if (ix == -1 && raise)
+        set_key_error(key);
+    return ix;
+}
 
-PyDoc_STRVAR(sorteddict_doc,
-             "sorteddict() -> new empty dictionary.\n"
-            );
+/* key (what 0), value (1) or the (key, value) tuple (2) at position ix */
+static PyObject *
+snapshot_item(snapshotobject *so, Py_ssize_t ix, int what)
+{
+    const char *buf = snapshot_image(so);
+    od_snapentry se;
+    PyObject *key, *value, *res;
 
+    if (buf == NULL || snapshot_entry(so, buf, ix, &se) < 0)
+        return NULL;
+    if (what == 0)
+        return snapshot_decode(so, buf, se.se_key);
+    if (what == 1)
+        return snapshot_decode(so, buf, se.se_value);
+    key = snapshot_decode(so, buf, se.se_key);
+    if (key == NULL)
+        return NULL;
+    value = snapshot_decode(so, buf, se.se_value);
+    if (value == NULL) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    res = PyTuple_Pack(2, key, value);
+    Py_DECREF(key);
+    Py_DECREF(value);
+    return res;
+}
 
-PyTypeObject PySortedDict_Type = {
-    PyObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type))
-    0,
-    "_ordereddict.sorteddict",
-    sizeof(PySortedDictObject),
-    0,
-    (destructor)dict_dealloc,		/* tp_dealloc */
-    (printfunc)ordereddict_print,			/* tp_print */
-    0,					/* tp_getattr */
-    0,					/* tp_setattr */
-    (cmpfunc)dict_compare,			/* tp_compare */
-    (reprfunc)ordereddict_repr,			/* tp_repr */
-    0,					/* tp_as_number */
-    &dict_as_sequence,			/* tp_as_sequence */
-    &dict_as_mapping,			/* tp_as_mapping */
-    dict_nohash,				/* tp_hash */
-    0,					/* tp_call */
-    0,					/* tp_str */
-    PyObject_GenericGetAttr,		/* tp_getattro */
-    0,					/* tp_setattro */
-    0,					/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
-    Py_TPFLAGS_BASETYPE,		/* tp_flags */
-    sorteddict_doc,				/* tp_doc */
-    dict_traverse,				/* tp_traverse */
-    dict_tp_clear,				/* tp_clear */
-    dict_richcompare,			/* tp_richcompare */
-    0,					/* tp_weaklistoffset */
-    (getiterfunc)dict_iter,			/* tp_iter */
-    0,					/* tp_iternext */
-    ordereddict_methods,				/* tp_methods */
-    0,					/* tp_members */
-    0,					/* tp_getset */
-    DEFERRED_ADDRESS(&PyDict_Type),					/* tp_base */
-    0,					/* tp_dict */
-    0,					/* tp_descr_get */
-    0,					/* tp_descr_set */
-    0,					/* tp_dictoffset */
-    sorteddict_init,				/* tp_init */
-    PyType_GenericAlloc,			/* tp_alloc */
-    sorteddict_new,				/* tp_new */
-    PyObject_GC_Del,        		/* tp_free */
-};
+static PyObject *
+snapshot_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"image", 0};
+    snapshotobject *so;
+    PyObject *source;
+    const void *buf;
+    Py_ssize_t len;
+    od_snaphead head;
+    long probe;
 
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O:snapshotdict", kwlist,
+                                     &source))
+        return NULL;
+    if (od_read_buffer(source, &buf, &len) < 0)
+        return NULL;
+    if (len < (Py_ssize_t) sizeof(head))
+        return snapshot_corrupt();
+    memcpy(&head, buf, sizeof(head));
+    if (memcmp(head.sn_magic, OD_SNAPMAGIC, sizeof(OD_SNAPMAGIC)) != 0) {
+        PyErr_SetString(PyExc_ValueError, "not a snapshot image");
+        return NULL;
+    }
+    /* the mask is a power of two minus one, and there are empty slots */
+    if (head.sn_size > len || head.sn_used < 0 || head.sn_mask < 0 ||
+            (head.sn_mask & (head.sn_mask + 1)) != 0 ||
+            head.sn_used > head.sn_mask ||
+            head.sn_used > (head.sn_size - (PY_LONG_LONG) sizeof(head)) /
+                           (PY_LONG_LONG) sizeof(od_snapentry) ||
+            head.sn_mask >= (head.sn_size - OD_SNAP_INDEX(head.sn_used)) / 8)
+        return snapshot_corrupt();
+    probe = od_snap_probe();
+    if (probe == -1)
+        return NULL;
+    if (head.sn_probe != probe) {
+        PyErr_SetString(PyExc_ValueError,
+                        "snapshot was made with a different string hash");
+        return NULL;
+    }
+    so = PyObject_GC_New(snapshotobject, type);
+    if (so == NULL)
+        return NULL;
+    Py_INCREF(source);
+    so->sn_source = source;
+    so->sn_size = (Py_ssize_t) head.sn_size;
+    so->sn_used = (Py_ssize_t) head.sn_used;
+    so->sn_mask = (Py_ssize_t) head.sn_mask;
+    PyObject_GC_Track(so);
+    return (PyObject *) so;
+}
 
+static void
+snapshot_dealloc(snapshotobject *so)
+{
+    PyObject_GC_UnTrack(so);
+    Py_XDECREF(so->sn_source);
+    PyObject_GC_Del(so);
+}
 
-/* Dictionary iterator types */
+static int
+snapshot_traverse(snapshotobject *so, visitproc visit, void *arg)
+{
+    Py_VISIT(so->sn_source);
+    return 0;
+}
 
-typedef struct {
-    PyObject_HEAD
-    PyOrderedDictObject *di_dict; /* Set to NULL when iterator is exhausted */
-    Py_ssize_t di_used;
-    Py_ssize_t di_pos;
-    PyObject* di_result; /* reusable result tuple for iteritems */
-    Py_ssize_t len;
-    int step;
-} ordereddictiterobject;
+static Py_ssize_t
+snapshot_len(snapshotobject *so)
+{
+    return so->sn_used;
+}
 
 static PyObject *
-dictiter_new(PyOrderedDictObject *dict, PyTypeObject *itertype,
-             PyObject *args, PyObject *kwds)
+snapshot_subscript(snapshotobject *so, PyObject *key)
 {
-    ordereddictiterobject *di;
-    int reverse = 0;
-    static char *kwlist[] = {"reverse", 0};
+    Py_ssize_t ix = snapshot_find(so, key, 1);
 
-    if (args != NULL)
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:keys",
-                                         kwlist, &reverse))
-            return NULL;
+    if (ix < 0)
+        return NULL;
+    return snapshot_item(so, ix, 1);
+}
 
-    di = PyObject_New(ordereddictiterobject, itertype);
-    if (di == NULL)
+static int
+snapshot_contains(snapshotobject *so, PyObject *key)
+{
+    Py_ssize_t ix = snapshot_find(so, key, 0);
+
+    if (ix == -2)
+        return -1;
+    return ix >= 0;
+}
+
+static PyObject *
+snapshot_get_(snapshotobject *so, PyObject *args)
+{
+    PyObject *key, *failobj = Py_None;
+    Py_ssize_t ix;
+
+    if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &failobj))
         return NULL;
-    Py_INCREF(dict);
-    di->di_dict = dict;
-    di->di_used = dict->ma_used;
-    di->len = dict->ma_used;
-    if (reverse) {
-        di->di_pos = (dict->ma_used) - 1;
-        di->step = -1;
-    } else {
-        di->di_pos = 0;
-        di->step = 1;
+    ix = snapshot_find(so, key, 0);
+    if (ix == -2)
+        return NULL;
+    if (ix == -1) {
+        Py_INCREF(failobj);
+        return failobj;
     }
-    if (itertype == &PyOrderedDictIterItem_Type) {
-        di->di_result = PyTuple_Pack(2, Py_None, Py_None);
-        if (di->di_result == NULL) {
-            Py_DECREF(di);
+    return snapshot_item(so, ix, 1);
+}
+
+static PyObject *
+snapshot_index(snapshotobject *so, PyObject *key)
+{
+    Py_ssize_t ix = snapshot_find(so, key, 1);
+
+    if (ix < 0)
+        return NULL;
+    return PyInt_FromSsize_t(ix);
+}
+
+static PyObject *
+snapshot_list(snapshotobject *so, int what)
+{
+    PyObject *list = PyList_New(so->sn_used), *item;
+    Py_ssize_t i;
+
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < so->sn_used; i++) {
+        item = snapshot_item(so, i, what);
+        if (item == NULL) {
+            Py_DECREF(list);
             return NULL;
         }
-    } else
-        di->di_result = NULL;
-    return (PyObject *)di;
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
 }
 
-static void
-dictiter_dealloc(ordereddictiterobject *di)
+static PyObject *
+snapshot_keys(snapshotobject *so)
 {
-    Py_XDECREF(di->di_dict);
-    Py_XDECREF(di->di_result);
-    PyObject_Del(di);
+    return snapshot_list(so, 0);
 }
 
 static PyObject *
-dictiter_len(ordereddictiterobject *di)
+snapshot_values(snapshotobject *so)
 {
-    Py_ssize_t len = 0;
-    if (di->di_dict != NULL && di->di_used == di->di_dict->ma_used)
-        len = di->len;
-    return PyInt_FromSize_t(len);
+    return snapshot_list(so, 1);
 }
 
-PyDoc_STRVAR(length_hint_doc, "Private method returning an estimate of len(list(it)).");
+static PyObject *
+snapshot_items(snapshotobject *so)
+{
+    return snapshot_list(so, 2);
+}
 
-static PyMethodDef dictiter_methods[] = {
-    {"__length_hint__", (PyCFunction)dictiter_len, METH_NOARGS, length_hint_doc},
-    {NULL,		NULL}		/* sentinel */
-};
+typedef struct {
+    PyObject_HEAD
+    snapshotobject *si_snap;	/* NULL when exhausted */
+    Py_ssize_t si_pos;
+    int si_what;
+} snapshotiterobject;
 
-static PyObject *dictiter_iternextkey(ordereddictiterobject *di)
+static PyObject *
+snapshot_iter_new(snapshotobject *so, int what)
 {
-    PyObject *key;
-    register Py_ssize_t i;
-    register PyOrderedDictEntry **epp;
-    PyOrderedDictObject *d = di->di_dict;
+    snapshotiterobject *si;
 
-    if (d == NULL)
+    si = PyObject_New(snapshotiterobject, &PySnapshotIter_Type);
+    if (si == NULL)
         return NULL;
-    assert (PyOrderedDict_Check(d));
+    Py_INCREF(so);
+    si->si_snap = so;
+    si->si_pos = 0;
+    si->si_what = what;
+    return (PyObject *) si;
+}
 
-    if (di->di_used != d->ma_used) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "dictionary changed size during iteration");
-        di->di_used = -1; /* Make this state sticky */
-        return NULL;
-    }
+static PyObject *
+snapshot_iter(snapshotobject *so)
+{
+    return snapshot_iter_new(so, 0);
+}
 
-    i = di->di_pos;
-    if (i < 0)
-        goto fail;
-    if (i >= d->ma_used)
-        goto fail;
-    epp = d->od_otablep;
-    di->di_pos = i+di->step;
-    di->len--; /* len can be calculated */
-    key = epp[i]->me_key;
-    Py_INCREF(key);
-    return key;
+static PyObject *
+snapshot_iterkeys(snapshotobject *so)
+{
+    return snapshot_iter_new(so, 0);
+}
 
-fail:
-    Py_DECREF(d);
-    di->di_dict = NULL;
-    return NULL;
+static PyObject *
+snapshot_itervalues(snapshotobject *so)
+{
+    return snapshot_iter_new(so, 1);
 }
 
-PyTypeObject PyOrderedDictIterKey_Type = {
-    PyObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type))
-    0,					/* ob_size */
-    "_ordereddict.keyiterator",		/* tp_name */
-    sizeof(ordereddictiterobject),			/* tp_basicsize */
-    0,					/* tp_itemsize */
-    /* methods */
-    (destructor)dictiter_dealloc, 		/* tp_dealloc */
-    0,					/* tp_print */
-    0,					/* tp_getattr */
-    0,					/* tp_setattr */
-    0,					/* tp_compare */
-    0,					/* tp_repr */
-    0,					/* tp_as_number */
-    0,					/* tp_as_sequence */
-    0,					/* tp_as_mapping */
-    0,					/* tp_hash */
-    0,					/* tp_call */
-    0,					/* tp_str */
-    PyObject_GenericGetAttr,		/* tp_getattro */
-    0,					/* tp_setattro */
-    0,					/* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,			/* tp_flags */
-    0,					/* tp_doc */
-    0,					/* tp_traverse */
-    0,					/* tp_clear */
-    0,					/* tp_richcompare */
-    0,					/* tp_weaklistoffset */
-    PyObject_SelfIter,			/* tp_iter */
-    (iternextfunc)dictiter_iternextkey,	/* tp_iternext */
-    dictiter_methods,			/* tp_methods */
-    0,
-};
+static PyObject *
+snapshot_iteritems(snapshotobject *so)
+{
+    return snapshot_iter_new(so, 2);
+}
 
-static PyObject *dictiter_iternextvalue(ordereddictiterobject *di)
+static PyObject *
+snapshot_repr(snapshotobject *so)
 {
-    PyObject *value;
-    register Py_ssize_t i;
-    register PyOrderedDictEntry **epp;
-    PyOrderedDictObject *d = di->di_dict;
+    PyObject *items, *s, *result;
 
-    if (d == NULL)
+    items = snapshot_list(so, 2);
+    if (items == NULL)
         return NULL;
-    assert (PyOrderedDict_Check(d));
+    s = PyObject_Repr(items);
+    Py_DECREF(items);
+    if (s == NULL)
+        return NULL;
+#ifdef OD_PY3
+    result = PyUnicode_FromFormat("snapshotdict(%U)", s);
+#else
+    result = PyString_FromFormat("snapshotdict(%s)", PyString_AS_STRING(s));
+#endif
+    Py_DECREF(s);
+    return result;
+}
 
-    if (di->di_used != d->ma_used) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "dictionary changed size during iteration");
-        di->di_used = -1; /* Make this state sticky */
+static void
+snapshotiter_dealloc(snapshotiterobject *si)
+{
+    Py_XDECREF(si->si_snap);
+    PyObject_Del(si);
+}
+
+static PyObject *
+snapshotiter_next(snapshotiterobject *si)
+{
+    snapshotobject *so = si->si_snap;
+
+    if (so == NULL)
+        return NULL;
+    if (si->si_pos >= so->sn_used) {
+        si->si_snap = NULL;
+        Py_DECREF(so);
         return NULL;
     }
+    return snapshot_item(so, si->si_pos++, si->si_what);
+}
 
-    i = di->di_pos;
-    if (i < 0 || i >= d->ma_used)
-        goto fail;
-    epp = d->od_otablep;
-    di->di_pos = i+di->step;
-    di->len--; /* len can be calculated */
-    value = epp[i]->me_value;
-    Py_INCREF(value);
-    return value;
-
-fail:
-    Py_DECREF(d);
-    di->di_dict = NULL;
-    return NULL;
+static PyObject *
+snapshotiter_len(snapshotiterobject *si)
+{
+    Py_ssize_t len = 0;
+
+    if (si->si_snap != NULL)
+        len = si->si_snap->sn_used - si->si_pos;
+    return PyInt_FromSize_t(len);
 }
 
-PyTypeObject PyOrderedDictIterValue_Type = {
-    PyObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type))
-    0,					/* ob_size */
-    "_ordereddict.valueiterator",		/* tp_name */
-    sizeof(ordereddictiterobject),			/* tp_basicsize */
+static PyMethodDef snapshotiter_methods[] = {
+    {"__length_hint__", (PyCFunction)snapshotiter_len, METH_NOARGS, length_hint_doc},
+    {NULL,		NULL}		/* sentinel */
+};
+
+PyTypeObject PySnapshotIter_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.snapshotiterator",	/* tp_name */
+    sizeof(snapshotiterobject),		/* tp_basicsize */
     0,					/* tp_itemsize */
     /* methods */
-    (destructor)dictiter_dealloc, 		/* tp_dealloc */
+    (destructor)snapshotiter_dealloc,	/* tp_dealloc */
     0,					/* tp_print */
     0,					/* tp_getattr */
     0,					/* tp_setattr */
@@ -3529,93 +9420,322 @@ PyTypeObject PyOrderedDictIterValue_Type = {
     0,					/* tp_richcompare */
     0,					/* tp_weaklistoffset */
     PyObject_SelfIter,			/* tp_iter */
-    (iternextfunc)dictiter_iternextvalue,	/* tp_iternext */
-    dictiter_methods,			/* tp_methods */
+    (iternextfunc)snapshotiter_next,	/* tp_iternext */
+    snapshotiter_methods,		/* tp_methods */
     0,
 };
 
-static PyObject *dictiter_iternextitem(ordereddictiterobject *di)
+PyDoc_STRVAR(snapshot_get__doc__,
+             "S.get(k[,d]) -> S[k] if k in S, else d.  d defaults to None.");
+
+PyDoc_STRVAR(snapshot_index__doc__,
+             "S.index(key) -> return the index of key in S");
+
+PyDoc_STRVAR(snapshot_keys__doc__, "S.keys() -> list of S's keys");
+
+PyDoc_STRVAR(snapshot_values__doc__, "S.values() -> list of S's values");
+
+PyDoc_STRVAR(snapshot_items__doc__,
+             "S.items() -> list of S's (key, value) pairs, as 2-tuples");
+
+PyDoc_STRVAR(snapshot_iterkeys__doc__,
+             "S.iterkeys() -> an iterator over the keys of S");
+
+PyDoc_STRVAR(snapshot_itervalues__doc__,
+             "S.itervalues() -> an iterator over the values of S");
+
+PyDoc_STRVAR(snapshot_iteritems__doc__,
+             "S.iteritems() -> an iterator over the (key, value) items of S");
+
+static PyMethodDef snapshot_methods[] = {
+    {"get",        (PyCFunction)snapshot_get_,      METH_VARARGS, snapshot_get__doc__},
+    {"index",      (PyCFunction)snapshot_index,      METH_O,       snapshot_index__doc__},
+    {"keys",       (PyCFunction)snapshot_keys,       METH_NOARGS,  snapshot_keys__doc__},
+    {"values",     (PyCFunction)snapshot_values,     METH_NOARGS,  snapshot_values__doc__},
+    {"items",      (PyCFunction)snapshot_items,      METH_NOARGS,  snapshot_items__doc__},
+    {"iterkeys",   (PyCFunction)snapshot_iterkeys,   METH_NOARGS,  snapshot_iterkeys__doc__},
+    {"itervalues", (PyCFunction)snapshot_itervalues, METH_NOARGS,  snapshot_itervalues__doc__},
+    {"iteritems",  (PyCFunction)snapshot_iteritems,  METH_NOARGS,  snapshot_iteritems__doc__},
+    {NULL,		NULL}		/* sentinel */
+};
+
+static PySequenceMethods snapshot_as_sequence = {
+    0,					/* sq_length */
+    0,					/* sq_concat */
+    0,					/* sq_repeat */
+    0,					/* sq_item */
+    0,					/* sq_slice */
+    0,					/* sq_ass_item */
+    0,					/* sq_ass_slice */
+    (objobjproc)snapshot_contains,	/* sq_contains */
+};
+
+static PyMappingMethods snapshot_as_mapping = {
+    (lenfunc)snapshot_len,		/* mp_length */
+    (binaryfunc)snapshot_subscript,	/* mp_subscript */
+    0,					/* mp_ass_subscript */
+};
+
+PyDoc_STRVAR(snapshotdict_doc,
+             "snapshotdict(image) -> read-only ordered mapping over the image made\n"
+             "by ordereddict.snapshot(), in a str, buffer or mmap, used in place");
+
+PyTypeObject PySnapshotDict_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.snapshotdict",		/* tp_name */
+    sizeof(snapshotobject),		/* tp_basicsize */
+    0,					/* tp_itemsize */
+    /* methods */
+    (destructor)snapshot_dealloc,	/* tp_dealloc */
+    0,					/* tp_print */
+    0,					/* tp_getattr */
+    0,					/* tp_setattr */
+    0,					/* tp_compare */
+    (reprfunc)snapshot_repr,		/* tp_repr */
+    0,					/* tp_as_number */
+    &snapshot_as_sequence,		/* tp_as_sequence */
+    &snapshot_as_mapping,		/* tp_as_mapping */
+    0,					/* tp_hash */
+    0,					/* tp_call */
+    0,					/* tp_str */
+    PyObject_GenericGetAttr,		/* tp_getattro */
+    0,					/* tp_setattro */
+    0,					/* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+    snapshotdict_doc,			/* tp_doc */
+    (traverseproc)snapshot_traverse,	/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    (getiterfunc)snapshot_iter,		/* tp_iter */
+    0,					/* tp_iternext */
+    snapshot_methods,			/* tp_methods */
+    0,					/* tp_members */
+    0,					/* tp_getset */
+    0,					/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    0,					/* tp_init */
+    0,					/* tp_alloc */
+    snapshot_new,			/* tp_new */
+    PyObject_GC_Del,			/* tp_free */
+};
+
+/*
+sharedkeys: the keys of a kind of record, calling it makes an ordereddict
+with those keys, see OD_KEYS_SHARED().  Its dict is not GC tracked, so that
+the collector never clears it while ordereddicts still use its indices (a
+key referring back to such an ordereddict makes a cycle that is not found).
+*/
+static PyObject *
+sharedkeys_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
-    PyObject *key, *value, *result = di->di_result;
-    register Py_ssize_t i;
-    register PyOrderedDictEntry **epp;
-    PyOrderedDictObject *d = di->di_dict;
+    static char *kwlist[] = {"keys", 0};
+    PyObject *keys, *it, *key;
+    PyOrderedDictObject *mp;
+    sharedkeysobject *sk;
+    Py_ssize_t n = 0;
 
-    if (d == NULL)
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O:sharedkeys", kwlist,
+                                     &keys))
         return NULL;
-    assert (PyOrderedDict_Check(d));
-
-    if (di->di_used != d->ma_used) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "dictionary changed size during iteration");
-        di->di_used = -1; /* Make this state sticky */
+    it = PyObject_GetIter(keys);
+    if (it == NULL)
+        return NULL;
+    mp = (PyOrderedDictObject *) PyOrderedDict_New();
+    if (mp == NULL) {
+        Py_DECREF(it);
         return NULL;
     }
+    PyObject_GC_UnTrack(mp);
+    while ((key = PyIter_Next(it)) != NULL) {
+        if (PyOrderedDict_SetItem((PyObject *) mp, key, Py_None) < 0) {
+            Py_DECREF(key);
+            goto Fail;
+        }
+        Py_DECREF(key);
+        if (mp->ma_used != ++n) {
+            PyErr_Format(PyExc_ValueError,
+                         "sharedkeys() same key twice, the second at pos " SPR,
+                         n - 1);
+            goto Fail;
+        }
+    }
+    if (PyErr_Occurred())
+        goto Fail;
+    Py_CLEAR(it);
+    /* the smallest table that holds them */
+    if (dictresize(mp, mp->ma_used) < 0)
+        goto Fail;
+    sk = (sharedkeysobject *) type->tp_alloc(type, 0);
+    if (sk == NULL)
+        goto Fail;
+    sk->sk_dict = mp;
+    return (PyObject *) sk;
+Fail:
+    Py_XDECREF(it);
+    Py_DECREF(mp);
+    return NULL;
+}
 
-    i = di->di_pos;
-    if (i < 0)
-        goto fail;
+static void
+sharedkeys_dealloc(sharedkeysobject *sk)
+{
+    Py_XDECREF(sk->sk_dict);
+    Py_TYPE(sk)->tp_free((PyObject *) sk);
+}
 
-    if (i >= d->ma_used)
-        goto fail;
-    epp = d->od_otablep;
-    di->di_pos = i+di->step;
-    if (result->ob_refcnt == 1) {
-        Py_INCREF(result);
-        Py_DECREF(PyTuple_GET_ITEM(result, 0));
-        Py_DECREF(PyTuple_GET_ITEM(result, 1));
-    } else {
-        result = PyTuple_New(2);
-        if (result == NULL)
-            return NULL;
+static PyObject *
+sharedkeys_call(sharedkeysobject *sk, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"values", 0};
+    PyObject *values = NULL, *seq, **items, *res;
+    PyOrderedDictEntry *ep;
+    Py_ssize_t i, n = sk->sk_dict->ma_used;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:sharedkeys", kwlist,
+                                     &values))
+        return NULL;
+    if (values == NULL)
+        return od_shared_new(sk);
+    seq = PySequence_Fast(values, "sharedkeys() values must be an iterable");
+    if (seq == NULL)
+        return NULL;
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_Format(PyExc_ValueError,
+                     "sharedkeys() requires sequence of length #%zd; "
+                     "provided was length %zd",
+                     n, PySequence_Fast_GET_SIZE(seq));
+        Py_DECREF(seq);
+        return NULL;
     }
-    di->len--; /* len can be calculated */
-    key = epp[i]->me_key;
-    value = epp[i]->me_value;
-    Py_INCREF(key);
-    Py_INCREF(value);
-    PyTuple_SET_ITEM(result, 0, key);
-    PyTuple_SET_ITEM(result, 1, value);
-    return result;
+    res = od_shared_new(sk);
+    if (res != NULL) {
+        ep = ((PyOrderedDictObject *) res)->ma_table;
+        items = PySequence_Fast_ITEMS(seq);
+        for (i = 0; i < n; i++) {
+            Py_INCREF(items[i]);
+            OD_SHARE(items[i]);
+            Py_DECREF(ep[i].me_value);	/* None */
+            ep[i].me_value = items[i];
+        }
+    }
+    Py_DECREF(seq);
+    return res;
+}
 
-fail:
-    Py_DECREF(d);
-    di->di_dict = NULL;
-    return NULL;
+static Py_ssize_t
+sharedkeys_len(sharedkeysobject *sk)
+{
+    return sk->sk_dict->ma_used;
 }
 
-PyTypeObject PyOrderedDictIterItem_Type = {
-    PyObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type))
-    0,					/* ob_size */
-    "_ordereddict.itemiterator",		/* tp_name */
-    sizeof(ordereddictiterobject),			/* tp_basicsize */
+static PyObject *
+sharedkeys_keys(sharedkeysobject *sk)
+{
+    return PyOrderedDict_Keys((PyObject *) sk->sk_dict);
+}
+
+static PyObject *
+sharedkeys_sizeof(sharedkeysobject *sk)
+{
+    PyObject *res = dict_sizeof(sk->sk_dict);
+    Py_ssize_t size;
+
+    if (res == NULL)
+        return NULL;
+    size = PyNumber_AsSsize_t(res, PyExc_OverflowError);
+    Py_DECREF(res);
+    return PyInt_FromSsize_t(Py_TYPE(sk)->tp_basicsize + size);
+}
+
+static PyObject *
+sharedkeys_repr(sharedkeysobject *sk)
+{
+    PyObject *keys, *s, *result;
+
+    keys = sharedkeys_keys(sk);
+    if (keys == NULL)
+        return NULL;
+    s = PyObject_Repr(keys);
+    Py_DECREF(keys);
+    if (s == NULL)
+        return NULL;
+#ifdef OD_PY3
+    result = PyUnicode_FromFormat("sharedkeys(%U)", s);
+#else
+    result = PyString_FromFormat("sharedkeys(%s)", PyString_AS_STRING(s));
+#endif
+    Py_DECREF(s);
+    return result;
+}
+
+PyDoc_STRVAR(sharedkeys_keys__doc__, "S.keys() -> list of S's keys");
+
+PyDoc_STRVAR(sharedkeys_sizeof__doc__,
+             "S.__sizeof__() -> size of S in memory, in bytes, its indices included");
+
+static PyMethodDef sharedkeys_methods[] = {
+    {"keys",       (PyCFunction)sharedkeys_keys,     METH_NOARGS, sharedkeys_keys__doc__},
+    {"__sizeof__", (PyCFunction)sharedkeys_sizeof,   METH_NOARGS, sharedkeys_sizeof__doc__},
+    {NULL,		NULL}		/* sentinel */
+};
+
+static PyMappingMethods sharedkeys_as_mapping = {
+    (lenfunc)sharedkeys_len,		/* mp_length */
+    0,					/* mp_subscript */
+    0,					/* mp_ass_subscript */
+};
+
+PyDoc_STRVAR(sharedkeys_doc,
+             "sharedkeys(keys) -> the keys of a kind of record, S(values) makes an\n"
+             "ordereddict with those keys and values, that shares its hash table\n"
+             "with the others made by S until its keys are changed (S() has None\n"
+             "for all values)");
+
+PyTypeObject PySharedKeys_Type = {
+    PyVarObject_HEAD_INIT(DEFERRED_ADDRESS(&PyType_Type), 0)
+    "_ordereddict.sharedkeys",		/* tp_name */
+    sizeof(sharedkeysobject),		/* tp_basicsize */
     0,					/* tp_itemsize */
     /* methods */
-    (destructor)dictiter_dealloc, 		/* tp_dealloc */
+    (destructor)sharedkeys_dealloc,	/* tp_dealloc */
     0,					/* tp_print */
     0,					/* tp_getattr */
     0,					/* tp_setattr */
     0,					/* tp_compare */
-    0,					/* tp_repr */
+    (reprfunc)sharedkeys_repr,		/* tp_repr */
     0,					/* tp_as_number */
     0,					/* tp_as_sequence */
-    0,					/* tp_as_mapping */
+    &sharedkeys_as_mapping,		/* tp_as_mapping */
     0,					/* tp_hash */
-    0,					/* tp_call */
+    (ternaryfunc)sharedkeys_call,	/* tp_call */
     0,					/* tp_str */
     PyObject_GenericGetAttr,		/* tp_getattro */
     0,					/* tp_setattro */
     0,					/* tp_as_buffer */
     Py_TPFLAGS_DEFAULT,			/* tp_flags */
-    0,					/* tp_doc */
+    sharedkeys_doc,			/* tp_doc */
     0,					/* tp_traverse */
     0,					/* tp_clear */
     0,					/* tp_richcompare */
     0,					/* tp_weaklistoffset */
-    PyObject_SelfIter,			/* tp_iter */
-    (iternextfunc)dictiter_iternextitem,	/* tp_iternext */
-    dictiter_methods,			/* tp_methods */
-    0,
+    0,					/* tp_iter */
+    0,					/* tp_iternext */
+    sharedkeys_methods,			/* tp_methods */
+    0,					/* tp_members */
+    0,					/* tp_getset */
+    0,					/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    0,					/* tp_init */
+    0,					/* tp_alloc */
+    sharedkeys_new,			/* tp_new */
+    PyObject_Del,			/* tp_free */
 };
 
 /*******************************************************************/
@@ -3644,6 +9764,166 @@ getset_kvio(PyObject *self, PyObject *args)
     return PyBool_FromLong(oldval);
 }
 
+static PyObject *
+getset_autoshrink(PyObject *self, PyObject *args)
+{
+    int n = -1, oldval = ordereddict_autoshrink;
+    if (!PyArg_ParseTuple(args, "|i", &n))
+        return NULL;
+    if (n != -1) {
+        ordereddict_autoshrink = n;
+    }
+    return PyBool_FromLong(oldval);
+}
+
+PyDoc_STRVAR(incremental_doc,
+"incremental([slots]) -> the current setting\n\n\
+An ordereddict with a table of at least slots slots (0, the default: none)\n\
+that grows is rehashed a few entries with every insert after that, instead\n\
+of all at once; lookups meanwhile look in the old table as well.");
+
+static PyObject *
+getset_incremental(PyObject *self, PyObject *args)
+{
+    Py_ssize_t n = -1, oldval = ordereddict_incremental;
+    if (!PyArg_ParseTuple(args, "|n:incremental", &n))
+        return NULL;
+    if (n < -1) {
+        PyErr_SetString(PyExc_ValueError, "slots must not be negative");
+        return NULL;
+    }
+    if (n != -1) {
+        ordereddict_incremental = n;
+    }
+    return PyInt_FromSsize_t(oldval);
+}
+
+PyDoc_STRVAR(arena_doc,
+"arena([enable]) -> dict with the memory of the tables of all dicts\n\n\
+enable: cut the tables of small dicts (up to 128 slots) from slabs of 256 KiB\n\
+instead of allocating each one by itself, or stop doing so (a slab stays\n\
+until the last table on it is freed).  Off by default.  The result has the\n\
+setting as \"enabled\", the table blocks (pooled ones included) and their\n\
+bytes as \"tables\" and \"table_bytes\", and the slabs, their bytes and\n\
+the tables on them as \"slabs\", \"slab_bytes\" and \"slab_tables\".");
+
+static PyObject *
+getset_arena(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"enable", 0};
+    int enable = -1, enabled;
+    Py_ssize_t tables, table_bytes, slabs, slab_tables;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:arena", kwlist, &enable))
+        return NULL;
+    OD_POOL_LOCK();
+    if (enable != -1)
+        od_arena = enable != 0;
+    enabled = od_arena;
+    tables = od_table_count;
+    table_bytes = od_table_bytes;
+    slabs = od_slab_count;
+    slab_tables = od_slab_chunks;
+    OD_POOL_UNLOCK();
+    return Py_BuildValue("{sNsnsnsnsnsn}",
+                         "enabled", PyBool_FromLong(enabled),
+                         "tables", tables,
+                         "table_bytes", table_bytes,
+                         "slabs", slabs,
+                         "slab_bytes", slabs * (Py_ssize_t) OD_SLAB_SIZE,
+                         "slab_tables", slab_tables);
+}
+
+PyDoc_STRVAR(module_stats_doc,
+"stats([enable, reset]) -> dict with the counters totalled over all dicts\n\n\
+enable: count lookups and their probes, resizes, entries moved and key\n\
+function calls (for all dicts, see D.stats() for one), or stop doing so;\n\
+reset: set the totals to 0 first.  Counting is off by default, when off it\n\
+costs next to nothing.  The result has the setting as \"enabled\".");
+
+static PyObject *
+getset_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"enable", "reset", 0};
+    int enable = -1, reset = 0, err;
+    PyObject *res, *v;
+    od_stats st;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii:stats", kwlist,
+                                     &enable, &reset))
+        return NULL;
+    if (reset)
+        memset(&od_stats_total, 0, sizeof(od_stats));
+    if (enable != -1)
+        ordereddict_stats = enable != 0;
+    st = od_stats_total;
+    res = od_stats_dict(&st);
+    if (res == NULL)
+        return NULL;
+    v = PyBool_FromLong(ordereddict_stats);
+    err = PyDict_SetItemString(res, "enabled", v);
+    Py_DECREF(v);
+    if (err < 0) {
+        Py_DECREF(res);
+        return NULL;
+    }
+    return res;
+}
+
+PyDoc_STRVAR(pool_doc,
+"pool([dicts, tables, maxslots]) -> dict with the pool limits and sizes\n\n\
+dicts: length of the free list kept for each of ordereddict and sorteddict;\n\
+tables: number of table buffers kept per size; maxslots: largest table\n\
+(in slots) that is kept at all.  Arguments that are given set the limit\n\
+(0 disables), pooled memory over the new limits is released.");
+
+static PyObject *
+getset_pool(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"dicts", "tables", "maxslots", 0};
+    int dicts = -1, tables = -1, c, ndicts, nsorteddicts;
+    Py_ssize_t maxslots = -1, ntables = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iin:pool", kwlist,
+                                     &dicts, &tables, &maxslots))
+        return NULL;
+    if (dicts < -1 || dicts > OD_MAXFREELIST) {
+        PyErr_Format(PyExc_ValueError,
+                     "pool dicts must be 0 .. %d", OD_MAXFREELIST);
+        return NULL;
+    }
+    if (tables < -1 || tables > OD_POOL_MAXDEPTH) {
+        PyErr_Format(PyExc_ValueError,
+                     "pool tables must be 0 .. %d", OD_POOL_MAXDEPTH);
+        return NULL;
+    }
+    if (maxslots < -1 || maxslots > ((Py_ssize_t) 1 << (OD_POOL_CLASSES - 1))) {
+        PyErr_Format(PyExc_ValueError, "pool maxslots must be 0 .. %zd",
+                     (Py_ssize_t) 1 << (OD_POOL_CLASSES - 1));
+        return NULL;
+    }
+    OD_POOL_LOCK();
+    if (dicts != -1)
+        od_freelist_limit = dicts;
+    if (tables != -1)
+        od_pool_depth = tables;
+    if (maxslots != -1)
+        od_pool_maxslots = maxslots;
+    od_pool_trim();
+    for (c = 0; c < OD_POOL_CLASSES; c++)
+        ntables += od_pool_count[c];
+    ndicts = num_free_dicts;
+    nsorteddicts = num_free_sorteddicts;
+    OD_POOL_UNLOCK();
+    return Py_BuildValue("{sisisnsisisn}",
+                         "dicts", od_freelist_limit,
+                         "tables", od_pool_depth,
+                         "maxslots", od_pool_maxslots,
+                         "free_ordereddicts", ndicts,
+                         "free_sorteddicts", nsorteddicts,
+                         "free_tables", ntables);
+}
+
 static PyMethodDef ordereddict_functions[] = {
     {
         "relax",	getset_relaxed,	METH_VARARGS,
@@ -3653,56 +9933,165 @@ static PyMethodDef ordereddict_functions[] = {
         "kvio",	getset_kvio,	METH_VARARGS,
         "get/set routine for allowing global KeyValue Insertion Order initialisation"
     },
+    {
+        "autoshrink",	getset_autoshrink,	METH_VARARGS,
+        "get/set routine for shrinking tables when most items have been deleted"
+    },
+    {
+        "incremental",	getset_incremental,	METH_VARARGS,
+        incremental_doc
+    },
+    {
+        "pool",	(PyCFunction)getset_pool,	METH_VARARGS | METH_KEYWORDS,
+        pool_doc
+    },
+    {
+        "arena",	(PyCFunction)getset_arena,	METH_VARARGS | METH_KEYWORDS,
+        arena_doc
+    },
+    {
+        "stats",	(PyCFunction)getset_stats,	METH_VARARGS | METH_KEYWORDS,
+        module_stats_doc
+    },
     {NULL,		NULL}		/* sentinel */
 };
 
 
+#ifdef OD_PY3
+/* isinstance(d, MutableMapping) for an ordereddict (and so a sorteddict),
+   which without dict as its base doesn't follow from the methods */
+static int
+od_register_mapping(PyObject *type)
+{
+    PyObject *abc, *mm, *res;
+
+    abc = PyImport_ImportModule("collections.abc");
+    if (abc == NULL)
+        return -1;
+    mm = PyObject_GetAttrString(abc, "MutableMapping");
+    Py_DECREF(abc);
+    if (mm == NULL)
+        return -1;
+    res = PyObject_CallMethod(mm, "register", "O", type);
+    Py_DECREF(mm);
+    Py_XDECREF(res);
+    return res == NULL ? -1 : 0;
+}
+
+static struct PyModuleDef ordereddict_module = {
+    PyModuleDef_HEAD_INIT,
+    "_ordereddict",
+    ordereddict_doc,
+    -1,
+    ordereddict_functions,
+};
+
+#define OD_INIT_ERROR	return NULL
+
+PyMODINIT_FUNC
+PyInit__ordereddict(void)
+#else
+#define OD_INIT_ERROR	return
+
 PyMODINIT_FUNC
 init_ordereddict(void)
+#endif
 {
     PyObject *m;
 
-    if (dummy == NULL) { /* Auto-initialize dummy */
-        dummy = PyString_FromString("<dummy key>");
-        if (dummy == NULL)
-            return;
 #ifdef SHOW_CONVERSION_COUNTS
-        Py_AtExit(show_counts);
+    Py_AtExit(show_counts);
 #endif
-    }
 
     /* Fill in deferred data addresses.  This must be done before
        PyType_Ready() is called.  Note that PyType_Ready() automatically
        initializes the ob.ob_type field to &PyType_Type if it's NULL,
        so it's not necessary to fill in ob_type first. */
+#ifdef OD_PY3
+    /* not a dict: the layout differs, and CPython would use one that
+       claims to be a dict (dict.get(), globals, __dict__) as a real one */
+    PyOrderedDict_Type.tp_base = &PyBaseObject_Type;
+#else
     PyOrderedDict_Type.tp_base = &PyDict_Type;
+#endif
     PySortedDict_Type.tp_base = &PyOrderedDict_Type;
+    PyFrozenOrderedDict_Type.tp_base = &PyOrderedDict_Type;
+#if PY_VERSION_HEX >= 0x03090000
+    PyOrderedDict_Type.tp_vectorcall = od_vectorcall;
+    PySortedDict_Type.tp_vectorcall = od_vectorcall;
+#endif
 
     if (PyType_Ready(&PyOrderedDict_Type) < 0)
-        return;
+        OD_INIT_ERROR;
     if (PyType_Ready(&PySortedDict_Type) < 0)
-        return;
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PyFrozenOrderedDict_Type) < 0)
+        OD_INIT_ERROR;
+    OD_NOT_DICT_C(&PyOrderedDict_Type);
+    OD_NOT_DICT_C(&PySortedDict_Type);
+    OD_NOT_DICT_C(&PyFrozenOrderedDict_Type);
 
     /* AvdN: TODO understand why it is necessary or not (as it seems)
     to PyTypeReady the iterator types
     */
-
+    /* the view types are garbage collected, they have to be readied */
+    if (PyType_Ready(&PyOrderedDictKeys_Type) < 0)
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PyOrderedDictValues_Type) < 0)
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PyOrderedDictItems_Type) < 0)
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PySnapshotDict_Type) < 0)
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PySnapshotIter_Type) < 0)
+        OD_INIT_ERROR;
+    if (PyType_Ready(&PySharedKeys_Type) < 0)
+        OD_INIT_ERROR;
+
+#ifdef OD_PY3
+    m = PyModule_Create(&ordereddict_module);
+#else
     m = Py_InitModule3("_ordereddict",
                        ordereddict_functions,
                        ordereddict_doc
                        // , NULL, PYTHON_API_VERSION
                       );
+#endif
     if (m == NULL)
-        return;
+        OD_INIT_ERROR;
+#ifdef Py_GIL_DISABLED
+    /* the types lock themselves */
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
 
     if (PyType_Ready(&PyOrderedDict_Type) < 0)
-        return;
+        OD_INIT_ERROR;
 
     Py_INCREF(&PyOrderedDict_Type);
     if (PyModule_AddObject(m, "ordereddict",
                            (PyObject *) &PyOrderedDict_Type) < 0)
-        Py_INCREF(&PySortedDict_Type);
+        OD_INIT_ERROR;
+    Py_INCREF(&PySortedDict_Type);
     if (PyModule_AddObject(m, "sorteddict",
                            (PyObject *) &PySortedDict_Type) < 0)
-        return;
+        OD_INIT_ERROR;
+    Py_INCREF(&PyFrozenOrderedDict_Type);
+    if (PyModule_AddObject(m, "frozenordereddict",
+                           (PyObject *) &PyFrozenOrderedDict_Type) < 0)
+        OD_INIT_ERROR;
+    Py_INCREF(&PySnapshotDict_Type);
+    if (PyModule_AddObject(m, "snapshotdict",
+                           (PyObject *) &PySnapshotDict_Type) < 0)
+        OD_INIT_ERROR;
+    Py_INCREF(&PySharedKeys_Type);
+    if (PyModule_AddObject(m, "sharedkeys",
+                           (PyObject *) &PySharedKeys_Type) < 0)
+        OD_INIT_ERROR;
+#ifdef OD_PY3
+    if (od_register_mapping((PyObject *) &PyOrderedDict_Type) < 0) {
+        Py_DECREF(m);
+        OD_INIT_ERROR;
+    }
+    return m;
+#endif
 }
@@ -11,8 +11,8 @@ extern "C" {
 #define PyAPI_DATA(RTYPE) __declspec(dllexport) RTYPE
 #endif
 
-/* Ordered Dictionary object implementation using a hash table and a vector of
-   pointers to the items.
+/* Ordered Dictionary object implementation using a table of indices into a
+   dense, ordered, array of the items.
 */
 /*
 
@@ -27,6 +27,12 @@ extern "C" {
   2007-10-13: Anthon van der Neut
 */
 
+/* A free-threaded build (3.14 on, for PyUnstable_TryIncRef) looks up
+   str keys without taking the lock of the dict, see ordereddict.c */
+#if defined(Py_GIL_DISABLED) && PY_VERSION_HEX >= 0x030E0000
+#define OD_LOCKFREE_READS
+#endif
+
 /* Dictionary object type -- mapping from hashable object to object */
 
 /* The distribution includes a separate file, Objects/dictnotes.txt,
@@ -36,28 +42,28 @@ extern "C" {
 */
 
 /*
-There are three kinds of slots in the table:
+The hash table proper (od_indices) only holds indices into ma_table, the
+entries themselves are stored densely in ma_table, in the order of the
+ordereddict (insertion order, or sort order for sorteddict).
+There are three kinds of slots in od_indices:
 
+1. Unused.  OD_IX_EMPTY
+   Does not refer to an entry now and never did.  Unused can transition
+   to Active upon key insertion.  This is each slot's initial state.
 
-1. Unused.  me_key == me_value == NULL
-   Does not hold an active (key, value) pair now and never did.  Unused can
-   transition to Active upon key insertion.  This is the only case in which
-   me_key is NULL, and is each slot's initial state.
+2. Active.  >= 0
+   The index into ma_table of an Active entry.  Active can transition to
+   Dummy upon key deletion.
 
-2. Active.  me_key != NULL and me_key != dummy and me_value != NULL
-   Holds an active (key, value) pair.  Active can transition to Dummy upon
-   key deletion.  This is the only case in which me_value != NULL.
+3. Dummy.  OD_IX_DUMMY
+   Previously referred to an entry, but that was deleted.  Dummy can
+   transition to Active upon key insertion.  Dummy slots cannot be made
+   Unused again, else the probe sequence in case of collision would have
+   no way to know they were once active.
 
-3. Dummy.  me_key == dummy and me_value == NULL
-   Previously held an active (key, value) pair, but that was deleted and an
-   active pair has not yet overwritten the slot.  Dummy can transition to
-   Active upon key insertion.  Dummy slots cannot be made Unused again
-   (cannot have me_key set to NULL), else the probe sequence in case of
-   collision would have no way to know they were once active.
-
-Note: .popitem() abuses the me_hash field of an Unused or Dummy slot to
-hold a search finger.  The me_hash field of Unused or Dummy slots has no
-meaning otherwise.
+The first od_nentries entries of ma_table are either Active (me_key and
+me_value != NULL) or deleted (me_key == me_value == NULL), the ones after
+that are all NULL.  The last entry in use is never a deleted one.
 */
 
 #if PY_VERSION_HEX < 0x02050000
@@ -74,7 +80,7 @@ typedef intintobjargproc	ssizessizeobjargproc;
 #endif
 
 /* PyOrderedDict_MINSIZE is the minimum size of a dictionary.  This many slots are
- * allocated directly in the dict object (in the ma_smalltable member).
+ * allocated directly in the dict object (in the od_smallindices member).
  * It must be a power of 2, and at least 4.  8 allows dicts with no more
  * than 5 active entries to live in ma_smalltable (and so avoid an
  * additional malloc); instrumentation suggested this suffices for the
@@ -83,10 +89,18 @@ typedef intintobjargproc	ssizessizeobjargproc;
  */
 #define PyOrderedDict_MINSIZE 8
 
+/* # of entries that a table with n slots in od_indices can hold (2/3) */
+#define OD_USABLE_FRACTION(n) (((n) << 1)/3)
+
+/* values of od_indices slots that do not refer to an entry */
+#define OD_IX_EMPTY (-1)
+#define OD_IX_DUMMY (-2)
+#define OD_IX_ERROR (-3)  /* only returned by od_lookup */
+
 typedef struct {
 	/* Cached hash code of me_key.  Note that hash codes are C longs.
-	 * We have to use Py_ssize_t instead because dict_popitem() abuses
-	 * me_hash to hold a search finger.
+	 * We have to use Py_ssize_t instead to have the same layout as
+	 * PyDictEntry.
 	 */
 	Py_ssize_t me_hash;
 	PyObject *me_key;
@@ -95,38 +109,87 @@ typedef struct {
 
 /*
 To ensure the lookup algorithm terminates, there must be at least one Unused
-slot (NULL key) in the table.
-The value od_fill is the number of non-NULL keys (sum of Active and Dummy);
-ma_used is the number of non-NULL, non-dummy keys (== the number of non-NULL
-values == the number of Active items).
+slot in od_indices.
+The value od_fill is the number of Active and Dummy slots in od_indices;
+ma_used is the number of Active items.
 To avoid slowing down lookups on a near-full table, we resize the table when
-it's two-thirds full.
+od_fill or od_nentries would exceed two-thirds of the slots.
+
+The fields up to ma_lookup have the same meaning as those of PyDictObject,
+as ordereddict is a subclass of dict on Python 2 and the methods of dict
+called on one (dict.get(od, key), dict.keys(od)) read it through them.  The
+rest of dict.c doesn't take it for a dict, see OD_NOT_DICT_C.
 */
 typedef struct _ordereddictobject PyOrderedDictObject;
 struct _ordereddictobject {
 	PyObject_HEAD
-	Py_ssize_t od_fill;  /* # Active + # Dummy */
+#if PY_MAJOR_VERSION >= 3
+	/* where a Python 3 dict has it, for PyDict_GET_SIZE() */
 	Py_ssize_t ma_used;  /* # Active */
+	Py_ssize_t od_fill;  /* # Active + # Dummy in od_indices */
+#else
+	Py_ssize_t od_fill;  /* # Active + # Dummy in od_indices */
+	Py_ssize_t ma_used;  /* # Active */
+#endif
 
-	/* The table contains ma_mask + 1 slots, and that's a power of 2.
-	 * We store the mask instead of the size because the mask is more
-	 * frequently needed.
+	/* ma_table has room for ma_mask + 1 entries (OD_USABLE_FRACTION of
+	 * the number of slots in od_indices), followed by one more entry that
+	 * always stays NULL (returned by ma_lookup for a missing key).
 	 */
 	Py_ssize_t ma_mask;
 
-	/* ma_table points to ma_smalltable for small tables, else to
-	 * additional malloc'ed memory.  ma_table is never NULL!  This rule
-	 * saves repeated runtime null-tests in the workhorse getitem and
-	 * setitem calls.
+	/* ma_table points to ma_smalltable for small tables, else into the
+	 * additional malloc'ed memory that od_indices points to.  ma_table is
+	 * never NULL!  This rule saves repeated runtime null-tests in the
+	 * workhorse getitem and setitem calls.
 	 */
 	PyOrderedDictEntry *ma_table;
+	/* dict.c compatible lookup, for internal use see od_lookup */
 	PyOrderedDictEntry *(*ma_lookup)(PyOrderedDictObject *mp, PyObject *key, long hash);
-	PyOrderedDictEntry ma_smalltable[PyOrderedDict_MINSIZE];
-	/* for small arrays, ordered table pointer points to small array of tables */
-	PyOrderedDictEntry **od_otablep; 
-	PyOrderedDictEntry *ma_smallotablep[PyOrderedDict_MINSIZE];
+
+	/* # entries of ma_table in use: Active + deleted */
+	Py_ssize_t od_nentries;
+	/* od_indices contains od_imask + 1 slots, and that's a power of 2.
+	 * A slot is a signed 1, 2, 4 or 8 byte integer depending on that size.
+	 */
+	Py_ssize_t od_imask;
+	void *od_indices;
+	/* returns the ma_table index of key (or OD_IX_EMPTY/OD_IX_ERROR), and
+	 * sets *hashpos to the slot in od_indices that holds or would hold it
+	 */
+	Py_ssize_t (*od_lookup)(PyOrderedDictObject *mp, PyObject *key, long hash,
+	                        Py_ssize_t *hashpos);
+	signed char od_smallindices[PyOrderedDict_MINSIZE];
+	PyOrderedDictEntry ma_smalltable[OD_USABLE_FRACTION(PyOrderedDict_MINSIZE) + 1];
 	/* for storing kvio, relaxed bits */
     long od_state;
+	/* the entries of ma_table before od_first are all deleted ones */
+	Py_ssize_t od_first;
+	/* if > 0, the oldest items are dropped when there are more */
+	Py_ssize_t od_maxsize;
+	/* goes up with every change of the items or their order, see
+	 * PyOrderedDict_Version(); od_moved is the version at the last
+	 * change that added, removed or reordered keys
+	 */
+	PY_UINT64_T od_version;
+	PY_UINT64_T od_moved;
+	/* while the table of a large ordereddict grows incrementally, see
+	 * ordereddict.c (NULL otherwise)
+	 */
+	struct _od_rehash *od_rehash;
+	/* what stats() counted for this dict, NULL until it counts something */
+	struct _od_stats *od_stats;
+	/* the sharedkeys this dict was made by, whose od_indices it uses until
+	 * a change of its keys gives it a table of its own (NULL if none)
+	 */
+	struct _sharedkeysobject *od_keys;
+#ifdef OD_LOCKFREE_READS
+	/* odd while a writer changes the table, for the readers that don't
+	 * lock; the tables replaced wait on od_retired until they are done
+	 */
+	uintptr_t od_seq;
+	struct _od_retired *od_retired;
+#endif
 };
 
 typedef struct _sorteddictobject PySortedDictObject;
@@ -135,24 +198,42 @@ struct _sorteddictobject {
 	PyObject *sd_cmp;
 	PyObject *sd_key;
 	PyObject *sd_value;
+	/* the sort order of a large sorteddict, when its entries in ma_table
+	 * are not kept sorted (NULL otherwise), see ordereddict.c
+	 */
+	struct _sd_order *sd_order;
+	/* with a key function: what it returned for the key of each entry,
+	 * parallel to ma_table (NULL for deleted entries, or if the key itself
+	 * is used because the call failed), so it is called once per key
+	 */
+	PyObject **sd_tkeys;
+	/* set during a bulk update: new keys are added at the end, and sorted
+	 * in once that is done
+	 */
+	int sd_bulk;
+};
+
+typedef struct _frozenordereddictobject PyFrozenOrderedDictObject;
+struct _frozenordereddictobject {
+    struct _ordereddictobject od;
+	/* the hash, computed the first time it is asked for, -1 until then */
+	long fd_hash;
 };
 
 
 PyAPI_DATA(PyTypeObject) PyOrderedDict_Type;
 PyAPI_DATA(PyTypeObject) PySortedDict_Type;
+PyAPI_DATA(PyTypeObject) PyFrozenOrderedDict_Type;
 
-#if PY_VERSION_HEX >= 0x02080000
-  /* AvdN: this might need reviewing for > 2.7 */
-  #define PyOrderedDict_Check(op) \
-                 PyType_FastSubclass(Py_Type(op), Py_TPFLAGS_DICT_SUBCLASS)
-  #define PySortedDict_Check(op) \
-                 PyType_FastSubclass(Py_Type(op), Py_TPFLAGS_DICT_SUBCLASS)
-#else
-  #define PyOrderedDict_Check(op) PyObject_TypeCheck(op, &PyOrderedDict_Type)
-  #define PySortedDict_Check(op) PyObject_TypeCheck(op, &PySortedDict_Type)
-#endif
-#define PyOrderedDict_CheckExact(op) ((op)->ob_type == &PyOrderedDict_Type)
-#define PySortedDict_CheckExact(op) ((op)->ob_type == &PySortedDict_Type)
+/* Py_TPFLAGS_DICT_SUBCLASS would hold for any dict, on Python 3 as well */
+#define PyOrderedDict_Check(op) PyObject_TypeCheck(op, &PyOrderedDict_Type)
+#define PySortedDict_Check(op) PyObject_TypeCheck(op, &PySortedDict_Type)
+#define PyOrderedDict_CheckExact(op) (Py_TYPE(op) == &PyOrderedDict_Type)
+#define PySortedDict_CheckExact(op) (Py_TYPE(op) == &PySortedDict_Type)
+#define PyFrozenOrderedDict_Check(op) \
+                 PyObject_TypeCheck(op, &PyFrozenOrderedDict_Type)
+#define PyFrozenOrderedDict_CheckExact(op) \
+                 (Py_TYPE(op) == &PyFrozenOrderedDict_Type)
 
 PyAPI_FUNC(PyObject *) PyOrderedDict_New(void);
 PyAPI_FUNC(PyObject *) PyOrderedDict_GetItem(PyObject *mp, PyObject *key);
@@ -163,6 +244,9 @@ PyAPI_FUNC(int) PyOrderedDict_Next(
 	PyObject *mp, Py_ssize_t *pos, PyObject **key, PyObject **value);
 PyAPI_FUNC(int) _PyOrderedDict_Next(
 	PyObject *mp, Py_ssize_t *pos, PyObject **key, PyObject **value, long *hash);
+PyAPI_FUNC(Py_ssize_t) PyOrderedDict_NextBatch(
+	PyObject *mp, Py_ssize_t *pos, PyObject **keys, PyObject **values,
+	Py_ssize_t n);
 PyAPI_FUNC(PyObject *) PyOrderedDict_Keys(PyObject *mp);
 PyAPI_FUNC(PyObject *) PyOrderedDict_Values(PyObject *mp);
 PyAPI_FUNC(PyObject *) PyOrderedDict_Items(PyObject *mp);
@@ -171,6 +255,12 @@ PyAPI_FUNC(PyObject *) PyOrderedDict_Copy(PyObject *mp);
 PyAPI_FUNC(int) PyOrderedDict_Contains(PyObject *mp, PyObject *key);
 PyAPI_FUNC(int) _PyOrderedDict_Contains(PyObject *mp, PyObject *key, long hash);
 
+/* PyOrderedDict_Version(mp) is a number that is larger after any change
+   of mp (a key, a value or the order), so that an unchanged dict can be
+   skipped.  It is per dict, and (PY_UINT64_T) -1 with an exception set if
+   mp is not an ordereddict. */
+PyAPI_FUNC(PY_UINT64_T) PyOrderedDict_Version(PyObject *mp);
+
 /* PyOrderedDict_Update(mp, other) is equivalent to PyOrderedDict_Merge(mp, other, 1). */
 PyAPI_FUNC(int) PyOrderedDict_Update(PyObject *mp, PyObject *other);
 
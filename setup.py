@@ -3,6 +3,7 @@
 
 import sys
 import os
+import io
 from textwrap import dedent
 
 name_space = 'ruamel'
@@ -49,8 +50,8 @@ class MyInstallLib(install_lib.install_lib):
                 with open(product_init, "w") as fp:
                     fp.write(init_txt)
         setup = os.path.join(self.install_dir, 'setup.py')
-        print '>' * 72
-        print 'setup', os.path.exists(setup), setup
+        print('>' * 72)
+        print('setup %s %s' % (os.path.exists(setup), setup))
 
     def install(self):
         fpp = full_package_name.split('.')  # full package path
@@ -66,9 +67,9 @@ class MyInstallLib(install_lib.install_lib):
                     break
             else:
                 alt_files.append(x)
-        print '<' * 60
+        print('<' * 60)
         for x in alt_files:
-            print '   ', x.split('site-packages/')[-1]
+            print('    ' + x.split('site-packages/')[-1])
 
         return alt_files
 
@@ -80,12 +81,11 @@ new keys is being tracked, updating values of existing keys does not
 change the order), Key Value Insertion Order (KVIO: KIO, but updates change
 order), and Key Sorted Order (KSO: key are kept sorted).
 
-The basic C structure is exented with a pointer to a list of item pointers.
-When a *new* key is added, this list is extended with a pointer to the item.
-The implementation compacts the list of pointers on every deletion (unless
-the last added key is removed, such as in popitem()). That
-involves a memmove of all the pointers behind the pointer to the item in
-question.
+The items are kept in a dense array, in order, with a separate hash table
+of indices into that array. When a *new* key is added, the item is appended
+to the array. Deletion only leaves a hole in the array, the holes are
+squeezed out in one pass when positions are needed (indexing, slicing,
+insert()) or on resize.
 
 The .keys, .values, .items, .iterkeys, itervalues, iteritems, __iter__
 return things in the order of insertion.
@@ -116,7 +116,7 @@ def main():
         install_requires=[
         ],
         #install_requires=install_requires,
-        long_description=open('README.rst').read(),
+        long_description=io.open('README.rst', encoding='utf-8').read(),
         url='https://bitbucket.org/ruamel/' + package_name,
         author='Anthon van der Neut',
         author_email='a.van.der.neut@ruamel.eu',
@@ -0,0 +1,416 @@
+"""
+benchmarks for ordereddict and sorteddict, with machine readable results
+
+  python test/bench.py [-o result.json] [--sizes 8,1000,100000] [--filter re]
+  python test/bench.py --compare old.json new.json [--threshold 10]
+
+Every benchmark is run for every size (the number of items in the dict;
+"all" is 8,100,10000,1000000,10000000), its result is the time per
+operation in ns, the minimum (and the median) of --repeat runs of at least
+--min-time seconds each.  The results go to stdout as a table and, with -o,
+to a JSON file; --compare prints the ratios between two such files (they may
+include results of test/bench_capi.c) and exits with 1 if a benchmark got
+slower by more than --threshold percent.
+
+With pyperf installed, --pyperf runs the same benchmarks through
+pyperf.Runner instead (with its options, e.g. -o, --rigorous), compare
+those results with "python -m pyperf compare_to".
+"""
+
+from __future__ import print_function
+
+import sys
+import re
+import gc
+import time
+import json
+import random
+import platform
+import argparse
+
+try:
+    import cPickle as pickle
+except ImportError:
+    import pickle
+
+ordereddict = sorteddict = None
+
+if sys.version_info < (3,):
+    range = xrange
+
+timer = getattr(time, 'perf_counter', time.time)
+
+ALL_SIZES = '8,100,10000,1000000,10000000'
+DEFAULT_SIZES = '8,1000,100000'
+
+BENCHMARKS = []
+
+
+def benchmark(ops=lambda n: n):
+    """register func(loops, n) -> seconds, for loops times ops(n) operations
+    on a dict of n items"""
+    def register(func):
+        BENCHMARKS.append((func.__name__[len('bench_'):], func, ops))
+        return func
+    return register
+
+
+_keys = {}
+
+
+def keys(n, kind='int'):
+    """n keys, the same ones every time (they can take a while to make)"""
+    k = (n, kind)
+    if k not in _keys:
+        if kind == 'int':
+            _keys[k] = list(range(n))
+        elif kind == 'str':
+            _keys[k] = ['k%d' % i for i in range(n)]
+        elif kind == 'shuffled':
+            _keys[k] = list(range(n))
+            random.Random(n).shuffle(_keys[k])
+        elif kind == 'miss':
+            _keys[k] = list(range(n, 2 * n))
+    return _keys[k]
+
+
+def filled(n, kind='int', **kw):
+    d = ordereddict(**kw)
+    for k in keys(n, kind):
+        d[k] = k
+    return d
+
+
+@benchmark()
+def bench_insert(loops, n):
+    ks = keys(n)
+    total = 0.0
+    for _ in range(loops):
+        d = ordereddict()
+        t0 = timer()
+        for k in ks:
+            d[k] = k
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_insert_str(loops, n):
+    ks = keys(n, 'str')
+    total = 0.0
+    for _ in range(loops):
+        d = ordereddict()
+        t0 = timer()
+        for k in ks:
+            d[k] = k
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_lookup(loops, n):
+    d = filled(n)
+    ks = keys(n, 'shuffled')
+    t0 = timer()
+    for _ in range(loops):
+        for k in ks:
+            d[k]
+    return timer() - t0
+
+
+@benchmark()
+def bench_lookup_str(loops, n):
+    d = filled(n, 'str')
+    ks = keys(n, 'str')
+    t0 = timer()
+    for _ in range(loops):
+        for k in ks:
+            d[k]
+    return timer() - t0
+
+
+@benchmark()
+def bench_lookup_miss(loops, n):
+    d = filled(n)
+    ks = keys(n, 'miss')
+    t0 = timer()
+    for _ in range(loops):
+        for k in ks:
+            k in d
+    return timer() - t0
+
+
+@benchmark(ops=lambda n: max(n // 2, 1))
+def bench_delete_middle(loops, n):
+    ks = keys(n)[n // 4:n // 4 + max(n // 2, 1)]
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n)
+        t0 = timer()
+        for k in ks:
+            del d[k]
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_popitem_last(loops, n):
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n)
+        t0 = timer()
+        for _ in range(n):
+            d.popitem()
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_popitem_first(loops, n):
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n)
+        t0 = timer()
+        for _ in range(n):
+            d.popitem(0)
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_insert_front(loops, n):
+    ks = keys(n)
+    total = 0.0
+    for _ in range(loops):
+        d = ordereddict()
+        t0 = timer()
+        for k in ks:
+            d.insert(0, k, k)
+        total += timer() - t0
+    return total
+
+
+@benchmark(ops=lambda n: min(n, 1000))
+def bench_popitem_middle(loops, n):
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n)
+        t0 = timer()
+        for _ in range(min(n, 1000)):
+            d.popitem(len(d) // 2)
+        total += timer() - t0
+    return total
+
+
+@benchmark(ops=lambda n: min(n, 1000))
+def bench_kvio_update(loops, n):
+    # the oldest keys, that have to move all the way to the end
+    ks = keys(n)[:min(n, 1000)]
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n, kvio=True)
+        t0 = timer()
+        for k in ks:
+            d[k] = None
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_sd_insert_random(loops, n):
+    ks = keys(n, 'shuffled')
+    total = 0.0
+    for _ in range(loops):
+        d = sorteddict()
+        t0 = timer()
+        for k in ks:
+            d[k] = k
+        total += timer() - t0
+    return total
+
+
+@benchmark(ops=lambda n: max(n // 4, 1))
+def bench_slice(loops, n):
+    d = filled(n)
+    lo, hi = n // 4, n // 4 + max(n // 4, 1)
+    t0 = timer()
+    for _ in range(loops):
+        d[lo:hi]
+    return timer() - t0
+
+
+@benchmark()
+def bench_merge(loops, n):
+    # half of the keys are new
+    other = ordereddict((k + n // 2, k) for k in keys(n))
+    total = 0.0
+    for _ in range(loops):
+        d = filled(n)
+        t0 = timer()
+        d.update(other)
+        total += timer() - t0
+    return total
+
+
+@benchmark()
+def bench_iterate(loops, n):
+    d = filled(n)
+    t0 = timer()
+    for _ in range(loops):
+        for k, v in d.items():
+            pass
+    return timer() - t0
+
+
+@benchmark()
+def bench_pickle_dumps(loops, n):
+    d = filled(n)
+    t0 = timer()
+    for _ in range(loops):
+        pickle.dumps(d, 2)
+    return timer() - t0
+
+
+@benchmark()
+def bench_pickle_loads(loops, n):
+    s = pickle.dumps(filled(n), 2)
+    t0 = timer()
+    for _ in range(loops):
+        pickle.loads(s)
+    return timer() - t0
+
+
+def load():
+    """import the types, --compare doesn't need them"""
+    global ordereddict, sorteddict
+    try:
+        from ruamel.ordereddict import ordereddict, sorteddict
+    except ImportError:
+        from _ordereddict import ordereddict, sorteddict
+
+
+def selected(args):
+    load()
+    sizes = [int(s) for s in
+             (ALL_SIZES if args.sizes == 'all' else args.sizes).split(',')]
+    for name, func, ops in BENCHMARKS:
+        if args.filter and not re.search(args.filter, name):
+            continue
+        for n in sizes:
+            yield '%s/%d' % (name, n), func, n, ops(n)
+
+
+def measure(func, n, ops, repeat, min_time):
+    """the seconds per operation of repeat runs of func, with enough loops
+    for a run to take min_time"""
+    loops = 1
+    while True:
+        t = func(loops, n)
+        if t >= min_time or loops >= 1 << 24:
+            break
+        loops = max(loops * 2, int(loops * min_time / max(t, 1e-9) * 1.1))
+    runs = [t]
+    gc.collect()
+    for _ in range(repeat - 1):
+        runs.append(func(loops, n))
+    return loops, [r / (loops * ops) for r in runs]
+
+
+def run(args):
+    # plain dicts, json reads them directly
+    results = {}
+    result = {
+        'python': platform.python_version(),
+        'implementation': platform.python_implementation(),
+        'platform': platform.platform(),
+        'unit': 'ns/op',
+        'results': results,
+    }
+    for name, func, n, ops in selected(args):
+        loops, runs = measure(func, n, ops, args.repeat, args.min_time)
+        runs = sorted(r * 1e9 for r in runs)
+        results[name] = {
+            'min': runs[0],
+            'median': runs[len(runs) // 2],
+            'loops': loops,
+            'runs': runs,
+        }
+        print('%-32s %12.1f %12.1f ns/op' % (name, runs[0], runs[len(runs) // 2]))
+        sys.stdout.flush()
+    if args.output:
+        with open(args.output, 'w') as fp:
+            json.dump(result, fp, indent=1, sort_keys=True)
+            fp.write('\n')
+    return 0
+
+
+def compare(args):
+    old, new = [json.load(open(f))['results'] for f in args.compare]
+    slower = 0
+    limit = 1.0 + args.threshold / 100.0
+    for name in sorted(set(old) & set(new)):
+        ratio = new[name]['min'] / old[name]['min']
+        mark = ''
+        if ratio > limit:
+            mark = '  slower'
+            slower += 1
+        elif ratio < 1.0 / limit:
+            mark = '  faster'
+        print('%-32s %12.1f %12.1f %7.3f%s' % (
+            name, old[name]['min'], new[name]['min'], ratio, mark))
+    for name in sorted(set(old) ^ set(new)):
+        print('%-32s only in %s' % (name, args.compare[name in new]))
+    if slower:
+        print('%d benchmark(s) more than %g%% slower' % (slower, args.threshold))
+    return 1 if slower else 0
+
+
+def add_arguments(parser):
+    parser.add_argument('--sizes', default=DEFAULT_SIZES,
+                        help='comma separated numbers of items, or "all" (%s)'
+                        % ALL_SIZES)
+    parser.add_argument('--filter', help='only the benchmarks matching this')
+
+
+def pyperf_main():
+    import pyperf
+
+    def add_cmdline_args(cmd, args):
+        # for the worker processes
+        cmd.extend(('--pyperf', '--sizes', args.sizes))
+        if args.filter:
+            cmd.extend(('--filter', args.filter))
+
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    add_arguments(runner.argparser)
+    runner.argparser.add_argument('--pyperf', action='store_true')
+    args = runner.parse_args()
+    for name, func, n, ops in selected(args):
+        runner.bench_time_func(name, func, n, inner_loops=ops)
+    return 0
+
+
+def main():
+    if '--pyperf' in sys.argv:
+        return pyperf_main()
+    parser = argparse.ArgumentParser(
+        description='benchmarks for ordereddict and sorteddict')
+    add_arguments(parser)
+    parser.add_argument('-o', '--output', help='write the results to this JSON file')
+    parser.add_argument('--repeat', type=int, default=5)
+    parser.add_argument('--min-time', type=float, default=0.1,
+                        help='seconds a run takes at least')
+    parser.add_argument('--compare', nargs=2, metavar='JSON',
+                        help='compare two results instead')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='percentage slower that --compare reports')
+    parser.add_argument('--pyperf', action='store_true',
+                        help='run through pyperf.Runner')
+    args = parser.parse_args()
+    if args.compare:
+        return compare(args)
+    return run(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,435 @@
+/*
+Microbenchmarks of the C API of ordereddict: PyOrderedDict_SetItem(),
+PyOrderedDict_GetItem(), PyOrderedDict_DelItem(), _PyOrderedDict_Next()
+and PyOrderedDict_Update() called directly, without the cost of the
+interpreter loop that test/bench.py includes.  It embeds Python with
+ordereddict.c linked in, build it from the top directory with e.g.
+
+  cc -O2 -I. $(python3-config --includes) test/bench_capi.c ordereddict.c \
+      $(python3-config --ldflags --embed) -o bench_capi
+
+(for Python 2 python2-config, without --embed) and run it as
+
+  ./bench_capi [-o result.json] [size ...]
+
+The sizes default to 8 1000 100000 1000000.  The results are printed and,
+with -o, written in the JSON format of test/bench.py, so that
+"python test/bench.py --compare old.json new.json" reports regressions.
+Timing uses clock_gettime(), so this needs a POSIX system.
+*/
+
+#include "Python.h"
+#include "ordereddict.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if PY_MAJOR_VERSION >= 3
+PyMODINIT_FUNC PyInit__ordereddict(void);
+#define OD_INITFUNC PyInit__ordereddict
+#define INT_FROM_SSIZE PyLong_FromSsize_t
+#define STR_FROM_STRING PyUnicode_FromString
+#else
+PyMODINIT_FUNC init_ordereddict(void);
+#define OD_INITFUNC init_ordereddict
+#define INT_FROM_SSIZE PyInt_FromSsize_t
+#define STR_FROM_STRING PyString_FromString
+#endif
+
+#define REPEAT 5
+#define MIN_TIME 0.1	/* seconds a run takes at least */
+#define MAX_OPS 1000	/* of the benchmarks that are O(n) per operation */
+
+static PyObject **keys;		/* 0 .. 2n - 1 */
+static PyObject **strkeys;	/* "k0" .. */
+static Py_ssize_t *order;	/* see shuffle() */
+static Py_ssize_t nkeys;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+fail(const char *what)
+{
+    if (PyErr_Occurred())
+        PyErr_Print();
+    fprintf(stderr, "bench_capi: %s failed\n", what);
+    exit(1);
+}
+
+static void
+free_keys(void)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < 2 * nkeys; i++)
+        Py_DECREF(keys[i]);
+    for (i = 0; i < nkeys; i++)
+        Py_DECREF(strkeys[i]);
+    free(keys);
+    free(strkeys);
+    free(order);
+    nkeys = 0;
+}
+
+/* the keys for dicts of up to n (> 0) items */
+static void
+make_keys(Py_ssize_t n)
+{
+    Py_ssize_t i;
+    char buf[32];
+
+    keys = malloc(2 * n * sizeof(PyObject *));
+    strkeys = malloc(n * sizeof(PyObject *));
+    order = malloc(n * sizeof(Py_ssize_t));
+    if (keys == NULL || strkeys == NULL || order == NULL)
+        fail("malloc");
+    for (i = 0; i < 2 * n; i++)
+        if ((keys[i] = INT_FROM_SSIZE(i)) == NULL)
+            fail("making keys");
+    for (i = 0; i < n; i++) {
+        sprintf(buf, "k%ld", (long) i);
+        if ((strkeys[i] = STR_FROM_STRING(buf)) == NULL)
+            fail("making keys");
+    }
+    nkeys = n;
+}
+
+/* order[0 .. n - 1] are 0 .. n - 1, shuffled the same way every time */
+static void
+shuffle(Py_ssize_t n)
+{
+    Py_ssize_t i, j, t;
+    size_t r = 12345;
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+    for (i = n - 1; i > 0; i--) {
+        r = r * 1103515245 + 12345;
+        j = (Py_ssize_t) ((r >> 16) % (size_t) (i + 1));
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+static PyObject *
+filled(Py_ssize_t n, PyObject **ks)
+{
+    PyObject *d = PyOrderedDict_New();
+    Py_ssize_t i;
+
+    if (d == NULL)
+        fail("PyOrderedDict_New");
+    for (i = 0; i < n; i++)
+        if (PyOrderedDict_SetItem(d, ks[i], ks[i]) < 0)
+            fail("PyOrderedDict_SetItem");
+    return d;
+}
+
+/* A benchmark: loops times ops_of(n) operations on a dict of n items,
+   returns the seconds that took (setting up not included). */
+typedef double (*benchfunc)(Py_ssize_t loops, Py_ssize_t n);
+
+static double
+bench_setitem(Py_ssize_t loops, Py_ssize_t n)
+{
+    double total = 0.0, t0;
+    Py_ssize_t l, i;
+    PyObject *d;
+
+    for (l = 0; l < loops; l++) {
+        if ((d = PyOrderedDict_New()) == NULL)
+            fail("PyOrderedDict_New");
+        t0 = now();
+        for (i = 0; i < n; i++)
+            if (PyOrderedDict_SetItem(d, keys[i], keys[i]) < 0)
+                fail("PyOrderedDict_SetItem");
+        total += now() - t0;
+        Py_DECREF(d);
+    }
+    return total;
+}
+
+static double
+bench_setitem_str(Py_ssize_t loops, Py_ssize_t n)
+{
+    double total = 0.0, t0;
+    Py_ssize_t l, i;
+    PyObject *d;
+
+    for (l = 0; l < loops; l++) {
+        if ((d = PyOrderedDict_New()) == NULL)
+            fail("PyOrderedDict_New");
+        t0 = now();
+        for (i = 0; i < n; i++)
+            if (PyOrderedDict_SetItem(d, strkeys[i], strkeys[i]) < 0)
+                fail("PyOrderedDict_SetItem");
+        total += now() - t0;
+        Py_DECREF(d);
+    }
+    return total;
+}
+
+static double
+bench_getitem(Py_ssize_t loops, Py_ssize_t n)
+{
+    PyObject *d = filled(n, keys);
+    Py_ssize_t l, i;
+    double t0;
+
+    shuffle(n);
+    t0 = now();
+    for (l = 0; l < loops; l++)
+        for (i = 0; i < n; i++)
+            if (PyOrderedDict_GetItem(d, keys[order[i]]) == NULL)
+                fail("PyOrderedDict_GetItem");
+    t0 = now() - t0;
+    Py_DECREF(d);
+    return t0;
+}
+
+static double
+bench_getitem_str(Py_ssize_t loops, Py_ssize_t n)
+{
+    PyObject *d = filled(n, strkeys);
+    Py_ssize_t l, i;
+    double t0;
+
+    shuffle(n);
+    t0 = now();
+    for (l = 0; l < loops; l++)
+        for (i = 0; i < n; i++)
+            if (PyOrderedDict_GetItem(d, strkeys[order[i]]) == NULL)
+                fail("PyOrderedDict_GetItem");
+    t0 = now() - t0;
+    Py_DECREF(d);
+    return t0;
+}
+
+static double
+bench_getitem_miss(Py_ssize_t loops, Py_ssize_t n)
+{
+    PyObject *d = filled(n, keys);
+    Py_ssize_t l, i;
+    double t0 = now();
+
+    for (l = 0; l < loops; l++)
+        for (i = n; i < 2 * n; i++)
+            if (PyOrderedDict_GetItem(d, keys[i]) != NULL)
+                fail("PyOrderedDict_GetItem");
+    t0 = now() - t0;
+    Py_DECREF(d);
+    return t0;
+}
+
+static double
+bench_delitem_middle(Py_ssize_t loops, Py_ssize_t n)
+{
+    double total = 0.0, t0;
+    Py_ssize_t l, i, end = n / 4 + (n / 2 > 1 ? n / 2 : 1);
+    PyObject *d;
+
+    for (l = 0; l < loops; l++) {
+        d = filled(n, keys);
+        t0 = now();
+        for (i = n / 4; i < end; i++)
+            if (PyOrderedDict_DelItem(d, keys[i]) < 0)
+                fail("PyOrderedDict_DelItem");
+        total += now() - t0;
+        Py_DECREF(d);
+    }
+    return total;
+}
+
+static double
+bench_kvio_update(Py_ssize_t loops, Py_ssize_t n)
+{
+    double total = 0.0, t0;
+    Py_ssize_t l, i, m = n < MAX_OPS ? n : MAX_OPS;
+    PyObject *d, *args, *kw;
+
+    /* only the constructor takes kvio */
+    args = PyTuple_New(0);
+    kw = Py_BuildValue("{sO}", "kvio", Py_True);
+    if (args == NULL || kw == NULL)
+        fail("ordereddict(kvio=True)");
+    for (l = 0; l < loops; l++) {
+        d = PyObject_Call((PyObject *) &PyOrderedDict_Type, args, kw);
+        if (d == NULL)
+            fail("ordereddict(kvio=True)");
+        for (i = 0; i < n; i++)
+            if (PyOrderedDict_SetItem(d, keys[i], keys[i]) < 0)
+                fail("PyOrderedDict_SetItem");
+        t0 = now();
+        for (i = 0; i < m; i++)
+            if (PyOrderedDict_SetItem(d, keys[i], Py_None) < 0)
+                fail("PyOrderedDict_SetItem");
+        total += now() - t0;
+        Py_DECREF(d);
+    }
+    Py_DECREF(args);
+    Py_DECREF(kw);
+    return total;
+}
+
+static double
+bench_next(Py_ssize_t loops, Py_ssize_t n)
+{
+    PyObject *d = filled(n, keys), *key, *value;
+    Py_ssize_t l, pos, count = 0;
+    long hash;
+    double t0 = now();
+
+    for (l = 0; l < loops; l++) {
+        pos = 0;
+        while (_PyOrderedDict_Next(d, &pos, &key, &value, &hash))
+            count++;
+    }
+    t0 = now() - t0;
+    if (count != loops * n)
+        fail("_PyOrderedDict_Next");
+    Py_DECREF(d);
+    return t0;
+}
+
+static double
+bench_update(Py_ssize_t loops, Py_ssize_t n)
+{
+    /* half of the keys are new */
+    PyObject *other = filled(n, keys + n / 2), *d;
+    double total = 0.0, t0;
+    Py_ssize_t l;
+
+    for (l = 0; l < loops; l++) {
+        d = filled(n, keys);
+        t0 = now();
+        if (PyOrderedDict_Update(d, other) < 0)
+            fail("PyOrderedDict_Update");
+        total += now() - t0;
+        Py_DECREF(d);
+    }
+    Py_DECREF(other);
+    return total;
+}
+
+static Py_ssize_t ops_n(Py_ssize_t n) { return n; }
+static Py_ssize_t ops_half(Py_ssize_t n) { return n / 2 > 1 ? n / 2 : 1; }
+static Py_ssize_t ops_max(Py_ssize_t n) { return n < MAX_OPS ? n : MAX_OPS; }
+
+static struct {
+    const char *name;
+    benchfunc func;
+    Py_ssize_t (*ops_of)(Py_ssize_t n);
+} benchmarks[] = {
+    {"capi_setitem", bench_setitem, ops_n},
+    {"capi_setitem_str", bench_setitem_str, ops_n},
+    {"capi_getitem", bench_getitem, ops_n},
+    {"capi_getitem_str", bench_getitem_str, ops_n},
+    {"capi_getitem_miss", bench_getitem_miss, ops_n},
+    {"capi_delitem_middle", bench_delitem_middle, ops_half},
+    {"capi_kvio_update", bench_kvio_update, ops_max},
+    {"capi_next", bench_next, ops_n},
+    {"capi_update", bench_update, ops_n},
+    {NULL}
+};
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+int
+main(int argc, char **argv)
+{
+    Py_ssize_t sizes[32], nsizes = 0, maxsize = 0, s, b, r, loops, ops;
+    const char *output = NULL;
+    char name[64];
+    double runs[REPEAT], t;
+    FILE *fp = NULL;
+    int i, first = 1;
+    PyObject *mod;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (nsizes < 32 && atol(argv[i]) > 0)
+            sizes[nsizes++] = atol(argv[i]);
+        else {
+            fprintf(stderr, "usage: %s [-o result.json] [size ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (nsizes == 0) {
+        sizes[nsizes++] = 8;
+        sizes[nsizes++] = 1000;
+        sizes[nsizes++] = 100000;
+        sizes[nsizes++] = 1000000;
+    }
+    for (s = 0; s < nsizes; s++)
+        if (sizes[s] > maxsize)
+            maxsize = sizes[s];
+
+    PyImport_AppendInittab("_ordereddict", OD_INITFUNC);
+    Py_Initialize();
+    /* readies the types */
+    mod = PyImport_ImportModule("_ordereddict");
+    if (mod == NULL)
+        fail("import _ordereddict");
+    make_keys(maxsize);
+
+    if (output != NULL) {
+        fp = fopen(output, "w");
+        if (fp == NULL) {
+            perror(output);
+            return 1;
+        }
+        fprintf(fp, "{\n \"implementation\": \"C API\",\n \"python\": \"%s\",\n"
+                " \"unit\": \"ns/op\",\n \"results\": {", PY_VERSION);
+    }
+    for (b = 0; benchmarks[b].name != NULL; b++)
+        for (s = 0; s < nsizes; s++) {
+            ops = benchmarks[b].ops_of(sizes[s]);
+            for (loops = 1; ; loops *= 2) {
+                t = benchmarks[b].func(loops, sizes[s]);
+                if (t >= MIN_TIME || loops >= (1 << 24))
+                    break;
+            }
+            runs[0] = t;
+            for (r = 1; r < REPEAT; r++)
+                runs[r] = benchmarks[b].func(loops, sizes[s]);
+            for (r = 0; r < REPEAT; r++)
+                runs[r] = runs[r] * 1e9 / ((double) loops * ops);
+            qsort(runs, REPEAT, sizeof(double), cmp_double);
+            sprintf(name, "%s/%ld", benchmarks[b].name, (long) sizes[s]);
+            printf("%-32s %12.1f %12.1f ns/op\n", name, runs[0],
+                   runs[REPEAT / 2]);
+            fflush(stdout);
+            if (fp != NULL) {
+                fprintf(fp, "%s\n  \"%s\": {\"min\": %.3f, \"median\": %.3f, "
+                        "\"loops\": %ld, \"runs\": [", first ? "" : ",",
+                        name, runs[0], runs[REPEAT / 2], (long) loops);
+                for (r = 0; r < REPEAT; r++)
+                    fprintf(fp, "%s%.3f", r ? ", " : "", runs[r]);
+                fprintf(fp, "]}");
+                first = 0;
+            }
+        }
+    if (fp != NULL) {
+        fprintf(fp, "\n }\n}\n");
+        fclose(fp);
+    }
+    Py_DECREF(mod);
+    free_keys();
+    Py_Finalize();
+    return 0;
+}
@@ -1,14 +1,29 @@
 # coding: utf-8
 
+from __future__ import print_function
+
 if __name__ != "__main__":
     import py
 import string
 import os
 import sys
-import cPickle
 import random
 
-from ruamel.ordereddict import ordereddict, sorteddict
+# the same tests on Python 3, where keys() etc. return lists as well
+PY3 = sys.version_info >= (3,)
+if PY3:
+    import pickle as cPickle
+    import builtins
+    long = int
+    xrange = range
+
+    def range(*args):
+        return list(builtins.range(*args))
+else:
+    import cPickle
+
+from ruamel.ordereddict import ordereddict, sorteddict, autoshrink, snapshotdict, \
+    frozenordereddict, pool, incremental, stats, arena, sharedkeys
 
 class TestOrderedDict(object):
     def __init__(self, nopytest=False):
@@ -21,7 +36,7 @@ class TestOrderedDict(object):
         self.x['c'] = 3
         self.x['d'] = 4
         self.z = ordereddict()
-        for index, ch in enumerate(string.lowercase):
+        for index, ch in enumerate(string.ascii_lowercase):
             self.z[ch] = index
         self.e = ordereddict()
         self.part = ordereddict((('f', 5),('g', 6),('h', 7),('i', 8), ('j', 9)))
@@ -75,7 +90,7 @@ class TestOrderedDict(object):
         assert sd == self.z
 
     def test_len(self):
-        assert len(self.z) == len(string.lowercase)
+        assert len(self.z) == len(string.ascii_lowercase)
         assert len(self.e) == 0
 
     def test_brackets(self):
@@ -112,13 +127,162 @@ class TestOrderedDict(object):
         assert self.x['c'] == 3
         assert x['c'] == 4
 
+    def test_sd_copy_key(self):
+        x1 = sorteddict(((i, i) for i in range(1000)), key=lambda k: -k)
+        del x1[500]
+        x = x1.copy()
+        assert x.keys() == x1.keys()
+        x[500] = 1
+        x[-1] = 1
+        assert x.keys() == range(999, -2, -1)
+
     def test_sd_lower(self):
         r = sorteddict(self.upperlower)
         assert r != self.upperlower
         assert r.index('a') == 2
-        rl = sorteddict(self.upperlower, key=string.lower)
+        rl = sorteddict(self.upperlower, key=str.lower)
         assert rl == self.upperlower
 
+    def test_sd_large_random(self):
+        r = random.Random(42)
+        keys = [r.randrange(1000000) for i in range(5000)]
+        x = sorteddict()
+        for k in keys:
+            x[k] = -k
+        ref = sorted(set(keys))
+        assert x.index(ref[1234]) == 1234
+        for k in ref[::3]:
+            del x[k]
+        del ref[::3]
+        assert x.popitem(100) == (ref[100], -ref[100])
+        del ref[100]
+        assert x.popitem() == (ref[-1], -ref[-1])
+        del ref[-1]
+        x[-1] = 1
+        ref.insert(0, -1)
+        assert [x.index(k) for k in ref[::50]] == range(0, len(ref), 50)
+        assert x.keys() == ref
+        assert x[10:20].keys() == ref[10:20]
+
+    def test_sd_key_called_once(self):
+        calls = []
+        def lower(k):
+            calls.append(k)
+            return k.lower()
+        r = random.Random(7)
+        keys = ['%s%04d' % (r.choice('aAbB'), r.randrange(10000))
+                for i in range(2000)]
+        x = sorteddict(key=lower)
+        for k in keys:
+            x[k] = 1
+        assert len(calls) == len(set(keys))
+        for k in keys[::2]:
+            x.pop(k, None)
+        x.update([('C0000', 1), ('c0001', 2)])
+        ref = sorted(set(keys) - set(keys[::2]) | set(['C0000', 'c0001']),
+                     key=str.lower)
+        assert [k.lower() for k in x.keys()] == [k.lower() for k in ref]
+        assert len(calls) == len(set(keys)) + 2
+
+    def test_sd_bisect(self):
+        s = sorteddict((i, -i) for i in range(0, 2000, 2))
+        s[501] = 1  # in the middle of a large one
+        assert s.bisect_left(500) == 250 and s.bisect_right(500) == 251
+        assert s.bisect_left(501) == 251 and s.bisect_right(-5) == 0
+        assert s.bisect_left(5000) == len(s)
+        assert s.floor(503) == 502 and s.floor(501) == 501
+        assert s.ceiling(503) == 504 and s.ceiling(-1) == 0
+        assert s.floor(-1, None) is None
+        try:
+            s.ceiling(1999)
+        except KeyError:
+            pass
+        else:
+            assert False
+        r = sorteddict(self.upperlower, key=str.lower)
+        assert r.bisect_left('B') == 2 and r.floor('az') == 'a'
+        try:
+            self.x.bisect_left('a')
+        except TypeError:
+            pass
+        else:
+            assert False
+
+    def test_sd_irange(self):
+        s = sorteddict((i, i) for i in range(0, 2000, 2))
+        s[501] = 1
+        assert list(s.irange(496, 504)) == [496, 498, 500, 501, 502, 504]
+        assert list(s.irange(496, 504, (False, False))) == [498, 500, 501, 502]
+        assert list(s.irange(1990)) == [1990, 1992, 1994, 1996, 1998]
+        assert list(s.irange(maximum=4, reverse=True)) == [4, 2, 0]
+        assert list(s.irange(10, 5)) == []
+        it = s.irange(100, 110)
+        next(it)
+        s[103] = 1
+        try:
+            list(it)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+
+    def test_int_tuple_keys(self):
+        x = ordereddict()
+        for i in range(100):
+            x[i * 1000] = i
+        assert int('5000') in x
+        assert x[long(5000)] == 5 and x[5000.0] == 5
+        x['a'] = 'a'
+        assert x[7000] == 7 and x['a'] == 'a'
+        y = ordereddict()
+        for i in range(100):
+            y[(i, str(i))] = i
+        assert y[(int('42'), '4' + '2')] == 42
+        assert (42, '43') not in y and (42, 42) not in y
+        assert y[(long(42), '42')] == 42
+        y.clear()
+        y[1] = 1
+        assert y[long(1)] == 1
+
+    def test_reserve(self):
+        x = ordereddict(capacity=1000)
+        for i in range(1000):
+            x[i] = i
+        x.reserve(5000)
+        x.reserve(10)
+        assert x.keys() == range(1000)
+        y = sorteddict(self.x, capacity=100)
+        assert y == self.x
+        try:
+            x.reserve(-1)
+            assert False
+        except ValueError:
+            pass
+
+    def test_compact_shrink(self):
+        x = ordereddict()
+        for i in range(10000):
+            x[i] = i
+        for i in range(0, 9990):
+            if i % 3:
+                del x[i]
+            elif i % 2:
+                x.pop(i)
+            else:
+                x.popitem(0)
+        assert x.keys() == range(9990, 10000)
+        assert x.index(9995) == 5
+        x[1] = 1
+        assert x.keys()[-1] == 1
+        assert autoshrink(0)
+        for i in range(1000):
+            x[-i] = i
+        for i in range(1000):
+            del x[-i]
+        x.compact()
+        assert not autoshrink(1)
+        assert x.keys() == range(9990, 10000) + [1]
+
     def test_in(self):
         assert 'c' in self.z
 
@@ -126,19 +290,22 @@ class TestOrderedDict(object):
         assert 'C' not in self.z
 
     def test_has_key(self):
+        if PY3:
+            assert not hasattr(self.z, 'has_key')
+            return
         assert self.z.has_key('z')
 
     def test_items(self):
         "unlikely to function in a non-ordered dictionary"
         index = 0
         for index, y in enumerate(self.z.items()):
-            assert string.lowercase[index] == y[0]
+            assert string.ascii_lowercase[index] == y[0]
             assert index == y[1]
 
     def test_items_rev(self):
         for index, y in enumerate(self.z.items(reverse=True)):
             i = 25 - index
-            assert string.lowercase[i] == y[0]
+            assert string.ascii_lowercase[i] == y[0]
             assert i == y[1]
 
     def test_keys(self):
@@ -152,7 +319,7 @@ class TestOrderedDict(object):
         "unlikely to function in a non-ordered dictionary"
         index = 25
         for y in self.z.keys(reverse=True):
-            assert string.lowercase[index] == y
+            assert string.ascii_lowercase[index] == y
             index -= 1
 
 
@@ -176,6 +343,19 @@ class TestOrderedDict(object):
         assert len(x) == 5
         assert x[5] == 'abc'
 
+    def test_sd_bulk(self):
+        r = random.Random(3)
+        keys = range(3000)
+        r.shuffle(keys)
+        x = sorteddict(zip(keys, keys))
+        assert x.keys() == range(3000)
+        x.update(dict((k, -k) for k in range(2500, 3500)))
+        assert x.keys() == range(3500)
+        assert x[2499] == 2499 and x[2500] == -2500
+        assert sorteddict(x) == x
+        x = sorteddict.fromkeys(set([100, 3, 50, 7]))
+        assert x.keys() == [3, 7, 50, 100]
+
     def test_fromkeys(self):
         x = ordereddict.fromkeys([1,2,3,4,5,6])
         assert len(x) == 6
@@ -278,11 +458,63 @@ class TestOrderedDict(object):
         y = ordereddict([('a',1), ('b',2), ('c',3), ('d', 4)])
         assert y == self.x
 
+    def test_compare_lockstep(self):
+        a = ordereddict(('k%d' % i, [i]) for i in range(2000))
+        b = ordereddict(('k%d' % i, [i]) for i in range(2000))
+        assert a == b
+        del a['k7']
+        b.pop('k7')
+        assert a == b and not a != b
+        b['k1999'] = [0]
+        assert a != b
+        b['k1999'] = [1999]
+        assert a == b
+        b.reorder([1, 0] + range(2, len(b)))
+        assert a != b
+        assert ordereddict([(1, 'x')]) == ordereddict([(1.0, 'x')])
+        s = sorteddict()
+        t = sorteddict()
+        keys = range(1000)
+        random.shuffle(keys)
+        for k in keys:
+            s[k] = k
+        for k in sorted(keys):
+            t[k] = k
+        assert s == t
+        class Evil(object):
+            def __init__(self, d):
+                self.d = d
+            def __hash__(self):
+                return 1
+            def __eq__(self, other):
+                self.d.clear()
+                return True
+        c = ordereddict()
+        d = ordereddict()
+        c[Evil(c)] = 1
+        d[Evil(d)] = 1
+        c[2] = 2
+        d[2] = 2
+        assert c != d or c == d
+
     def test_index(self):
         assert self.x.index('c') == 2
         if not self.nopytest:
             py.test.raises(ValueError, "self.x.index('1')")
 
+    def test_index_after_reorder(self):
+        d = ordereddict([(i, i) for i in range(20)])
+        del d[3]
+        d.insert(0, 'x', 1)
+        d.reverse()
+        d.rename(10, 'ten')
+        for pos, k in enumerate(d.keys()):
+            assert d.index(k) == pos
+        s = sorteddict([(i, i) for i in range(0, 20, 2)])
+        s[7] = 7
+        for pos, k in enumerate(s.keys()):
+            assert s.index(k) == pos
+
 
 ###################
 
@@ -310,14 +542,14 @@ class TestOrderedDict(object):
     def test_iterkeys(self):
         index = 0
         for y in self.z.iterkeys():
-            assert string.lowercase[index] == y
+            assert string.ascii_lowercase[index] == y
             index += 1
         assert index == 26
 
     def test_iterkeys_rev(self):
         index = 0
         for y in self.z.iterkeys(reverse=True):
-            assert string.lowercase[25 - index] == y
+            assert string.ascii_lowercase[25 - index] == y
             index += 1
         assert index == 26
 
@@ -329,7 +561,37 @@ class TestOrderedDict(object):
         res = ""
         for y in self.z:
             res += y
-        assert string.lowercase == res
+        assert string.ascii_lowercase == res
+
+    def test_views(self):
+        k = self.z.viewkeys()
+        v = self.z.viewvalues()
+        it = self.z.viewitems()
+        assert len(k) == 26
+        assert list(k) == self.z.keys()
+        assert k[0] == 'a' and k[-1] == 'z'
+        assert v[2] == 2 and it[3] == ('d', 3)
+        assert 'c' in k and 'C' not in k
+        assert 4 in v and 26 not in v
+        assert ('e', 4) in it and ('e', 5) not in it
+        assert list(self.z.viewkeys(reverse=True)) == self.z.keys(reverse=True)
+        assert list(it[1:10:3]) == self.z.items()[1:10:3]
+        assert list(k[::-1][:3]) == ['z', 'y', 'x']
+        s = k[2:8:2]
+        assert 'e' in s and 'f' not in s and 'i' not in s
+        assert repr(s) == "ordereddict_keys(['c', 'e', 'g'])"
+        del self.z['a']
+        assert k[0] == 'b' and len(v) == 25
+        try:
+            len(s)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+        sd = sorteddict((i, i) for i in range(1000, 0, -1))
+        assert sd.viewkeys()[600] == 601
+        assert 600 in sd.viewkeys()[300:700]
+        assert 200 not in sd.viewkeys()[300:700]
 
     def test_itervalues(self):
         index = 0
@@ -346,17 +608,50 @@ class TestOrderedDict(object):
     def test_iteritems(self):
         index = 0
         for index, y in enumerate(self.z.iteritems()):
-            assert string.lowercase[index] == y[0]
+            assert string.ascii_lowercase[index] == y[0]
             assert index == y[1]
 
     def test_iteritems_rev(self):
         index = 0
         for y in self.z.iteritems(reverse=True):
-            assert string.lowercase[25-index] == y[0]
+            assert string.ascii_lowercase[25-index] == y[0]
             assert 25 - index == y[1]
             index += 1
         assert index == 26
 
+    def test_iteritems_reuse(self):
+        # the result tuple is reused once the previous one is released
+        for rev in (False, True):
+            ids = set()
+            for y in self.z.iteritems(reverse=rev):
+                ids.add(id(y))
+                del y
+            assert len(ids) == 1
+        kept = list(self.z.iteritems())
+        assert kept == self.z.items()
+
+    def test_iteritems_reuse_gc(self):
+        # a collection untracks the reused tuple of two ints, it has to be
+        # tracked again once it holds something that can be in a cycle
+        import gc
+        import weakref
+        class C(object):
+            pass
+        c = C()
+        d = ordereddict([(1, 2), (3, c)])
+        it = d.iteritems()
+        t = next(it)
+        del t
+        gc.collect()
+        t = next(it)
+        assert t[1] is c and gc.is_tracked(t)
+        c.t = t
+        del c, t
+        r = weakref.ref(d[3])
+        del d, it
+        gc.collect()
+        assert r() is None
+
 
     def test_repr(self):
         d = ordereddict()
@@ -380,13 +675,13 @@ class TestOrderedDict(object):
         r.insert(pos, 'k', 42)
         assert r.index('k') == pos
         assert r.get('k') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_reverse(self):
         r = self.z
         r.reverse()
         res = []
-        for index, ch in enumerate(string.lowercase):
+        for index, ch in enumerate(string.ascii_lowercase):
             assert r[ch] == index
             res.insert(0, ch)
         assert res == r.keys()
@@ -414,7 +709,7 @@ class TestOrderedDict(object):
         r = self.z
         del r[4:24:2]
         t = ordereddict()
-        for index, ch in enumerate(string.lowercase):
+        for index, ch in enumerate(string.ascii_lowercase):
             if ch not in 'abcdfhjlnprtvxyz':
                 continue
             t[ch] = index
@@ -445,7 +740,7 @@ class TestOrderedDict(object):
         r = self.z
         del r[22:3:-2]
         t = ordereddict()
-        for index, ch in enumerate(string.lowercase):
+        for index, ch in enumerate(string.ascii_lowercase):
             if ch not in 'abcdfhjlnprtvxyz':
                 continue
             t[ch] = index
@@ -453,6 +748,20 @@ class TestOrderedDict(object):
         #print t
         assert r == t
 
+    def test_del_large_slice(self):
+        r = ordereddict((i, i) for i in range(10000))
+        del r[5]
+        r[5] = 5
+        keys = r.keys()
+        del r[::2]
+        del keys[::2]
+        assert r.keys() == keys
+        assert r[100:102].items() == [(202, 202), (204, 204)]
+        del r[-2:10:-3]
+        del keys[-2:10:-3]
+        assert r.keys() == keys
+        assert r.index(5) == len(keys) - 1
+
     def test_ass_consequitive_slice_wrong_size(self):
         r = self.z
         if not self.nopytest:
@@ -515,6 +824,14 @@ class TestOrderedDict(object):
         self.x.rename('c', 'caaa')
         assert self.x == ordereddict([('a',1), ('b',2), ('caaa',3), ('d', 4)])
 
+    def test_rename_missing_key(self):
+        try:
+            self.x.rename('z', 'zz')
+        except KeyError:
+            pass
+        else:
+            assert False, 'rename of missing key should raise KeyError'
+
     def test_sd_rename(self):
         x = sorteddict(self.x)
         if not self.nopytest:
@@ -549,6 +866,61 @@ class TestOrderedDict(object):
             py.test.raises(ValueError, "r1.setkeys(('d', 'c', 'a', 42, 'b', 'a',))")
             py.test.raises(ValueError, "r1.setkeys(('g', 'c', 'a', 42,))")
 
+    def test_setkeys_bulk(self):
+        d = ordereddict()
+        for i in range(1000):
+            d['k%d' % i] = i
+        del d['k3']
+        keys = d.keys()
+        random.shuffle(keys)
+        d.setkeys(iter(keys))
+        assert d.keys() == keys
+        assert d.index(keys[10]) == 10
+        before = d.items()
+        for bad in (keys[:-1], keys[:-1] + [keys[0]], keys[:-1] + ['zz']):
+            try:
+                d.setkeys(bad)
+            except (KeyError, ValueError):
+                pass
+            else:
+                assert False
+        assert d.items() == before
+        try:
+            d.setvalues(range(5))
+        except ValueError:
+            pass
+        assert d.items() == before
+        d.setvalues(xrange(len(d)))
+        assert d.values() == range(len(d))
+
+    def test_reorder(self):
+        d = ordereddict([('a', 1), ('b', 2), ('c', 3), ('d', 4)])
+        del d['b']
+        d.reorder([2, 0, 1])
+        assert d.items() == [('d', 4), ('a', 1), ('c', 3)]
+        assert d.index('c') == 2
+        for bad in ([0, 1], [0, 1, 1], [0, 1, 3], [0, 1, -1], [0, 1, 'x']):
+            try:
+                d.reorder(bad)
+            except (ValueError, TypeError):
+                pass
+            else:
+                assert False
+        assert d.keys() == ['d', 'a', 'c']
+        n = 10000
+        d = ordereddict((i, str(i)) for i in range(n))
+        perm = range(n)
+        random.shuffle(perm)
+        d.reorder(perm)
+        assert d.keys() == perm
+        assert d[perm[0]] == str(perm[0])
+        try:
+            sorteddict(a=1).reorder([0])
+        except TypeError:
+            pass
+        else:
+            assert False
+
     def test_sd_setkeys(self):
         x = sorteddict.fromkeys((1,2,3,4,5), 'abc')
         if not self.nopytest:
@@ -565,7 +937,7 @@ class TestOrderedDict(object):
         r.insert(pos-3, 'k', 42)
         assert r.index('k') == pos - 3
         assert r.get('k') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_insert_existing_key_after(self):
         r = self.z
@@ -573,7 +945,7 @@ class TestOrderedDict(object):
         r.insert(pos+3, 'k', 42)
         assert r.index('k') == pos + 3
         assert r.get('k') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_insert_existing_non_last_key_beyond(self):
         r = self.z
@@ -582,7 +954,7 @@ class TestOrderedDict(object):
         r.insert(pos, 'y', 42)
         assert r.index('y') == pos
         assert r.get('y') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_insert_existing_last_key_at_end(self):
         r = self.z
@@ -590,7 +962,7 @@ class TestOrderedDict(object):
         r.insert(pos, 'z', 42)
         assert r.index('z') == pos
         assert r.get('z') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_insert_existing_last_key_beyond_end(self):
         r = self.z
@@ -598,7 +970,7 @@ class TestOrderedDict(object):
         r.insert(pos + 1, 'z', 42)
         assert r.index('z') == pos
         assert r.get('z') == 42
-        assert len(r) == len(string.lowercase)
+        assert len(r) == len(string.ascii_lowercase)
 
     def test_insert_range(self):
         r = ordereddict()
@@ -610,6 +982,52 @@ class TestOrderedDict(object):
         self.x['e'] = 5
         assert r == self.x
 
+    def test_insert_front(self):
+        r = ordereddict()
+        for i in range(1000):
+            r.insert(0, i, i)
+            if i % 3 == 0:
+                assert r.popitem(0) == (i, i)
+        k = [i for i in range(1000) if i % 3][::-1]
+        assert r.keys() == k and r.index(k[0]) == 0
+        r.insert(0, k[-1], 'x')     # the last one to the front
+        r.insert(0, k[400], 'y')
+        assert r.keys() == [k[400], k[-1]] + k[:400] + k[401:-1]
+        assert r[k[-1]] == 'x' and r.popitem() == (k[-2], k[-2])
+        del r[k[5]]
+        r.insert(0, 'a', 0)
+        assert r.keys()[:3] == ['a', k[400], k[-1]] and len(r) == 665
+        assert r[3:5].keys() == k[:2]
+        # a comparison during the lookup that takes the slot of a deleted
+        # key (a Dummy) for a new one
+        class K(object):
+            def __init__(self, n):
+                self.n = n
+            def __hash__(self):
+                return 7
+            def __eq__(self, other):
+                if K.hook is not None:
+                    K.hook -= 1
+                    if K.hook == 0:
+                        K.hook = None
+                        d.popitem()
+                        d[K(100)] = 'x'
+                return self.n == other.n
+        K.hook = None
+        for key, keys in ((50, [50, 1, 2, 100]), (3, [3, 1, 2, 100]),
+                          (None, [1, 2, 100, 50])):
+            d = ordereddict((K(i), i) for i in range(4))
+            del d[d.keys()[0]]
+            K.hook = 2
+            if key is None:
+                d[K(50)] = 'v'
+            else:
+                d.insert(0, K(key), 'v')
+            assert [x.n for x in d.keys()] == keys
+            assert all(x in d for x in d.keys())
+            while d:
+                d.popitem()
+
     def test_pickle(self):
         fname = 'tmpdata.pkl'
         r = self.z.copy()
@@ -634,6 +1052,297 @@ class TestOrderedDict(object):
         assert s == r
         os.remove(fname)
 
+    def test_pickle_lru(self):
+        r = ordereddict(self.z, lru=True, maxsize=len(self.z))
+        s = cPickle.loads(cPickle.dumps(r, 2))
+        assert s == r
+        r['k'] = s['k'] = 42
+        r[self.z.keys()[1]]
+        s[self.z.keys()[1]]
+        assert s == r
+
+    def test_pickle_protocols(self):
+        r = ordereddict(relax=True)
+        for i in range(1000):
+            r['k%d' % ((i * 7) % 1000)] = i
+        del r['k7']
+        s = sorteddict(r)
+        for o in (r, s, ordereddict(self.z, kvio=True), sorteddict()):
+            for proto in (0, 1, 2, -1):
+                c = cPickle.loads(cPickle.dumps(o, proto))
+                assert type(c) is type(o)
+                assert c.items() == o.items()
+                assert c.getstate() == o.getstate()
+        c = cPickle.loads(cPickle.dumps(s, 2))
+        c['k70x'] = 1
+        c['a'] = 2
+        assert c.keys() == sorted(c.keys())
+        assert len(cPickle.dumps(r, 2)) < len(cPickle.dumps(r, 0))
+        e = ordereddict()
+        try:
+            e.__setstate__((0, ('a', 1, 'b')))
+        except ValueError:
+            pass
+        else:
+            assert False
+        e.__setstate__((0, ('a', 1, 'b', 2, 'a', 3)))
+        assert e.items() == [('a', 3), ('b', 2)]
+        # the state of a sorteddict is sorted in, not taken as it is
+        for e, keys in ((sorteddict(), [-1, 0, 1, 2, 3]),
+                        (sorteddict(key=lambda k: -k), [3, 2, 1, 0, -1])):
+            e.__setstate__((0, (2, 'a', 1, 'b', 2, 'c', 3, 'd', 0, 'e')))
+            assert e.keys() == keys[1:] or e.keys() == keys[:-1]
+            assert e[2] == 'c' and len(e) == 4
+            e[-1] = 'f'
+            assert e.keys() == keys
+
+    def test_snapshot(self):
+        d = ordereddict([('b', 1), (u'\xe9', 2.5), (3, None), (long(4), 'x'),
+                         (5.5, True), ('', u'')])
+        d['b'] = 10 ** 12
+        del d[3]
+        s = snapshotdict(d.snapshot())
+        assert len(s) == len(d)
+        assert s.items() == d.items()
+        assert list(s) == d.keys()
+        assert list(s.itervalues()) == d.values()
+        assert s['b'] == 10 ** 12 and s[4] == 'x' and s[5.5] is True
+        assert u'\xe9' in s and 3 not in s
+        assert s.get(3, 'no') == 'no'
+        assert s.index(4) == 2
+        # ints outside 64 bits, as keys and values
+        nums = [2 ** 63, -2 ** 63 - 1, 10 ** 30, -10 ** 30, 2 ** 64 - 1,
+                2 ** 1000, 2 ** 63 - 1, -2 ** 63]
+        n = snapshotdict(ordereddict((x, -x) for x in nums).snapshot())
+        assert n.items() == [(x, -x) for x in nums]
+        assert n[10 ** 30] == -10 ** 30 and 2 ** 64 not in n
+        try:
+            s[3]
+        except KeyError:
+            pass
+        else:
+            assert False
+        big = ordereddict(('k%d' % i, i) for i in range(5000))
+        fname = 'tmpdata.snap'
+        fp = open(fname, 'wb')
+        fp.write(big.snapshot())
+        fp.close()
+        s = snapshotdict(open(fname, 'rb').read())
+        assert s['k4999'] == 4999 and s.keys() == big.keys()
+        os.remove(fname)
+        for bad in (b'', b'x' * 100, big.snapshot()[:200]):
+            try:
+                snapshotdict(bad)
+            except ValueError:
+                pass
+            else:
+                assert False
+        try:
+            ordereddict(a=[]).snapshot()
+        except TypeError:
+            pass
+        else:
+            assert False
+
+    def test_frozen(self):
+        f = frozenordereddict([('a', 1), ('b', 2)])
+        assert f == ordereddict([('a', 1), ('b', 2)])
+        assert hash(f) == hash(frozenordereddict(f))
+        assert hash(f) != hash(frozenordereddict([('b', 2), ('a', 1)]))
+        assert f.copy() is f
+        cache = {f: 'x'}
+        assert cache[frozenordereddict([('a', 1), ('b', 2)])] == 'x'
+        for change in (lambda: f.__setitem__('c', 3),
+                       lambda: f.__delitem__('a'),
+                       lambda: f.pop('a'),
+                       lambda: f.popitem(),
+                       lambda: f.clear(),
+                       lambda: f.update(c=3),
+                       lambda: f.setdefault('c', 3),
+                       lambda: f.insert(0, 'c', 3),
+                       lambda: f.reverse(),
+                       lambda: f.setkeys(['b', 'a']),
+                       lambda: f.setvalues([3, 4]),
+                       lambda: f.__init__([('c', 3)]),
+                       lambda: ordereddict.__setitem__(f, 'c', 3)):
+            try:
+                change()
+            except TypeError:
+                pass
+            else:
+                assert False
+        assert f.items() == [('a', 1), ('b', 2)]
+        g = cPickle.loads(cPickle.dumps(f, 2))
+        assert type(g) is frozenordereddict and g == f and hash(g) == hash(f)
+        assert ordereddict(f).keys() == ['a', 'b']
+        assert frozenordereddict.fromkeys('xy').keys() == ['x', 'y']
+        try:
+            hash(frozenordereddict([('a', [])]))
+        except TypeError:
+            pass
+        else:
+            assert False
+
+    def test_pool(self):
+        old = pool()
+        try:
+            p = pool(dicts=2, tables=1, maxslots=64)
+            assert p['dicts'] == 2 and p['tables'] == 1 and p['maxslots'] == 64
+            assert p['free_ordereddicts'] <= 2 and p['free_sorteddicts'] <= 2
+            x = [ordereddict.fromkeys(range(20)) for i in range(4)]
+            y = [sorteddict.fromkeys(range(20)) for i in range(4)]
+            del x, y
+            p = pool()
+            assert p['free_ordereddicts'] == 2 and p['free_sorteddicts'] == 2
+            assert 1 <= p['free_tables'] <= 7
+            # recycled objects and tables start out empty
+            x = ordereddict.fromkeys(range(20))
+            assert x.keys() == range(20)
+            assert ordereddict().items() == []
+            s = sorteddict()
+            s['b'] = 1
+            s['a'] = 2
+            assert s.keys() == ['a', 'b']
+            p = pool(dicts=0, tables=0)
+            assert p['free_ordereddicts'] == 0 and p['free_tables'] == 0
+            try:
+                pool(tables=1000)
+            except ValueError:
+                pass
+            else:
+                assert False
+        finally:
+            pool(old['dicts'], old['tables'], old['maxslots'])
+        assert pool()['dicts'] == old['dicts']
+
+    def test_incremental(self):
+        old = incremental(16)
+        try:
+            assert incremental() == 16
+            x = ordereddict()
+            ref = {}
+            for i in range(5000):
+                k = i if i % 2 else str(i)
+                x[k] = ref[k] = i
+                if i % 7 == 0:
+                    del x[k], ref[k]
+                if i % 101 == 0:
+                    assert x.get(str(i - 1), None) == ref.get(str(i - 1))
+                    x.insert(len(x) // 2, ('ins', i), i)
+                    ref[('ins', i)] = i
+            assert len(x) == len(ref)
+            for k in ref:
+                assert x[k] == ref[k]
+            assert x.keys()[:3] == [('ins', 0), 1, '2']
+            assert x.copy() == x
+            assert cPickle.loads(cPickle.dumps(x, 2)) == x
+            y = ordereddict(lru=True, maxsize=1000)
+            for i in range(3000):
+                y[i] = i
+                y.get(i // 2)
+            assert len(y) == 1000
+            assert all(y[k] == k for k in y.keys())
+            x.clear()
+            assert x.items() == []
+            try:
+                incremental(-2)
+            except ValueError:
+                pass
+            else:
+                assert False
+        finally:
+            incremental(old)
+        assert incremental() == old
+
+    def test_stats(self):
+        old = stats()['enabled']
+        try:
+            x = ordereddict()
+            x[1] = 1
+            stats(False)
+            x[2] = 2
+            assert x.stats()['lookups'] == 0
+            stats(True, reset=True)
+            for i in range(100):
+                x[i] = i
+            x.insert(1, 'a', 0)
+            del x[50]
+            st = x.stats()
+            assert st['lookups'] == 102
+            assert st['probes'] >= st['lookups'] and st['max_probes'] >= 1
+            assert st['resizes'] >= 1 and st['resize_bytes'] > 0
+            assert st['move_bytes'] > 0
+            assert st['used'] == 100 and st['deleted'] == 1
+            assert st['dummies'] == 1 and st['slots'] >= 128
+            y = sorteddict(key=lambda k: -k)
+            for i in range(10):
+                y[i] = i
+            assert y.stats()['key_calls'] == 10
+            total = stats(False)
+            assert total['enabled'] is False
+            assert total['lookups'] >= 112 and total['key_calls'] == 10
+            y[10] = 10
+            assert y.stats()['key_calls'] == 10
+            assert stats(reset=True)['lookups'] == 0
+        finally:
+            stats(old)
+
+    def test_sizeof_arena(self):
+        small, large = ordereddict(), ordereddict()
+        for i in range(1000):
+            large[i] = i
+        assert sys.getsizeof(large) > sys.getsizeof(small) + 1000 * 16
+        s = sorteddict(large, key=lambda k: -k)
+        assert s.__sizeof__() > large.__sizeof__()
+        old = arena()['enabled']
+        try:
+            assert arena(True)['enabled'] is True
+            x = [ordereddict.fromkeys(range(10)) for i in range(100)]
+            res = arena()
+            assert res['slabs'] >= 1 and res['slab_tables'] >= 50
+            assert res['table_bytes'] > 0 and res['tables'] >= res['slab_tables']
+            assert arena(False)['enabled'] is False
+            del x
+            assert arena()['slab_tables'] < res['slab_tables']
+        finally:
+            arena(old)
+
+    def test_sharedkeys(self):
+        keys = ['a%d' % i for i in range(12)]
+        sk = sharedkeys(keys)
+        assert len(sk) == 12 and sk.keys() == keys
+        x, y = sk(range(12)), sk()
+        assert x.keys() == keys and x.values() == list(range(12))
+        assert y.values() == [None] * 12
+        assert x.stats()['shared'] and y.stats()['shared']
+        assert sys.getsizeof(x) < sys.getsizeof(ordereddict(x))
+        x['a3'] = 'x'               # values change in place
+        assert x['a3'] == 'x' and x.stats()['shared']
+        z = x.copy()
+        assert z == x and z.stats()['shared']
+        del x['a0']                 # the keys don't
+        assert not x.stats()['shared'] and x.keys() == keys[1:]
+        assert y.stats()['shared'] and y.keys() == keys
+        y['new'] = 1
+        assert not y.stats()['shared'] and y.keys() == keys + ['new']
+        assert z.keys() == keys and z['a3'] == 'x'
+        z.reverse()
+        assert z.keys() == keys[::-1]
+        assert sk().keys() == keys
+        try:
+            sk([1, 2])
+        except ValueError:
+            pass
+        else:
+            assert False
+        try:
+            sharedkeys('aba')
+        except ValueError:
+            pass
+        else:
+            assert False
+        small = sharedkeys('ab')
+        assert small((1, 2)) == ordereddict([('a', 1), ('b', 2)])
 
     def test_sd_pickle(self):
         fname = 'tmpdata.pkl'
@@ -671,13 +1380,54 @@ class TestOrderedDict(object):
         r1.update([('c', 3), ('d', 4)])
         assert r1 == self.x
 
+    def test_lru(self):
+        r = ordereddict(lru=True, maxsize=3)
+        r.update(self.x)
+        assert r.keys() == ['b', 'c', 'd']
+        r['b']
+        r.get('c')
+        r['e'] = 5
+        assert r.keys() == ['b', 'c', 'e']
+        r['b'] = 6
+        assert r.items() == [('c', 3), ('e', 5), ('b', 6)]
+        r.clear()
+        for i in range(10000):
+            r[i] = i
+            r.get(i - 1)
+        assert r.keys() == [9997, 9999, 9998]
+        r1 = r.copy()
+        r1['z'] = 1
+        assert r1.keys() == [9999, 9998, 'z']
+        r = ordereddict(self.x, maxsize=2)
+        r['c']
+        r['e'] = 5
+        assert r.keys() == ['d', 'e']
+        # insert() of a new key drops the oldest of the items already there
+        for lru in (False, True):
+            r = ordereddict([(1, 1), (2, 2), (3, 3)], lru=lru, maxsize=3)
+            r.insert(0, 'new', 0)
+            assert r.items() == [('new', 0), (2, 2), (3, 3)]
+            r.insert(1, 'mid', 0)
+            assert r.items() == [('mid', 0), (2, 2), (3, 3)]
+            r.insert(0, 3, 'x')     # an existing key drops nothing
+            assert r.items() == [(3, 'x'), ('mid', 0), (2, 2)]
+        r = ordereddict([(1, 1)], maxsize=1)
+        r.insert(0, 2, 2)
+        assert r.items() == [(2, 2)]
+        try:
+            ordereddict(maxsize=-1)
+        except ValueError:
+            pass
+        else:
+            assert False
+
     def test_relax(self):
         nd = dict(z=1,y=2,w=3,v=4,x=5)
         if not self.nopytest:
             py.test.raises(TypeError, "r = ordereddict(nd)")
         r = ordereddict(nd, relax=True)
-        assert nd.keys() == r.keys()
-        assert nd.values() == r.values()
+        assert list(nd.keys()) == r.keys()
+        assert list(nd.values()) == r.values()
 
     def test_relax_class(self):
         class relaxed_ordereddict(ordereddict):
@@ -687,8 +1437,8 @@ class TestOrderedDict(object):
 
         nd = dict(z=1,y=2,w=3,v=4,x=5)
         r = relaxed_ordereddict(nd)
-        assert nd.keys() == r.keys()
-        assert nd.values() == r.values()
+        assert list(nd.keys()) == r.keys()
+        assert list(nd.values()) == r.values()
 
 
     def test_relax_update(self):
@@ -702,8 +1452,8 @@ class TestOrderedDict(object):
     def _test_order(self):
         nd = dict(z=1,y=2,w=3,v=4,x=5)
         r = ordereddict(nd, key=True)
-        assert nd.keys() == r.keys()
-        assert nd.values() == r.values()
+        assert list(nd.keys()) == r.keys()
+        assert list(nd.values()) == r.values()
 
     def test_subclass_sorted(self): # found thanks to Sam Pointon
         class SD(sorteddict):
@@ -724,13 +1474,101 @@ class TestOrderedDict(object):
         import copy
         import gc
         d = ordereddict([(1, 2)])
-        gc.collect()
-        none_refcount = sys.getrefcount(None)
-        for i in xrange(10):
-            copy.deepcopy(d)
+        # Python 3.10 and 3.11 drop references to None of their own during
+        # the first rounds, a leak would show in every one
+        for round in xrange(10):
             gc.collect()
+            none_refcount = sys.getrefcount(None)
+            for i in xrange(100):
+                copy.deepcopy(d)
+                gc.collect()
         assert none_refcount == sys.getrefcount(None)
 
+    def test_reduce_refcount(self):
+        d = ordereddict([(1, 2)])
+        s = sorteddict([(1, 2)])
+        refs = sys.getrefcount(d), sys.getrefcount(s)
+        for i in xrange(10):
+            d.__reduce__()
+            s.__reduce__()
+        assert refs == (sys.getrefcount(d), sys.getrefcount(s))
+
+    def test_reversed(self):
+        assert list(reversed(self.x)) == ['d', 'c', 'b', 'a']
+        assert list(reversed(self.e)) == []
+        s = sorteddict(self.part)
+        assert list(reversed(s)) == s.keys(reverse=True)
+        it = reversed(self.x)
+        del self.x['a']
+        try:
+            list(it)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+
+    def test_version(self):
+        d = ordereddict([('a', 1), ('b', 2)])
+        v = d.version
+        d.get('a'); d.keys(); 'a' in d; d.compact()
+        assert d.version == v
+        seen = [v]
+        for change in (lambda: d.__setitem__('a', 3),
+                       lambda: d.__setitem__('c', 4),
+                       lambda: d.__delitem__('a'),
+                       lambda: d.setkeys(['c', 'b']),
+                       lambda: d.setvalues([0, 0]),
+                       lambda: d.rename('c', 'x'),
+                       lambda: d.reverse(),
+                       lambda: d.insert(0, 'y', 5),
+                       lambda: d.clear()):
+            change()
+            assert d.version > seen[-1]
+            seen.append(d.version)
+        d.clear()
+        assert d.version == seen[-1]
+        s = sorteddict([('b', 1)])
+        v = s.version
+        s['a'] = 2
+        assert s.version > v
+        try:
+            s.version = 0
+        except (AttributeError, TypeError):
+            pass
+        else:
+            assert False
+
+    def test_iter_keys_changed(self):
+        d = ordereddict([('a', 1), ('b', 2), ('c', 3)])
+        for k in d:
+            d[k] = 0  # new values are fine
+        it = iter(d)
+        next(it)
+        del d['c']
+        d['z'] = 26  # same size, other keys
+        try:
+            list(it)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+        it = iter(d)
+        d.setkeys(['z', 'b', 'a'])
+        try:
+            list(it)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+        s = d.viewkeys()[0:2]
+        d.reverse()
+        try:
+            list(s)
+        except RuntimeError:
+            pass
+        else:
+            assert False
+
     # this failed
     def test_multiple_inserts_then_deletes(self):
         d = ordereddict()
@@ -751,6 +1589,315 @@ class TestOrderedDict(object):
             d[el]=el
             del d[el]
 
+    def test_delete_middle_then_index(self):
+        d = ordereddict()
+        for i in range(100):
+            d[i] = i * 2
+        for i in range(10, 90, 3):
+            del d[i]
+        keys = [i for i in range(100) if not (10 <= i < 90 and (i - 10) % 3 == 0)]
+        assert d.keys() == keys
+        assert list(d.iteritems()) == [(i, i * 2) for i in keys]
+        assert d.index(keys[40]) == 40
+        assert d[20:23] == ordereddict([(k, k * 2) for k in keys[20:23]])
+        assert d.popitem(10) == (keys[10], keys[10] * 2)
+        assert d.popitem() == (99, 198)
+        d.insert(1, 'x', 0)
+        assert d.keys()[:3] == [0, 'x', 1]
+
+    def test_delete_while_growing(self):
+        d = ordereddict()
+        for i in range(1000):
+            d[i] = i
+            if i % 3:
+                del d[i - 1]
+        assert d.keys() == [i for i in range(1000) if i % 3 == 2 or i == 999]
+
+    def test_kvio_many_updates(self):
+        d = ordereddict(kvio=True)
+        for i in range(10):
+            d[i] = i
+        for j in range(100):
+            d[j % 10] = j
+        assert d.keys() == range(10)
+        assert d.values() == range(90, 100)
+        del d[5]
+        d[0] = 'a'
+        assert d.keys() == [1, 2, 3, 4, 6, 7, 8, 9, 0]
+
+    def test_dict_functions_after_delete(self):
+        # the builtin dict code reads the table directly
+        def f(**kw):
+            return kw
+        for n in (5, 300, 70000):
+            d = ordereddict()
+            for i in range(n):
+                d['k%d' % i] = i
+            for i in range(0, n, 3):
+                del d['k%d' % i]
+            ref = dict(d.items())
+            assert dict(d) == ref
+            assert f(**d) == ref
+            x = {}
+            x.update(d)
+            assert x == ref
+            if PY3:
+                continue    # not a dict, see test_not_a_dict
+            assert dict.get(d, 'k1') == 1
+            assert dict.get(d, 'k0') is None
+
+    def test_dict_c(self):
+        # on Python 2 an ordereddict is a dict, but dict.c has to leave it
+        # alone, its table is no dict's
+        if PY3:
+            return
+        class OD(ordereddict):
+            pass
+        for d in (ordereddict(), OD(), sorteddict()):
+            d.update((i, i) for i in range(20))
+            del d[1]
+            dict.clear(d)
+            for f in (lambda: dict.__setitem__(d, 'x', 1),
+                      lambda: dict.update(d, x=1), lambda: type('X', (), d)):
+                try:
+                    f()
+                except SystemError:
+                    pass
+                else:
+                    assert False
+            assert d.keys() == [0] + range(2, 20) and dict.get(d, 19) == 19
+            d[-1] = 1
+            d.clear()
+            assert len(d) == 0 and d.keys() == []
+
+    def test_not_a_dict(self):
+        # on Python 3 an ordereddict does not have a dict's layout, where
+        # CPython wants a real dict it has to refuse one
+        if not PY3:
+            return
+        import collections.abc
+        d = ordereddict([('a', 1)])
+        assert not isinstance(d, dict)
+        assert isinstance(d, collections.abc.MutableMapping)
+        assert isinstance(sorteddict(), collections.abc.MutableMapping)
+        for f in (lambda: dict.get(d, 'a'), lambda: dict.keys(d),
+                  lambda: type('X', (), d), lambda: eval('1', d)):
+            try:
+                f()
+            except TypeError:
+                pass
+            else:
+                assert False
+        class C(object):
+            pass
+        c = C()
+        try:
+            c.__dict__ = d
+        except TypeError:
+            pass
+        else:
+            assert False
+        assert dict(d) == {'a': 1} and d == {'a': 1}
+        if sys.version_info >= (3, 9):
+            assert ordereddict[str, int].__origin__ is ordereddict
+
+    def test_update_fast_paths(self):
+        s = sorteddict([('c', 3), ('a', 1), ('b', 2)])
+        d = ordereddict(s)
+        assert d.keys() == ['a', 'b', 'c']
+        d = ordereddict([('b', 0), ('x', 9)])
+        d.update(s)
+        assert d.items() == [('b', 2), ('x', 9), ('a', 1), ('c', 3)]
+        k = ordereddict([('a', 0), ('b', 0), ('c', 0)], kvio=True)
+        k.update(ordereddict([('a', 1), ('z', 26)]))
+        assert k.items() == [('b', 0), ('c', 0), ('a', 1), ('z', 26)]
+        p = {}
+        for i in range(1000):
+            p['k%d' % i] = i
+        d = ordereddict([('k5', -1), ('y', 0)], relax=True)
+        d.update(p)
+        assert d.keys()[:2] == ['k5', 'y']
+        assert d['k5'] == 5
+        assert len(d) == 1001
+        assert dict(d) == dict(p, y=0)
+        assert ordereddict(p, relax=True).items() == list(p.items())
+
+    def test_method_args(self):
+        # unpacked without an argument tuple on Python 3.7 and later
+        d = ordereddict([('a', 1), ('b', 2), ('c', 3)])
+        assert d.get('a') == 1 and d.get('x') is None and d.get('x', 0) == 0
+        assert d.setdefault('d') is None and d.setdefault('e', 5) == 5
+        assert d.pop('e') == 5 and d.pop('e', 0) == 0
+        assert d.popitem() == ('d', None) and d.popitem(0) == ('a', 1)
+        assert d.popitem(-1) == ('c', 3)
+        d.insert(0, 'z', 26)
+        assert d.items() == [('z', 26), ('b', 2)]
+        for call in (lambda: d.get(), lambda: d.get(1, 2, 3),
+                     lambda: d.get(key='a'), lambda: d.pop(),
+                     lambda: d.pop(1, 2, 3), lambda: d.popitem(0, 1),
+                     lambda: d.popitem('x'), lambda: d.setdefault(),
+                     lambda: d.insert(0, 'y'), lambda: d.insert('y', 0, 0)):
+            try:
+                call()
+            except TypeError:
+                pass
+            else:
+                assert False
+        try:
+            d.pop('x')
+        except KeyError:
+            pass
+        else:
+            assert False
+        assert d.items() == [('z', 26), ('b', 2)]
+
+    def test_constructor_calls(self):
+        # the types are called through vectorcall on Python 3.9 and later
+        assert ordereddict().items() == []
+        assert ordereddict([('b', 1), ('a', 2)]).keys() == ['b', 'a']
+        assert ordereddict(self.x).items() == self.x.items()
+        d = ordereddict([('b', 1), ('a', 2)], kvio=True)
+        d['b'] = 3
+        assert d.keys() == ['a', 'b']
+        assert ordereddict({'a': 1}, relax=True).items() == [('a', 1)]
+        assert sorteddict([('b', 1), ('a', 2)]).keys() == ['a', 'b']
+        assert sorteddict(self.upperlower, key=str.lower).keys()[:2] == \
+            ['A', 'a']
+        assert frozenordereddict([('a', 1)]).items() == [('a', 1)]
+        for call in (lambda: ordereddict(a=1), lambda: ordereddict([], []),
+                     lambda: ordereddict(1), lambda: sorteddict(x=1)):
+            try:
+                call()
+            except TypeError:
+                pass
+            else:
+                assert False
+
+        class OD(ordereddict):
+            def __init__(self, src=(), extra=None):
+                ordereddict.__init__(self, src)
+                self.extra = extra
+
+        class SD(sorteddict):
+            pass
+        o = OD([('b', 1)], extra=42)
+        assert type(o) is OD and o.extra == 42 and o.items() == [('b', 1)]
+        s = SD([('b', 1), ('a', 2)])
+        assert type(s) is SD and s.keys() == ['a', 'b']
+
+    def test_str_keys(self):
+        # the cached hash of the str keys is used to look them up
+        keys = ['a', u'\xe9', u'\u20ac', u'\U0001f600', 'k' * 100, '']
+        d = ordereddict((k, i) for i, k in enumerate(keys))
+        for i, k in enumerate(keys):
+            # equal strings, but with no hash computed yet
+            fresh = ''.join(['', k]) if k else k[:]
+            assert d[fresh] == i and fresh in d and d.get(fresh) == i
+        assert u'a\u20ac'[:1] in d and 'b' not in d
+
+        class S(str):
+            pass
+
+        class H(str):
+            def __hash__(self):
+                return hash(str(self))
+        assert d[S('a')] == 0 and d[H('a')] == 0
+        d[S('s')] = 's'
+        assert d['s'] == 's' and type(d.keys()[-1]) is S
+        assert d.index(u'\u20ac') == 2
+
+    def test_compare_dicts(self):
+        d = ordereddict([('a', 1), ('b', 2)])
+        assert d == ordereddict(d) and not d != ordereddict(d)
+        assert d != ordereddict([('b', 2), ('a', 1)])
+        assert d == {'b': 2, 'a': 1} and {'b': 2, 'a': 1} == d
+        assert d != {'a': 1} and d != [('a', 1), ('b', 2)]
+        assert d == sorteddict(d)
+        if PY3:
+            try:
+                d < d
+            except TypeError:
+                pass
+            else:
+                assert False
+
+    def test_threaded_readers(self):
+        # only with the GIL disabled can a (lock-free) reader run while a
+        # writer is halfway an update, every value it finds has to fit its key
+        if getattr(sys, '_is_gil_enabled', lambda: True)():
+            return
+        import threading
+        keys = ['k%d' % i for i in range(64)]
+        d = ordereddict()
+        done = []
+        bad = []
+        def writer(seed):
+            r = random.Random(seed)
+            try:
+                for i in xrange(20000):
+                    k = r.choice(keys)
+                    op = r.randrange(6)
+                    try:
+                        if op == 0:
+                            d[k] = k + 'v'
+                        elif op == 1:
+                            del d[k]
+                        elif op == 2:
+                            d.update([(x, x + 'v') for x in r.sample(keys, 8)])
+                        elif op == 3:
+                            d.update(dict((x, x + 'v') for x in r.sample(keys, 8)))
+                        elif op == 4:
+                            d.insert(r.randrange(len(d) + 1), k, k + 'v')
+                        elif r.randrange(20) == 0:
+                            d.clear()
+                    except (KeyError, IndexError):
+                        pass
+            finally:
+                done.append(seed)
+        def reader():
+            while len(done) < 2:
+                for k in keys:
+                    try:
+                        if d[k] != k + 'v':
+                            bad.append(k)
+                    except KeyError:
+                        pass
+                    v = d.get(k)
+                    if v is not None and v != k + 'v':
+                        bad.append(k)
+                    k in d
+        threads = [threading.Thread(target=writer, args=(s,)) for s in (1, 2)]
+        threads += [threading.Thread(target=reader) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert not bad, bad[:5]
+        assert all(d[k] == k + 'v' for k in d)
+
+    def test_or(self):
+        if sys.version_info < (3, 9):
+            return
+        d = ordereddict([('b', 1), ('a', 2)])
+        e = d | {'c': 3, 'b': 0}
+        assert type(e) is ordereddict
+        assert e.items() == [('b', 0), ('a', 2), ('c', 3)]
+        assert d.items() == [('b', 1), ('a', 2)]
+        assert type({'c': 3} | d) is dict
+        assert ({'c': 3} | d) == {'c': 3, 'b': 1, 'a': 2}
+        assert (d | ordereddict([('a', 0)])).items() == [('b', 1), ('a', 0)]
+        f = frozenordereddict(d) | {'c': 3}
+        assert type(f) is frozenordereddict and f.keys() == ['b', 'a', 'c']
+        d |= ordereddict([('z', 0)])
+        d |= [('y', 1)]
+        assert d.keys() == ['b', 'a', 'z', 'y']
+        for call in (lambda: d | 1, lambda: d | [('q', 1)]):
+            try:
+                call()
+            except TypeError:
+                pass
+            else:
+                assert False
 
 #############################
 
@@ -779,21 +1926,21 @@ def main():
         total += 1
         x = TestOrderedDict(True)
         x.setup_method(True)
-        print '\r--> %50s ' % (func),
+        print('\r--> %50s ' % (func), end=' ')
         sys.stdout.flush()
         try:
             getattr(x, func)()
         except KeyError:
-            if not verbose: print '\r--> %50s ' % (func),
+            if not verbose: print('\r--> %50s ' % (func), end=' ')
             failed += 1
-            print 'Failed'
+            print('Failed')
         else:
             if verbose:
-                print 'Ok'
+                print('Ok')
             else:
-                print '\r                                                              \r',
+                print('\r                                                              \r', end=' ')
                 sys.stdout.flush()
-    print "Total %d, Failed %d" % (total, failed)
+    print("Total %d, Failed %d" % (total, failed))
 
 if __name__ == "__main__":
     main()